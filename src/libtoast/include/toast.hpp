@@ -22,6 +22,12 @@
 #include <toast/tod_filter.hpp>
 #include <toast/tod_pointing.hpp>
 #include <toast/tod_simnoise.hpp>
+#include <toast/tod_offset.hpp>
+#include <toast/tod_demod.hpp>
+#include <toast/tod_glitch.hpp>
+#include <toast/tod_sources.hpp>
+#include <toast/tod_timeconst.hpp>
+#include <toast/weather.hpp>
 #include <toast/atm_utils.hpp>
 #include <toast/test.hpp>
 
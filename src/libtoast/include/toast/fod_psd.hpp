@@ -16,6 +16,11 @@ void fod_autosums(int64_t n, const double * x, const uint8_t * good,
 void fod_crosssums(int64_t n, const double * x, const double * y,
                    const uint8_t * good, int64_t lagmax, double * sums,
                    int64_t * hits);
+
+void fod_fit_psds(int64_t npsd, int64_t nfreq, double const * freqs,
+                  double const * psds, double const * weights,
+                  uint8_t const * fixed, int64_t maxiter, double tol,
+                  double * params, double * cov, double * chi2);
 }
 
 #endif // ifndef TOAST_FOD_PSD_HPP
@@ -6,14 +6,39 @@
 #ifndef TOAST_MAP_COV_HPP
 #define TOAST_MAP_COV_HPP
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif // ifdef _OPENMP
+
+#include <algorithm>
+#include <vector>
 
 namespace toast {
+// The weight of sample i in a piecewise constant weight stream.  Step k
+// covers the samples [starts[k], starts[k + 1]), the last step extends to
+// the end of the data, and samples before the first step have zero weight.
+// The accumulation loops visit the samples in order, so the current step
+// (initialized to -1) is advanced incrementally instead of expanding the
+// weights into a full timestream.  Without steps the weight is one.
+inline double step_weight(int64_t i, int64_t nstep, int64_t const * starts,
+                          double const * values, int64_t & istep) {
+    if (nstep == 0) return 1.0;
+    while ((istep + 1 < nstep) && (i >= starts[istep + 1])) ++istep;
+    if (istep < 0) return 0.0;
+    return values[istep];
+}
+
+// The accumulation functions below take optional piecewise constant weights
+// (nstep may be zero) that multiply the constant scale.  Samples with a zero
+// step weight are skipped.
+
 void cov_accum_diag(int64_t nsub, int64_t subsize, int64_t nnz,
                     int64_t nsamp,
                     int64_t const * indx_submap, int64_t const * indx_pix,
                     double const * weights,
-                    double scale, double const * signal, double * zdata,
-                    int64_t * hits, double * invnpp);
+                    double scale, int64_t nstep, int64_t const * step_starts,
+                    double const * step_weights, double const * signal,
+                    double * zdata, int64_t * hits, double * invnpp);
 
 void cov_accum_diag_hits(int64_t nsub, int64_t subsize, int64_t nnz,
                          int64_t nsamp,
@@ -25,12 +50,103 @@ void cov_accum_diag_invnpp(int64_t nsub, int64_t subsize, int64_t nnz,
                            int64_t const * indx_submap,
                            int64_t const * indx_pix,
                            double const * weights,
-                           double scale, int64_t * hits, double * invnpp);
+                           double scale, int64_t nstep,
+                           int64_t const * step_starts,
+                           double const * step_weights, int64_t * hits,
+                           double * invnpp);
 
 void cov_accum_zmap(int64_t nsub, int64_t subsize, int64_t nnz, int64_t nsamp,
                     int64_t const * indx_submap, int64_t const * indx_pix,
                     double const * weights,
-                    double scale, double const * signal, double * zdata);
+                    double scale, int64_t nstep, int64_t const * step_starts,
+                    double const * step_weights, double const * signal,
+                    double * zdata);
+
+// Accumulate any combination of the noise weighted map, hits and diagonal
+// inverse covariance of several data splits directly from global pixel
+// numbers, in one pass over the pointing.  Bit s of the split mask of a
+// sample (split_masks[i] | det_splits) selects whether it goes to split s.
+// The output vectors hold one local buffer per split, or are empty to skip
+// that product.  Samples with a negative pixel, a flag bit set in either
+// mask, or a submap that is not stored locally are skipped.  Any of the
+// flag and split mask pointers may be NULL.
+template <typename P, typename W>
+void cov_accum_split(int64_t nsub, int64_t subsize, int64_t nnz,
+                     int64_t nsamp, P const * global_pixels,
+                     int64_t const * global2local, W const * weights,
+                     double scale, int64_t nstep, int64_t const * step_starts,
+                     double const * step_weights, double const * signal,
+                     uint8_t const * det_flags, uint8_t det_mask,
+                     uint8_t const * common_flags, uint8_t common_mask,
+                     uint64_t const * split_masks, uint64_t det_splits,
+                     std::vector <double *> const & zdata,
+                     std::vector <int64_t *> const & hits,
+                     std::vector <double *> const & invnpp) {
+    const int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
+    const int64_t nsplit = std::max(zdata.size(),
+                                    std::max(hits.size(), invnpp.size()));
+    #pragma omp parallel
+    {
+        #ifdef _OPENMP
+        int nthread = omp_get_num_threads();
+        int trank = omp_get_thread_num();
+        int64_t npix_thread = nsub * subsize / nthread + 1;
+        int64_t first_pix = trank * npix_thread;
+        int64_t last_pix = first_pix + npix_thread - 1;
+        #endif // ifdef _OPENMP
+
+        int64_t istep = -1;
+        for (int64_t i = 0; i < nsamp; ++i) {
+            const int64_t gpix = static_cast <int64_t> (global_pixels[i]);
+            if (gpix < 0) continue;
+            if ((det_flags != NULL) && ((det_flags[i] & det_mask) != 0)) continue;
+            if ((common_flags != NULL) &&
+                ((common_flags[i] & common_mask) != 0)) continue;
+
+            const int64_t isubmap = global2local[gpix / subsize];
+            if (isubmap < 0) continue;
+
+            const int64_t hpx = isubmap * subsize + gpix % subsize;
+            #ifdef _OPENMP
+            if ((hpx < first_pix) || (hpx > last_pix)) continue;
+            #endif // ifdef _OPENMP
+
+            const double sweight = step_weight(i, nstep, step_starts,
+                                               step_weights, istep);
+            if (sweight == 0) continue;
+            const double wscale = scale * sweight;
+
+            uint64_t member = det_splits;
+            if (split_masks != NULL) member |= split_masks[i];
+
+            W const * wpointer = weights + i * nnz;
+            for (int64_t isplit = 0; isplit < nsplit; ++isplit) {
+                if ((member & ((uint64_t)1 << isplit)) == 0) continue;
+                if (!zdata.empty()) {
+                    const double scaled_signal = wscale * signal[i];
+                    double * zpointer = zdata[isplit] + hpx * nnz;
+                    for (int64_t j = 0; j < nnz; ++j) {
+                        zpointer[j] += wpointer[j] * scaled_signal;
+                    }
+                }
+                if (!invnpp.empty()) {
+                    double * covpointer = invnpp[isplit] + hpx * block;
+                    for (int64_t j = 0; j < nnz; ++j) {
+                        const double scaled_weight = wpointer[j] * wscale;
+                        for (int64_t k = j; k < nnz; ++k, ++covpointer) {
+                            *covpointer += wpointer[k] * scaled_weight;
+                        }
+                    }
+                }
+                if (!hits.empty()) {
+                    hits[isplit][hpx] += 1;
+                }
+            }
+        }
+    }
+
+    return;
+}
 
 void cov_eigendecompose_diag(int64_t nsub, int64_t subsize, int64_t nnz,
                              double * data, double * cond, double threshold,
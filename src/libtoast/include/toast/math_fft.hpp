@@ -36,6 +36,17 @@ class FFTPlanReal1D : public std::enable_shared_from_this <FFTPlanReal1D> {
             return;
         }
 
+        // Execute the plan on caller-owned buffers instead of the internal
+        // ones.  Both buffers hold the batch of n rows of length samples
+        // contiguously:  strided rows are not supported and must be copied
+        // into a contiguous block first.  The input is time domain data for
+        // a forward plan and half-complex data for a backward plan, and is
+        // not modified.  Concurrent calls on one plan are safe.  With FFTW
+        // they run in parallel without touching the internal buffers.  With
+        // MKL the rows are staged through the internal buffers and the calls
+        // are serialized.
+        virtual void exec(double const * in, double * out) = 0;
+
         virtual double * tdata(int64_t indx) {
             return NULL;
         }
@@ -7,6 +7,7 @@
 #define TOAST_MATH_FFT_FFTW_HPP
 
 #include <vector>
+#include <mutex>
 
 #ifdef HAVE_FFTW
 
@@ -23,12 +24,18 @@ class FFTPlanReal1DFFTW : public toast::FFTPlanReal1D {
 
         void exec();
 
+        void exec(double const * in, double * out);
+
         double * tdata(int64_t indx);
         double * fdata(int64_t indx);
 
     private:
 
+        void create_buffer_plan();
+
         fftw_plan plan_;
+        fftw_plan buffer_plan_;
+        std::once_flag buffer_once_;
         toast::AlignedVector <double> data_;
         double * traw_;
         double * fraw_;
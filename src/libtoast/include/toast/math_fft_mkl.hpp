@@ -7,6 +7,7 @@
 #define TOAST_MATH_FFT_MKL_HPP
 
 #include <vector>
+#include <mutex>
 
 
 #ifdef HAVE_MKL
@@ -24,6 +25,8 @@ class FFTPlanReal1DMKL : public toast::FFTPlanReal1D {
 
         void exec();
 
+        void exec(double const * in, double * out);
+
         double * tdata(int64_t indx);
 
         double * fdata(int64_t indx);
@@ -37,6 +40,7 @@ class FFTPlanReal1DMKL : public toast::FFTPlanReal1D {
         void hc2cce();
 
         DFTI_DESCRIPTOR_HANDLE descriptor_;
+        std::mutex buffer_mutex_;
         toast::AlignedVector <double> data_;
         double * traw_;
         double * fraw_;
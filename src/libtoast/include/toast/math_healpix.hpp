@@ -6,6 +6,14 @@
 #ifndef TOAST_MATH_HEALPIX_HPP
 #define TOAST_MATH_HEALPIX_HPP
 
+// The BMI2 pdep / pext path is only used when requested with the
+// TOAST_USE_BMI2 build option, not whenever the target supports BMI2 (for example with
+// -march=native).  These instructions are microcoded on AMD processors before
+// Zen 3, where they are much slower than the default mask sequences.
+#if defined(TOAST_USE_BMI2) && defined(__BMI2__)
+# define TOAST_HEALPIX_BMI2
+# include <immintrin.h>
+#endif // if defined(TOAST_USE_BMI2) && defined(__BMI2__)
 
 namespace toast {
 void healpix_ang2vec(int64_t n, double const * theta, double const * phi,
@@ -71,52 +79,71 @@ class HealpixPixels {
         void upgrade_nest(int factor, int64_t n, int64_t const * inpix,
                           int64_t * outpix) const;
 
-    private:
+        // Interleave the bits of the face coordinates into the pixel index
+        // within a face (x in the even bits, y in the odd bits) and back.
+        // When built with TOAST_USE_BMI2 this uses pdep / pext, otherwise the
+        // branch-free mask and shift sequences of xy2pix_masked and
+        // pix2xy_masked, which vectorize in the pixel loops.
 
-        void init();
+        static uint64_t xy2pix(uint64_t x, uint64_t y) {
+            #ifdef TOAST_HEALPIX_BMI2
+            return _pdep_u64(x, 0x5555555555555555ull) |
+                   _pdep_u64(y, 0xaaaaaaaaaaaaaaaaull);
 
-        uint64_t xy2pix_(uint64_t x, uint64_t y) const {
-            return utab_[x & 0xff] | (utab_[(x >> 8) & 0xff] << 16) |
-                   (utab_[(x >> 16) & 0xff] << 32) |
-                   (utab_[(x >> 24) & 0xff] << 48) |
-                   (utab_[y & 0xff] << 1) | (utab_[(y >> 8) & 0xff] << 17) |
-                   (utab_[(y >> 16) & 0xff] << 33) |
-                   (utab_[(y >> 24) & 0xff] << 49);
+            #else // ifdef TOAST_HEALPIX_BMI2
+            return xy2pix_masked(x, y);
+
+            #endif // ifdef TOAST_HEALPIX_BMI2
         }
 
-        uint64_t x2pix_(uint64_t x) const {
-            return utab_[x & 0xff] | (utab_[x >> 8] << 16) |
-                   (utab_[(x >> 16) & 0xff] << 32) |
-                   (utab_[(x >> 24) & 0xff] << 48);
+        static void pix2xy(uint64_t pix, uint64_t & x, uint64_t & y) {
+            #ifdef TOAST_HEALPIX_BMI2
+            x = _pext_u64(pix, 0x5555555555555555ull);
+            y = _pext_u64(pix, 0xaaaaaaaaaaaaaaaaull);
+
+            #else // ifdef TOAST_HEALPIX_BMI2
+            pix2xy_masked(pix, x, y);
+
+            #endif // ifdef TOAST_HEALPIX_BMI2
+            return;
         }
 
-        uint64_t y2pix_(uint64_t y) const {
-            return (utab_[y & 0xff] << 1) | (utab_[y >> 8] << 17) |
-                   (utab_[(y >> 16) & 0xff] << 33) |
-                   (utab_[(y >> 24) & 0xff] << 49);
+        static uint64_t xy2pix_masked(uint64_t x, uint64_t y) {
+            return spread_bits_(x) | (spread_bits_(y) << 1);
         }
 
-        void pix2xy_(uint64_t pix, uint64_t & x, uint64_t & y) const {
-            uint64_t raw;
-            raw = (pix & 0x5555ull) | ((pix & 0x55550000ull) >> 15) |
-                  ((pix & 0x555500000000ull) >> 16) |
-                  ((pix & 0x5555000000000000ull) >> 31);
-            x = ctab_[raw & 0xff] | (ctab_[(raw >> 8) & 0xff] << 4) |
-                (ctab_[(raw >> 16) & 0xff] << 16) |
-                (ctab_[(raw >> 24) & 0xff] << 20);
-            raw = ((pix & 0xaaaaull) >> 1) | ((pix & 0xaaaa0000ull) >> 16) |
-                  ((pix & 0xaaaa00000000ull) >> 17) |
-                  ((pix & 0xaaaa000000000000ull) >> 32);
-            y = ctab_[raw & 0xff] | (ctab_[(raw >> 8) & 0xff] << 4) |
-                (ctab_[(raw >> 16) & 0xff] << 16) |
-                (ctab_[(raw >> 24) & 0xff] << 20);
+        static void pix2xy_masked(uint64_t pix, uint64_t & x, uint64_t & y) {
+            x = compress_bits_(pix);
+            y = compress_bits_(pix >> 1);
             return;
         }
 
+    private:
+
+        static uint64_t spread_bits_(uint64_t v) {
+            v &= 0x00000000ffffffffull;
+            v = (v | (v << 16)) & 0x0000ffff0000ffffull;
+            v = (v | (v << 8)) & 0x00ff00ff00ff00ffull;
+            v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0full;
+            v = (v | (v << 2)) & 0x3333333333333333ull;
+            v = (v | (v << 1)) & 0x5555555555555555ull;
+            return v;
+        }
+
+        static uint64_t compress_bits_(uint64_t v) {
+            v &= 0x5555555555555555ull;
+            v = (v | (v >> 1)) & 0x3333333333333333ull;
+            v = (v | (v >> 2)) & 0x0f0f0f0f0f0f0f0full;
+            v = (v | (v >> 4)) & 0x00ff00ff00ff00ffull;
+            v = (v | (v >> 8)) & 0x0000ffff0000ffffull;
+            v = (v | (v >> 16)) & 0x00000000ffffffffull;
+            return v;
+        }
+
+        void init();
+
         static const int64_t jr_[];
         static const int64_t jp_[];
-        uint64_t utab_[0x100];
-        uint64_t ctab_[0x100];
         int64_t nside_;
         int64_t npix_;
         int64_t ncap_;
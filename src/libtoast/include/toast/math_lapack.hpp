@@ -40,6 +40,9 @@ void lapack_pocon(char * UPLO, int * N, double * A, int * LDA, double * ANORM,
 
 void lapack_potri(char * UPLO, int * N, double * A, int * LDA, int * INFO);
 
+void lapack_pbtrf(char * UPLO, int * N, int * KD, double * AB, int * LDAB,
+                  int * INFO);
+
 void lapack_dgelss(int * M, int * N, int * NRHS, double * A, int * LDA,
                    double * B, int * LDB, double * S, double * RCOND,
                    int * RANK, double * WORK, int * LWORK, int * INFO);
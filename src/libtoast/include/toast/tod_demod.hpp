@@ -0,0 +1,23 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_TOD_DEMOD_HPP
+#define TOAST_TOD_DEMOD_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace toast {
+void hwp_demodulate(int64_t nsamp, int64_t nnz, double const * hwp_angle,
+                    double const * signal, uint8_t const * flags,
+                    uint8_t flag_mask, int64_t const * pixels,
+                    double const * weights, int64_t ntap, double const * fir,
+                    int64_t step, int64_t nout, double * out_signal,
+                    int64_t * out_pixels, double * out_weights,
+                    uint8_t * out_flags);
+}
+
+#endif // ifndef TOAST_TOD_DEMOD_HPP
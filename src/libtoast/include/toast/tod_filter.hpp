@@ -18,6 +18,10 @@ void chebyshev(double * x, double * templates, size_t start_order, size_t stop_o
                size_t nsample);
 void add_templates(double * signal, double * templates, double * coeff, size_t nsample,
                    size_t ntemplate);
+void filter_lines(int64_t nsamp, double rate, int64_t nline, double const * freqs,
+                  double const * widths, size_t nscan, int64_t const * starts,
+                  int64_t const * stops, std::vector <uint8_t *> const & flags,
+                  std::vector <double *> const & signals);
 }
 
 #endif // ifndef TOAST_TOD_FILTER_HPP
@@ -0,0 +1,27 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_TOD_GLITCH_HPP
+#define TOAST_TOD_GLITCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace toast {
+void running_median(int64_t nsamp, int64_t window, double const * signal,
+                    uint8_t const * flags, uint8_t flag_mask, double * median);
+
+void flag_glitches(int64_t nsamp, int64_t window, double glitch_threshold,
+                   int64_t jump_width, double jump_threshold,
+                   int64_t dilation, uint8_t glitch_value, uint8_t jump_value,
+                   uint8_t flag_mask, uint8_t const * common_flags,
+                   uint8_t common_mask,
+                   std::vector <double const *> const & signals,
+                   std::vector <uint8_t *> const & flags);
+}
+
+#endif // ifndef TOAST_TOD_GLITCH_HPP
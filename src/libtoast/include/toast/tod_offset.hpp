@@ -0,0 +1,25 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_TOD_OFFSET_HPP
+#define TOAST_TOD_OFFSET_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace toast {
+void offset_noise_filter(int64_t nfreq, double const * logfreq,
+                         double const * logpsd, double step_length,
+                         int64_t nstep, double lim,
+                         toast::AlignedVector <double> & filter);
+
+int64_t offset_banded_precond(int64_t nstep, double const * sigmasqs,
+                              int64_t nfilter, double const * filter,
+                              int64_t precond_width,
+                              toast::AlignedVector <double> & precond);
+}
+
+#endif // ifndef TOAST_TOD_OFFSET_HPP
@@ -16,6 +16,16 @@ void pointing_matrix_healpix(toast::HealpixPixels const & hpix,
                              double const * pdata, double const * hwpang,
                              uint8_t const * flags,
                              int64_t * pixels, double * weights);
+
+void pointing_matrix_healpix_pair(toast::HealpixPixels const & hpix,
+                                  bool nest, double eps_a, double cal_a,
+                                  double eps_b, double cal_b, double dpsi,
+                                  std::string const & mode, size_t n,
+                                  double const * pdata,
+                                  double const * hwpang,
+                                  uint8_t const * flags,
+                                  int64_t * pixels_a, int64_t * pixels_b,
+                                  double * weights_a, double * weights_b);
 }
 
 #endif // ifndef TOAST_TOD_POINTING_HPP
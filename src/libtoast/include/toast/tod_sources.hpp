@@ -0,0 +1,89 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_TOD_SOURCES_HPP
+#define TOAST_TOD_SOURCES_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+namespace toast {
+class SourceIndex {
+    // A spatial index of compact sources on the sphere.
+    //
+    // The sources are bucketed by their nested HEALPix pixel at a coarse
+    // NSIDE and the non-empty buckets are organized in a k-d tree of their
+    // 3D unit vectors.  Every tree node stores a bounding cap of the
+    // sources below it, so that finding the sources within some distance
+    // of a direction only visits the nearby buckets.  Sources may move
+    // linearly on the sphere (solar system bodies), in which case the index
+    // is built from their positions at the reference time and queries are
+    // widened by the largest distance any source moves.
+
+    public:
+
+        typedef std::shared_ptr <SourceIndex> pshr;
+        typedef std::unique_ptr <SourceIndex> puniq;
+
+        SourceIndex(int64_t nsource, double const * dirs,
+                    double const * vels = NULL, double tref = 0.0,
+                    int64_t nside = 64, int64_t leaf_size = 16);
+        ~SourceIndex() {}
+
+        int64_t nsource() const {
+            return nsource_;
+        }
+
+        int64_t nnode() const {
+            return nodes_.size();
+        }
+
+        // Append the indices of all sources within `radius` (radians) of
+        // the unit vector `dir` at any time in [tmin, tmax].
+        void query(double const * dir, double radius, double tmin,
+                   double tmax, std::vector <int64_t> & result) const;
+
+        // The unit vector of a source at time t.
+        void position(int64_t source, double t, double * dir) const;
+
+        // Accumulate the signal of the sources seen by a detector with an
+        // elliptical Gaussian beam.
+        void scan(int64_t nsamp, double const * times, double const * quats,
+                  double fwhm_major, double fwhm_minor, double psi_beam,
+                  double const * flux, double nsigma, double * signal) const;
+
+    private:
+
+        typedef struct {
+            double center[3];
+            double chord;
+            int64_t first;
+            int64_t last;
+            int64_t left;
+            int64_t right;
+        } node_t;
+
+        int64_t build(int64_t first, int64_t last,
+                      std::vector <int64_t> & buckets,
+                      std::vector <int64_t> const & bucket_first,
+                      std::vector <double> const & centroids,
+                      std::vector <int64_t> const & sorted);
+
+        int64_t nsource_;
+        int64_t leaf_size_;
+        double tref_;
+        double max_speed_;
+        std::vector <double> dirs_;
+        std::vector <double> vels_;
+        std::vector <int64_t> order_;
+        std::vector <int64_t> rank_;
+        std::vector <node_t> nodes_;
+};
+}
+
+#endif // ifndef TOAST_TOD_SOURCES_HPP
@@ -0,0 +1,25 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_TOD_TIMECONST_HPP
+#define TOAST_TOD_TIMECONST_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+namespace toast {
+void time_constant_response(double freq, double rate, double tau,
+                            double tau2, double fraction, double & re,
+                            double & im);
+
+void filter_time_constant(int64_t nsamp, double rate, double const * tau,
+                          double const * tau2, double const * fraction,
+                          bool deconvolve, double epsilon, int64_t fftlen,
+                          std::vector <double *> const & signals);
+}
+
+#endif // ifndef TOAST_TOD_TIMECONST_HPP
@@ -0,0 +1,20 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#ifndef TOAST_WEATHER_HPP
+#define TOAST_WEATHER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace toast {
+void weather_sample(size_t nsamp, double const * times, uint64_t const * sites,
+                    uint64_t const * realizations, size_t nvar,
+                    uint64_t const * varindex, size_t ncdfvar, size_t nprob,
+                    double const * prob, double const * cdf, double * values);
+}
+
+#endif // ifndef TOAST_WEATHER_HPP
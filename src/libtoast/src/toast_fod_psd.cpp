@@ -7,6 +7,9 @@
 #include <toast/fod_psd.hpp>
 
 #include <cmath>
+#include <algorithm>
+#include <sstream>
+#include <vector>
 
 
 void toast::fod_autosums(int64_t n, double const * x, uint8_t const * good,
@@ -82,3 +85,259 @@ void toast::fod_crosssums(int64_t n, double const * x, double const * y,
 
     return;
 }
+
+namespace {
+double log_add_exp(double a, double b) {
+    // log(exp(a) + exp(b)) without overflow
+    if (a > b) return a + std::log1p(std::exp(b - a));
+    return b + std::log1p(std::exp(a - b));
+}
+
+double log_noise_model(double lnf, double const * theta, double * grad) {
+    // Logarithm of the analytic noise PSD
+    //
+    //     NET^2 (f^alpha + fknee^alpha) / (f^alpha + fmin^alpha)
+    //
+    // and (if grad is not NULL) its gradient with respect to
+    // theta = (ln NET^2, ln fknee, alpha, ln fmin).
+    double alpha = theta[2];
+    double lnu = alpha * lnf;
+    double lnk = alpha * theta[1];
+    double lnm = alpha * theta[3];
+    double num = log_add_exp(lnu, lnk);
+    double den = log_add_exp(lnu, lnm);
+    if (grad != NULL) {
+        double wk = std::exp(lnk - num);
+        double wm = std::exp(lnm - den);
+        grad[0] = 1.0;
+        grad[1] = alpha * wk;
+        grad[2] = ((1.0 - wk) * lnf + wk * theta[1]) -
+                  ((1.0 - wm) * lnf + wm * theta[3]);
+        grad[3] = -alpha * wm;
+    }
+    return theta[0] + num - den;
+}
+
+bool solve_small(int64_t n, double * a, double * b) {
+    // Solve the dense n x n system a x = b in place with partial pivoting.
+    // The solution replaces b.  Returns false if the matrix is singular.
+    for (int64_t col = 0; col < n; ++col) {
+        int64_t pivot = col;
+        for (int64_t row = col + 1; row < n; ++row) {
+            if (std::fabs(a[row * n + col]) > std::fabs(a[pivot * n + col])) {
+                pivot = row;
+            }
+        }
+        if (!(std::fabs(a[pivot * n + col]) > 0)) return false;
+        if (pivot != col) {
+            for (int64_t k = 0; k < n; ++k) {
+                std::swap(a[col * n + k], a[pivot * n + k]);
+            }
+            std::swap(b[col], b[pivot]);
+        }
+        for (int64_t row = col + 1; row < n; ++row) {
+            double factor = a[row * n + col] / a[col * n + col];
+            for (int64_t k = col; k < n; ++k) {
+                a[row * n + k] -= factor * a[col * n + k];
+            }
+            b[row] -= factor * b[col];
+        }
+    }
+    for (int64_t row = n - 1; row >= 0; --row) {
+        for (int64_t k = row + 1; k < n; ++k) {
+            b[row] -= a[row * n + k] * b[k];
+        }
+        b[row] /= a[row * n + row];
+    }
+    return true;
+}
+}
+
+void toast::fod_fit_psds(int64_t npsd, int64_t nfreq, double const * freqs,
+                         double const * psds, double const * weights,
+                         uint8_t const * fixed, int64_t maxiter, double tol,
+                         double * params, double * cov, double * chi2) {
+    // Fit the analytic 1/f + white noise model to a batch of PSDs with
+    // Levenberg-Marquardt iterations in log space.  The residuals are
+    //
+    //     weights[i, f] * (ln psds[i, f] - ln model(freqs[f]))
+    //
+    // so the weights are the inverse uncertainties of the log PSD.  Bins
+    // with a non-positive frequency or PSD are ignored.  params holds
+    // (NET, fknee, alpha, fmin) for each PSD: the starting point on input
+    // and the best fit on output.  Parameters with a nonzero entry in
+    // `fixed` (4 values shared by all PSDs) are not fitted.  The optional
+    // cov receives the 4 x 4 covariance of the fitted parameters, scaled by
+    // the reduced chi^2 when no weights are given.  The optional chi2
+    // receives the final weighted sum of squared residuals.
+
+    int64_t npar = 4;
+
+    for (int64_t ipsd = 0; ipsd < npsd; ++ipsd) {
+        double const * par = params + ipsd * npar;
+        if ((par[0] <= 0) || (par[1] <= 0) || (par[2] <= 0) || (par[3] <= 0)) {
+            auto here = TOAST_HERE();
+            auto log = toast::Logger::get();
+            std::ostringstream o;
+            o << "Starting point of PSD " << ipsd << " must be positive: ("
+              << par[0] << ", " << par[1] << ", " << par[2] << ", "
+              << par[3] << ")";
+            log.error(o.str().c_str(), here);
+            throw std::runtime_error(o.str().c_str());
+        }
+    }
+
+    std::vector <double> lnfreqs(nfreq);
+    for (int64_t f = 0; f < nfreq; ++f) {
+        lnfreqs[f] = (freqs[f] > 0) ? std::log(freqs[f]) : 0.0;
+    }
+
+    int64_t nfree = 0;
+    bool isfree[4];
+    for (int64_t k = 0; k < npar; ++k) {
+        isfree[k] = (fixed == NULL) || (fixed[k] == 0);
+        if (isfree[k]) nfree++;
+    }
+
+    #pragma omp parallel for default(none) shared(npsd, nfreq, freqs, psds, \
+    weights, maxiter, tol, params, cov, chi2, lnfreqs, isfree, nfree, npar) \
+    schedule(dynamic, 16)
+    for (int64_t ipsd = 0; ipsd < npsd; ++ipsd) {
+        double * par = params + ipsd * npar;
+        double const * psd = psds + ipsd * nfreq;
+        double const * wt = (weights == NULL) ? NULL : weights + ipsd * nfreq;
+
+        // Log PSD and weight of each bin, with invalid bins given zero weight
+        std::vector <double> lnpsd(nfreq);
+        std::vector <double> w(nfreq);
+        int64_t nvalid = 0;
+        for (int64_t f = 0; f < nfreq; ++f) {
+            w[f] = (wt == NULL) ? 1.0 : wt[f];
+            if ((freqs[f] > 0) && (psd[f] > 0) && std::isfinite(psd[f])) {
+                lnpsd[f] = std::log(psd[f]);
+            } else {
+                lnpsd[f] = 0.0;
+                w[f] = 0.0;
+            }
+            if (w[f] != 0) nvalid++;
+        }
+
+        double theta[4];
+        theta[0] = 2.0 * std::log(par[0]);
+        theta[1] = std::log(par[1]);
+        theta[2] = par[2];
+        theta[3] = std::log(par[3]);
+
+        double grad[4];
+        double jtj[16];
+        double jtr[4];
+        double lhs[16];
+        double step[4];
+        double trial[4];
+
+        auto evaluate = [&](double const * th, bool normal) {
+            // Weighted chi^2 and optionally the normal equations
+            double total = 0.0;
+            if (normal) {
+                std::fill(jtj, jtj + 16, 0.0);
+                std::fill(jtr, jtr + 4, 0.0);
+            }
+            for (int64_t f = 0; f < nfreq; ++f) {
+                if (w[f] == 0) continue;
+                double model = log_noise_model(lnfreqs[f], th,
+                                               normal ? grad : NULL);
+                double r = w[f] * (lnpsd[f] - model);
+                total += r * r;
+                if (normal) {
+                    for (int64_t j = 0; j < 4; ++j) {
+                        double gj = w[f] * grad[j];
+                        jtr[j] += gj * r;
+                        for (int64_t k = 0; k < 4; ++k) {
+                            jtj[j * 4 + k] += gj * w[f] * grad[k];
+                        }
+                    }
+                }
+            }
+            return total;
+        };
+
+        double lambda = 1.0e-3;
+        double current = evaluate(theta, true);
+        for (int64_t iter = 0; iter < maxiter; ++iter) {
+            bool accepted = false;
+            double improved = current;
+            while (lambda < 1.0e10) {
+                for (int64_t j = 0; j < 4; ++j) {
+                    for (int64_t k = 0; k < 4; ++k) {
+                        lhs[j * 4 + k] = (isfree[j] && isfree[k])
+                                         ? jtj[j * 4 + k] : 0.0;
+                    }
+                    if (isfree[j]) {
+                        lhs[j * 4 + j] += lambda * jtj[j * 4 + j];
+                        step[j] = jtr[j];
+                    } else {
+                        lhs[j * 4 + j] = 1.0;
+                        step[j] = 0.0;
+                    }
+                }
+                if (solve_small(4, lhs, step)) {
+                    for (int64_t j = 0; j < 4; ++j) {
+                        trial[j] = theta[j] + step[j];
+                    }
+                    if (trial[2] > 0) {
+                        improved = evaluate(trial, false);
+                        if (improved < current) {
+                            accepted = true;
+                            break;
+                        }
+                    }
+                }
+                lambda *= 10.0;
+            }
+            if (!accepted) break;
+            std::copy(trial, trial + 4, theta);
+            lambda = std::max(lambda * 0.1, 1.0e-12);
+            bool converged = (current - improved <= tol * current);
+            current = evaluate(theta, true);
+            if (converged) break;
+        }
+
+        // Fixed parameters are returned exactly as they came in
+        if (isfree[0]) par[0] = std::exp(0.5 * theta[0]);
+        if (isfree[1]) par[1] = std::exp(theta[1]);
+        if (isfree[2]) par[2] = theta[2];
+        if (isfree[3]) par[3] = std::exp(theta[3]);
+
+        if (chi2 != NULL) chi2[ipsd] = current;
+
+        if (cov != NULL) {
+            // Invert the normal matrix of the free parameters one column at a
+            // time and propagate to (NET, fknee, alpha, fmin).
+            double * pcov = cov + ipsd * 16;
+            std::fill(pcov, pcov + 16, 0.0);
+            double scale = 1.0;
+            if ((weights == NULL) && (nvalid > nfree)) {
+                scale = current / (double)(nvalid - nfree);
+            }
+            double deriv[4] = {0.5 * par[0], par[1], 1.0, par[3]};
+            for (int64_t col = 0; col < 4; ++col) {
+                if (!isfree[col]) continue;
+                for (int64_t j = 0; j < 4; ++j) {
+                    for (int64_t k = 0; k < 4; ++k) {
+                        lhs[j * 4 + k] = (isfree[j] && isfree[k])
+                                         ? jtj[j * 4 + k] : 0.0;
+                    }
+                    if (!isfree[j]) lhs[j * 4 + j] = 1.0;
+                    step[j] = (j == col) ? 1.0 : 0.0;
+                }
+                if (!solve_small(4, lhs, step)) continue;
+                for (int64_t j = 0; j < 4; ++j) {
+                    if (!isfree[j]) continue;
+                    pcov[j * 4 + col] = scale * deriv[j] * step[j] * deriv[col];
+                }
+            }
+        }
+    }
+
+    return;
+}
@@ -16,8 +16,10 @@ void toast::cov_accum_diag(int64_t nsub, int64_t subsize, int64_t nnz,
                            int64_t nsamp,
                            int64_t const * indx_submap,
                            int64_t const * indx_pix, double const * weights,
-                           double scale, double const * signal, double * zdata,
-                           int64_t * hits, double * invnpp) {
+                           double scale, int64_t nstep,
+                           int64_t const * step_starts,
+                           double const * step_weights, double const * signal,
+                           double * zdata, int64_t * hits, double * invnpp) {
     const int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
     #pragma omp parallel
     {
@@ -29,6 +31,7 @@ void toast::cov_accum_diag(int64_t nsub, int64_t subsize, int64_t nnz,
         int64_t last_pix = first_pix + npix_thread - 1;
         #endif // ifdef _OPENMP
 
+        int64_t istep = -1;
         for (size_t i = 0; i < nsamp; ++i) {
             const int64_t isubmap = indx_submap[i] * subsize;
             const int64_t ipix = indx_pix[i];
@@ -38,16 +41,20 @@ void toast::cov_accum_diag(int64_t nsub, int64_t subsize, int64_t nnz,
             #ifdef _OPENMP
             if ((hpx < first_pix) || (hpx > last_pix)) continue;
             #endif // ifdef _OPENMP
+            const double sweight = toast::step_weight(i, nstep, step_starts,
+                                                      step_weights, istep);
+            if (sweight == 0) continue;
+            const double wscale = scale * sweight;
             const int64_t zpx = hpx * nnz;
             const int64_t ipx = hpx * block;
 
-            const double scaled_signal = scale * signal[i];
+            const double scaled_signal = wscale * signal[i];
             double * zpointer = zdata + zpx;
             const double * wpointer = weights + i * nnz;
             double * covpointer = invnpp + ipx;
             for (size_t j = 0; j < nnz; ++j, ++zpointer, ++wpointer) {
                 *zpointer += *wpointer * scaled_signal;
-                const double scaled_weight = *wpointer * scale;
+                const double scaled_weight = *wpointer * wscale;
                 const double * wpointer2 = wpointer;
                 for (size_t k = j; k < nnz; ++k, ++wpointer2, ++covpointer) {
                     *covpointer += *wpointer2 * scaled_weight;
@@ -94,8 +101,10 @@ void toast::cov_accum_diag_invnpp(int64_t nsub, int64_t subsize, int64_t nnz,
                                   int64_t const * indx_submap,
                                   int64_t const * indx_pix,
                                   double const * weights,
-                                  double scale, int64_t * hits,
-                                  double * invnpp) {
+                                  double scale, int64_t nstep,
+                                  int64_t const * step_starts,
+                                  double const * step_weights,
+                                  int64_t * hits, double * invnpp) {
     const int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
     #pragma omp parallel
     {
@@ -107,6 +116,7 @@ void toast::cov_accum_diag_invnpp(int64_t nsub, int64_t subsize, int64_t nnz,
         int64_t last_pix = first_pix + npix_thread - 1;
         #endif // ifdef _OPENMP
 
+        int64_t istep = -1;
         for (size_t i = 0; i < nsamp; ++i) {
             const int64_t isubmap = indx_submap[i] * subsize;
             const int64_t ipix = indx_pix[i];
@@ -116,12 +126,16 @@ void toast::cov_accum_diag_invnpp(int64_t nsub, int64_t subsize, int64_t nnz,
             #ifdef _OPENMP
             if ((hpx < first_pix) || (hpx > last_pix)) continue;
             #endif // ifdef _OPENMP
+            const double sweight = toast::step_weight(i, nstep, step_starts,
+                                                      step_weights, istep);
+            if (sweight == 0) continue;
+            const double wscale = scale * sweight;
             const int64_t ipx = hpx * block;
 
             const double * wpointer = weights + i * nnz;
             double * covpointer = invnpp + ipx;
             for (size_t j = 0; j < nnz; ++j, ++wpointer) {
-                const double scaled_weight = *wpointer * scale;
+                const double scaled_weight = *wpointer * wscale;
                 const double * wpointer2 = wpointer;
                 for (size_t k = j; k < nnz; ++k, ++wpointer2, ++covpointer) {
                     *covpointer += *wpointer2 * scaled_weight;
@@ -139,7 +153,9 @@ void toast::cov_accum_zmap(int64_t nsub, int64_t subsize, int64_t nnz,
                            int64_t nsamp,
                            int64_t const * indx_submap,
                            int64_t const * indx_pix, double const * weights,
-                           double scale, double const * signal,
+                           double scale, int64_t nstep,
+                           int64_t const * step_starts,
+                           double const * step_weights, double const * signal,
                            double * zdata) {
     #pragma omp parallel
     {
@@ -151,6 +167,7 @@ void toast::cov_accum_zmap(int64_t nsub, int64_t subsize, int64_t nnz,
         int64_t last_pix = first_pix + npix_thread - 1;
         #endif // ifdef _OPENMP
 
+        int64_t istep = -1;
         for (int64_t i = 0; i < nsamp; ++i) {
             const int64_t isubmap = indx_submap[i] * subsize;
             const int64_t ipix = indx_pix[i];
@@ -160,9 +177,12 @@ void toast::cov_accum_zmap(int64_t nsub, int64_t subsize, int64_t nnz,
             #ifdef _OPENMP
             if ((hpx < first_pix) || (hpx > last_pix)) continue;
             #endif // ifdef _OPENMP
+            const double sweight = toast::step_weight(i, nstep, step_starts,
+                                                      step_weights, istep);
+            if (sweight == 0) continue;
             const int64_t zpx = hpx * nnz;
 
-            const double scaled_signal = scale * signal[i];
+            const double scaled_signal = scale * sweight * signal[i];
             double * zpointer = zdata + zpx;
             const double * wpointer = weights + i * nnz;
             for (int64_t j = 0; j < nnz; ++j, ++zpointer, ++wpointer) {
@@ -12,6 +12,7 @@
 #include <cstring>
 #include <cmath>
 #include <vector>
+#include <mutex>
 
 
 // In all cases, the memory buffer used for these FFTs is allocated as a single
@@ -22,19 +23,20 @@
 
 #ifdef HAVE_FFTW
 
+namespace {
+// FFTW planning (and plan destruction) is not thread-safe, even between
+// distinct plans.  Every call into the planner goes through this lock.
+
+std::mutex & fftw_planner_mutex() {
+    static std::mutex mtx;
+    return mtx;
+}
+}
+
 toast::FFTPlanReal1DFFTW::FFTPlanReal1DFFTW(
     int64_t length, int64_t n, toast::fft_plan_type type,
     toast::fft_direction dir, double scale) :
     toast::FFTPlanReal1D(length, n, type, dir, scale) {
-    int threads = 1;
-
-    // enable threads
-    # ifdef HAVE_FFTW_THREADS
-    auto env = toast::Environment::get();
-    threads = env.max_threads();
-    fftw_plan_with_nthreads(threads);
-    # endif // ifdef HAVE_FFTW_THREADS
-
     // allocate memory
 
     data_.resize(n_ * 2 * length_);
@@ -74,17 +76,30 @@ toast::FFTPlanReal1DFFTW::FFTPlanReal1DFFTW(
         kind = FFTW_HC2R;
     }
 
-    flags = flags | FFTW_DESTROY_INPUT;
-
     if (type == toast::fft_plan_type::best) {
         flags = flags | FFTW_MEASURE;
     } else {
         flags = flags | FFTW_ESTIMATE;
     }
 
-    plan_ = fftw_plan_many_r2r(1, &ilength, iN, rawin, &ilength,
-                               1, ilength, rawout, &ilength, 1,
-                               ilength, &kind, flags);
+    {
+        std::lock_guard <std::mutex> lock(fftw_planner_mutex());
+
+        // enable threads
+        # ifdef HAVE_FFTW_THREADS
+        auto env = toast::Environment::get();
+        fftw_plan_with_nthreads(env.max_threads());
+        # endif // ifdef HAVE_FFTW_THREADS
+
+        plan_ = fftw_plan_many_r2r(1, &ilength, iN, rawin, &ilength,
+                                   1, ilength, rawout, &ilength, 1,
+                                   ilength, &kind, flags | FFTW_DESTROY_INPUT);
+    }
+
+    // The plan for caller-owned buffers is only created when first used
+
+    buffer_plan_ = NULL;
+
     if (plan_ == NULL) {
         // This can occur, for example, if MKL is masquerading as FFTW.
         auto here = TOAST_HERE();
@@ -97,7 +112,11 @@ toast::FFTPlanReal1DFFTW::FFTPlanReal1DFFTW(
 }
 
 toast::FFTPlanReal1DFFTW::~FFTPlanReal1DFFTW() {
+    std::lock_guard <std::mutex> lock(fftw_planner_mutex());
     fftw_destroy_plan(static_cast <fftw_plan> (plan_));
+    if (buffer_plan_ != NULL) {
+        fftw_destroy_plan(static_cast <fftw_plan> (buffer_plan_));
+    }
     tview_.clear();
     fview_.clear();
     data_.clear();
@@ -126,6 +145,79 @@ void toast::FFTPlanReal1DFFTW::exec() {
     return;
 }
 
+void toast::FFTPlanReal1DFFTW::create_buffer_plan() {
+    // The same batch layout as the internal plan, on caller-owned buffers
+    // which may have any alignment and whose input must survive the
+    // transform.  Planning may overwrite its arrays, so plan on scratch
+    // memory rather than the internal buffers.
+
+    int ilength = static_cast <int> (length_);
+    int iN = static_cast <int> (n_);
+
+    toast::AlignedVector <double> scratch(2 * n_ * length_);
+    double * rawin = &scratch[0];
+    double * rawout = &scratch[n_ * length_];
+
+    fftw_r2r_kind kind = FFTW_R2HC;
+    if (dir_ == toast::fft_direction::backward) {
+        kind = FFTW_HC2R;
+    }
+
+    unsigned flags = FFTW_UNALIGNED | FFTW_PRESERVE_INPUT;
+    if (type_ == toast::fft_plan_type::best) {
+        flags = flags | FFTW_MEASURE;
+    } else {
+        flags = flags | FFTW_ESTIMATE;
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(fftw_planner_mutex());
+
+        # ifdef HAVE_FFTW_THREADS
+        auto env = toast::Environment::get();
+        fftw_plan_with_nthreads(env.max_threads());
+        # endif // ifdef HAVE_FFTW_THREADS
+
+        buffer_plan_ = fftw_plan_many_r2r(1, &ilength, iN, rawin, &ilength,
+                                          1, ilength, rawout, &ilength, 1,
+                                          ilength, &kind, flags);
+    }
+
+    if (buffer_plan_ == NULL) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::string msg =
+            "fftw_plan_many_r2r returned plan=NULL unexpectedly; MKL linking issue?";
+        log.error(msg.c_str(), here);
+        throw std::runtime_error(msg.c_str());
+    }
+    return;
+}
+
+void toast::FFTPlanReal1DFFTW::exec(double const * in, double * out) {
+    std::call_once(buffer_once_,
+                   &toast::FFTPlanReal1DFFTW::create_buffer_plan, this);
+
+    // The buffer plan preserves its input, so casting away const is safe.
+    fftw_execute_r2r(buffer_plan_, const_cast <double *> (in), out);
+
+    double norm;
+
+    if (dir_ == toast::fft_direction::forward) {
+        norm = scale_;
+    } else {
+        norm = scale_ / static_cast <double> (length_);
+    }
+
+    int64_t len = n_ * length_;
+
+    for (int64_t i = 0; i < len; ++i) {
+        out[i] *= norm;
+    }
+
+    return;
+}
+
 double * toast::FFTPlanReal1DFFTW::tdata(int64_t indx) {
     if ((indx < 0) || (indx >= n_)) {
         auto here = TOAST_HERE();
@@ -304,6 +396,34 @@ void toast::FFTPlanReal1DMKL::exec() {
     return;
 }
 
+void toast::FFTPlanReal1DMKL::exec(double const * in, double * out) {
+    // DFTI produces CCE packed data, which must be repacked to half-complex
+    // through workspace of the padded row length.  With MKL this method is
+    // therefore copy-based: rows are staged through the internal buffers,
+    // and concurrent calls on the same plan are serialized.
+
+    std::lock_guard <std::mutex> lock(buffer_mutex_);
+
+    std::vector <double *> & inview = (dir_ == toast::fft_direction::forward)
+                                      ? tview_ : fview_;
+    std::vector <double *> & outview = (dir_ == toast::fft_direction::forward)
+                                       ? fview_ : tview_;
+
+    for (int64_t i = 0; i < n_; ++i) {
+        memcpy((void *)inview[i], (void *)(in + i * length_),
+               length_ * sizeof(double));
+    }
+
+    exec();
+
+    for (int64_t i = 0; i < n_; ++i) {
+        memcpy((void *)(out + i * length_), (void *)outview[i],
+               length_ * sizeof(double));
+    }
+
+    return;
+}
+
 double * toast::FFTPlanReal1DMKL::tdata(int64_t indx) {
     if ((indx < 0) || (indx >= n_)) {
         auto here = TOAST_HERE();
@@ -10,6 +10,27 @@
 #include <cmath>
 
 
+#ifdef TOAST_HEALPIX_BMI2
+namespace {
+// This file is built for BMI2.  Check the processor once, so that a build
+// with TOAST_USE_BMI2 fails with a diagnostic on processors without BMI2
+// instead of an illegal instruction.
+
+void check_bmi2() {
+    static bool const supported = __builtin_cpu_supports("bmi2");
+    if (!supported) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::string msg(
+            "libtoast was built with TOAST_USE_BMI2, but this processor does "
+            "not support the BMI2 instructions.  Rebuild without it.");
+        log.error(msg.c_str(), here);
+        throw std::runtime_error(msg.c_str());
+    }
+}
+}
+#endif // ifdef TOAST_HEALPIX_BMI2
+
 const int64_t toast::HealpixPixels::jr_[] =
 {2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4};
 
@@ -179,6 +200,10 @@ toast::HealpixPixels::HealpixPixels(int64_t nside) {
 }
 
 void toast::HealpixPixels::reset(int64_t nside) {
+    #ifdef TOAST_HEALPIX_BMI2
+    check_bmi2();
+    #endif // ifdef TOAST_HEALPIX_BMI2
+
     if (nside <= 0) {
         auto here = TOAST_HERE();
         auto log = toast::Logger::get();
@@ -200,16 +225,6 @@ void toast::HealpixPixels::reset(int64_t nside) {
 
     nside_ = nside;
 
-    for (uint64_t m = 0; m < 0x100; ++m) {
-        utab_[m] = (m & 0x1) | ((m & 0x2) << 1) | ((m & 0x4) << 2) |
-                   ((m & 0x8) << 3) | ((m & 0x10) << 4) | ((m & 0x20) << 5) |
-                   ((m & 0x40) << 6) | ((m & 0x80) << 7);
-
-        ctab_[m] = (m & 0x1) | ((m & 0x2) << 7) | ((m & 0x4) >> 1) |
-                   ((m & 0x8) << 6) | ((m & 0x10) >> 2) | ((m & 0x20) << 5) |
-                   ((m & 0x40) >> 3) | ((m & 0x80) << 4);
-    }
-
     ncap_ = 2 * (nside * nside - nside);
 
     npix_ = 12 * nside * nside;
@@ -439,8 +454,8 @@ void toast::HealpixPixels::zphi2nest(int64_t n, double const * phi,
                 }
             }
 
-            uint64_t sipf = xy2pix_(static_cast <uint64_t> (x),
-                                    static_cast <uint64_t> (y));
+            uint64_t sipf = xy2pix(static_cast <uint64_t> (x),
+                                   static_cast <uint64_t> (y));
 
             pix[i] = static_cast <int64_t> (sipf) + (face << (2 * factor_));
         }
@@ -513,8 +528,8 @@ void toast::HealpixPixels::zphi2nest(int64_t n, double const * phi,
                 }
             }
 
-            uint64_t sipf = xy2pix_(static_cast <uint64_t> (x),
-                                    static_cast <uint64_t> (y));
+            uint64_t sipf = xy2pix(static_cast <uint64_t> (x),
+                                   static_cast <uint64_t> (y));
 
             pix[i] = static_cast <int64_t> (sipf) + (face << (2 * factor_));
         }
@@ -814,7 +829,7 @@ void toast::HealpixPixels::ring2nest(int64_t n, int64_t const * ringpix,
             x = static_cast <uint64_t> (ix);
             y = static_cast <uint64_t> (iy);
 
-            nestpix[i] = xy2pix_(x, y);
+            nestpix[i] = xy2pix(x, y);
             nestpix[i] += (fc << (2 * factor_));
         }
     } else {
@@ -897,7 +912,7 @@ void toast::HealpixPixels::ring2nest(int64_t n, int64_t const * ringpix,
             x = static_cast <uint64_t> (ix);
             y = static_cast <uint64_t> (iy);
 
-            nestpix[i] = xy2pix_(x, y);
+            nestpix[i] = xy2pix(x, y);
             nestpix[i] += (fc << (2 * factor_));
         }
     }
@@ -926,7 +941,7 @@ void toast::HealpixPixels::nest2ring(int64_t n, int64_t const * nestpix,
             int64_t kshift;
             int64_t n_before;
             fc = nestpix[i] >> (2 * factor_);
-            pix2xy_(nestpix[i] & (nside_ * nside_ - 1), x, y);
+            pix2xy(nestpix[i] & (nside_ * nside_ - 1), x, y);
             ix = static_cast <int64_t> (x);
             iy = static_cast <int64_t> (y);
 
@@ -969,7 +984,7 @@ void toast::HealpixPixels::nest2ring(int64_t n, int64_t const * nestpix,
             int64_t kshift;
             int64_t n_before;
             fc = nestpix[i] >> (2 * factor_);
-            pix2xy_(nestpix[i] & (nside_ * nside_ - 1), x, y);
+            pix2xy(nestpix[i] & (nside_ * nside_ - 1), x, y);
             ix = static_cast <int64_t> (x);
             iy = static_cast <int64_t> (y);
 
@@ -1024,7 +1039,10 @@ void toast::HealpixPixels::degrade_ring(int factor, int64_t n,
 
     degrade_nest(factor, n, temp_nest.data(), temp.data());
 
-    nest2ring(n, temp.data(), outpix);
+    // The degraded pixels are numbered at the lower resolution
+
+    toast::HealpixPixels lowres(nside_ >> factor);
+    lowres.nest2ring(n, temp.data(), outpix);
 
     return;
 }
@@ -1074,7 +1092,10 @@ void toast::HealpixPixels::upgrade_ring(int factor, int64_t n,
 
     upgrade_nest(factor, n, temp_nest.data(), temp.data());
 
-    nest2ring(n, temp.data(), outpix);
+    // The upgraded pixels are numbered at the higher resolution
+
+    toast::HealpixPixels highres(nside_ << factor);
+    highres.nest2ring(n, temp.data(), outpix);
 
     return;
 }
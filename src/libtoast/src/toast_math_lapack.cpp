@@ -225,6 +225,25 @@ void toast::lapack_potri(char * UPLO, int * N, double * A, int * LDA,
     return;
 }
 
+#define dpbtrf LAPACK_FUNC(dpbtrf, DPBTRF)
+
+extern "C" void dpbtrf(char * UPLO, int * N, int * KD, double * AB, int * LDAB,
+                       int * INFO);
+
+void toast::lapack_pbtrf(char * UPLO, int * N, int * KD, double * AB, int * LDAB,
+                         int * INFO) {
+    #ifdef HAVE_LAPACK
+    dpbtrf(UPLO, N, KD, AB, LDAB, INFO);
+    #else // ifdef HAVE_LAPACK
+    auto here = TOAST_HERE();
+    auto log = toast::Logger::get();
+    std::string msg("TOAST was not compiled with BLAS/LAPACK support.");
+    log.error(msg.c_str(), here);
+    throw std::runtime_error(msg.c_str());
+    #endif // ifdef HAVE_LAPACK
+    return;
+}
+
 #define dgelss LAPACK_FUNC(dgelss, DGELSS)
 
 extern "C" void dgelss(int * M, int * N, int * NRHS, double * A, int * LDA,
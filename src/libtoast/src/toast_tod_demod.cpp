@@ -0,0 +1,118 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/tod_demod.hpp>
+
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+
+
+void toast::hwp_demodulate(int64_t nsamp, int64_t nnz,
+                           double const * hwp_angle, double const * signal,
+                           uint8_t const * flags, uint8_t flag_mask,
+                           int64_t const * pixels, double const * weights,
+                           int64_t ntap, double const * fir, int64_t step,
+                           int64_t nout, double * out_signal,
+                           int64_t * out_pixels, double * out_weights,
+                           uint8_t * out_flags) {
+    // Lock-in demodulate one detector against the cached HWP angle.  The
+    // signal is multiplied by the three modulation functions
+    // {1, 2 cos(4 chi), 2 sin(4 chi)}, low-pass filtered with the symmetric
+    // FIR and sampled every `step` input samples.  The pointing weights are
+    // put through exactly the same operation, so that each demodulated
+    // stream is still a linear function of the map:
+    //
+    //     out_signal[j, k] = sum_m out_weights[j, k, m] * map[out_pixels[j], m]
+    //
+    // Output sample j is centered on input sample j * step + step / 2.
+    // Flagged input samples and samples beyond the ends of the data are
+    // dropped from the filter, which is renormalized over the remaining
+    // taps.  An output sample is flagged if less than half of the filter
+    // weight survives or if the central sample has no valid pixel.
+    // All outputs are stored as (nout, 3) blocks so that they can be
+    // viewed as 3 * nout samples with the usual (nsamp, nnz) layout.
+
+    if ((ntap < 1) || (ntap % 2 == 0)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "demodulation filter must have an odd number of taps, not "
+          << ntap;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    if ((step < 1) || (nout > (nsamp + step - 1) / step)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "cannot produce " << nout << " samples from " << nsamp
+          << " with a decimation step of " << step;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    int64_t half = ntap / 2;
+
+    double fir_total = 0.0;
+    for (int64_t t = 0; t < ntap; ++t) {
+        fir_total += fir[t];
+    }
+
+    #pragma omp parallel default(none)                                   \
+    shared(nsamp, nnz, hwp_angle, signal, flags, flag_mask, pixels,      \
+    weights, ntap, fir, step, nout, out_signal, out_pixels, out_weights, \
+    out_flags, half, fir_total)
+    {
+        toast::AlignedVector <double> wt(3 * nnz);
+
+        #pragma omp for schedule(static)
+        for (int64_t j = 0; j < nout; ++j) {
+            int64_t center = j * step + step / 2;
+            if (center > nsamp - 1) center = nsamp - 1;
+
+            double sig[3] = {0.0, 0.0, 0.0};
+            std::fill(wt.begin(), wt.end(), 0.0);
+            double norm = 0.0;
+
+            for (int64_t t = 0; t < ntap; ++t) {
+                int64_t i = center - half + t;
+                if ((i < 0) || (i >= nsamp)) continue;
+                if ((flags != NULL) && ((flags[i] & flag_mask) != 0)) continue;
+                if (pixels[i] < 0) continue;
+                double chi = 4.0 * hwp_angle[i];
+                double mod[3] = {fir[t], 2.0 * fir[t] * ::cos(chi),
+                                 2.0 * fir[t] * ::sin(chi)};
+                for (int64_t k = 0; k < 3; ++k) {
+                    sig[k] += mod[k] * signal[i];
+                    for (int64_t m = 0; m < nnz; ++m) {
+                        wt[k * nnz + m] += mod[k] * weights[i * nnz + m];
+                    }
+                }
+                norm += fir[t];
+            }
+
+            bool bad = (pixels[center] < 0) || (norm < 0.5 * fir_total);
+            if (!bad) {
+                norm = 1.0 / norm;
+            } else {
+                norm = 0.0;
+            }
+
+            for (int64_t k = 0; k < 3; ++k) {
+                int64_t off = 3 * j + k;
+                out_signal[off] = sig[k] * norm;
+                out_pixels[off] = bad ? -1 : pixels[center];
+                out_flags[off] = bad ? 1 : 0;
+                for (int64_t m = 0; m < nnz; ++m) {
+                    out_weights[off * nnz + m] = wt[k * nnz + m] * norm;
+                }
+            }
+        }
+    }
+
+    return;
+}
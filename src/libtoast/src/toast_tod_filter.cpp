@@ -4,7 +4,9 @@
 // a BSD-style license that can be found in the LICENSE file.
 
 #include <string.h>
+#include <cmath>
 #include <algorithm>
+#include <sstream>
 
 #ifdef _OPENMP
 # include <omp.h>
@@ -12,6 +14,7 @@
 
 #include <toast/sys_utils.hpp>
 #include <toast/math_lapack.hpp>
+#include <toast/math_fft.hpp>
 #include <toast/tod_filter.hpp>
 
 
@@ -367,3 +370,206 @@ void toast::add_templates(double * signal, double * templates, double * coeff,
 
     return;
 }
+
+namespace {
+int64_t line_filter_length(int64_t n) {
+    // The smallest length of the form 2^a 3^b 5^c that holds n samples.
+    int64_t best = 1;
+    while (best < n) best *= 2;
+    for (int64_t p5 = 1; p5 < best; p5 *= 5) {
+        for (int64_t p35 = p5; p35 < best; p35 *= 3) {
+            int64_t len = p35;
+            while (len < n) len *= 2;
+            best = std::min(best, len);
+        }
+    }
+    return best;
+}
+}
+
+void toast::filter_lines(int64_t nsamp, double rate, int64_t nline,
+                         double const * freqs, double const * widths,
+                         size_t nscan, int64_t const * starts,
+                         int64_t const * stops,
+                         std::vector <uint8_t *> const & flags,
+                         std::vector <double *> const & signals) {
+    // Remove narrow spectral lines from the signals, one scan at a time.
+    //
+    // The flagged samples of each scan are first filled by linear
+    // interpolation, and the straight line between the end points is
+    // removed so that the zero padded scan is continuous.  The Fourier
+    // modes of this gap-filled scan within half a line width of each line
+    // frequency make up the line estimate, which is subtracted from all
+    // samples of the scan, flagged or not.  Like any Fourier notch, the
+    // estimate is incomplete within about one inverse width of the scan
+    // ends, where the lines are truncated.  The scans of all detectors
+    // are transformed together with batched plans from the global plan
+    // store, so the cost is one forward and one inverse FFT per detector
+    // and scan.  The flags are optional (empty vector).
+
+    int64_t ndet = signals.size();
+    if ((ndet == 0) || (nsamp == 0) || (nline == 0)) {
+        return;
+    }
+    if (!(rate > 0)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "sample rate must be positive, not " << rate;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    for (int64_t iline = 0; iline < nline; ++iline) {
+        if (!(freqs[iline] > 0) || (widths[iline] < 0)) {
+            auto here = TOAST_HERE();
+            auto log = toast::Logger::get();
+            std::ostringstream o;
+            o << "line " << iline << " has frequency " << freqs[iline]
+              << " and width " << widths[iline]
+              << ", the frequency must be positive and the width must "
+              << "not be negative";
+            log.error(o.str().c_str(), here);
+            throw std::runtime_error(o.str().c_str());
+        }
+    }
+    int64_t nflag = flags.size();
+    if ((nflag != 0) && (nflag != ndet)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "got " << flags.size() << " flag vectors for " << ndet
+          << " signals";
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    int64_t nbatch = std::min(ndet, (int64_t)64);
+    auto & store = toast::FFTPlanReal1DStore::get();
+
+    // Scans are zero padded to the length of the longest scan, unless that
+    // would more than double them, so that scans of slightly different
+    // lengths reuse the same plans instead of each creating their own.
+
+    int64_t maxlen = 0;
+    for (size_t iscan = 0; iscan < nscan; ++iscan) {
+        int64_t start = std::max(starts[iscan], (int64_t)0);
+        int64_t stop = std::min(stops[iscan], nsamp - 1);
+        if (stop <= start) continue;
+        maxlen = std::max(maxlen, stop - start + 1);
+    }
+    int64_t maxfftlen = line_filter_length(maxlen);
+
+    for (size_t iscan = 0; iscan < nscan; ++iscan) {
+        int64_t start = std::max(starts[iscan], (int64_t)0);
+        int64_t stop = std::min(stops[iscan], nsamp - 1);
+        if (stop <= start) continue;
+        int64_t scanlen = stop - start + 1;
+        int64_t fftlen = maxfftlen;
+        if (2 * scanlen <= maxfftlen) fftlen = line_filter_length(scanlen);
+        int64_t half = fftlen / 2;
+
+        // The Fourier modes in the notches.  Every line removes at least
+        // the mode closest to its frequency.
+
+        std::vector <uint8_t> notch(half + 1, 0);
+        double df = rate / static_cast <double> (fftlen);
+        for (int64_t iline = 0; iline < nline; ++iline) {
+            int64_t kcenter = static_cast <int64_t> (::round(freqs[iline] / df));
+            if ((kcenter > 0) && (kcenter <= half)) notch[kcenter] = 1;
+            int64_t kfirst = static_cast <int64_t> (
+                ::ceil((freqs[iline] - 0.5 * widths[iline]) / df));
+            int64_t klast = static_cast <int64_t> (
+                ::floor((freqs[iline] + 0.5 * widths[iline]) / df));
+            for (int64_t k = std::max(kfirst, (int64_t)1);
+                 k <= std::min(klast, half); ++k) {
+                notch[k] = 1;
+            }
+        }
+
+        auto fplan = store.forward(fftlen, nbatch);
+        auto rplan = store.backward(fftlen, nbatch);
+        toast::AlignedVector <double> tbuf(nbatch * fftlen);
+        toast::AlignedVector <double> fbuf(nbatch * fftlen);
+        toast::AlignedVector <double> obuf(nbatch * fftlen);
+
+        for (int64_t first = 0; first < ndet; first += nbatch) {
+            int64_t nb = std::min(nbatch, ndet - first);
+
+            // Gather the gap-filled and detrended scans
+
+            #pragma omp parallel for default(none) \
+            shared(first, nb, nbatch, start, scanlen, fftlen, signals, flags, \
+            tbuf)
+            for (int64_t ib = 0; ib < nbatch; ++ib) {
+                double * row = tbuf.data() + ib * fftlen;
+                std::fill(row, row + fftlen, 0.0);
+                if (ib >= nb) continue;
+                double const * sig = signals[first + ib] + start;
+                uint8_t const * flg = NULL;
+                if (flags.size() != 0) flg = flags[first + ib] + start;
+
+                // Fill the gaps between good samples
+                int64_t last_good = -1;
+                for (int64_t i = 0; i < scanlen; ++i) {
+                    if ((flg != NULL) && (flg[i] != 0)) continue;
+                    row[i] = sig[i];
+                    if (last_good < 0) {
+                        std::fill(row, row + i, sig[i]);
+                    } else if (i > last_good + 1) {
+                        double step = (sig[i] - sig[last_good]) /
+                                      static_cast <double> (i - last_good);
+                        for (int64_t j = last_good + 1; j < i; ++j) {
+                            row[j] = sig[last_good] + step * (j - last_good);
+                        }
+                    }
+                    last_good = i;
+                }
+                if (last_good < 0) {
+                    // No good samples, nothing to filter
+                    continue;
+                }
+                std::fill(row + last_good + 1, row + scanlen, sig[last_good]);
+
+                double offset = row[0];
+                double slope = (row[scanlen - 1] - row[0]) /
+                               static_cast <double> (scanlen - 1);
+                for (int64_t i = 0; i < scanlen; ++i) {
+                    row[i] -= offset + slope * i;
+                }
+            }
+
+            fplan->exec(tbuf.data(), fbuf.data());
+
+            // Keep only the modes in the notches, in the half-complex
+            // layout.
+
+            #pragma omp parallel for default(none) \
+            shared(nb, fftlen, half, notch, fbuf)
+            for (int64_t ib = 0; ib < nb; ++ib) {
+                double * row = fbuf.data() + ib * fftlen;
+                row[0] = 0.0;
+                for (int64_t k = 1; k <= half; ++k) {
+                    if (notch[k] != 0) continue;
+                    row[k] = 0.0;
+                    if (2 * k != fftlen) row[fftlen - k] = 0.0;
+                }
+            }
+
+            rplan->exec(fbuf.data(), obuf.data());
+
+            // Subtract the line estimates
+
+            #pragma omp parallel for default(none) \
+            shared(first, nb, start, scanlen, fftlen, signals, obuf)
+            for (int64_t ib = 0; ib < nb; ++ib) {
+                double const * row = obuf.data() + ib * fftlen;
+                double * sig = signals[first + ib] + start;
+                for (int64_t i = 0; i < scanlen; ++i) {
+                    sig[i] -= row[i];
+                }
+            }
+        }
+    }
+
+    return;
+}
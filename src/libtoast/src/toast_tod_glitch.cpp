@@ -0,0 +1,274 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/tod_glitch.hpp>
+
+#include <cmath>
+#include <limits>
+#include <set>
+#include <iterator>
+#include <algorithm>
+#include <sstream>
+
+
+namespace {
+// The median of a sliding window of values.  The window is split into two
+// balanced trees holding the lower and upper halves, so that inserting or
+// removing a sample is O(log w) and the median is read from the ends of the
+// trees.
+class WindowMedian {
+    public:
+
+        void insert(double value) {
+            if (lower_.empty() || (value <= *lower_.rbegin())) {
+                lower_.insert(value);
+            } else {
+                upper_.insert(value);
+            }
+            balance();
+        }
+
+        void erase(double value) {
+            // Every value in the lower half is <= every value in the upper
+            // half, so the value can only be in the lower half if it does
+            // not exceed the lower maximum.
+            if ((!lower_.empty()) && (value <= *lower_.rbegin())) {
+                lower_.erase(lower_.find(value));
+            } else {
+                upper_.erase(upper_.find(value));
+            }
+            balance();
+        }
+
+        double median() const {
+            if (lower_.empty()) {
+                return std::numeric_limits <double>::quiet_NaN();
+            }
+            if (lower_.size() > upper_.size()) {
+                return *lower_.rbegin();
+            }
+            return 0.5 * (*lower_.rbegin() + *upper_.begin());
+        }
+
+    private:
+
+        void balance() {
+            if (lower_.size() > upper_.size() + 1) {
+                auto it = std::prev(lower_.end());
+                upper_.insert(*it);
+                lower_.erase(it);
+            } else if (upper_.size() > lower_.size()) {
+                auto it = upper_.begin();
+                lower_.insert(*it);
+                upper_.erase(it);
+            }
+        }
+
+        std::multiset <double> lower_;
+        std::multiset <double> upper_;
+};
+
+void window_median(int64_t nsamp, int64_t window, double const * values,
+                   uint8_t const * good, double * median) {
+    // Median over the good samples of the centered window [i - half, i + half].
+    // The window is truncated at the ends of the data, and the median is NaN
+    // where it holds no good samples.
+    int64_t half = window / 2;
+    WindowMedian med;
+    for (int64_t i = 0; i < std::min(half, nsamp); ++i) {
+        if (good[i]) med.insert(values[i]);
+    }
+    for (int64_t i = 0; i < nsamp; ++i) {
+        int64_t enter = i + half;
+        if ((enter < nsamp) && good[enter]) med.insert(values[enter]);
+        median[i] = med.median();
+        int64_t leave = i - half;
+        if ((leave >= 0) && good[leave]) med.erase(values[leave]);
+    }
+    return;
+}
+}
+
+
+void toast::running_median(int64_t nsamp, int64_t window,
+                           double const * signal, uint8_t const * flags,
+                           uint8_t flag_mask, double * median) {
+    // Running median of the unflagged, finite samples.
+    if (window < 1) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "running median window must be positive, not " << window;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    std::vector <uint8_t> good(nsamp);
+    for (int64_t i = 0; i < nsamp; ++i) {
+        good[i] = std::isfinite(signal[i]);
+        if ((flags != NULL) && ((flags[i] & flag_mask) != 0)) good[i] = 0;
+    }
+    window_median(nsamp, window, signal, good.data(), median);
+    return;
+}
+
+void toast::flag_glitches(int64_t nsamp, int64_t window,
+                          double glitch_threshold, int64_t jump_width,
+                          double jump_threshold, int64_t dilation,
+                          uint8_t glitch_value, uint8_t jump_value,
+                          uint8_t flag_mask, uint8_t const * common_flags,
+                          uint8_t common_mask,
+                          std::vector <double const *> const & signals,
+                          std::vector <uint8_t *> const & flags) {
+    // Flag glitches and jumps in a set of detector timestreams.
+    //
+    // The noise level is tracked with a running median and a running
+    // median absolute deviation (MAD) of the residual, both over `window`
+    // samples.  Samples deviating from the median by more than
+    // `glitch_threshold` robust standard deviations (1.4826 MAD) are
+    // glitches.  Jumps are found with a matched filter that compares the
+    // mean of the `jump_width` samples after each sample boundary with the
+    // mean of the `jump_width` samples before it.  Local maxima of the
+    // filter that exceed `jump_threshold` standard deviations are jumps.
+    // Samples within `dilation` samples of a glitch or jump are flagged
+    // too.  The glitch and jump flag values are OR-ed into the detector
+    // flags.  Samples with a bit of `flag_mask` set in the detector flags,
+    // or a bit of `common_mask` set in the (optional) common flags, are
+    // excluded from the statistics.
+
+    if (window < 1) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "running median window must be positive, not " << window;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    if (signals.size() != flags.size()) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "got " << signals.size() << " signals but " << flags.size()
+          << " flag vectors";
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    if (dilation < 0) dilation = 0;
+
+    int64_t ndet = signals.size();
+
+    #pragma                                                       \
+    omp parallel default(none)                                    \
+    shared(nsamp, window, glitch_threshold, jump_width,           \
+    jump_threshold, dilation, glitch_value, jump_value, flag_mask, \
+    common_flags, common_mask, signals, flags, ndet)
+    {
+        const double mad_to_sigma = 1.4826;
+        std::vector <uint8_t> good(nsamp);
+        std::vector <double> median(nsamp);
+        std::vector <double> resid(nsamp);
+        std::vector <double> sigma(nsamp);
+        std::vector <uint8_t> newflags(nsamp);
+
+        #pragma omp for schedule(dynamic)
+        for (int64_t idet = 0; idet < ndet; ++idet) {
+            double const * signal = signals[idet];
+            uint8_t * detflags = flags[idet];
+
+            for (int64_t i = 0; i < nsamp; ++i) {
+                good[i] = std::isfinite(signal[i]) &&
+                          ((detflags[i] & flag_mask) == 0);
+                if ((common_flags != NULL) &&
+                    ((common_flags[i] & common_mask) != 0)) good[i] = 0;
+                newflags[i] = 0;
+            }
+
+            // Running median and MAD of the residual
+
+            window_median(nsamp, window, signal, good.data(), median.data());
+            for (int64_t i = 0; i < nsamp; ++i) {
+                resid[i] = std::fabs(signal[i] - median[i]);
+                if (!std::isfinite(resid[i])) good[i] = 0;
+            }
+            window_median(nsamp, window, resid.data(), good.data(),
+                          sigma.data());
+            for (int64_t i = 0; i < nsamp; ++i) {
+                sigma[i] *= mad_to_sigma;
+            }
+
+            // Glitches
+
+            if (glitch_threshold > 0) {
+                for (int64_t i = 0; i < nsamp; ++i) {
+                    if (!good[i]) continue;
+                    if (!(sigma[i] > 0)) continue;
+                    if (resid[i] > glitch_threshold * sigma[i]) {
+                        int64_t first = std::max(i - dilation, (int64_t)0);
+                        int64_t last = std::min(i + dilation, nsamp - 1);
+                        for (int64_t j = first; j <= last; ++j) {
+                            newflags[j] |= glitch_value;
+                        }
+                        // The glitch must not bias the jump filter
+                        good[i] = 0;
+                    }
+                }
+            }
+
+            // Jumps.  The cumulative sums of the good samples give the mean
+            // on either side of every sample boundary in constant time.
+
+            if ((jump_threshold > 0) && (jump_width > 0)) {
+                std::vector <double> cumsum(nsamp + 1);
+                std::vector <int64_t> cumgood(nsamp + 1);
+                cumsum[0] = 0;
+                cumgood[0] = 0;
+                for (int64_t i = 0; i < nsamp; ++i) {
+                    cumsum[i + 1] = cumsum[i] + (good[i] ? signal[i] : 0.0);
+                    cumgood[i + 1] = cumgood[i] + (good[i] ? 1 : 0);
+                }
+
+                // resid is reused for the significance of a jump between
+                // samples i - 1 and i.
+                int64_t minsamp = std::max(jump_width / 2, (int64_t)1);
+                for (int64_t i = 0; i < nsamp; ++i) {
+                    resid[i] = 0;
+                    if ((i == 0) || !(sigma[i] > 0)) continue;
+                    int64_t left = std::max(i - jump_width, (int64_t)0);
+                    int64_t right = std::min(i + jump_width, nsamp);
+                    int64_t nleft = cumgood[i] - cumgood[left];
+                    int64_t nright = cumgood[right] - cumgood[i];
+                    if ((nleft < minsamp) || (nright < minsamp)) continue;
+                    double step = (cumsum[right] - cumsum[i]) / nright -
+                                  (cumsum[i] - cumsum[left]) / nleft;
+                    double err = sigma[i] * std::sqrt(1.0 / nleft +
+                                                      1.0 / nright);
+                    resid[i] = std::fabs(step) / err;
+                }
+                for (int64_t i = 1; i < nsamp; ++i) {
+                    if (resid[i] <= jump_threshold) continue;
+                    bool peak = true;
+                    int64_t first = std::max(i - jump_width + 1, (int64_t)1);
+                    int64_t last = std::min(i + jump_width - 1, nsamp - 1);
+                    for (int64_t j = first; j <= last; ++j) {
+                        if ((j < i) && (resid[j] >= resid[i])) peak = false;
+                        if ((j > i) && (resid[j] > resid[i])) peak = false;
+                    }
+                    if (!peak) continue;
+                    first = std::max(i - 1 - dilation, (int64_t)0);
+                    last = std::min(i + dilation, nsamp - 1);
+                    for (int64_t j = first; j <= last; ++j) {
+                        newflags[j] |= jump_value;
+                    }
+                }
+            }
+
+            for (int64_t i = 0; i < nsamp; ++i) {
+                detflags[i] |= newflags[i];
+            }
+        }
+    }
+
+    return;
+}
@@ -0,0 +1,155 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/math_fft.hpp>
+#include <toast/math_lapack.hpp>
+#include <toast/tod_offset.hpp>
+
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+
+void toast::offset_noise_filter(int64_t nfreq, double const * logfreq,
+                                double const * logpsd, double step_length,
+                                int64_t nstep, double lim,
+                                toast::AlignedVector <double> & filter) {
+    // Build the real space noise filter (or prior) for a run of `nstep`
+    // baseline offsets.  The tabulated log-PSD is interpolated onto the
+    // frequencies of a (2 * nstep + 1)-point real FFT, transformed back to
+    // real space with a (2 * nstep)-point inverse transform and truncated
+    // symmetrically where it falls below `lim` times the zero-lag value.
+
+    if (nstep < 1) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::string msg("offset noise filter needs at least one step");
+        log.error(msg.c_str(), here);
+        throw std::runtime_error(msg.c_str());
+    }
+
+    int64_t fftlen = 2 * nstep;
+    double df = 1.0 / (static_cast <double> (fftlen + 1) * step_length);
+
+    auto & store = toast::FFTPlanReal1DStore::get();
+    auto plan = store.backward(fftlen, 1);
+
+    // Interpolate in log space into the half-complex buffer.  The input is
+    // real, so all imaginary parts are zero.  Frequencies outside of the
+    // tabulated range take the value at the nearest end point.
+
+    double * pdata = plan->fdata(0);
+    std::fill(pdata, pdata + fftlen, 0);
+
+    int64_t ibin = 0;
+    for (int64_t i = 1; i <= nstep; ++i) {
+        double x = ::log(df * static_cast <double> (i));
+        double value;
+        if (x <= logfreq[0]) {
+            value = logpsd[0];
+        } else if (x >= logfreq[nfreq - 1]) {
+            value = logpsd[nfreq - 1];
+        } else {
+            while ((ibin < nfreq - 2) && (logfreq[ibin + 1] < x)) ++ibin;
+            double r = (x - logfreq[ibin]) / (logfreq[ibin + 1] - logfreq[ibin]);
+            value = logpsd[ibin] + r * (logpsd[ibin + 1] - logpsd[ibin]);
+        }
+        pdata[i] = ::exp(value);
+    }
+
+    plan->exec();
+    double const * tdata = plan->tdata(0);
+
+    // Find the last lag that is still significant
+
+    int64_t icenter = nstep;
+    double thresh = ::fabs(tdata[0]) * lim;
+    int64_t icut = 0;
+    for (int64_t i = 0; i < icenter; ++i) {
+        if (::fabs(tdata[i]) > thresh) icut = i;
+    }
+    if (icut % 2 == 0) icut += 1;
+
+    // Store the symmetric filter centered on the zero lag
+
+    int64_t first = -icut;
+    int64_t last = std::min(icut, fftlen - 1 - icenter);
+    filter.resize(last - first + 1);
+    for (int64_t lag = first; lag <= last; ++lag) {
+        filter[lag - first] = tdata[(lag + fftlen) % fftlen];
+    }
+
+    return;
+}
+
+int64_t toast::offset_banded_precond(int64_t nstep, double const * sigmasqs,
+                                     int64_t nfilter, double const * filter,
+                                     int64_t precond_width,
+                                     toast::AlignedVector <double> & precond) {
+    // Build the lower banded form of (diag(sigmasqs) + F), where F is the
+    // Toeplitz matrix of the noise filter, and factor it in place with a
+    // banded Cholesky decomposition.  The result is stored in the
+    // (width, nstep) row-major layout used by scipy.linalg.cho_solve_banded.
+    // Returns the band width.  If the banded matrix is not positive definite,
+    // fall back to its diagonal:  a band of width one holding the square
+    // roots of the diagonal entries.
+
+    int64_t wband = std::min(precond_width, nfilter / 2);
+    int64_t width = std::max(wband, std::min(precond_width, nstep));
+    int64_t icenter = nfilter / 2;
+
+    // LAPACK expects the band in column-major order
+
+    toast::AlignedVector <double> band(width * nstep);
+    std::fill(band.begin(), band.end(), 0);
+    for (int64_t j = 0; j < nstep; ++j) {
+        double * col = band.data() + j * width;
+        col[0] = sigmasqs[j];
+        for (int64_t r = 0; r < wband; ++r) {
+            col[r] += filter[icenter + r];
+        }
+    }
+
+    char uplo = 'L';
+    int n = static_cast <int> (nstep);
+    int kd = static_cast <int> (width - 1);
+    int ldab = static_cast <int> (width);
+    int info = 0;
+    toast::lapack_pbtrf(&uplo, &n, &kd, band.data(), &ldab, &info);
+
+    if (info != 0) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "banded Cholesky decomposition of the offset preconditioner "
+          << "failed with info = " << info << ", using the diagonal of "
+          << nstep << " baselines instead";
+        log.warning(o.str().c_str(), here);
+
+        precond.resize(nstep);
+        for (int64_t j = 0; j < nstep; ++j) {
+            double diag = sigmasqs[j] + filter[icenter];
+            if (diag <= 0) {
+                o.str("");
+                o << "diagonal offset preconditioner is not positive ("
+                  << diag << ") for baseline " << j;
+                log.error(o.str().c_str(), here);
+                throw std::runtime_error(o.str().c_str());
+            }
+            precond[j] = ::sqrt(diag);
+        }
+        return 1;
+    }
+
+    precond.resize(width * nstep);
+    for (int64_t j = 0; j < nstep; ++j) {
+        for (int64_t r = 0; r < width; ++r) {
+            precond[r * nstep + j] = band[j * width + r];
+        }
+    }
+
+    return width;
+}
@@ -12,19 +12,18 @@
 #include <iostream>
 
 
-void toast::pointing_matrix_healpix(toast::HealpixPixels const & hpix,
-                                    bool nest, double eps, double cal,
-                                    std::string const & mode, size_t n,
-                                    double const * pdata,
-                                    double const * hwpang,
-                                    uint8_t const * flags,
-                                    int64_t * pixels, double * weights) {
+namespace {
+void pointing_healpix_angles(toast::HealpixPixels const & hpix, bool nest,
+                             bool angles, size_t n, double const * pdata,
+                             double const * hwpang, uint8_t const * flags,
+                             int64_t * pixels, double * sinout,
+                             double * cosout) {
+    // Compute the pixel indices and, if requested, the sine and cosine of
+    // twice the polarization angle (including the HWP) of every sample.
     double xaxis[3] = {1.0, 0.0, 0.0};
     double zaxis[3] = {0.0, 0.0, 1.0};
     double nullquat[4] = {0.0, 0.0, 0.0, 1.0};
 
-    double eta = (1.0 - eps) / (1.0 + eps);
-
     toast::AlignedVector <double> dir(3 * n);
     toast::AlignedVector <double> pin(4 * n);
 
@@ -62,66 +61,146 @@ void toast::pointing_matrix_healpix(toast::HealpixPixels const & hpix,
         }
     }
 
-    if (mode == "I") {
-        for (size_t i = 0; i < n; ++i) {
-            weights[i] = cal;
-        }
-    } else if (mode == "IQU") {
-        toast::AlignedVector <double> orient(3 * n);
-        toast::AlignedVector <double> buf1(n);
-        toast::AlignedVector <double> buf2(n);
+    if (!angles) {
+        return;
+    }
 
-        toast::qa_rotate_many_one(n, pin.data(), xaxis, orient.data());
+    toast::AlignedVector <double> orient(3 * n);
+
+    toast::qa_rotate_many_one(n, pin.data(), xaxis, orient.data());
+
+    double * bx = cosout;
+    double * by = sinout;
+
+    #pragma omp simd
+    for (size_t i = 0; i < n; ++i) {
+        size_t off = 3 * i;
+        by[i] = orient[off + 0] * dir[off + 1] - orient[off + 1] *
+                dir[off + 0];
+        bx[i] = orient[off + 0] * (-dir[off + 2] * dir[off + 0]) +
+                orient[off + 1] * (-dir[off + 2] * dir[off + 1]) +
+                orient[off + 2] * (dir[off + 0] * dir[off + 0] +
+                                   dir[off + 1] * dir[off + 1]);
+    }
 
-        double * bx = buf1.data();
-        double * by = buf2.data();
+    toast::AlignedVector <double> detang(n);
 
-        #pragma omp simd
+    // FIXME:  Switch back to fast version after unit tests improved.
+    toast::vatan2(n, by, bx, detang.data());
+
+    if (hwpang == NULL) {
         for (size_t i = 0; i < n; ++i) {
-            size_t off = 3 * i;
-            by[i] = orient[off + 0] * dir[off + 1] - orient[off + 1] *
-                    dir[off + 0];
-            bx[i] = orient[off + 0] * (-dir[off + 2] * dir[off + 0]) +
-                    orient[off + 1] * (-dir[off + 2] * dir[off + 1]) +
-                    orient[off + 2] * (dir[off + 0] * dir[off + 0] +
-                                       dir[off + 1] * dir[off + 1]);
+            detang[i] *= 2.0;
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            detang[i] += 2.0 * hwpang[i];
+            detang[i] *= 2.0;
         }
+    }
 
-        toast::AlignedVector <double> detang(n);
+    // FIXME:  Switch back to fast version after unit tests pass
+    toast::vsincos(n, detang.data(), sinout, cosout);
 
-        // FIXME:  Switch back to fast version after unit tests improved.
-        toast::vatan2(n, by, bx, detang.data());
+    return;
+}
 
-        if (hwpang == NULL) {
-            for (size_t i = 0; i < n; ++i) {
-                detang[i] *= 2.0;
-            }
-        } else {
-            for (size_t i = 0; i < n; ++i) {
-                detang[i] += 2.0 * hwpang[i];
-                detang[i] *= 2.0;
-            }
-        }
+void check_healpix_mode(std::string const & mode) {
+    if ((mode != "I") && (mode != "IQU")) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "unknown healpix pointing matrix mode \"" << mode << "\"";
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    return;
+}
+}
 
-        double * sinout = buf1.data();
-        double * cosout = buf2.data();
+void toast::pointing_matrix_healpix(toast::HealpixPixels const & hpix,
+                                    bool nest, double eps, double cal,
+                                    std::string const & mode, size_t n,
+                                    double const * pdata,
+                                    double const * hwpang,
+                                    uint8_t const * flags,
+                                    int64_t * pixels, double * weights) {
+    check_healpix_mode(mode);
 
-        // FIXME:  Switch back to fast version after unit tests pass
-        toast::vsincos(n, detang.data(), sinout, cosout);
+    double eta = (1.0 - eps) / (1.0 + eps);
 
+    if (mode == "I") {
+        pointing_healpix_angles(hpix, nest, false, n, pdata, hwpang, flags,
+                                pixels, NULL, NULL);
+        for (size_t i = 0; i < n; ++i) {
+            weights[i] = cal;
+        }
+    } else {
+        toast::AlignedVector <double> sinout(n);
+        toast::AlignedVector <double> cosout(n);
+        pointing_healpix_angles(hpix, nest, true, n, pdata, hwpang, flags,
+                                pixels, sinout.data(), cosout.data());
         for (size_t i = 0; i < n; ++i) {
             size_t off = 3 * i;
             weights[off + 0] = cal;
             weights[off + 1] = cosout[i] * eta * cal;
             weights[off + 2] = sinout[i] * eta * cal;
         }
+    }
+
+    return;
+}
+
+void toast::pointing_matrix_healpix_pair(toast::HealpixPixels const & hpix,
+                                         bool nest, double eps_a,
+                                         double cal_a, double eps_b,
+                                         double cal_b, double dpsi,
+                                         std::string const & mode, size_t n,
+                                         double const * pdata,
+                                         double const * hwpang,
+                                         uint8_t const * flags,
+                                         int64_t * pixels_a,
+                                         int64_t * pixels_b,
+                                         double * weights_a,
+                                         double * weights_b) {
+    // The two detectors of a pair share their line of sight, and the
+    // second one is rotated by dpsi about it.  The pixels and the
+    // orientation are computed once from the pointing of the first
+    // detector, and the polarization angles of the second detector are
+    // offset by dpsi.  A HWP rotates both angles by the same amount, so
+    // the offset of 2 * psi is the constant rotation by 2 * dpsi.
+    check_healpix_mode(mode);
+
+    double eta_a = (1.0 - eps_a) / (1.0 + eps_a);
+    double eta_b = (1.0 - eps_b) / (1.0 + eps_b);
+
+    if (mode == "I") {
+        pointing_healpix_angles(hpix, nest, false, n, pdata, hwpang, flags,
+                                pixels_a, NULL, NULL);
+        std::copy(pixels_a, pixels_a + n, pixels_b);
+        for (size_t i = 0; i < n; ++i) {
+            weights_a[i] = cal_a;
+            weights_b[i] = cal_b;
+        }
     } else {
-        auto here = TOAST_HERE();
-        auto log = toast::Logger::get();
-        std::ostringstream o;
-        o << "unknown healpix pointing matrix mode \"" << mode << "\"";
-        log.error(o.str().c_str(), here);
-        throw std::runtime_error(o.str().c_str());
+        toast::AlignedVector <double> sinout(n);
+        toast::AlignedVector <double> cosout(n);
+        pointing_healpix_angles(hpix, nest, true, n, pdata, hwpang, flags,
+                                pixels_a, sinout.data(), cosout.data());
+        std::copy(pixels_a, pixels_a + n, pixels_b);
+        double cosd = ::cos(2.0 * dpsi);
+        double sind = ::sin(2.0 * dpsi);
+        for (size_t i = 0; i < n; ++i) {
+            size_t off = 3 * i;
+            weights_a[off + 0] = cal_a;
+            weights_a[off + 1] = cosout[i] * eta_a * cal_a;
+            weights_a[off + 2] = sinout[i] * eta_a * cal_a;
+            double cosb = cosout[i] * cosd - sinout[i] * sind;
+            double sinb = sinout[i] * cosd + cosout[i] * sind;
+            weights_b[off + 0] = cal_b;
+            weights_b[off + 1] = cosb * eta_b * cal_b;
+            weights_b[off + 2] = sinb * eta_b * cal_b;
+        }
     }
 
     return;
@@ -0,0 +1,474 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/math_healpix.hpp>
+#include <toast/tod_sources.hpp>
+
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
+
+namespace {
+double angle_to_chord(double angle) {
+    // The straight line distance between two unit vectors separated by
+    // the given angle.
+    if (angle >= toast::PI) {
+        return 2.0;
+    }
+    if (angle <= 0) {
+        return 0.0;
+    }
+    return 2.0 * ::sin(0.5 * angle);
+}
+
+double chord_distance(double const * a, double const * b) {
+    double dx = a[0] - b[0];
+    double dy = a[1] - b[1];
+    double dz = a[2] - b[2];
+    return ::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+void quat_axes(double const * q, double * xaxis, double * yaxis,
+               double * zaxis) {
+    // The images of the coordinate axes under the rotation described by a
+    // (not necessarily normalized) quaternion.
+    double norm = q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3];
+    double s = (norm > 0) ? 2.0 / norm : 0.0;
+    double xx = s * q[0] * q[0];
+    double yy = s * q[1] * q[1];
+    double zz = s * q[2] * q[2];
+    double xy = s * q[0] * q[1];
+    double xz = s * q[0] * q[2];
+    double yz = s * q[1] * q[2];
+    double xw = s * q[0] * q[3];
+    double yw = s * q[1] * q[3];
+    double zw = s * q[2] * q[3];
+    xaxis[0] = 1.0 - yy - zz;
+    xaxis[1] = xy + zw;
+    xaxis[2] = xz - yw;
+    yaxis[0] = xy - zw;
+    yaxis[1] = 1.0 - xx - zz;
+    yaxis[2] = yz + xw;
+    zaxis[0] = xz + yw;
+    zaxis[1] = yz - xw;
+    zaxis[2] = 1.0 - xx - yy;
+    return;
+}
+}
+
+
+toast::SourceIndex::SourceIndex(int64_t nsource, double const * dirs,
+                                double const * vels, double tref,
+                                int64_t nside, int64_t leaf_size) {
+    if ((nsource < 0) || (leaf_size < 1)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "invalid source index dimensions: nsource = " << nsource
+          << ", leaf_size = " << leaf_size;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    nsource_ = nsource;
+    leaf_size_ = leaf_size;
+    tref_ = tref;
+    max_speed_ = 0.0;
+
+    std::vector <double> unit(3 * nsource);
+    for (int64_t i = 0; i < nsource; ++i) {
+        double norm = 0.0;
+        for (int64_t j = 0; j < 3; ++j) {
+            norm += dirs[3 * i + j] * dirs[3 * i + j];
+        }
+        if (!(norm > 0)) {
+            auto here = TOAST_HERE();
+            auto log = toast::Logger::get();
+            std::ostringstream o;
+            o << "source " << i << " has an invalid direction";
+            log.error(o.str().c_str(), here);
+            throw std::runtime_error(o.str().c_str());
+        }
+        norm = 1.0 / ::sqrt(norm);
+        for (int64_t j = 0; j < 3; ++j) {
+            unit[3 * i + j] = dirs[3 * i + j] * norm;
+        }
+    }
+
+    // Bucket the sources by their nested pixel.  Sorting by the nested
+    // index keeps the sources of neighboring buckets close in memory.
+
+    std::vector <int64_t> pixels(nsource);
+    if (nsource > 0) {
+        toast::HealpixPixels hpix(nside);
+        hpix.vec2nest(nsource, unit.data(), pixels.data());
+    }
+    std::vector <int64_t> sorted(nsource);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&pixels](int64_t a, int64_t b) {
+                         return pixels[a] < pixels[b];
+                     });
+
+    std::vector <int64_t> bucket_first;
+    for (int64_t i = 0; i < nsource; ++i) {
+        if ((i == 0) || (pixels[sorted[i]] != pixels[sorted[i - 1]])) {
+            bucket_first.push_back(i);
+        }
+    }
+    int64_t nbucket = bucket_first.size();
+    bucket_first.push_back(nsource);
+
+    std::vector <double> centroids(3 * nbucket, 0.0);
+    for (int64_t b = 0; b < nbucket; ++b) {
+        for (int64_t i = bucket_first[b]; i < bucket_first[b + 1]; ++i) {
+            for (int64_t j = 0; j < 3; ++j) {
+                centroids[3 * b + j] += unit[3 * sorted[i] + j];
+            }
+        }
+        for (int64_t j = 0; j < 3; ++j) {
+            centroids[3 * b + j] /= (double)(bucket_first[b + 1] -
+                                             bucket_first[b]);
+        }
+    }
+
+    // The tree is built over the buckets.  The leaves append their sources
+    // to order_ depth first, so that every node covers a contiguous range
+    // of it.
+
+    order_.clear();
+    order_.reserve(nsource);
+    nodes_.clear();
+    if (nbucket > 0) {
+        std::vector <int64_t> buckets(nbucket);
+        std::iota(buckets.begin(), buckets.end(), 0);
+        build(0, nbucket, buckets, bucket_first, centroids, sorted);
+    }
+
+    // Store the directions and velocities in tree order.
+
+    dirs_.resize(3 * nsource);
+    for (int64_t i = 0; i < nsource; ++i) {
+        for (int64_t j = 0; j < 3; ++j) {
+            dirs_[3 * i + j] = unit[3 * order_[i] + j];
+        }
+    }
+
+    vels_.clear();
+    if (vels != NULL) {
+        vels_.resize(3 * nsource);
+        for (int64_t i = 0; i < nsource; ++i) {
+            double speed = 0.0;
+            for (int64_t j = 0; j < 3; ++j) {
+                vels_[3 * i + j] = vels[3 * order_[i] + j];
+                speed += vels_[3 * i + j] * vels_[3 * i + j];
+            }
+            max_speed_ = std::max(max_speed_, ::sqrt(speed));
+        }
+    }
+
+    rank_.resize(nsource);
+    for (int64_t i = 0; i < nsource; ++i) {
+        rank_[order_[i]] = i;
+    }
+
+    // Bounding caps of the nodes
+
+    for (auto & nd : nodes_) {
+        double center[3] = {0.0, 0.0, 0.0};
+        for (int64_t i = nd.first; i < nd.last; ++i) {
+            for (int64_t j = 0; j < 3; ++j) {
+                center[j] += dirs_[3 * i + j];
+            }
+        }
+        double norm = ::sqrt(center[0] * center[0] + center[1] * center[1] +
+                             center[2] * center[2]);
+        if (norm > 0) {
+            for (int64_t j = 0; j < 3; ++j) {
+                nd.center[j] = center[j] / norm;
+            }
+        } else {
+            nd.center[0] = 0.0;
+            nd.center[1] = 0.0;
+            nd.center[2] = 1.0;
+        }
+        nd.chord = 0.0;
+        for (int64_t i = nd.first; i < nd.last; ++i) {
+            nd.chord = std::max(nd.chord,
+                                chord_distance(nd.center, &dirs_[3 * i]));
+        }
+    }
+}
+
+int64_t toast::SourceIndex::build(int64_t first, int64_t last,
+                                  std::vector <int64_t> & buckets,
+                                  std::vector <int64_t> const & bucket_first,
+                                  std::vector <double> const & centroids,
+                                  std::vector <int64_t> const & sorted) {
+    // Build the subtree over the buckets in buckets[first:last] and return
+    // its root node.  Bucket b holds the pixel-sorted sources
+    // sorted[bucket_first[b]:bucket_first[b + 1]].
+    int64_t nd = nodes_.size();
+    nodes_.push_back(node_t());
+    nodes_[nd].left = -1;
+    nodes_[nd].right = -1;
+
+    int64_t count = 0;
+    for (int64_t b = first; b < last; ++b) {
+        count += bucket_first[buckets[b] + 1] - bucket_first[buckets[b]];
+    }
+
+    if ((last - first == 1) || (count <= leaf_size_)) {
+        nodes_[nd].first = order_.size();
+        for (int64_t b = first; b < last; ++b) {
+            for (int64_t i = bucket_first[buckets[b]];
+                 i < bucket_first[buckets[b] + 1]; ++i) {
+                order_.push_back(sorted[i]);
+            }
+        }
+        nodes_[nd].last = order_.size();
+        return nd;
+    }
+
+    // Split at the median bucket along the axis of largest spread of the
+    // bucket centroids.
+
+    int64_t axis = 0;
+    double spread = -1.0;
+    for (int64_t ax = 0; ax < 3; ++ax) {
+        double lo = 2.0;
+        double hi = -2.0;
+        for (int64_t b = first; b < last; ++b) {
+            double c = centroids[3 * buckets[b] + ax];
+            lo = std::min(lo, c);
+            hi = std::max(hi, c);
+        }
+        if (hi - lo > spread) {
+            spread = hi - lo;
+            axis = ax;
+        }
+    }
+    int64_t mid = first + (last - first) / 2;
+    std::nth_element(buckets.begin() + first, buckets.begin() + mid,
+                     buckets.begin() + last,
+                     [&](int64_t a, int64_t b) {
+                         return centroids[3 * a + axis] <
+                         centroids[3 * b + axis];
+                     });
+
+    int64_t left = build(first, mid, buckets, bucket_first, centroids,
+                         sorted);
+    int64_t right = build(mid, last, buckets, bucket_first, centroids,
+                          sorted);
+    nodes_[nd].left = left;
+    nodes_[nd].right = right;
+    nodes_[nd].first = nodes_[left].first;
+    nodes_[nd].last = nodes_[right].last;
+    return nd;
+}
+
+void toast::SourceIndex::position(int64_t source, double t,
+                                  double * dir) const {
+    int64_t i = rank_[source];
+    if (vels_.empty()) {
+        for (int64_t j = 0; j < 3; ++j) {
+            dir[j] = dirs_[3 * i + j];
+        }
+        return;
+    }
+    double dt = t - tref_;
+    double norm = 0.0;
+    for (int64_t j = 0; j < 3; ++j) {
+        dir[j] = dirs_[3 * i + j] + vels_[3 * i + j] * dt;
+        norm += dir[j] * dir[j];
+    }
+    norm = 1.0 / ::sqrt(norm);
+    for (int64_t j = 0; j < 3; ++j) {
+        dir[j] *= norm;
+    }
+    return;
+}
+
+void toast::SourceIndex::query(double const * dir, double radius, double tmin,
+                               double tmax,
+                               std::vector <int64_t> & result) const {
+    if (nodes_.empty()) {
+        return;
+    }
+
+    // Widen the search by the largest distance a source travels from its
+    // reference position during the time span.
+    double dt = std::max(std::fabs(tmin - tref_), std::fabs(tmax - tref_));
+    double chord = angle_to_chord(radius + max_speed_ * dt);
+
+    std::vector <int64_t> stack;
+    stack.push_back(0);
+    while (!stack.empty()) {
+        node_t const & nd = nodes_[stack.back()];
+        stack.pop_back();
+        if (chord_distance(nd.center, dir) > nd.chord + chord) {
+            continue;
+        }
+        if (nd.left < 0) {
+            for (int64_t i = nd.first; i < nd.last; ++i) {
+                if (chord_distance(&dirs_[3 * i], dir) <= chord) {
+                    result.push_back(order_[i]);
+                }
+            }
+        } else {
+            stack.push_back(nd.right);
+            stack.push_back(nd.left);
+        }
+    }
+    return;
+}
+
+void toast::SourceIndex::scan(int64_t nsamp, double const * times,
+                              double const * quats, double fwhm_major,
+                              double fwhm_minor, double psi_beam,
+                              double const * flux, double nsigma,
+                              double * signal) const {
+    // Accumulate the signal of all sources seen by a detector.
+    //
+    // The beam is an elliptical Gaussian with unit integral, so `flux` is
+    // the integrated amplitude of each source and the peak response is
+    // flux / (2 pi sigma_major sigma_minor).  The beam major axis is at
+    // angle `psi_beam` from the detector X axis (the polarization
+    // direction) towards its Y axis.  Sources are evaluated out to
+    // `nsigma` times the major axis sigma.  The samples are processed in
+    // blocks: the sources near each block are found once from the
+    // spatial index and then evaluated for every sample in the detector
+    // frame, using the azimuthal equidistant projection about the line of
+    // sight.  The times may be NULL when no source moves.
+
+    if (!(fwhm_major > 0)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "beam FWHM must be positive, not " << fwhm_major;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    if (!(fwhm_minor > 0)) {
+        fwhm_minor = fwhm_major;
+    }
+    if ((times == NULL) && (!vels_.empty())) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "sample times are required for moving sources";
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+    if (nodes_.empty()) {
+        return;
+    }
+
+    double fwhm_to_sigma = 1.0 / ::sqrt(8.0 * ::log(2.0));
+    double sigma_major = fwhm_major * fwhm_to_sigma;
+    double sigma_minor = fwhm_minor * fwhm_to_sigma;
+    double norm = 1.0 / (toast::TWOPI * sigma_major * sigma_minor);
+    double cutoff = nsigma * std::max(sigma_major, sigma_minor);
+    double cos_cutoff = (cutoff >= toast::PI) ? -2.0 : ::cos(cutoff);
+    double cospsi = ::cos(psi_beam);
+    double sinpsi = ::sin(psi_beam);
+    double inv_major = 1.0 / (sigma_major * sigma_major);
+    double inv_minor = 1.0 / (sigma_minor * sigma_minor);
+    int64_t block_size = 64;
+    int64_t nblock = (nsamp + block_size - 1) / block_size;
+
+    #pragma                                                         \
+    omp parallel default(none)                                      \
+    shared(nsamp, times, quats, flux, signal, nblock, block_size,   \
+    cutoff, cos_cutoff, cospsi, sinpsi, inv_major, inv_minor, norm)
+    {
+        std::vector <int64_t> nearby;
+        std::vector <double> axes(9 * block_size);
+
+        #pragma omp for schedule(static)
+        for (int64_t iblock = 0; iblock < nblock; ++iblock) {
+            int64_t first = iblock * block_size;
+            int64_t n = std::min(block_size, nsamp - first);
+
+            // The cap containing every line of sight of the block
+
+            double center[3] = {0.0, 0.0, 0.0};
+            for (int64_t i = 0; i < n; ++i) {
+                double * ax = &axes[9 * i];
+                quat_axes(&quats[4 * (first + i)], ax, ax + 3, ax + 6);
+                for (int64_t j = 0; j < 3; ++j) {
+                    center[j] += ax[6 + j];
+                }
+            }
+            double cnorm = ::sqrt(center[0] * center[0] +
+                                  center[1] * center[1] +
+                                  center[2] * center[2]);
+            double radius = toast::PI;
+            if (cnorm > 0) {
+                double mincos = 1.0;
+                for (int64_t j = 0; j < 3; ++j) {
+                    center[j] /= cnorm;
+                }
+                for (int64_t i = 0; i < n; ++i) {
+                    double const * z = &axes[9 * i + 6];
+                    mincos = std::min(mincos, z[0] * center[0] +
+                                      z[1] * center[1] + z[2] * center[2]);
+                }
+                radius = ::acos(std::max(-1.0, mincos));
+            }
+
+            double tmin = tref_;
+            double tmax = tref_;
+            if (times != NULL) {
+                tmin = times[first];
+                tmax = times[first + n - 1];
+            }
+
+            nearby.clear();
+            query(center, radius + cutoff, tmin, tmax, nearby);
+            if (nearby.empty()) {
+                continue;
+            }
+
+            for (int64_t i = 0; i < n; ++i) {
+                double const * xaxis = &axes[9 * i];
+                double const * yaxis = xaxis + 3;
+                double const * zaxis = xaxis + 6;
+                double t = (times == NULL) ? tref_ : times[first + i];
+                double sig = 0.0;
+                for (auto const & src : nearby) {
+                    double dir[3];
+                    position(src, t, dir);
+                    double dz = dir[0] * zaxis[0] + dir[1] * zaxis[1] +
+                                dir[2] * zaxis[2];
+                    if (dz <= cos_cutoff) {
+                        continue;
+                    }
+                    double dx = dir[0] * xaxis[0] + dir[1] * xaxis[1] +
+                                dir[2] * xaxis[2];
+                    double dy = dir[0] * yaxis[0] + dir[1] * yaxis[1] +
+                                dir[2] * yaxis[2];
+                    double rho = ::sqrt(dx * dx + dy * dy);
+                    double u = 0.0;
+                    double v = 0.0;
+                    if (rho > 0) {
+                        double scale = ::atan2(rho, dz) / rho;
+                        dx *= scale;
+                        dy *= scale;
+                        u = dx * cospsi + dy * sinpsi;
+                        v = -dx * sinpsi + dy * cospsi;
+                    }
+                    sig += flux[src] *
+                           ::exp(-0.5 * (u * u * inv_major + v * v * inv_minor));
+                }
+                signal[first + i] += norm * sig;
+            }
+        }
+    }
+
+    return;
+}
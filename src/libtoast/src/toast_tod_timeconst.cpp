@@ -0,0 +1,252 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/math_fft.hpp>
+#include <toast/tod_timeconst.hpp>
+
+#include <cmath>
+#include <algorithm>
+#include <sstream>
+
+
+void toast::time_constant_response(double freq, double rate, double tau,
+                                   double tau2, double fraction, double & re,
+                                   double & im) {
+    // The complex response of a sampled bolometer with one or two time
+    // constants,
+    //
+    //   H(f) = (1 - fraction) H_1(f) + fraction H_2(f)
+    //
+    // where each pole is the recursive filter
+    //
+    //   y[n] = a y[n - 1] + (1 - a) x[n],  a = exp(-1 / (tau rate))
+    //
+    // whose impulse response samples exp(-t / tau), so that
+    //
+    //   H_k(f) = (1 - a) / (1 - a exp(-2 pi i f / rate))
+    //
+    // for the exp(-i omega t) sign convention of the forward FFT.  Unlike
+    // the continuous 1 / (1 + 2 pi i f tau), this response is periodic and
+    // smooth across the Nyquist frequency.  Its inverse is a two sample
+    // difference for a single time constant, so deconvolution does not
+    // ring.
+    double phase = -toast::TWOPI * freq / rate;
+    double cosp = ::cos(phase);
+    double sinp = ::sin(phase);
+    re = 0.0;
+    im = 0.0;
+    double taus[2] = {tau, tau2};
+    double weights[2] = {1.0 - fraction, fraction};
+    for (int64_t k = 0; k < 2; ++k) {
+        if (weights[k] == 0) continue;
+        double a = 0.0;
+        if (taus[k] > 0) {
+            a = ::exp(-1.0 / (taus[k] * rate));
+        }
+        // (1 - a) / (1 - a cos(phase) - i a sin(phase))
+        double dre = 1.0 - a * cosp;
+        double dim = -a * sinp;
+        double scale = weights[k] * (1.0 - a) / (dre * dre + dim * dim);
+        re += scale * dre;
+        im -= scale * dim;
+    }
+    return;
+}
+
+void toast::filter_time_constant(int64_t nsamp, double rate,
+                                 double const * tau, double const * tau2,
+                                 double const * fraction, bool deconvolve,
+                                 double epsilon, int64_t fftlen,
+                                 std::vector <double *> const & signals) {
+    // Convolve the signals with the time constant response of each detector,
+    // or deconvolve it with the regularized inverse
+    //
+    //   G(f) = conj(H(f)) / (|H(f)|^2 + epsilon)
+    //
+    // which is the exact inverse for epsilon = 0.  The second time
+    // constant and its fraction are optional (NULL).
+    //
+    // The timestreams are filtered in overlap-save blocks of fftlen
+    // samples.  Each block keeps the central fftlen - 2 * margin samples,
+    // which must be at least one margin, where the margin covers 20 of the
+    // longest time constants, and the signals are extended beyond their
+    // ends with their end values.  The blocks of all detectors are transformed together with batched plans
+    // from the global plan store, so the cost is that of a single filtering
+    // pass regardless of the number of detectors.
+
+    int64_t ndet = signals.size();
+    if ((ndet == 0) || (nsamp == 0)) {
+        return;
+    }
+    if (!(rate > 0)) {
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "sample rate must be positive, not " << rate;
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    double taumax = 0.0;
+    for (int64_t idet = 0; idet < ndet; ++idet) {
+        double t2 = (tau2 == NULL) ? 0.0 : tau2[idet];
+        if ((tau[idet] < 0) || (t2 < 0)) {
+            auto here = TOAST_HERE();
+            auto log = toast::Logger::get();
+            std::ostringstream o;
+            o << "time constants must not be negative (detector " << idet
+              << ")";
+            log.error(o.str().c_str(), here);
+            throw std::runtime_error(o.str().c_str());
+        }
+        taumax = std::max(taumax, std::max(tau[idet], t2));
+    }
+    if (taumax == 0) {
+        return;
+    }
+
+    int64_t margin = static_cast <int64_t> (::ceil(20.0 * taumax * rate));
+    if (fftlen <= 0) {
+        // A power of two several times the margin, but no longer than the
+        // padded timestream.
+        fftlen = 1024;
+        while (fftlen < 8 * margin) fftlen *= 2;
+        while ((fftlen / 2 >= 3 * margin) &&
+               (fftlen / 2 >= nsamp + 2 * margin)) fftlen /= 2;
+    }
+    if (fftlen < 3 * margin) {
+        // The blocks of a batch only read the input of the previous block,
+        // which is either in the batch or carried over from the last one.
+        auto here = TOAST_HERE();
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "FFT length " << fftlen << " is shorter than three times the "
+          << "filter margin of " << margin << " samples";
+        log.error(o.str().c_str(), here);
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    int64_t nvalid = fftlen - 2 * margin;
+    int64_t nblock = (nsamp + nvalid - 1) / nvalid;
+    int64_t nrow = ndet * nblock;
+    int64_t nbatch = std::min(nrow, (int64_t)64);
+
+    auto & store = toast::FFTPlanReal1DStore::get();
+    auto fplan = store.forward(fftlen, nbatch);
+    auto rplan = store.backward(fftlen, nbatch);
+
+    toast::AlignedVector <double> tbuf(nbatch * fftlen);
+    toast::AlignedVector <double> fbuf(nbatch * fftlen);
+    toast::AlignedVector <double> obuf(nbatch * fftlen);
+
+    // The signals are filtered in place, but every block reads the margin
+    // before it.  When the previous block of a detector was written by an
+    // earlier batch, those input samples are taken from a copy.
+    toast::AlignedVector <double> carry(ndet * margin);
+
+    for (int64_t first = 0; first < nrow; first += nbatch) {
+        int64_t nb = std::min(nbatch, nrow - first);
+
+        // Gather the blocks, padding the ends of the timestreams with their
+        // end values.
+
+        #pragma omp parallel for default(none) \
+        shared(first, nb, nbatch, nblock, nvalid, margin, fftlen, nsamp, \
+        signals, tbuf, carry)
+        for (int64_t ib = 0; ib < nbatch; ++ib) {
+            double * row = tbuf.data() + ib * fftlen;
+            if (ib >= nb) {
+                std::fill(row, row + fftlen, 0.0);
+                continue;
+            }
+            int64_t idet = (first + ib) / nblock;
+            int64_t iblock = (first + ib) % nblock;
+            double const * sig = signals[idet];
+            int64_t start = iblock * nvalid;
+            int64_t off = start - margin;
+            bool carried = (iblock > 0) && (ib == 0);
+            for (int64_t i = 0; i < fftlen; ++i) {
+                int64_t j = std::min(std::max(off + i, (int64_t)0),
+                                     nsamp - 1);
+                if (carried && (j < start)) {
+                    row[i] = carry[idet * margin + j - off];
+                } else {
+                    row[i] = sig[j];
+                }
+            }
+        }
+
+        // Keep the input margin needed by the next block of the last
+        // detector in the batch.
+
+        int64_t last = first + nb - 1;
+        if ((last % nblock) < nblock - 1) {
+            int64_t idet = last / nblock;
+            double const * row = tbuf.data() + (nb - 1) * fftlen + fftlen -
+                                 2 * margin;
+            std::copy(row, row + margin, carry.data() + idet * margin);
+        }
+
+        fplan->exec(tbuf.data(), fbuf.data());
+
+        // Apply the response in the half-complex layout
+
+        #pragma omp parallel for default(none) \
+        shared(first, nb, nblock, fftlen, rate, tau, tau2, fraction, \
+        deconvolve, epsilon, fbuf)
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            double * row = fbuf.data() + ib * fftlen;
+            int64_t idet = (first + ib) / nblock;
+            double t1 = tau[idet];
+            double t2 = (tau2 == NULL) ? 0.0 : tau2[idet];
+            double frac = (fraction == NULL) ? 0.0 : fraction[idet];
+            int64_t half = fftlen / 2;
+            for (int64_t k = 1; k <= half; ++k) {
+                double freq = rate * static_cast <double> (k) /
+                              static_cast <double> (fftlen);
+                double hre;
+                double him;
+                toast::time_constant_response(freq, rate, t1, t2, frac, hre,
+                                              him);
+                if (deconvolve) {
+                    double denom = 1.0 / (hre * hre + him * him + epsilon);
+                    hre *= denom;
+                    him *= -denom;
+                }
+                if (2 * k == fftlen) {
+                    // The Nyquist term is real
+                    row[k] *= hre;
+                } else {
+                    double re = row[k];
+                    double im = row[fftlen - k];
+                    row[k] = re * hre - im * him;
+                    row[fftlen - k] = re * him + im * hre;
+                }
+            }
+            if (deconvolve) {
+                row[0] /= (1.0 + epsilon);
+            }
+        }
+
+        rplan->exec(fbuf.data(), obuf.data());
+
+        // Scatter the valid samples of each block
+
+        #pragma omp parallel for default(none) \
+        shared(first, nb, nblock, nvalid, margin, fftlen, nsamp, signals, \
+        obuf)
+        for (int64_t ib = 0; ib < nb; ++ib) {
+            double const * row = obuf.data() + ib * fftlen + margin;
+            int64_t idet = (first + ib) / nblock;
+            int64_t iblock = (first + ib) % nblock;
+            int64_t off = iblock * nvalid;
+            int64_t n = std::min(nvalid, nsamp - off);
+            std::copy(row, row + n, signals[idet] + off);
+        }
+    }
+
+    return;
+}
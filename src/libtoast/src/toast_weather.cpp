@@ -0,0 +1,78 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <toast/sys_utils.hpp>
+#include <toast/math_rng.hpp>
+#include <toast/weather.hpp>
+
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+
+
+double weather_interp(double x, size_t nprob, double const * prob,
+                      double const * cdf) {
+    // Linear interpolation with the same arithmetic and end point handling
+    // as numpy.interp, so that batch and single draws agree exactly.
+    if (x < prob[0]) return cdf[0];
+    if (x >= prob[nprob - 1]) return cdf[nprob - 1];
+    size_t j = std::upper_bound(prob, prob + nprob, x) - prob - 1;
+    double slope = (cdf[j + 1] - cdf[j]) / (prob[j + 1] - prob[j]);
+    double result = slope * (x - prob[j]) + cdf[j];
+    if (std::isnan(result)) {
+        result = slope * (x - prob[j + 1]) + cdf[j + 1];
+        if (std::isnan(result) && (cdf[j] == cdf[j + 1])) {
+            result = cdf[j];
+        }
+    }
+    return result;
+}
+
+void toast::weather_sample(size_t nsamp, double const * times,
+                           uint64_t const * sites,
+                           uint64_t const * realizations, size_t nvar,
+                           uint64_t const * varindex, size_t ncdfvar,
+                           size_t nprob, double const * prob,
+                           double const * cdf, double * values) {
+    // Sample `nvar` weather variables for every (time, site, realization).
+    // The inverse cumulative distributions are tabulated in a contiguous
+    // (month, hour, variable, probability) table.  Each value uses its own
+    // Threefry stream keyed by the site and realization, with the variable
+    // index and the UTC hour since year zero as the counter.
+    for (size_t ivar = 0; ivar < nvar; ++ivar) {
+        if (varindex[ivar] >= ncdfvar) {
+            auto here = TOAST_HERE();
+            auto log = toast::Logger::get();
+            std::string msg("weather variable index out of range");
+            log.error(msg.c_str(), here);
+            throw std::runtime_error(msg.c_str());
+        }
+    }
+
+    #pragma omp parallel for default(shared) schedule(static)
+    for (size_t i = 0; i < nsamp; ++i) {
+        time_t seconds = static_cast <time_t> (std::floor(times[i]));
+        struct tm date;
+        gmtime_r(&seconds, &date);
+        uint64_t year = static_cast <uint64_t> (date.tm_year + 1900);
+        uint64_t doy = static_cast <uint64_t> (date.tm_yday + 1);
+        uint64_t hour = static_cast <uint64_t> (date.tm_hour);
+
+        // This is the definition of month used in the weather files
+        size_t month = static_cast <size_t> ((doy - 1) / 30.5);
+        uint64_t counter2 = (year * 366 + doy) * 24 + hour;
+
+        double const * hour_cdf = cdf + (month * 24 + hour) * ncdfvar * nprob;
+        for (size_t ivar = 0; ivar < nvar; ++ivar) {
+            double x;
+            toast::rng_dist_uniform_01(1, sites[i], realizations[i],
+                                       varindex[ivar], counter2, &x);
+            values[i * nvar + ivar] = weather_interp(
+                x, nprob, prob, hour_cdf + varindex[ivar] * nprob);
+        }
+    }
+
+    return;
+}
@@ -5,7 +5,9 @@
 
 #include <toast_test.hpp>
 
+#include <algorithm>
 #include <cmath>
+#include <numeric>
 #include <vector>
 
 
@@ -58,7 +60,7 @@ TEST_F(TOASTcovTest, accumulate) {
     }
 
     toast::cov_accum_diag(nsm, npix, nnz, nsamp, sm.data(), pix.data(),
-                          weights.data(), scale, signal.data(),
+                          weights.data(), scale, 0, NULL, NULL, signal.data(),
                           fakedata.data(), fakehits.data(), fakeinvn.data());
 
     for (int64_t i = 0; i < nsamp; ++i) {
@@ -95,6 +97,244 @@ TEST_F(TOASTcovTest, accumulate) {
 }
 
 
+TEST_F(TOASTcovTest, accumulate_masked) {
+    int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
+
+    // Three global submaps, of which the middle one is not stored locally.
+    int64_t nglob = nsm + 1;
+    std::vector <int64_t> global2local = {1, -1, 0};
+
+    std::vector <double> fakedata(nsm * npix * nnz, 0.0);
+    std::vector <int64_t> fakehits(nsm * npix, 0);
+    std::vector <double> fakeinvn(nsm * npix * block, 0.0);
+
+    std::vector <double> checkdata(nsm * npix * nnz, 0.0);
+    std::vector <int64_t> checkhits(nsm * npix, 0);
+    std::vector <double> checkinvn(nsm * npix * block, 0.0);
+
+    std::vector <double> signal(nsamp);
+    std::vector <float> weights(nsamp * nnz);
+    std::vector <double> dweights(nsamp * nnz);
+    std::vector <int32_t> pixels(nsamp);
+    std::vector <uint8_t> detflags(nsamp);
+    std::vector <uint8_t> commonflags(nsamp);
+    std::vector <int64_t> sm(nsamp);
+    std::vector <int64_t> pix(nsamp);
+
+    toast::rng_dist_normal(nsamp, 0, 0, 0, 0, signal.data());
+
+    for (int64_t i = 0; i < nsamp; ++i) {
+        pixels[i] = (i % 7 == 0) ? -1 : (int32_t)(i % (nglob * npix));
+        detflags[i] = (i % 5 == 0) ? 2 : 0;
+        commonflags[i] = (i % 11 == 0) ? 1 : 4;
+        for (int64_t k = 0; k < nnz; ++k) {
+            weights[i * nnz + k] = (float)(k + 1) / (float)(i % 3 + 1);
+            dweights[i * nnz + k] = (double)weights[i * nnz + k];
+        }
+
+        // Reference local pointing, with flagged samples removed.
+        sm[i] = -1;
+        pix[i] = -1;
+        if ((pixels[i] < 0) || (detflags[i] & 2) || (commonflags[i] & 1)) continue;
+        int64_t loc = global2local[pixels[i] / npix];
+        if (loc < 0) continue;
+        sm[i] = loc;
+        pix[i] = pixels[i] % npix;
+    }
+
+    toast::cov_accum_diag(nsm, npix, nnz, nsamp, sm.data(), pix.data(),
+                          dweights.data(), scale, 0, NULL, NULL,
+                          signal.data(), checkdata.data(), checkhits.data(), checkinvn.data());
+
+    toast::cov_accum_split <int32_t, float> (
+        nsm, npix, nnz, nsamp, pixels.data(), global2local.data(),
+        weights.data(), scale, 0, NULL, NULL, signal.data(), detflags.data(), 2,
+        commonflags.data(), 1, NULL, 1, {fakedata.data()}, {fakehits.data()},
+        {fakeinvn.data()});
+
+    for (int64_t i = 0; i < (nsm * npix); ++i) {
+        EXPECT_EQ(checkhits[i], fakehits[i]);
+        for (int64_t k = 0; k < nnz; ++k) {
+            EXPECT_DOUBLE_EQ(checkdata[i * nnz + k], fakedata[i * nnz + k]);
+        }
+        for (int64_t k = 0; k < block; ++k) {
+            EXPECT_DOUBLE_EQ(checkinvn[i * block + k], fakeinvn[i * block + k]);
+        }
+    }
+
+    // Accumulating only the hits must not touch the other products.
+    std::fill(fakehits.begin(), fakehits.end(), 0);
+    toast::cov_accum_split <int32_t, float> (
+        nsm, npix, nnz, nsamp, pixels.data(), global2local.data(),
+        weights.data(), scale, 0, NULL, NULL, signal.data(), detflags.data(), 2,
+        commonflags.data(), 1, NULL, 1, {}, {fakehits.data()}, {});
+
+    for (int64_t i = 0; i < (nsm * npix); ++i) {
+        EXPECT_EQ(checkhits[i], fakehits[i]);
+    }
+}
+
+
+TEST_F(TOASTcovTest, accumulate_split) {
+    int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
+    int64_t nsplit = 3;
+    std::vector <int64_t> global2local = {0, 1};
+
+    std::vector <double> signal(nsamp);
+    std::vector <double> weights(nsamp * nnz);
+    std::vector <int64_t> pixels(nsamp);
+    std::vector <uint64_t> masks(nsamp);
+
+    toast::rng_dist_normal(nsamp, 0, 0, 0, 0, signal.data());
+
+    for (int64_t i = 0; i < nsamp; ++i) {
+        pixels[i] = i % (nsm * npix);
+        masks[i] = (uint64_t)(i % 4);
+        for (int64_t k = 0; k < nnz; ++k) {
+            weights[i * nnz + k] = (double)(k + 1) / (double)(i % 3 + 1);
+        }
+    }
+
+    // Bit 2 is set for the whole detector, so the last split gets every sample.
+    std::vector <std::vector <double> > data(nsplit);
+    std::vector <std::vector <int64_t> > hits(nsplit);
+    std::vector <std::vector <double> > invn(nsplit);
+    std::vector <double *> pdata;
+    std::vector <int64_t *> phits;
+    std::vector <double *> pinvn;
+    for (int64_t s = 0; s < nsplit; ++s) {
+        data[s].assign(nsm * npix * nnz, 0.0);
+        hits[s].assign(nsm * npix, 0);
+        invn[s].assign(nsm * npix * block, 0.0);
+        pdata.push_back(data[s].data());
+        phits.push_back(hits[s].data());
+        pinvn.push_back(invn[s].data());
+    }
+
+    toast::cov_accum_split <int64_t, double> (
+        nsm, npix, nnz, nsamp, pixels.data(), global2local.data(),
+        weights.data(), scale, 0, NULL, NULL, signal.data(), NULL, 0, NULL, 0,
+        masks.data(), 4, pdata, phits, pinvn);
+
+    // Each split must match a single split accumulation of its own samples.
+    for (int64_t s = 0; s < nsplit; ++s) {
+        std::vector <int64_t> splitpixels(pixels);
+        for (int64_t i = 0; i < nsamp; ++i) {
+            if (((masks[i] | 4) & ((uint64_t)1 << s)) == 0) splitpixels[i] = -1;
+        }
+        std::vector <double> checkdata(nsm * npix * nnz, 0.0);
+        std::vector <int64_t> checkhits(nsm * npix, 0);
+        std::vector <double> checkinvn(nsm * npix * block, 0.0);
+        toast::cov_accum_split <int64_t, double> (
+            nsm, npix, nnz, nsamp, splitpixels.data(), global2local.data(),
+            weights.data(), scale, 0, NULL, NULL, signal.data(), NULL, 0, NULL,
+            0, NULL, 1, {checkdata.data()}, {checkhits.data()},
+            {checkinvn.data()});
+
+        for (int64_t i = 0; i < (nsm * npix); ++i) {
+            EXPECT_EQ(checkhits[i], hits[s][i]);
+            for (int64_t k = 0; k < nnz; ++k) {
+                EXPECT_DOUBLE_EQ(checkdata[i * nnz + k], data[s][i * nnz + k]);
+            }
+            for (int64_t k = 0; k < block; ++k) {
+                EXPECT_DOUBLE_EQ(checkinvn[i * block + k], invn[s][i * block + k]);
+            }
+        }
+    }
+    EXPECT_EQ(nsamp / 2, std::accumulate(hits[0].begin(), hits[0].end(), (int64_t)0));
+    EXPECT_EQ(nsamp, std::accumulate(hits[2].begin(), hits[2].end(), (int64_t)0));
+}
+
+
+TEST_F(TOASTcovTest, accumulate_steps) {
+    int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
+    std::vector <int64_t> global2local = {0, 1};
+
+    std::vector <double> signal(nsamp);
+    std::vector <double> weights(nsamp * nnz);
+    std::vector <int64_t> pixels(nsamp);
+
+    toast::rng_dist_normal(nsamp, 0, 0, 0, 0, signal.data());
+
+    for (int64_t i = 0; i < nsamp; ++i) {
+        pixels[i] = i % (nsm * npix);
+        for (int64_t k = 0; k < nnz; ++k) {
+            weights[i * nnz + k] = (double)(k + 1) / (double)(i % 3 + 1);
+        }
+    }
+
+    // The data starts with unweighted samples and has a zero weight piece.
+    std::vector <int64_t> starts = {5, 30, 50, 70};
+    std::vector <double> values = {1.5, 0.0, 0.25, 4.0};
+
+    std::vector <double> data(nsm * npix * nnz, 0.0);
+    std::vector <int64_t> hits(nsm * npix, 0);
+    std::vector <double> invn(nsm * npix * block, 0.0);
+    toast::cov_accum_split <int64_t, double> (
+        nsm, npix, nnz, nsamp, pixels.data(), global2local.data(),
+        weights.data(), scale, starts.size(), starts.data(), values.data(),
+        signal.data(), NULL, 0, NULL, 0, NULL, 1, {data.data()}, {hits.data()},
+        {invn.data()});
+
+    std::vector <double> checkdata(nsm * npix * nnz, 0.0);
+    std::vector <int64_t> checkhits(nsm * npix, 0);
+    std::vector <double> checkinvn(nsm * npix * block, 0.0);
+    int64_t istep = -1;
+    for (int64_t i = 0; i < nsamp; ++i) {
+        while ((istep + 1 < (int64_t)starts.size()) &&
+               (i >= starts[istep + 1])) ++istep;
+        if ((istep < 0) || (values[istep] == 0)) continue;
+        double wscale = scale * values[istep];
+        int64_t hpx = pixels[i];
+        checkhits[hpx] += 1;
+        int64_t off = 0;
+        for (int64_t k = 0; k < nnz; ++k) {
+            checkdata[hpx * nnz + k] += wscale * signal[i] * weights[i * nnz + k];
+            for (int64_t m = k; m < nnz; ++m) {
+                checkinvn[hpx * block + off] +=
+                    wscale * weights[i * nnz + k] * weights[i * nnz + m];
+                off++;
+            }
+        }
+    }
+
+    for (int64_t i = 0; i < (nsm * npix); ++i) {
+        EXPECT_EQ(checkhits[i], hits[i]);
+        for (int64_t k = 0; k < nnz; ++k) {
+            EXPECT_DOUBLE_EQ(checkdata[i * nnz + k], data[i * nnz + k]);
+        }
+        for (int64_t k = 0; k < block; ++k) {
+            EXPECT_DOUBLE_EQ(checkinvn[i * block + k], invn[i * block + k]);
+        }
+    }
+
+    // The other kernels apply the same weights.
+    std::vector <int64_t> sm(nsamp);
+    std::vector <int64_t> pix(nsamp);
+    for (int64_t i = 0; i < nsamp; ++i) {
+        sm[i] = pixels[i] / npix;
+        pix[i] = pixels[i] % npix;
+    }
+    std::fill(data.begin(), data.end(), 0.0);
+    std::fill(hits.begin(), hits.end(), 0);
+    std::fill(invn.begin(), invn.end(), 0.0);
+    toast::cov_accum_diag(nsm, npix, nnz, nsamp, sm.data(), pix.data(),
+                          weights.data(), scale, starts.size(), starts.data(),
+                          values.data(), signal.data(), data.data(),
+                          hits.data(), invn.data());
+
+    for (int64_t i = 0; i < (nsm * npix); ++i) {
+        EXPECT_EQ(checkhits[i], hits[i]);
+        for (int64_t k = 0; k < nnz; ++k) {
+            EXPECT_FLOAT_EQ(checkdata[i * nnz + k], data[i * nnz + k]);
+        }
+        for (int64_t k = 0; k < block; ++k) {
+            EXPECT_FLOAT_EQ(checkinvn[i * block + k], invn[i * block + k]);
+        }
+    }
+}
+
+
 TEST_F(TOASTcovTest, eigendecompose) {
     int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
 
@@ -174,3 +174,43 @@ TEST_F(TOASTfftTest, plancache_multi) {
     rplan = store.backward(length, n);
     runbatch(n, fplan, rplan);
 }
+
+
+TEST_F(TOASTfftTest, buffers_multi) {
+    // execute cached plans directly on caller-owned buffers and compare
+    // with the internal buffer path.
+    toast::FFTPlanReal1DStore & store =
+        toast::FFTPlanReal1DStore::get();
+    store.clear();
+
+    toast::FFTPlanReal1D::pshr fplan = store.forward(length, n);
+    toast::FFTPlanReal1D::pshr rplan = store.backward(length, n);
+
+    toast::AlignedVector <double> input(n * length);
+    toast::AlignedVector <double> fourier(n * length);
+    toast::AlignedVector <double> output(n * length);
+
+    toast::rng_dist_normal(n * length, 0, 0, 0, 0, input.data());
+    toast::AlignedVector <double> compare(input);
+
+    for (int64_t i = 0; i < n; ++i) {
+        std::copy(input.data() + i * length, input.data() + (i + 1) * length,
+                  fplan->tdata(i));
+    }
+    fplan->exec();
+
+    fplan->exec(input.data(), fourier.data());
+
+    for (int64_t i = 0; i < n; ++i) {
+        for (int64_t j = 0; j < length; ++j) {
+            EXPECT_FLOAT_EQ(compare[i * length + j], input[i * length + j]);
+            EXPECT_FLOAT_EQ(fplan->fdata(i)[j], fourier[i * length + j]);
+        }
+    }
+
+    rplan->exec(fourier.data(), output.data());
+
+    for (int64_t i = 0; i < n * length; ++i) {
+        EXPECT_FLOAT_EQ(compare[i], output[i]);
+    }
+}
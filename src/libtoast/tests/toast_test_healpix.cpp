@@ -6,6 +6,7 @@
 #include <toast_test.hpp>
 
 #include <cmath>
+#include <vector>
 
 
 TEST_F(TOASThealpixTest, pixelops) {
@@ -37,3 +38,77 @@ TEST_F(TOASThealpixTest, pixelops) {
         EXPECT_EQ(pixnest[i], comp_pixnest[i]);
     }
 }
+
+
+TEST_F(TOASThealpixTest, bitinterleave) {
+    // Reference byte lookup tables for the bit interleaving.  Both the
+    // default helpers (pdep / pext when built with TOAST_USE_BMI2) and the mask
+    // sequences must match them exactly.
+    uint64_t utab[0x100];
+    uint64_t ctab[0x100];
+    for (uint64_t m = 0; m < 0x100; ++m) {
+        utab[m] = (m & 0x1) | ((m & 0x2) << 1) | ((m & 0x4) << 2) |
+                  ((m & 0x8) << 3) | ((m & 0x10) << 4) | ((m & 0x20) << 5) |
+                  ((m & 0x40) << 6) | ((m & 0x80) << 7);
+        ctab[m] = (m & 0x1) | ((m & 0x2) << 7) | ((m & 0x4) >> 1) |
+                  ((m & 0x8) << 6) | ((m & 0x10) >> 2) | ((m & 0x20) << 5) |
+                  ((m & 0x40) >> 3) | ((m & 0x80) << 4);
+    }
+
+    int64_t ntest = 10000;
+    std::vector <uint64_t> rand(2 * ntest);
+    toast::rng_dist_uint64(2 * ntest, 0, 0, 0, 0, rand.data());
+
+    for (int64_t i = 0; i < ntest; ++i) {
+        uint64_t x = rand[2 * i] & 0xffffffffull;
+        uint64_t y = rand[2 * i + 1] & 0xffffffffull;
+        uint64_t check = utab[x & 0xff] | (utab[(x >> 8) & 0xff] << 16) |
+                         (utab[(x >> 16) & 0xff] << 32) |
+                         (utab[(x >> 24) & 0xff] << 48) |
+                         (utab[y & 0xff] << 1) |
+                         (utab[(y >> 8) & 0xff] << 17) |
+                         (utab[(y >> 16) & 0xff] << 33) |
+                         (utab[(y >> 24) & 0xff] << 49);
+        EXPECT_EQ(check, toast::HealpixPixels::xy2pix(x, y));
+        EXPECT_EQ(check, toast::HealpixPixels::xy2pix_masked(x, y));
+
+        uint64_t pix = rand[2 * i];
+        uint64_t raw = (pix & 0x5555ull) | ((pix & 0x55550000ull) >> 15) |
+                       ((pix & 0x555500000000ull) >> 16) |
+                       ((pix & 0x5555000000000000ull) >> 31);
+        uint64_t checkx = ctab[raw & 0xff] | (ctab[(raw >> 8) & 0xff] << 4) |
+                          (ctab[(raw >> 16) & 0xff] << 16) |
+                          (ctab[(raw >> 24) & 0xff] << 20);
+        raw = ((pix & 0xaaaaull) >> 1) | ((pix & 0xaaaa0000ull) >> 16) |
+              ((pix & 0xaaaa00000000ull) >> 17) |
+              ((pix & 0xaaaa000000000000ull) >> 32);
+        uint64_t checky = ctab[raw & 0xff] | (ctab[(raw >> 8) & 0xff] << 4) |
+                          (ctab[(raw >> 16) & 0xff] << 16) |
+                          (ctab[(raw >> 24) & 0xff] << 20);
+        uint64_t compx;
+        uint64_t compy;
+        toast::HealpixPixels::pix2xy(pix, compx, compy);
+        EXPECT_EQ(checkx, compx);
+        EXPECT_EQ(checky, compy);
+        toast::HealpixPixels::pix2xy_masked(pix, compx, compy);
+        EXPECT_EQ(checkx, compx);
+        EXPECT_EQ(checky, compy);
+    }
+
+    // Every pixel must survive the round trip between the orderings.
+    for (int64_t nside = 1; nside <= 256; nside *= 4) {
+        toast::HealpixPixels hpx(nside);
+        int64_t npix = 12 * nside * nside;
+        toast::AlignedVector <int64_t> nest(npix);
+        toast::AlignedVector <int64_t> ring(npix);
+        toast::AlignedVector <int64_t> back(npix);
+        for (int64_t i = 0; i < npix; ++i) {
+            nest[i] = i;
+        }
+        hpx.nest2ring(npix, nest.data(), ring.data());
+        hpx.ring2nest(npix, ring.data(), back.data());
+        for (int64_t i = 0; i < npix; ++i) {
+            EXPECT_EQ(nest[i], back[i]);
+        }
+    }
+}
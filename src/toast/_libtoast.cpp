@@ -41,6 +41,12 @@ PYBIND11_MODULE(_libtoast, m) {
     init_map_cov(m);
     init_pixels(m);
     init_todmap_mapmaker(m);
+    init_tod_offset(m);
+    init_tod_demod(m);
+    init_tod_glitch(m);
+    init_tod_sources(m);
+    init_tod_timeconst(m);
+    init_weather(m);
     init_atm(m);
 
     // Internal unit test runner
@@ -220,6 +220,12 @@ void init_todmap_scanning(py::module & m);
 void init_map_cov(py::module & m);
 void init_pixels(py::module & m);
 void init_todmap_mapmaker(py::module & m);
+void init_tod_offset(py::module & m);
+void init_tod_demod(py::module & m);
+void init_tod_glitch(py::module & m);
+void init_tod_sources(py::module & m);
+void init_tod_timeconst(py::module & m);
+void init_weather(py::module & m);
 void init_atm(py::module & m);
 
 #endif // ifndef LIBTOAST_HPP
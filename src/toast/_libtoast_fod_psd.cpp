@@ -112,5 +112,96 @@ void init_fod_psd(py::module & m) {
 
     )");
 
+    m.def("fod_fit_psds",
+          [](py::buffer freqs, py::buffer psds, py::buffer weights,
+             py::buffer fixed, int64_t maxiter, double tol, py::buffer params,
+             py::buffer cov, py::buffer chi2) {
+              pybuffer_check_1D <double> (freqs);
+              pybuffer_check_1D <uint8_t> (fixed);
+              pybuffer_check_1D <double> (chi2);
+              py::buffer_info info_freqs = freqs.request();
+              py::buffer_info info_psds = psds.request();
+              py::buffer_info info_weights = weights.request();
+              py::buffer_info info_fixed = fixed.request();
+              py::buffer_info info_params = params.request(true);
+              py::buffer_info info_cov = cov.request(true);
+              py::buffer_info info_chi2 = chi2.request(true);
+              int64_t nfreq = info_freqs.size;
+              int64_t npsd = (nfreq > 0) ? info_psds.size / nfreq : 0;
+              if ((info_psds.size != npsd * nfreq) ||
+                  (info_psds.itemsize != sizeof(double)) ||
+                  ((info_weights.size != 0) &&
+                   (info_weights.size != npsd * nfreq)) ||
+                  ((info_weights.size != 0) &&
+                   (info_weights.itemsize != sizeof(double))) ||
+                  ((info_fixed.size != 0) && (info_fixed.size != 4)) ||
+                  (info_params.size != npsd * 4) ||
+                  (info_params.itemsize != sizeof(double)) ||
+                  ((info_cov.size != 0) && (info_cov.size != npsd * 16)) ||
+                  ((info_cov.size != 0) &&
+                   (info_cov.itemsize != sizeof(double))) ||
+                  ((info_chi2.size != 0) && (info_chi2.size != npsd))) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              double * rawfreqs = reinterpret_cast <double *> (info_freqs.ptr);
+              double * rawpsds = reinterpret_cast <double *> (info_psds.ptr);
+              double * rawweights = NULL;
+              if (info_weights.size != 0) {
+                  rawweights = reinterpret_cast <double *> (info_weights.ptr);
+              }
+              uint8_t * rawfixed = NULL;
+              if (info_fixed.size != 0) {
+                  rawfixed = reinterpret_cast <uint8_t *> (info_fixed.ptr);
+              }
+              double * rawparams = reinterpret_cast <double *> (info_params.ptr);
+              double * rawcov = NULL;
+              if (info_cov.size != 0) {
+                  rawcov = reinterpret_cast <double *> (info_cov.ptr);
+              }
+              double * rawchi2 = NULL;
+              if (info_chi2.size != 0) {
+                  rawchi2 = reinterpret_cast <double *> (info_chi2.ptr);
+              }
+              toast::fod_fit_psds(npsd, nfreq, rawfreqs, rawpsds, rawweights,
+                                  rawfixed, maxiter, tol, rawparams, rawcov,
+                                  rawchi2);
+              return;
+          }, py::arg("freqs"), py::arg("psds"), py::arg("weights"),
+          py::arg("fixed"), py::arg("maxiter"), py::arg("tol"),
+          py::arg("params"), py::arg("cov"), py::arg(
+              "chi2"), R"(
+        Fit the analytic noise model to a batch of PSDs.
+
+        The model NET^2 (f^alpha + fknee^alpha) / (f^alpha + fmin^alpha) is
+        fitted to the logarithm of each PSD with Levenberg-Marquardt
+        iterations.  The PSDs are processed in parallel.
+
+        Args:
+            freqs (array_like, float64): The frequencies of the PSD bins.
+            psds (array_like, float64): The (npsd, nfreq) PSDs.
+            weights (array_like, float64): The (npsd, nfreq) inverse
+                uncertainties of the log PSDs, or an empty array for uniform
+                weights.
+            fixed (array_like, uint8): Nonzero for each of (NET, fknee, alpha,
+                fmin) that is not fitted, or an empty array to fit all four.
+            maxiter (int): The maximum number of iterations.
+            tol (float): The relative chi^2 improvement for convergence.
+            params (array_like, float64): The (npsd, 4) parameters
+                (NET, fknee, alpha, fmin).  The starting point on input and
+                the best fit on output.
+            cov (array_like, float64): The (npsd, 4, 4) output parameter
+                covariances, or an empty array.
+            chi2 (array_like, float64): The output chi^2 of each fit, or an
+                empty array.
+
+        Returns:
+            None.
+
+    )");
+
     return;
 }
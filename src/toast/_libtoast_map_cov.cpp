@@ -6,12 +6,122 @@
 #include <_libtoast.hpp>
 
 
+template <typename P, typename W>
+void cov_accum_split(
+    int64_t nsub, int64_t nsubpix, int64_t nnz,
+    py::array_t <P, py::array::c_style | py::array::forcecast> pixels,
+    py::array_t <int64_t, py::array::c_style | py::array::forcecast> global2local,
+    py::array_t <W, py::array::c_style | py::array::forcecast> weights,
+    double scale,
+    py::array_t <double, py::array::c_style | py::array::forcecast> tod,
+    py::array_t <uint8_t, py::array::c_style | py::array::forcecast> det_flags,
+    uint8_t det_mask,
+    py::array_t <uint8_t, py::array::c_style | py::array::forcecast> common_flags,
+    uint8_t common_mask,
+    py::array_t <uint64_t, py::array::c_style | py::array::forcecast> split_masks,
+    uint64_t det_splits, py::list invnpp, py::list hits, py::list zmap,
+    py::array_t <int64_t, py::array::c_style | py::array::forcecast> step_starts,
+    py::array_t <double, py::array::c_style | py::array::forcecast> step_weights) {
+    auto & gt = toast::GlobalTimers::get();
+    gt.start("cov_accum_split");
+
+    // Empty lists of output buffers are not accumulated, and empty flag or
+    // split mask buffers are not applied.
+    std::vector <double *> rawinvnpp;
+    std::vector <int64_t *> rawhits;
+    std::vector <double *> rawzmap;
+    uint8_t const * rawdetflags = NULL;
+    uint8_t const * rawcommonflags = NULL;
+    uint64_t const * rawsplitmasks = NULL;
+
+    int64_t nsamp = pixels.size();
+    int64_t nlocal = nsub * nsubpix;
+    int64_t block = (int64_t)(nnz * (nnz + 1) / 2);
+    size_t nsplit = std::max(invnpp.size(), std::max(hits.size(), zmap.size()));
+    bool consistent = (nsplit <= 64);
+    for (auto const & item : invnpp) {
+        auto buf = item.cast <py::buffer> ();
+        pybuffer_check_1D <double> (buf);
+        py::buffer_info info = buf.request();
+        rawinvnpp.push_back(reinterpret_cast <double *> (info.ptr));
+        if (info.size != nlocal * block) consistent = false;
+    }
+    for (auto const & item : hits) {
+        auto buf = item.cast <py::buffer> ();
+        pybuffer_check_1D <int64_t> (buf);
+        py::buffer_info info = buf.request();
+        rawhits.push_back(reinterpret_cast <int64_t *> (info.ptr));
+        if (info.size != nlocal) consistent = false;
+    }
+    for (auto const & item : zmap) {
+        auto buf = item.cast <py::buffer> ();
+        pybuffer_check_1D <double> (buf);
+        py::buffer_info info = buf.request();
+        rawzmap.push_back(reinterpret_cast <double *> (info.ptr));
+        if (info.size != nlocal * nnz) consistent = false;
+    }
+    if ((!rawinvnpp.empty()) && (rawinvnpp.size() != nsplit)) consistent = false;
+    if ((!rawhits.empty()) && (rawhits.size() != nsplit)) consistent = false;
+    if ((!rawzmap.empty()) && (rawzmap.size() != nsplit)) consistent = false;
+    if ((!rawzmap.empty()) && (tod.size() != nsamp)) consistent = false;
+    if ((!rawinvnpp.empty()) || (!rawzmap.empty())) {
+        if (weights.size() != nsamp * nnz) consistent = false;
+    }
+    if (det_flags.size() > 0) {
+        rawdetflags = det_flags.data();
+        if (det_flags.size() != nsamp) consistent = false;
+    }
+    if (common_flags.size() > 0) {
+        rawcommonflags = common_flags.data();
+        if (common_flags.size() != nsamp) consistent = false;
+    }
+    if (step_starts.size() != step_weights.size()) consistent = false;
+    if (split_masks.size() > 0) {
+        rawsplitmasks = split_masks.data();
+        if (split_masks.size() != nsamp) consistent = false;
+    }
+    if (!consistent) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Buffer sizes are not consistent.";
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    toast::cov_accum_split <P, W> (
+        nsub, nsubpix, nnz, nsamp, pixels.data(), global2local.data(),
+        weights.data(), scale, step_starts.size(), step_starts.data(),
+        step_weights.data(), tod.data(), rawdetflags, det_mask,
+        rawcommonflags, common_mask, rawsplitmasks, det_splits, rawzmap,
+        rawhits, rawinvnpp);
+    gt.stop("cov_accum_split");
+    return;
+}
+
+// All versions share the argument names and defaults, so that keyword
+// arguments work for every pixel and weight type.
+template <typename P, typename W>
+void register_cov_accum_split(py::module & m, char const * doc) {
+    m.def("cov_accum_split", &cov_accum_split <P, W>, py::arg("nsub"),
+          py::arg("nsubpix"), py::arg("nnz"), py::arg("pixels"),
+          py::arg("global2local"), py::arg("weights"), py::arg("scale"),
+          py::arg("tod"), py::arg("det_flags"), py::arg("det_mask"),
+          py::arg("common_flags"), py::arg("common_mask"),
+          py::arg("split_masks"), py::arg("det_splits"), py::arg("invnpp"),
+          py::arg("hits"), py::arg("zmap"),
+          py::arg("step_starts") = py::array_t <int64_t>(),
+          py::arg("step_weights") = py::array_t <double>(), doc);
+    return;
+}
+
 void init_map_cov(py::module & m) {
     m.def("cov_accum_diag",
           [](int64_t nsub, int64_t nsubpix, int64_t nnz, py::buffer submap,
              py::buffer subpix,
              py::buffer weights, double scale, py::buffer tod, py::buffer invnpp,
-             py::buffer hits, py::buffer zmap) {
+             py::buffer hits, py::buffer zmap,
+             py::array_t <int64_t, py::array::c_style | py::array::forcecast> step_starts,
+             py::array_t <double, py::array::c_style | py::array::forcecast> step_weights) {
               auto & gt = toast::GlobalTimers::get();
               gt.start("cov_accum_diag");
               pybuffer_check_1D <int64_t> (submap);
@@ -32,7 +142,8 @@ void init_map_cov(py::module & m) {
               size_t nw = (size_t)(info_weights.size / nnz);
               if ((info_subpix.size != nsamp) ||
                   (info_tod.size != nsamp) ||
-                  (nw != nsamp)) {
+                  (nw != nsamp) ||
+                  (step_starts.size() != step_weights.size())) {
                   auto log = toast::Logger::get();
                   std::ostringstream o;
                   o << "Buffer sizes are not consistent.";
@@ -48,13 +159,15 @@ void init_map_cov(py::module & m) {
               double * rawtod = reinterpret_cast <double *> (info_tod.ptr);
               toast::cov_accum_diag(
                   nsub, nsubpix, nnz, nsamp, rawsubmap, rawsubpix, rawweights, scale,
+                  step_starts.size(), step_starts.data(), step_weights.data(),
                   rawtod, rawzmap, rawhits, rawinvnpp);
               gt.stop("cov_accum_diag");
               return;
           }, py::arg("nsub"), py::arg("nsubpix"), py::arg("nnz"), py::arg("submap"),
           py::arg("subpix"), py::arg("weights"), py::arg("scale"), py::arg("tod"),
-          py::arg("invnpp"), py::arg("hits"), py::arg(
-              "zmap"), R"(
+          py::arg("invnpp"), py::arg("hits"), py::arg("zmap"),
+          py::arg("step_starts") = py::array_t <int64_t>(),
+          py::arg("step_weights") = py::array_t <double>(), R"(
         Accumulate block diagonal noise products
 
         This uses a pointing matrix and timestream data to accumulate the local pieces
@@ -77,6 +190,12 @@ void init_map_cov(py::module & m) {
                 covariances, stored as the lower triangle for each pixel.
             hits (array, int64):  The local hitmap buffer to accumulate.
             zmap (array, float64):  The local noise weighted map buffer.
+            step_starts (array, int64):  The first sample of each piece of the
+                optional piecewise constant weights.  Samples before the first
+                piece are not accumulated.
+            step_weights (array, float64):  The weight of each piece, applied on
+                top of the scale.  Samples with zero weight are not accumulated.
+                Empty arrays (the default) disable these weights.
 
         Returns:
             None.
@@ -134,7 +253,9 @@ void init_map_cov(py::module & m) {
     m.def("cov_accum_diag_invnpp",
           [](int64_t nsub, int64_t nsubpix, int64_t nnz, py::buffer submap,
              py::buffer subpix, py::buffer weights, double scale, py::buffer invnpp,
-             py::buffer hits) {
+             py::buffer hits,
+             py::array_t <int64_t, py::array::c_style | py::array::forcecast> step_starts,
+             py::array_t <double, py::array::c_style | py::array::forcecast> step_weights) {
               auto & gt = toast::GlobalTimers::get();
               gt.start("cov_accum_diag_invnpp");
               pybuffer_check_1D <int64_t> (submap);
@@ -150,7 +271,8 @@ void init_map_cov(py::module & m) {
               size_t nsamp = info_submap.size;
               size_t nw = (size_t)(info_weights.size / nnz);
               if ((info_subpix.size != nsamp) ||
-                  (nw != nsamp)) {
+                  (nw != nsamp) ||
+                  (step_starts.size() != step_weights.size())) {
                   auto log = toast::Logger::get();
                   std::ostringstream o;
                   o << "Buffer sizes are not consistent.";
@@ -164,13 +286,14 @@ void init_map_cov(py::module & m) {
               double * rawweights = reinterpret_cast <double *> (info_weights.ptr);
               toast::cov_accum_diag_invnpp(
                   nsub, nsubpix, nnz, nsamp, rawsubmap, rawsubpix, rawweights, scale,
+                  step_starts.size(), step_starts.data(), step_weights.data(),
                   rawhits, rawinvnpp);
               gt.stop("cov_accum_diag_invnpp");
               return;
           }, py::arg("nsub"), py::arg("nsubpix"), py::arg("nnz"), py::arg("submap"),
           py::arg("subpix"), py::arg("weights"), py::arg("scale"), py::arg("invnpp"),
-          py::arg(
-              "hits"), R"(
+          py::arg("hits"), py::arg("step_starts") = py::array_t <int64_t>(),
+          py::arg("step_weights") = py::array_t <double>(), R"(
         Accumulate block diagonal noise covariance and hits.
 
         This uses a pointing matrix to accumulate the local pieces
@@ -190,6 +313,12 @@ void init_map_cov(py::module & m) {
             invnpp (array, float64):  The local buffer of diagonal inverse pixel
                 covariances, stored as the lower triangle for each pixel.
             hits (array, int64):  The local hitmap buffer to accumulate.
+            step_starts (array, int64):  The first sample of each piece of the
+                optional piecewise constant weights.  Samples before the first
+                piece are not accumulated.
+            step_weights (array, float64):  The weight of each piece, applied on
+                top of the scale.  Samples with zero weight are not accumulated.
+                Empty arrays (the default) disable these weights.
 
         Returns:
             None.
@@ -199,7 +328,9 @@ void init_map_cov(py::module & m) {
     m.def("cov_accum_zmap",
           [](int64_t nsub, int64_t nsubpix, int64_t nnz, py::buffer submap,
              py::buffer subpix, py::buffer weights, double scale, py::buffer tod,
-             py::buffer zmap) {
+             py::buffer zmap,
+             py::array_t <int64_t, py::array::c_style | py::array::forcecast> step_starts,
+             py::array_t <double, py::array::c_style | py::array::forcecast> step_weights) {
               auto & gt = toast::GlobalTimers::get();
               gt.start("cov_accum_zmap");
               pybuffer_check_1D <int64_t> (submap);
@@ -216,7 +347,8 @@ void init_map_cov(py::module & m) {
               size_t nw = (size_t)(info_weights.size / nnz);
               if ((info_subpix.size != nsamp) ||
                   (info_tod.size != nsamp) ||
-                  (nw != nsamp)) {
+                  (nw != nsamp) ||
+                  (step_starts.size() != step_weights.size())) {
                   auto log = toast::Logger::get();
                   std::ostringstream o;
                   o << "Buffer sizes are not consistent.";
@@ -230,13 +362,14 @@ void init_map_cov(py::module & m) {
               double * rawtod = reinterpret_cast <double *> (info_tod.ptr);
               toast::cov_accum_zmap(
                   nsub, nsubpix, nnz, nsamp, rawsubmap, rawsubpix, rawweights, scale,
+                  step_starts.size(), step_starts.data(), step_weights.data(),
                   rawtod, rawzmap);
               gt.stop("cov_accum_zmap");
               return;
           }, py::arg("nsub"), py::arg("nsubpix"), py::arg("nnz"), py::arg("submap"),
           py::arg("subpix"), py::arg("weights"), py::arg("scale"), py::arg("tod"),
-          py::arg(
-              "zmap"), R"(
+          py::arg("zmap"), py::arg("step_starts") = py::array_t <int64_t>(),
+          py::arg("step_weights") = py::array_t <double>(), R"(
         Accumulate the noise weighted map.
 
         This uses a pointing matrix and timestream data to accumulate the local pieces
@@ -259,11 +392,70 @@ void init_map_cov(py::module & m) {
                 covariances, stored as the lower triangle for each pixel.
             hits (array, int64):  The local hitmap buffer to accumulate.
             zmap (array, float64):  The local noise weighted map buffer.
+            step_starts (array, int64):  The first sample of each piece of the
+                optional piecewise constant weights.  Samples before the first
+                piece are not accumulated.
+            step_weights (array, float64):  The weight of each piece, applied on
+                top of the scale.  Samples with zero weight are not accumulated.
+                Empty arrays (the default) disable these weights.
+
+        Returns:
+            None.
+
+    )");
+
+    // Register versions for the pixel and weight types found in the cache.
+    register_cov_accum_split <int64_t, double> (m, R"(
+        Accumulate noise products of several data splits in one pass.
+
+        This combines flagging, the global to local pixel conversion and the
+        accumulation of the inverse diagonal pixel covariance, hits and noise
+        weighted map into a single pass over the pointing.  Samples with a
+        negative pixel, a flag bit set in either mask or a submap that is not
+        stored locally are skipped.  Each sample is accumulated into every
+        split s for which bit s of (split_masks[i] | det_splits) is set, so
+        that a sample may belong to one split of each of several split
+        families at once.  Up to 64 splits are supported.
+
+        Args:
+            nsub (int):  The number of locally stored submaps.
+            nsubpix (int):  The number of pixels in each submap.
+            nnz (int):  The number of non-zeros in each row of the pointing matrix.
+            pixels (array, int32 / int64):  The global pixel index of each time
+                domain sample.
+            global2local (array, int64):  The local submap for each global submap.
+            weights (array, float32 / float64):  The pointing matrix weights for
+                each time sample and map.
+            scale (float):  Optional scaling factor.
+            tod (array, float64):  The timestream to accumulate in the noise weighted
+                map.
+            det_flags (array, uint8):  The detector flags, or an empty array.
+            det_mask (int):  The detector flag mask.
+            common_flags (array, uint8):  The common flags, or an empty array.
+            common_mask (int):  The common flag mask.
+            split_masks (array, uint64):  The split membership bits of each
+                sample, or an empty array.
+            det_splits (int):  Split membership bits shared by all samples.
+            invnpp (list):  One local buffer of diagonal inverse pixel
+                covariances per split.  An empty list disables this accumulation.
+            hits (list):  One local hitmap buffer per split.  An empty list
+                disables this accumulation.
+            zmap (list):  One local noise weighted map buffer per split.  An empty
+                list disables this accumulation.
+            step_starts (array, int64):  The first sample of each piece of the
+                optional piecewise constant weights.  Samples before the first
+                piece are not accumulated.
+            step_weights (array, float64):  The weight of each piece, applied on
+                top of the scale.  Samples with zero weight are not accumulated.
+                Empty arrays (the default) disable these weights.
 
         Returns:
             None.
 
     )");
+    register_cov_accum_split <int64_t, float> (m, "");
+    register_cov_accum_split <int32_t, double> (m, "");
+    register_cov_accum_split <int32_t, float> (m, "");
 
     m.def("cov_eigendecompose_diag",
           [](int64_t nsub, int64_t nsubpix, int64_t nnz, py::buffer data,
@@ -37,9 +37,56 @@ void init_math_fft(py::module & m) {
             (FFTPlanReal1D):  The plan.
 
     )")
-    .def("exec", &toast::FFTPlanReal1D::exec,
+    .def("exec",
+         (void (toast::FFTPlanReal1D::*)()) & toast::FFTPlanReal1D::exec,
          R"(
         Execute the plan on the current state of the data buffers.
+        )")
+    .def("exec", [](toast::FFTPlanReal1D & self, py::buffer in,
+                    py::buffer out) {
+             py::buffer_info info_in = in.request();
+             py::buffer_info info_out = out.request(true);
+             int64_t nelem = self.length() * self.count();
+             for (auto info : {&info_in, &info_out}) {
+                 int64_t stride = sizeof(double);
+                 bool contiguous = true;
+                 for (int64_t d = info->ndim - 1; d >= 0; --d) {
+                     if ((info->shape[d] > 1) && (info->strides[d] != stride)) {
+                         contiguous = false;
+                     }
+                     stride *= info->shape[d];
+                 }
+                 bool is_double =
+                     (info->format == py::format_descriptor <double>::format());
+                 if (!is_double || !contiguous || (info->size != nelem)) {
+                     auto log = toast::Logger::get();
+                     std::ostringstream o;
+                     o << "Buffers must be contiguous float64 arrays with "
+                       << self.count() << " x " << self.length() << " elements";
+                     log.error(o.str().c_str());
+                     throw std::runtime_error(o.str().c_str());
+                 }
+             }
+             double * rawin = reinterpret_cast <double *> (info_in.ptr);
+             double * rawout = reinterpret_cast <double *> (info_out.ptr);
+             self.exec(rawin, rawout);
+             return;
+         }, py::arg("in"), py::arg("out"), R"(
+        Execute the plan on caller-owned buffers.
+
+        The input and output are C-contiguous float64 arrays holding the
+        whole batch, for example of shape (count, length).  The input is
+        time domain data for a forward plan and half-complex data for a
+        backward plan.  It is not modified, and the internal buffers of the
+        plan are not used.
+
+        Args:
+            in (array_like):  The input data.
+            out (array_like):  The output data.
+
+        Returns:
+            None.
+
         )")
     .def("length", &toast::FFTPlanReal1D::length,
          R"(
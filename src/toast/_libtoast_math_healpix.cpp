@@ -423,7 +423,7 @@ void init_math_healpix(py::module & m) {
              }
              int64_t * rawin = reinterpret_cast <int64_t *> (info_in.ptr);
              int64_t * rawout = reinterpret_cast <int64_t *> (info_out.ptr);
-             self.degrade_ring(info_in.size, factor, rawin, rawout);
+             self.degrade_ring(factor, info_in.size, rawin, rawout);
              return;
          }, py::arg("factor"), py::arg("in"), py::arg(
              "out"), R"(
@@ -460,7 +460,7 @@ void init_math_healpix(py::module & m) {
              }
              int64_t * rawin = reinterpret_cast <int64_t *> (info_in.ptr);
              int64_t * rawout = reinterpret_cast <int64_t *> (info_out.ptr);
-             self.degrade_nest(info_in.size, factor, rawin, rawout);
+             self.degrade_nest(factor, info_in.size, rawin, rawout);
              return;
          }, py::arg("factor"), py::arg("in"), py::arg(
              "out"), R"(
@@ -497,7 +497,7 @@ void init_math_healpix(py::module & m) {
              }
              int64_t * rawin = reinterpret_cast <int64_t *> (info_in.ptr);
              int64_t * rawout = reinterpret_cast <int64_t *> (info_out.ptr);
-             self.upgrade_ring(info_in.size, factor, rawin, rawout);
+             self.upgrade_ring(factor, info_in.size, rawin, rawout);
              return;
          }, py::arg("factor"), py::arg("in"), py::arg(
              "out"), R"(
@@ -535,7 +535,7 @@ void init_math_healpix(py::module & m) {
              }
              int64_t * rawin = reinterpret_cast <int64_t *> (info_in.ptr);
              int64_t * rawout = reinterpret_cast <int64_t *> (info_out.ptr);
-             self.degrade_nest(info_in.size, factor, rawin, rawout);
+             self.upgrade_nest(factor, info_in.size, rawin, rawout);
              return;
          }, py::arg("factor"), py::arg("in"), py::arg(
              "out"), R"(
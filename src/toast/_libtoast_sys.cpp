@@ -5,6 +5,8 @@
 
 #include <_libtoast.hpp>
 
+#include <set>
+
 
 void init_sys(py::module & m) {
     py::class_ <toast::Environment,
@@ -358,6 +360,40 @@ void init_sys(py::module & m) {
             Returns:
                 (dict):  A dictionary of Timers.
 
+        )")
+    .def("collect_table", [](toast::GlobalTimers & self,
+                             std::vector <std::string> const & names) {
+             self.stop_all();
+             size_t nname = names.size();
+             py::array_t <double> seconds(nname);
+             py::array_t <int64_t> calls(nname);
+             auto fast_seconds = seconds.mutable_unchecked <1>();
+             auto fast_calls = calls.mutable_unchecked <1>();
+             auto registered = self.names();
+             std::set <std::string> local(registered.begin(), registered.end());
+             for (size_t i = 0; i < nname; ++i) {
+                 if (local.count(names[i]) == 0) {
+                     fast_seconds(i) = -1.0;
+                     fast_calls(i) = -1;
+                 } else {
+                     fast_seconds(i) = self.seconds(names[i]);
+                     fast_calls(i) = static_cast <int64_t> (self.calls(names[i]));
+                 }
+             }
+             return py::make_tuple(seconds, calls);
+         }, py::arg(
+             "names"), R"(
+            Stop all timers and return their state in a fixed name order.
+
+            Timers that are not registered on this process are given a value
+            of -1 for both the seconds and the number of calls.
+
+            Args:
+                names (list):  The timer names.
+
+            Returns:
+                (tuple):  The seconds (float64) and calls (int64) arrays.
+
         )");
 
 
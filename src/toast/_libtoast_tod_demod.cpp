@@ -0,0 +1,112 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_tod_demod(py::module & m) {
+    m.def("hwp_demodulate",
+          [](py::buffer hwp_angle, py::buffer signal, py::buffer flags,
+             uint8_t flag_mask, py::buffer pixels, py::buffer weights,
+             py::buffer fir, int64_t step, py::buffer out_signal,
+             py::buffer out_pixels, py::buffer out_weights,
+             py::buffer out_flags) {
+              pybuffer_check_1D <double> (hwp_angle);
+              pybuffer_check_1D <double> (signal);
+              pybuffer_check_1D <uint8_t> (flags);
+              pybuffer_check_1D <int64_t> (pixels);
+              pybuffer_check_1D <double> (fir);
+              pybuffer_check_1D <int64_t> (out_pixels);
+              pybuffer_check_1D <uint8_t> (out_flags);
+              py::buffer_info info_hwp = hwp_angle.request();
+              py::buffer_info info_signal = signal.request();
+              py::buffer_info info_flags = flags.request();
+              py::buffer_info info_pixels = pixels.request();
+              py::buffer_info info_weights = weights.request();
+              py::buffer_info info_fir = fir.request();
+              py::buffer_info info_out_signal = out_signal.request(true);
+              py::buffer_info info_out_pixels = out_pixels.request(true);
+              py::buffer_info info_out_weights = out_weights.request(true);
+              py::buffer_info info_out_flags = out_flags.request(true);
+              int64_t nsamp = info_signal.size;
+              int64_t nout = info_out_pixels.size / 3;
+              int64_t nnz = (nsamp > 0) ? info_weights.size / nsamp : 0;
+              if ((info_hwp.size != nsamp) ||
+                  ((info_flags.size != 0) && (info_flags.size != nsamp)) ||
+                  (info_pixels.size != nsamp) ||
+                  (info_weights.size != nsamp * nnz) ||
+                  (info_out_pixels.size != 3 * nout) ||
+                  (info_out_signal.size != 3 * nout) ||
+                  (info_out_flags.size != 3 * nout) ||
+                  (info_out_weights.size != 3 * nout * nnz) ||
+                  (info_weights.format != info_out_weights.format) ||
+                  (info_weights.itemsize != sizeof(double)) ||
+                  (info_out_signal.itemsize != sizeof(double))) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              double * rawhwp = reinterpret_cast <double *> (info_hwp.ptr);
+              double * rawsignal = reinterpret_cast <double *> (info_signal.ptr);
+              uint8_t * rawflags = NULL;
+              if (info_flags.size != 0) {
+                  rawflags = reinterpret_cast <uint8_t *> (info_flags.ptr);
+              }
+              int64_t * rawpixels =
+                  reinterpret_cast <int64_t *> (info_pixels.ptr);
+              double * rawweights =
+                  reinterpret_cast <double *> (info_weights.ptr);
+              double * rawfir = reinterpret_cast <double *> (info_fir.ptr);
+              double * rawoutsignal =
+                  reinterpret_cast <double *> (info_out_signal.ptr);
+              int64_t * rawoutpixels =
+                  reinterpret_cast <int64_t *> (info_out_pixels.ptr);
+              double * rawoutweights =
+                  reinterpret_cast <double *> (info_out_weights.ptr);
+              uint8_t * rawoutflags =
+                  reinterpret_cast <uint8_t *> (info_out_flags.ptr);
+              toast::hwp_demodulate(nsamp, nnz, rawhwp, rawsignal, rawflags,
+                                    flag_mask, rawpixels, rawweights,
+                                    info_fir.size, rawfir, step, nout,
+                                    rawoutsignal, rawoutpixels, rawoutweights,
+                                    rawoutflags);
+              return;
+          }, py::arg("hwp_angle"), py::arg("signal"), py::arg("flags"),
+          py::arg("flag_mask"), py::arg("pixels"), py::arg("weights"),
+          py::arg("fir"), py::arg("step"), py::arg("out_signal"),
+          py::arg("out_pixels"), py::arg("out_weights"), py::arg(
+              "out_flags"), R"(
+        Lock-in demodulate and decimate one detector timestream.
+
+        The signal and the pointing weights are multiplied by
+        {1, 2 cos(4 chi), 2 sin(4 chi)}, low-pass filtered with the
+        symmetric FIR and sampled every `step` samples.  Flagged samples
+        are dropped from the filter, which is renormalized over the
+        remaining taps.  The outputs hold 3 entries (one per demodulated
+        stream) for each of the nout output samples.
+
+        Args:
+            hwp_angle (array, float64):  The HWP angle.
+            signal (array, float64):  The detector signal.
+            flags (array, uint8):  The sample flags (may be empty).
+            flag_mask (int):  Flag bits that reject a sample.
+            pixels (array, int64):  The pixel numbers.
+            weights (array, float64):  The (nsamp, nnz) pointing weights.
+            fir (array, float64):  The low-pass filter, odd length.
+            step (int):  The decimation factor.
+            out_signal (array, float64):  The (nout, 3) demodulated signal.
+            out_pixels (array, int64):  The (nout, 3) pixel numbers.
+            out_weights (array, float64):  The (nout, 3, nnz) weights.
+            out_flags (array, uint8):  The (nout, 3) output flags.
+
+        Returns:
+            None.
+
+    )");
+
+    return;
+}
@@ -170,7 +170,7 @@ void init_tod_filter(py::module & m) {
               size_t nsignal = signals.size();
               size_t nsamp = info_flags.size;
               size_t nscan = info_starts.size;
-              if (info_stops.size != nscan) {
+              if (info_stops.size != info_starts.size) {
                   auto log = toast::Logger::get();
                   std::ostringstream o;
                   o << "Starts / stops buffer sizes are not consistent.";
@@ -215,5 +215,93 @@ void init_tod_filter(py::module & m) {
 
     )");
 
+    m.def("filter_lines",
+          [](double rate, py::buffer freqs, py::buffer widths, py::buffer starts,
+             py::buffer stops, py::list flags, py::list signals) {
+              pybuffer_check_1D <double> (freqs);
+              pybuffer_check_1D <double> (widths);
+              pybuffer_check_1D <int64_t> (starts);
+              pybuffer_check_1D <int64_t> (stops);
+              py::buffer_info info_freqs = freqs.request();
+              py::buffer_info info_widths = widths.request();
+              py::buffer_info info_starts = starts.request();
+              py::buffer_info info_stops = stops.request();
+              int64_t nline = info_freqs.size;
+              size_t nscan = info_starts.size;
+              if ((info_widths.size != nline) || (info_stops.size != info_starts.size) ||
+                  ((flags.size() != 0) && (flags.size() != signals.size()))) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              int64_t nsamp = -1;
+              std::vector <double *> sigs;
+              for (auto const & sg : signals) {
+                  auto sgbuf = sg.cast <py::buffer> ();
+                  pybuffer_check_1D <double> (sgbuf);
+                  py::buffer_info info_sg = sgbuf.request(true);
+                  if (nsamp < 0) nsamp = info_sg.size;
+                  if (info_sg.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  sigs.push_back(reinterpret_cast <double *> (info_sg.ptr));
+              }
+              std::vector <uint8_t *> flgs;
+              for (auto const & fg : flags) {
+                  auto fgbuf = fg.cast <py::buffer> ();
+                  pybuffer_check_1D <uint8_t> (fgbuf);
+                  py::buffer_info info_fg = fgbuf.request();
+                  if (info_fg.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal and flag buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  flgs.push_back(reinterpret_cast <uint8_t *> (info_fg.ptr));
+              }
+              if (nsamp < 0) return;
+              double * rawfreqs = reinterpret_cast <double *> (info_freqs.ptr);
+              double * rawwidths = reinterpret_cast <double *> (info_widths.ptr);
+              int64_t * rawstarts = reinterpret_cast <int64_t *> (info_starts.ptr);
+              int64_t * rawstops = reinterpret_cast <int64_t *> (info_stops.ptr);
+              toast::filter_lines(nsamp, rate, nline, rawfreqs, rawwidths, nscan,
+                                  rawstarts, rawstops, flgs, sigs);
+              return;
+          }, py::arg("rate"), py::arg("freqs"), py::arg("widths"), py::arg("starts"),
+          py::arg("stops"), py::arg("flags"), py::arg(
+              "signals"), R"(
+        Remove narrow spectral lines from one or more signals.
+
+        Each scan is gap-filled over the flagged samples and detrended.  The
+        Fourier modes within half a width of every line frequency form the
+        line estimate, which is subtracted from all samples of the scan.
+        The removal is incomplete within about one inverse width of the scan
+        ends.  The scans of all signals are transformed with batched FFT
+        plans.
+
+        Args:
+            rate (float):  The sample rate in Hz.
+            freqs (array, float64):  The line frequencies in Hz.
+            widths (array, float64):  The full widths of the notches in Hz.
+                Each line removes at least the closest Fourier mode.
+            starts (array, int64):  The start samples of each scan.
+            stops (array, int64):  The stop samples of each scan.
+            flags (list):  A list of uint8 arrays with the flags of each
+                signal, nonzero samples are replaced with an interpolation.
+                May be empty.
+            signals (list):  A list of float64 arrays, filtered in place.
+
+        Returns:
+            None.
+
+    )");
+
     return;
 }
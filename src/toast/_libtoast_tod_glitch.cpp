@@ -0,0 +1,158 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_tod_glitch(py::module & m) {
+    m.def("running_median",
+          [](int64_t window, py::buffer signal, py::buffer flags,
+             uint8_t flag_mask, py::buffer median) {
+              pybuffer_check_1D <double> (signal);
+              pybuffer_check_1D <uint8_t> (flags);
+              pybuffer_check_1D <double> (median);
+              py::buffer_info info_signal = signal.request();
+              py::buffer_info info_flags = flags.request();
+              py::buffer_info info_median = median.request(true);
+              int64_t nsamp = info_signal.size;
+              if (((info_flags.size != 0) && (info_flags.size != nsamp)) ||
+                  (info_median.size != nsamp)) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              double * rawsignal = reinterpret_cast <double *> (info_signal.ptr);
+              uint8_t * rawflags = NULL;
+              if (info_flags.size != 0) {
+                  rawflags = reinterpret_cast <uint8_t *> (info_flags.ptr);
+              }
+              double * rawmedian = reinterpret_cast <double *> (info_median.ptr);
+              toast::running_median(nsamp, window, rawsignal, rawflags,
+                                    flag_mask, rawmedian);
+              return;
+          }, py::arg("window"), py::arg("signal"), py::arg("flags"),
+          py::arg("flag_mask"), py::arg(
+              "median"), R"(
+        Compute the running median of a timestream.
+
+        The median at each sample is taken over the unflagged samples within
+        window / 2 samples of it.  It is NaN where there are none.
+
+        Args:
+            window (int):  The width of the window in samples.
+            signal (array, float64):  The timestream.
+            flags (array, uint8):  The sample flags (may be empty).
+            flag_mask (int):  Flag bits that reject a sample.
+            median (array, float64):  The output running median.
+
+        Returns:
+            None.
+
+    )");
+
+    m.def("flag_glitches",
+          [](int64_t window, double glitch_threshold, int64_t jump_width,
+             double jump_threshold, int64_t dilation, uint8_t glitch_value,
+             uint8_t jump_value, uint8_t flag_mask, py::buffer common_flags,
+             uint8_t common_mask, py::list signals, py::list flags) {
+              pybuffer_check_1D <uint8_t> (common_flags);
+              py::buffer_info info_common = common_flags.request();
+              if (signals.size() != flags.size()) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Number of signals and flag vectors are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              int64_t nsamp = -1;
+              std::vector <double const *> sigs;
+              std::vector <uint8_t *> flgs;
+              for (auto const & sg : signals) {
+                  auto sgbuf = sg.cast <py::buffer> ();
+                  pybuffer_check_1D <double> (sgbuf);
+                  py::buffer_info info_sg = sgbuf.request();
+                  if (nsamp < 0) nsamp = info_sg.size;
+                  if (info_sg.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  sigs.push_back(reinterpret_cast <double *> (info_sg.ptr));
+              }
+              for (auto const & fl : flags) {
+                  auto flbuf = fl.cast <py::buffer> ();
+                  pybuffer_check_1D <uint8_t> (flbuf);
+                  py::buffer_info info_fl = flbuf.request(true);
+                  if (info_fl.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal and flag buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  flgs.push_back(reinterpret_cast <uint8_t *> (info_fl.ptr));
+              }
+              uint8_t * rawcommon = NULL;
+              if (info_common.size != 0) {
+                  if (info_common.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal and common flag buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  rawcommon = reinterpret_cast <uint8_t *> (info_common.ptr);
+              }
+              if (nsamp < 0) return;
+              toast::flag_glitches(nsamp, window, glitch_threshold, jump_width,
+                                   jump_threshold, dilation, glitch_value,
+                                   jump_value, flag_mask, rawcommon,
+                                   common_mask, sigs, flgs);
+              return;
+          }, py::arg("window"), py::arg("glitch_threshold"),
+          py::arg("jump_width"), py::arg("jump_threshold"), py::arg("dilation"),
+          py::arg("glitch_value"), py::arg("jump_value"), py::arg("flag_mask"),
+          py::arg("common_flags"), py::arg("common_mask"), py::arg("signals"),
+          py::arg(
+              "flags"), R"(
+        Flag glitches and jumps in one or more detector timestreams.
+
+        The noise level is tracked with a running median and median absolute
+        deviation (MAD) over `window` samples.  Samples further than
+        `glitch_threshold` robust standard deviations (1.4826 MAD) from the
+        running median are glitches.  A matched filter comparing the means
+        of `jump_width` samples on either side of each sample boundary finds
+        jumps larger than `jump_threshold` standard deviations.  Samples
+        within `dilation` samples of a glitch or jump are also flagged.  The
+        detectors are processed in parallel.
+
+        Args:
+            window (int):  The running median window in samples.
+            glitch_threshold (float):  The glitch threshold.  Zero disables
+                glitch detection.
+            jump_width (int):  The half-width of the jump filter in samples.
+            jump_threshold (float):  The jump threshold.  Zero disables jump
+                detection.
+            dilation (int):  The number of samples flagged on either side.
+            glitch_value (int):  The flag bits OR-ed into glitch samples.
+            jump_value (int):  The flag bits OR-ed into jump samples.
+            flag_mask (int):  Detector flag bits that reject a sample.
+            common_flags (array, uint8):  The common flags (may be empty).
+            common_mask (int):  Common flag bits that reject a sample.
+            signals (list):  A list of float64 arrays containing the signals.
+            flags (list):  A list of uint8 arrays with the detector flags,
+                updated in place.
+
+        Returns:
+            None.
+
+    )");
+
+    return;
+}
@@ -0,0 +1,98 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_tod_offset(py::module & m) {
+    m.def("offset_noise_filter",
+          [](py::buffer logfreq, py::buffer logpsd, double step_length,
+             int64_t nstep, double lim) {
+              pybuffer_check_1D <double> (logfreq);
+              pybuffer_check_1D <double> (logpsd);
+              py::buffer_info info_logfreq = logfreq.request();
+              py::buffer_info info_logpsd = logpsd.request();
+              int64_t nfreq = info_logfreq.size;
+              if ((info_logpsd.size != nfreq) || (nfreq < 2)) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              double * rawlogfreq = reinterpret_cast <double *> (info_logfreq.ptr);
+              double * rawlogpsd = reinterpret_cast <double *> (info_logpsd.ptr);
+              toast::AlignedF64 filter;
+              toast::offset_noise_filter(nfreq, rawlogfreq, rawlogpsd, step_length,
+                                         nstep, lim, filter);
+              py::array_t <double> ret;
+              ret.resize({filter.size()});
+              py::buffer_info info = ret.request();
+              double * raw = static_cast <double *> (info.ptr);
+              std::copy(filter.begin(), filter.end(), raw);
+              return ret;
+          }, py::arg("logfreq"), py::arg("logpsd"), py::arg("step_length"),
+          py::arg("nstep"), py::arg("lim") = 1e-4, R"(
+        Build the real space noise filter for a run of baseline offsets.
+
+        The tabulated PSD is interpolated in log-log space onto the frequencies
+        of a (2 * nstep + 1)-point real FFT, transformed to real space and
+        truncated where the lags fall below `lim` times the zero-lag value.
+        Passing the log of the inverse offset PSD yields the noise prior filter
+        and passing the log of the offset PSD yields its inverse.
+
+        Args:
+            logfreq (array, float64):  Natural log of the tabulated frequencies.
+            logpsd (array, float64):  Natural log of the tabulated values.
+            step_length (float):  The baseline length in seconds.
+            nstep (int):  The number of baselines in the interval.
+            lim (float):  The relative truncation threshold.
+
+        Returns:
+            (array):  The symmetric filter, centered on the zero lag.
+
+    )");
+
+    m.def("offset_banded_precond",
+          [](py::buffer sigmasqs, py::buffer noisefilter, int64_t precond_width) {
+              pybuffer_check_1D <double> (sigmasqs);
+              pybuffer_check_1D <double> (noisefilter);
+              py::buffer_info info_sigmasqs = sigmasqs.request();
+              py::buffer_info info_filter = noisefilter.request();
+              int64_t nstep = info_sigmasqs.size;
+              int64_t nfilter = info_filter.size;
+              double * rawsigmasqs = reinterpret_cast <double *> (info_sigmasqs.ptr);
+              double * rawfilter = reinterpret_cast <double *> (info_filter.ptr);
+              toast::AlignedF64 precond;
+              int64_t width = toast::offset_banded_precond(
+                  nstep, rawsigmasqs, nfilter, rawfilter, precond_width, precond);
+              py::array_t <double> ret;
+              ret.resize({width, nstep});
+              py::buffer_info info = ret.request();
+              double * raw = static_cast <double *> (info.ptr);
+              std::copy(precond.begin(), precond.end(), raw);
+              return ret;
+          }, py::arg("sigmasqs"), py::arg("noisefilter"), py::arg(
+              "precond_width"), R"(
+        Build and factor the banded offset preconditioner.
+
+        The diagonal baseline variances are combined with the central band of
+        the noise filter and factored with a banded Cholesky decomposition.
+        If that matrix is not positive definite, a warning is logged and the
+        factor of its diagonal is returned instead, with a width of one.
+
+        Args:
+            sigmasqs (array, float64):  The white noise variance of each baseline.
+            noisefilter (array, float64):  The symmetric noise prior filter.
+            precond_width (int):  The requested band width.
+
+        Returns:
+            (array):  The lower Cholesky factor in the (width, nstep) banded
+                layout accepted by scipy.linalg.cho_solve_banded.
+
+    )");
+
+    return;
+}
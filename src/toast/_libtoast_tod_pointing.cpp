@@ -79,5 +79,111 @@ void init_tod_pointing(py::module & m) {
 
     )");
 
+    m.def("pointing_matrix_healpix_pair",
+          [](toast::HealpixPixels const & hpix, bool nest, double eps_a,
+             double cal_a, double eps_b, double cal_b, double dpsi,
+             std::string const & mode, py::buffer pdata, py::object hwpang,
+             py::buffer flags, py::buffer pixels_a, py::buffer pixels_b,
+             py::buffer weights_a, py::buffer weights_b) {
+              pybuffer_check_1D <double> (pdata);
+              pybuffer_check_1D <uint8_t> (flags);
+              pybuffer_check_1D <double> (weights_a);
+              pybuffer_check_1D <double> (weights_b);
+              pybuffer_check_1D <int64_t> (pixels_a);
+              pybuffer_check_1D <int64_t> (pixels_b);
+              py::buffer_info info_pdata = pdata.request();
+              py::buffer_info info_flags = flags.request();
+              py::buffer_info info_pixels_a = pixels_a.request(true);
+              py::buffer_info info_pixels_b = pixels_b.request(true);
+              py::buffer_info info_weights_a = weights_a.request(true);
+              py::buffer_info info_weights_b = weights_b.request(true);
+              size_t n = (size_t)(info_pdata.size / 4);
+              size_t nnz = 1;
+              if (mode.compare("IQU") == 0) {
+                  nnz = 3;
+              }
+              if ((info_flags.size != n) ||
+                  (info_pixels_a.size != n) || (info_pixels_b.size != n) ||
+                  (info_weights_a.size != nnz * n) ||
+                  (info_weights_b.size != nnz * n)) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              double * rawpdata = reinterpret_cast <double *> (info_pdata.ptr);
+              uint8_t * rawflags = reinterpret_cast <uint8_t *> (info_flags.ptr);
+              double * rawweights_a =
+                  reinterpret_cast <double *> (info_weights_a.ptr);
+              double * rawweights_b =
+                  reinterpret_cast <double *> (info_weights_b.ptr);
+              int64_t * rawpixels_a =
+                  reinterpret_cast <int64_t *> (info_pixels_a.ptr);
+              int64_t * rawpixels_b =
+                  reinterpret_cast <int64_t *> (info_pixels_b.ptr);
+              double * rawhwpang = NULL;
+              if (!hwpang.is_none()) {
+                  auto hwpbuf = py::cast <py::buffer> (hwpang);
+                  pybuffer_check_1D <double> (hwpbuf);
+                  py::buffer_info info_hwpang = hwpbuf.request();
+                  if (info_hwpang.size != n) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "HWP buffer size is not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  rawhwpang = reinterpret_cast <double *> (info_hwpang.ptr);
+              }
+              toast::pointing_matrix_healpix_pair(hpix, nest, eps_a, cal_a,
+                                                  eps_b, cal_b, dpsi, mode, n,
+                                                  rawpdata, rawhwpang,
+                                                  rawflags, rawpixels_a,
+                                                  rawpixels_b, rawweights_a,
+                                                  rawweights_b);
+              return;
+          }, py::arg("hpix"), py::arg("nest"), py::arg("eps_a"),
+          py::arg("cal_a"), py::arg("eps_b"), py::arg("cal_b"),
+          py::arg("dpsi"), py::arg("mode"), py::arg("pdata"),
+          py::arg("hwpang").none(true), py::arg("flags"),
+          py::arg("pixels_a"), py::arg("pixels_b"), py::arg("weights_a"),
+          py::arg(
+              "weights_b"), R"(
+        Compute the healpix pixel indices and weights for a detector pair.
+
+        The second detector of the pair has the same line of sight as the
+        first one, and is rotated by dpsi about it.  The pixel indices and
+        the orientation are computed once from the pointing of the first
+        detector.
+
+        Args:
+            hpix (HealpixPixels):  The healpix projection object.
+            nest (bool):  If True, then use NESTED ordering, else RING.
+            eps_a (float):  The cross polar response of the first detector.
+            cal_a (float):  The calibration of the first detector.
+            eps_b (float):  The cross polar response of the second detector.
+            cal_b (float):  The calibration of the second detector.
+            dpsi (float):  The polarization angle of the second detector
+                relative to the first, in radians.
+            mode (str):  Either "I" or "IQU".
+            pdata (array, float64):  The flat-packed array of quaternions of
+                the first detector.
+            hwpang (array, float64):  The HWP angles.
+            flags (array, uint8):  The pointing flags.
+            pixels_a (array, int64):  The pixel indices of the first
+                detector.
+            pixels_b (array, int64):  The pixel indices of the second
+                detector.
+            weights_a (array, float64):  The flat packed weights of the
+                first detector.
+            weights_b (array, float64):  The flat packed weights of the
+                second detector.
+
+        Returns:
+            None.
+
+    )");
+
     return;
 }
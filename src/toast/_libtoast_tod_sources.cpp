@@ -0,0 +1,172 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_tod_sources(py::module & m) {
+    py::class_ <toast::SourceIndex, toast::SourceIndex::puniq> (
+        m, "SourceIndex",
+        R"(
+        Spatial index of a catalog of compact sources.
+
+        The sources are bucketed by their nested HEALPix pixel and the
+        buckets are organized in a k-d tree, so that the sources near a
+        direction are found without visiting the whole catalog.  Sources
+        may move linearly on the sphere.
+
+        Args:
+            dirs (array, float64):  The flattened (nsource, 3) unit vectors
+                of the sources at the reference time.
+            vels (array, float64):  The flattened (nsource, 3) velocities
+                of the sources in radians per second, or an empty array
+                for fixed sources.
+            tref (float):  The reference time of the positions.
+            nside (int):  The NSIDE of the HEALPix buckets.
+            leaf_size (int):  The maximum number of sources in a leaf with
+                more than one bucket.
+
+        )")
+    .def(py::init([](py::buffer dirs, py::buffer vels, double tref,
+                     int64_t nside, int64_t leaf_size) {
+                      pybuffer_check_1D <double> (dirs);
+                      pybuffer_check_1D <double> (vels);
+                      py::buffer_info info_dirs = dirs.request();
+                      py::buffer_info info_vels = vels.request();
+                      int64_t nsource = info_dirs.size / 3;
+                      if ((info_dirs.size != 3 * nsource) ||
+                          ((info_vels.size != 0) &&
+                           (info_vels.size != info_dirs.size))) {
+                          auto log = toast::Logger::get();
+                          std::ostringstream o;
+                          o << "Buffer sizes are not consistent.";
+                          log.error(o.str().c_str());
+                          throw std::runtime_error(o.str().c_str());
+                      }
+                      double * rawdirs = reinterpret_cast <double *> (
+                          info_dirs.ptr);
+                      double * rawvels = NULL;
+                      if (info_vels.size != 0) {
+                          rawvels = reinterpret_cast <double *> (info_vels.ptr);
+                      }
+                      return new toast::SourceIndex(nsource, rawdirs, rawvels,
+                                                    tref, nside, leaf_size);
+                  }), py::arg("dirs"), py::arg("vels"), py::arg("tref") = 0.0,
+         py::arg("nside") = 64, py::arg("leaf_size") = 16)
+    .def("nsource", &toast::SourceIndex::nsource, R"(
+        The number of sources in the index.
+
+        Returns:
+            (int):  The number of sources.
+
+    )")
+    .def("nnode", &toast::SourceIndex::nnode, R"(
+        The number of nodes of the k-d tree.
+
+        Returns:
+            (int):  The number of nodes.
+
+    )")
+    .def("query", [](toast::SourceIndex & self, py::buffer dir,
+                     double radius, double tmin, double tmax) {
+             pybuffer_check_1D <double> (dir);
+             py::buffer_info info_dir = dir.request();
+             if (info_dir.size != 3) {
+                 auto log = toast::Logger::get();
+                 std::ostringstream o;
+                 o << "Direction must have 3 elements.";
+                 log.error(o.str().c_str());
+                 throw std::runtime_error(o.str().c_str());
+             }
+             double * rawdir = reinterpret_cast <double *> (info_dir.ptr);
+             std::vector <int64_t> result;
+             self.query(rawdir, radius, tmin, tmax, result);
+             py::array_t <int64_t> ret;
+             ret.resize({result.size()});
+             py::buffer_info info = ret.request();
+             int64_t * raw = static_cast <int64_t *> (info.ptr);
+             std::copy(result.begin(), result.end(), raw);
+             return ret;
+         }, py::arg("dir"), py::arg("radius"), py::arg("tmin") = 0.0,
+         py::arg(
+             "tmax") = 0.0, R"(
+        Find the sources near a direction.
+
+        Args:
+            dir (array, float64):  The unit vector to search around.
+            radius (float):  The search radius in radians.
+            tmin (float):  The start of the time span.
+            tmax (float):  The end of the time span.
+
+        Returns:
+            (array):  The indices of all sources that are within the radius
+                at some time during the span.  The result may include
+                moving sources that are slightly further away.
+
+    )")
+    .def("scan", [](toast::SourceIndex & self, py::buffer times,
+                    py::buffer quats, double fwhm_major, double fwhm_minor,
+                    double psi_beam, py::buffer flux, double nsigma,
+                    py::buffer signal) {
+             pybuffer_check_1D <double> (times);
+             pybuffer_check_1D <double> (quats);
+             pybuffer_check_1D <double> (flux);
+             pybuffer_check_1D <double> (signal);
+             py::buffer_info info_times = times.request();
+             py::buffer_info info_quats = quats.request();
+             py::buffer_info info_flux = flux.request();
+             py::buffer_info info_signal = signal.request(true);
+             int64_t nsamp = info_signal.size;
+             if ((info_quats.size != 4 * nsamp) ||
+                 ((info_times.size != 0) && (info_times.size != nsamp)) ||
+                 (info_flux.size != self.nsource())) {
+                 auto log = toast::Logger::get();
+                 std::ostringstream o;
+                 o << "Buffer sizes are not consistent.";
+                 log.error(o.str().c_str());
+                 throw std::runtime_error(o.str().c_str());
+             }
+             double * rawtimes = NULL;
+             if (info_times.size != 0) {
+                 rawtimes = reinterpret_cast <double *> (info_times.ptr);
+             }
+             double * rawquats = reinterpret_cast <double *> (info_quats.ptr);
+             double * rawflux = reinterpret_cast <double *> (info_flux.ptr);
+             double * rawsignal = reinterpret_cast <double *> (info_signal.ptr);
+             self.scan(nsamp, rawtimes, rawquats, fwhm_major, fwhm_minor,
+                       psi_beam, rawflux, nsigma, rawsignal);
+             return;
+         }, py::arg("times"), py::arg("quats"), py::arg("fwhm_major"),
+         py::arg("fwhm_minor"), py::arg("psi_beam"), py::arg("flux"),
+         py::arg("nsigma"), py::arg(
+             "signal"), R"(
+        Accumulate the signal of the sources seen by a detector.
+
+        The beam is an elliptical Gaussian with unit integral, so the peak
+        response to a source is flux / (2 pi sigma_major sigma_minor).  The
+        sources near each block of samples are found from the index and
+        evaluated out to `nsigma` beam sigmas.
+
+        Args:
+            times (array, float64):  The sample times.  May be empty if no
+                source moves.
+            quats (array, float64):  The flattened detector quaternions.
+            fwhm_major (float):  The major axis FWHM in radians.
+            fwhm_minor (float):  The minor axis FWHM in radians.  Zero
+                gives a circular beam.
+            psi_beam (float):  The angle of the major axis from the
+                detector X axis in radians.
+            flux (array, float64):  The integrated amplitude of each
+                source.
+            nsigma (float):  The beam cutoff in units of sigma.
+            signal (array, float64):  The timestream to accumulate into.
+
+        Returns:
+            None.
+
+    )");
+
+    return;
+}
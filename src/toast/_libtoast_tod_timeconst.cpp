@@ -0,0 +1,101 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_tod_timeconst(py::module & m) {
+    m.def("filter_time_constant",
+          [](double rate, py::buffer tau, py::buffer tau2, py::buffer fraction,
+             bool deconvolve, double epsilon, int64_t fftlen,
+             py::list signals) {
+              pybuffer_check_1D <double> (tau);
+              pybuffer_check_1D <double> (tau2);
+              pybuffer_check_1D <double> (fraction);
+              py::buffer_info info_tau = tau.request();
+              py::buffer_info info_tau2 = tau2.request();
+              py::buffer_info info_fraction = fraction.request();
+              int64_t ndet = signals.size();
+              if ((info_tau.size != ndet) ||
+                  ((info_tau2.size != 0) && (info_tau2.size != ndet)) ||
+                  ((info_fraction.size != 0) && (info_fraction.size != ndet))) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              int64_t nsamp = -1;
+              std::vector <double *> sigs;
+              for (auto const & sg : signals) {
+                  auto sgbuf = sg.cast <py::buffer> ();
+                  pybuffer_check_1D <double> (sgbuf);
+                  py::buffer_info info_sg = sgbuf.request(true);
+                  if (nsamp < 0) nsamp = info_sg.size;
+                  if (info_sg.size != nsamp) {
+                      auto log = toast::Logger::get();
+                      std::ostringstream o;
+                      o << "Signal buffer sizes are not consistent.";
+                      log.error(o.str().c_str());
+                      throw std::runtime_error(o.str().c_str());
+                  }
+                  sigs.push_back(reinterpret_cast <double *> (info_sg.ptr));
+              }
+              if (nsamp < 0) return;
+              double * rawtau = reinterpret_cast <double *> (info_tau.ptr);
+              double * rawtau2 = NULL;
+              if (info_tau2.size != 0) {
+                  rawtau2 = reinterpret_cast <double *> (info_tau2.ptr);
+              }
+              double * rawfraction = NULL;
+              if (info_fraction.size != 0) {
+                  rawfraction = reinterpret_cast <double *> (info_fraction.ptr);
+              }
+              toast::filter_time_constant(nsamp, rate, rawtau, rawtau2,
+                                          rawfraction, deconvolve, epsilon,
+                                          fftlen, sigs);
+              return;
+          }, py::arg("rate"), py::arg("tau"), py::arg("tau2"),
+          py::arg("fraction"), py::arg("deconvolve"), py::arg("epsilon"),
+          py::arg("fftlen"), py::arg(
+              "signals"), R"(
+        Apply or remove detector time constants.
+
+        The response of each detector is
+
+            H(f) = (1 - fraction) H(f, tau) + fraction H(f, tau2)
+
+        where H(f, tau) is the response of the sampled exponential with
+        time constant tau, (1 - a) / (1 - a exp(-2 pi i f / rate)) with
+        a = exp(-1 / (tau rate)).  This approaches 1 / (1 + 2 pi i f tau)
+        when tau is much longer than the sample interval.
+
+        The signals are either convolved with H or deconvolved with the
+        regularized inverse conj(H) / (|H|^2 + epsilon).  They are filtered
+        in place with overlap-save blocks, and the blocks of all detectors
+        are transformed together with batched FFT plans.
+
+        Args:
+            rate (float):  The sample rate in Hz.
+            tau (array, float64):  The time constant of each detector in
+                seconds.
+            tau2 (array, float64):  The optional second time constant of
+                each detector (may be empty).
+            fraction (array, float64):  The fraction of the response with
+                the second time constant (may be empty).
+            deconvolve (bool):  If True, remove the time constants instead
+                of applying them.
+            epsilon (float):  The regularization of the deconvolution.
+            fftlen (int):  The FFT length of the blocks.  Zero selects a
+                length from the time constants.
+            signals (list):  A list of float64 arrays, filtered in place.
+
+        Returns:
+            None.
+
+    )");
+
+    return;
+}
@@ -89,6 +89,48 @@ void project_signal_offsets(py::array_t <double> ref, py::list todslices,
     }
 }
 
+void add_ground_to_signal(py::array_t <double> ref,
+                          py::array_t <int64_t> pixels,
+                          py::array_t <double> amplitudes,
+                          int64_t offset) {
+    auto fast_ref = ref.mutable_unchecked <1>();
+    auto fast_pixels = pixels.unchecked <1>();
+    auto fast_amplitudes = amplitudes.unchecked <1>();
+    size_t nsamp = pixels.size();
+
+    #pragma omp parallel for schedule(static, 64)
+    for (size_t i = 0; i < nsamp; ++i) {
+        int64_t pixel = fast_pixels(i);
+        if (pixel < 0) continue;
+        fast_ref(i) += fast_amplitudes(offset + pixel);
+    }
+}
+
+void project_signal_ground(py::array_t <double> ref,
+                           py::array_t <int64_t> pixels,
+                           py::array_t <double> amplitudes,
+                           int64_t offset) {
+    auto fast_ref = ref.unchecked <1>();
+    auto fast_pixels = pixels.unchecked <1>();
+    auto fast_amplitudes = amplitudes.mutable_unchecked <1>();
+    size_t nsamp = pixels.size();
+
+    // Consecutive samples mostly fall in the same ground pixel, so the
+    // sums are accumulated over runs of samples before they are stored.
+    int64_t last_pixel = -1;
+    double sum = 0;
+    for (size_t i = 0; i < nsamp; ++i) {
+        int64_t pixel = fast_pixels(i);
+        if (pixel != last_pixel) {
+            if (last_pixel >= 0) fast_amplitudes(offset + last_pixel) += sum;
+            last_pixel = pixel;
+            sum = 0;
+        }
+        sum += fast_ref(i);
+    }
+    if (last_pixel >= 0) fast_amplitudes(offset + last_pixel) += sum;
+}
+
 void expand_matrix(py::array_t <double> compressed_matrix,
                    py::array_t <int64_t> local_to_global,
                    int64_t npix,
@@ -334,14 +376,365 @@ void accumulate_observation_matrix(py::array_t <double,
     }
 }
 
+template <typename T>
+bool noiseweight_obs_matrix(py::array_t <double, py::array::c_style> data,
+                            py::array_t <T, py::array::c_style> indices,
+                            py::array_t <T, py::array::c_style> indptr,
+                            py::array_t <double,
+                                         py::array::c_style |
+                                         py::array::forcecast> white_noise_cov,
+                            py::array_t <int64_t,
+                                         py::array::c_style |
+                                         py::array::forcecast> local_submaps,
+                            int64_t npix,
+                            int64_t nnz) {
+    // Left-multiply a CSR observation matrix by the block diagonal white noise
+    // covariance.  Row `pix + inz * npix` of the product is a linear combination
+    // of the `nnz` rows belonging to the same pixel, so if those rows share
+    // their sparsity pattern the product can be computed in place.  Returns
+    // false without touching the matrix if the patterns differ.
+    auto fast_data = data.mutable_unchecked <1>();
+    auto fast_indices = indices.template unchecked <1>();
+    auto fast_indptr = indptr.template unchecked <1>();
+    auto fast_cov = white_noise_cov.unchecked <3>();
+    auto fast_submaps = local_submaps.unchecked <1>();
+
+    size_t nsubmap = fast_cov.shape(0);
+    int64_t npix_submap = fast_cov.shape(1);
+    int64_t ncov = fast_cov.shape(2);
+
+    if ((int64_t)fast_indptr.shape(0) != npix * nnz + 1) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Observation matrix has " << fast_indptr.shape(0) - 1
+          << " rows, expected " << npix * nnz;
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+    if (ncov != nnz * (nnz + 1) / 2) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "White noise covariance has " << ncov
+          << " elements per pixel, expected " << nnz * (nnz + 1) / 2;
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    if ((npix_submap <= 0) || (npix % npix_submap != 0)) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Map of " << npix << " pixels cannot be divided into submaps of "
+          << npix_submap << " pixels";
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    // Every row pixel below npix now maps to a submap index below nglob
+
+    int64_t nglob = npix / npix_submap;
+    std::vector <int64_t> glob2loc(nglob, -1);
+    for (size_t isubmap = 0; isubmap < nsubmap; ++isubmap) {
+        const int64_t submap = fast_submaps(isubmap);
+        if ((submap < 0) || (submap >= nglob)) {
+            auto log = toast::Logger::get();
+            std::ostringstream o;
+            o << "Local submap " << submap << " is outside the " << nglob
+              << " submaps of the map";
+            log.error(o.str().c_str());
+            throw std::runtime_error(o.str().c_str());
+        }
+        glob2loc[submap] = isubmap;
+    }
+
+    // Verify that all rows of each pixel have identical column indices
+
+    bool consistent = true;
+    #pragma omp parallel for schedule(static, 64) reduction(&& : consistent)
+    for (int64_t pix = 0; pix < npix; ++pix) {
+        const int64_t start = fast_indptr(pix);
+        const int64_t len = fast_indptr(pix + 1) - start;
+        for (int64_t inz = 1; inz < nnz; ++inz) {
+            const int64_t row = pix + inz * npix;
+            const int64_t row_start = fast_indptr(row);
+            if (fast_indptr(row + 1) - row_start != len) {
+                consistent = false;
+                break;
+            }
+            for (int64_t k = 0; k < len; ++k) {
+                if (fast_indices(row_start + k) != fast_indices(start + k)) {
+                    consistent = false;
+                    break;
+                }
+            }
+        }
+    }
+    if (!consistent) return false;
+
+    #pragma omp parallel
+    {
+        std::vector <double> cov(nnz * nnz);
+        std::vector <int64_t> row_starts(nnz);
+        std::vector <double> temp(nnz);
+
+        #pragma omp for schedule(static, 64)
+        for (int64_t pix = 0; pix < npix; ++pix) {
+            const int64_t len = fast_indptr(pix + 1) - fast_indptr(pix);
+            if (len == 0) continue;
+            for (int64_t inz = 0; inz < nnz; ++inz) {
+                row_starts[inz] = fast_indptr(pix + inz * npix);
+            }
+
+            // Unpack the upper triangle of this pixel's covariance
+
+            const int64_t isubmap = glob2loc[pix / npix_submap];
+            const int64_t ipix = pix % npix_submap;
+            bool empty = true;
+            if (isubmap >= 0) {
+                int64_t icov = 0;
+                for (int64_t inz = 0; inz < nnz; ++inz) {
+                    for (int64_t jnz = inz; jnz < nnz; ++jnz) {
+                        const double value = fast_cov(isubmap, ipix, icov++);
+                        cov[inz * nnz + jnz] = value;
+                        cov[jnz * nnz + inz] = value;
+                        if (value != 0) empty = false;
+                    }
+                }
+            }
+
+            if (empty) {
+                // The covariance has no entries for this pixel
+                for (int64_t inz = 0; inz < nnz; ++inz) {
+                    double * row = &fast_data(row_starts[inz]);
+                    std::fill(row, row + len, 0);
+                }
+                continue;
+            }
+
+            for (int64_t k = 0; k < len; ++k) {
+                for (int64_t inz = 0; inz < nnz; ++inz) {
+                    double val = 0;
+                    for (int64_t jnz = 0; jnz < nnz; ++jnz) {
+                        val += cov[inz * nnz + jnz] * fast_data(row_starts[jnz] + k);
+                    }
+                    temp[inz] = val;
+                }
+                for (int64_t inz = 0; inz < nnz; ++inz) {
+                    fast_data(row_starts[inz] + k) = temp[inz];
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+template <typename T>
+void multiply_obs_matrix(py::array_t <double, py::array::c_style> data,
+                         py::array_t <T, py::array::c_style> indices,
+                         py::array_t <T, py::array::c_style> indptr,
+                         int64_t row_start,
+                         int64_t row_stop,
+                         py::array_t <double, py::array::c_style> maps,
+                         py::array_t <double, py::array::c_style> out,
+                         int64_t out_offset) {
+    // Multiply rows [row_start, row_stop) of a CSR matrix slice with a set
+    // of maps and add the result to rows starting at `out_offset` of `out`.
+    // The maps are stored pixel-major, one row of `nmap` values per matrix
+    // column, so every nonzero updates a contiguous row of the output.
+    auto fast_data = data.unchecked <1>();
+    auto fast_indices = indices.template unchecked <1>();
+    auto fast_indptr = indptr.template unchecked <1>();
+    auto fast_maps = maps.unchecked <2>();
+    auto fast_out = out.mutable_unchecked <2>();
+
+    int64_t ncol = fast_maps.shape(0);
+    int64_t nmap = fast_maps.shape(1);
+
+    if ((row_start < 0) || (row_stop < row_start)
+        || (row_stop >= (int64_t)fast_indptr.shape(0))) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Rows " << row_start << " - " << row_stop
+          << " are not in the observation matrix slice of "
+          << fast_indptr.shape(0) - 1 << " rows";
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+    if ((fast_out.shape(1) != nmap) || (out_offset < 0)
+        || (out_offset + row_stop - row_start > (int64_t)fast_out.shape(0))) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Output buffer of shape (" << fast_out.shape(0) << ", "
+          << fast_out.shape(1) << ") does not fit " << row_stop - row_start
+          << " rows of " << nmap << " maps at offset " << out_offset;
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int64_t row = row_start; row < row_stop; ++row) {
+        double * outrow = &fast_out(out_offset + row - row_start, 0);
+        for (int64_t k = fast_indptr(row); k < fast_indptr(row + 1); ++k) {
+            const int64_t col = fast_indices(k);
+            if ((col < 0) || (col >= ncol)) continue;
+            const double value = fast_data(k);
+            const double * maprow = &fast_maps(col, 0);
+            for (int64_t imap = 0; imap < nmap; ++imap) {
+                outrow[imap] += value * maprow[imap];
+            }
+        }
+    }
+
+    return;
+}
+
+py::tuple offset_steps(py::array_t <double, py::array::c_style> times,
+                       py::array_t <unsigned char, py::array::c_style> flags,
+                       py::array_t <int64_t,
+                                    py::array::c_style |
+                                    py::array::forcecast> firsts,
+                       py::array_t <int64_t,
+                                    py::array::c_style |
+                                    py::array::forcecast> lasts,
+                       double step_length,
+                       double gap_length,
+                       double detweight) {
+    // Divide the intervals [first, last] of one detector into offset steps.
+    // Runs of flagged samples longer than `gap_length` split an interval into
+    // segments at their midpoints, and every segment is split into steps of
+    // `step_length`, the last one being shorter.  This keeps the steps at the
+    // nominal length that the noise prior is built for.  Returns the first
+    // and last (exclusive) sample, the interval index and the diagonal
+    // preconditioner of every step.
+    auto fast_times = times.unchecked <1>();
+    auto fast_flags = flags.unchecked <1>();
+    auto fast_firsts = firsts.unchecked <1>();
+    auto fast_lasts = lasts.unchecked <1>();
+
+    int64_t nsamp = fast_times.shape(0);
+    size_t nival = fast_firsts.shape(0);
+
+    if ((int64_t)fast_flags.shape(0) != nsamp) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Flags have " << fast_flags.shape(0) << " samples, expected "
+          << nsamp;
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+    if ((size_t)fast_lasts.shape(0) != nival) {
+        auto log = toast::Logger::get();
+        std::ostringstream o;
+        o << "Got " << nival << " interval starts but " << fast_lasts.shape(0)
+          << " interval ends";
+        log.error(o.str().c_str());
+        throw std::runtime_error(o.str().c_str());
+    }
+
+    std::vector <int64_t> starts;
+    std::vector <int64_t> stops;
+    std::vector <int64_t> ivals;
+    std::vector <double> sigmasqs;
+    std::vector <int64_t> breaks;
+
+    for (size_t ival = 0; ival < nival; ++ival) {
+        int64_t first = std::max(fast_firsts(ival), (int64_t)0);
+        int64_t last = std::min(fast_lasts(ival) + 1, nsamp);
+        if (last <= first) continue;
+
+        // Segment boundaries at the middle of long flagged gaps
+
+        breaks.clear();
+        breaks.push_back(first);
+        int64_t gap_start = -1;
+        for (int64_t i = first; i < last; ++i) {
+            if (fast_flags(i) != 0) {
+                if (gap_start < 0) gap_start = i;
+            } else if (gap_start >= 0) {
+                if ((gap_start > first)
+                    && (fast_times(i) - fast_times(gap_start - 1) > gap_length)) {
+                    breaks.push_back((gap_start + i) / 2);
+                }
+                gap_start = -1;
+            }
+        }
+        breaks.push_back(last);
+
+        for (size_t iseg = 0; iseg + 1 < breaks.size(); ++iseg) {
+            const int64_t seg_first = breaks[iseg];
+            const int64_t seg_last = breaks[iseg + 1];
+            const double tstart = fast_times(seg_first);
+            const double length = fast_times(seg_last - 1) - tstart;
+            int64_t nstep = 1;
+            double tstep = length;
+            if ((step_length > 0) && (length > step_length)) {
+                nstep = (int64_t)std::ceil(length / step_length);
+                tstep = step_length;
+            }
+            int64_t istart = seg_first;
+            for (int64_t istep = 0; istep < nstep; ++istep) {
+                int64_t istop = seg_last;
+                if (istep < nstep - 1) {
+                    const double tstop = tstart + (istep + 1) * tstep;
+                    istop = istart;
+                    while ((istop < seg_last) && (fast_times(istop) < tstop)) {
+                        ++istop;
+                    }
+                }
+                if (istop == istart) continue;
+                int64_t ngood = 0;
+                for (int64_t i = istart; i < istop; ++i) {
+                    if (fast_flags(i) == 0) ++ngood;
+                }
+                double sigmasq = 1;
+                if (detweight != 0) sigmasq /= detweight;
+                if (ngood != 0) sigmasq /= ngood;
+                starts.push_back(istart);
+                stops.push_back(istop);
+                ivals.push_back(ival);
+                sigmasqs.push_back(sigmasq);
+                istart = istop;
+            }
+        }
+    }
+
+    size_t nstep = starts.size();
+    py::array_t <int64_t> ret_starts;
+    py::array_t <int64_t> ret_stops;
+    py::array_t <int64_t> ret_ivals;
+    py::array_t <double> ret_sigmasqs;
+    ret_starts.resize({nstep});
+    ret_stops.resize({nstep});
+    ret_ivals.resize({nstep});
+    ret_sigmasqs.resize({nstep});
+    std::copy(starts.begin(), starts.end(),
+              static_cast <int64_t *> (ret_starts.request().ptr));
+    std::copy(stops.begin(), stops.end(),
+              static_cast <int64_t *> (ret_stops.request().ptr));
+    std::copy(ivals.begin(), ivals.end(),
+              static_cast <int64_t *> (ret_ivals.request().ptr));
+    std::copy(sigmasqs.begin(), sigmasqs.end(),
+              static_cast <double *> (ret_sigmasqs.request().ptr));
+    return py::make_tuple(ret_starts, ret_stops, ret_ivals, ret_sigmasqs);
+}
+
 void init_todmap_mapmaker(py::module & m)
 {
     m.doc() = "Compiled kernels to support TOAST mapmaker";
 
     m.def("project_signal_offsets", &project_signal_offsets);
     m.def("add_offsets_to_signal", &add_offsets_to_signal);
+    m.def("project_signal_ground", &project_signal_ground);
+    m.def("add_ground_to_signal", &add_ground_to_signal);
+    m.def("offset_steps", &offset_steps);
     m.def("apply_flags_to_pixels", &apply_flags_to_pixels);
     m.def("accumulate_observation_matrix", &accumulate_observation_matrix);
     m.def("expand_matrix", &expand_matrix);
     m.def("build_template_covariance", &build_template_covariance);
+
+    // scipy.sparse uses 32bit indices whenever they are sufficient
+    m.def("noiseweight_obs_matrix", &noiseweight_obs_matrix <int32_t>);
+    m.def("noiseweight_obs_matrix", &noiseweight_obs_matrix <int64_t>);
+    m.def("multiply_obs_matrix", &multiply_obs_matrix <int32_t>);
+    m.def("multiply_obs_matrix", &multiply_obs_matrix <int64_t>);
 }
@@ -0,0 +1,79 @@
+
+// Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <_libtoast.hpp>
+
+
+void init_weather(py::module & m) {
+    m.def("weather_sample",
+          [](py::buffer times, py::buffer sites, py::buffer realizations,
+             py::buffer varindex, py::buffer prob,
+             py::array_t <double, py::array::c_style | py::array::forcecast> cdf) {
+              pybuffer_check_1D <double> (times);
+              pybuffer_check_1D <uint64_t> (sites);
+              pybuffer_check_1D <uint64_t> (realizations);
+              pybuffer_check_1D <uint64_t> (varindex);
+              pybuffer_check_1D <double> (prob);
+              py::buffer_info info_times = times.request();
+              py::buffer_info info_sites = sites.request();
+              py::buffer_info info_realizations = realizations.request();
+              py::buffer_info info_varindex = varindex.request();
+              py::buffer_info info_prob = prob.request();
+              size_t nsamp = info_times.size;
+              size_t nvar = info_varindex.size;
+              size_t nprob = info_prob.size;
+              if ((info_sites.size != nsamp) ||
+                  (info_realizations.size != nsamp) ||
+                  (cdf.ndim() != 4) || (cdf.shape(0) != 12) ||
+                  (cdf.shape(1) != 24) || (cdf.shape(3) != nprob) ||
+                  (nprob < 2)) {
+                  auto log = toast::Logger::get();
+                  std::ostringstream o;
+                  o << "Buffer sizes are not consistent.";
+                  log.error(o.str().c_str());
+                  throw std::runtime_error(o.str().c_str());
+              }
+              size_t ncdfvar = cdf.shape(2);
+              double * rawtimes = reinterpret_cast <double *> (info_times.ptr);
+              uint64_t * rawsites = reinterpret_cast <uint64_t *> (info_sites.ptr);
+              uint64_t * rawrealizations =
+                  reinterpret_cast <uint64_t *> (info_realizations.ptr);
+              uint64_t * rawvarindex =
+                  reinterpret_cast <uint64_t *> (info_varindex.ptr);
+              double * rawprob = reinterpret_cast <double *> (info_prob.ptr);
+              py::array_t <double> ret;
+              ret.resize({nsamp, nvar});
+              py::buffer_info info = ret.request();
+              double * raw = static_cast <double *> (info.ptr);
+              toast::weather_sample(nsamp, rawtimes, rawsites, rawrealizations,
+                                    nvar, rawvarindex, ncdfvar, nprob, rawprob,
+                                    cdf.data(), raw);
+              return ret;
+          }, py::arg("times"), py::arg("sites"), py::arg("realizations"),
+          py::arg("varindex"), py::arg("prob"), py::arg(
+              "cdf"), R"(
+        Sample weather variables for many times, sites and realizations.
+
+        Every value is drawn from its own random stream (keyed by the site and
+        realization, with the variable index and UTC hour as the counter) and
+        mapped through the inverse cumulative distribution function of the
+        corresponding month and hour.
+
+        Args:
+            times (array, float64):  The POSIX time of each sample.
+            sites (array, uint64):  The site index of each sample.
+            realizations (array, uint64):  The realization of each sample.
+            varindex (array, uint64):  The index of each variable to sample.
+            prob (array, float64):  The probability axis of the CDFs.
+            cdf (array, float64):  The (month, hour, variable, probability)
+                table of inverse cumulative distribution functions.
+
+        Returns:
+            (array):  The (sample, variable) values.
+
+    )");
+
+    return;
+}
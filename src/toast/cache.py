@@ -2,8 +2,14 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+import os
 import re
+import sys
 import ctypes
+import tempfile
+import weakref
+import zlib
+
 import numpy as np
 
 from .utils import (
@@ -21,23 +27,68 @@ from .utils import (
 )
 
 
+# The caches of this process that have a memory budget.  The budget limits
+# their total resident memory, so that every TOD and map owning a cache does
+# not get a budget of its own.
+_budget_caches = weakref.WeakSet()
+
+# Access counter shared by all caches, to find the least recently used
+# buffers across caches.
+_budget_clock = [0]
+
+
 class Cache(object):
     """Data cache with explicit memory management.
 
     This class acts as a dictionary of named arrays.  Each array may be
     multi-dimensional.
 
+    The memory of the caches may be limited to a budget.  The budget
+    applies to the total resident memory of all caches with a budget in
+    the process.  When a new buffer would exceed it, the least recently
+    referenced buffers of any of these caches are spilled to files in a
+    scratch directory and read back into memory when they are referenced
+    again.  Only buffers without any outstanding numpy references are
+    spilled, so the budget is not a hard limit.  The default budget (in
+    bytes) and scratch directory are taken from the TOAST_CACHE_BUDGET and
+    TOAST_CACHE_SPILL environment variables.  The scratch directory should
+    be on node-local storage.
+
     Args:
         pymem (bool): if True, use python memory rather than external
             allocations in C.  Only used for testing.
+        budget (int):  The memory budget of the process in bytes.  If None,
+            the memory of this cache is not limited.
+        spill_dir (str):  The directory for spilled buffers.  If None, the
+            default temporary directory is used.
+        compress (bool):  If True, compress the spilled buffers.
     """
 
-    def __init__(self, pymem=False):
+    def __init__(self, pymem=False, budget=None, spill_dir=None, compress=False):
         self._pymem = pymem
         self._buffers = dict()
         self._dtypes = dict()
         self._shapes = dict()
         self._aliases = dict()
+        if budget is None and "TOAST_CACHE_BUDGET" in os.environ:
+            budget = int(os.environ["TOAST_CACHE_BUDGET"])
+        if spill_dir is None:
+            spill_dir = os.environ.get("TOAST_CACHE_SPILL", None)
+        self._budget = budget
+        self._spill_dir = spill_dir
+        self._compress = compress
+        self._spilled = dict()
+        self._access = dict()
+        if self._budget is not None:
+            _budget_caches.add(self)
+
+    def __del__(self):
+        # Remove the spill files
+        try:
+            for path in self._spilled.values():
+                os.remove(path)
+        except Exception:
+            pass
 
     def __getitem__(self, key):
         return self.reference(key)
@@ -85,13 +136,17 @@ class Cache(object):
         """
         if pattern is None:
             # free all buffers
+            for path in self._spilled.values():
+                os.remove(path)
             self._aliases.clear()
             self._buffers.clear()
             self._dtypes.clear()
             self._shapes.clear()
+            self._spilled.clear()
+            self._access.clear()
         else:
             pat = re.compile(pattern)
-            names = list(self._buffers.keys())
+            names = self.keys()
             matching = list()
             for n in names:
                 mat = pat.match(n)
@@ -126,41 +181,130 @@ class Cache(object):
         flatshape = 1
         for dim in shape:
             flatshape *= dim
-        if self._pymem:
-            self._buffers[name] = np.zeros(flatshape, dtype=ttype)
-        else:
-            if ttype.char == "b":
-                self._buffers[name] = AlignedI8.zeros(flatshape)
-            elif ttype.char == "B":
-                self._buffers[name] = AlignedU8.zeros(flatshape)
-            elif ttype.char == "h":
-                self._buffers[name] = AlignedI16.zeros(flatshape)
-            elif ttype.char == "H":
-                self._buffers[name] = AlignedU16.zeros(flatshape)
-            elif ttype.char == "i":
-                self._buffers[name] = AlignedI32.zeros(flatshape)
-            elif ttype.char == "I":
-                self._buffers[name] = AlignedU32.zeros(flatshape)
-            elif (ttype.char == "q") or (ttype.char == "l"):
-                self._buffers[name] = AlignedI64.zeros(flatshape)
-            elif (ttype.char == "Q") or (ttype.char == "L"):
-                self._buffers[name] = AlignedU64.zeros(flatshape)
-            elif ttype.char == "f":
-                self._buffers[name] = AlignedF32.zeros(flatshape)
-            elif ttype.char == "d":
-                self._buffers[name] = AlignedF64.zeros(flatshape)
-            else:
-                msg = "Unsupported data typecode '{}'".format(ttype.char)
-                log.error(msg)
-                raise ValueError(msg)
+        self._make_room(flatshape * ttype.itemsize)
+        self._buffers[name] = self._allocate(ttype, flatshape)
         self._dtypes[name] = ttype
         self._shapes[name] = shape
+        self._touch(name)
         if self._pymem:
             return self._buffers[name].reshape(self._shapes[name])
         else:
             return self._buffers[name].array().reshape(self._shapes[name])
         return self._buffers[name]
 
+    def _allocate(self, ttype, flatshape):
+        """Allocate a flat buffer of zeros."""
+        log = Logger.get()
+        if self._pymem:
+            return np.zeros(flatshape, dtype=ttype)
+        if ttype.char == "b":
+            return AlignedI8.zeros(flatshape)
+        elif ttype.char == "B":
+            return AlignedU8.zeros(flatshape)
+        elif ttype.char == "h":
+            return AlignedI16.zeros(flatshape)
+        elif ttype.char == "H":
+            return AlignedU16.zeros(flatshape)
+        elif ttype.char == "i":
+            return AlignedI32.zeros(flatshape)
+        elif ttype.char == "I":
+            return AlignedU32.zeros(flatshape)
+        elif (ttype.char == "q") or (ttype.char == "l"):
+            return AlignedI64.zeros(flatshape)
+        elif (ttype.char == "Q") or (ttype.char == "L"):
+            return AlignedU64.zeros(flatshape)
+        elif ttype.char == "f":
+            return AlignedF32.zeros(flatshape)
+        elif ttype.char == "d":
+            return AlignedF64.zeros(flatshape)
+        else:
+            msg = "Unsupported data typecode '{}'".format(ttype.char)
+            log.error(msg)
+            raise ValueError(msg)
+
+    def _nbytes(self, name):
+        """The size of a buffer in bytes."""
+        n = self._dtypes[name].itemsize
+        for dim in self._shapes[name]:
+            n *= dim
+        return n
+
+    def _touch(self, name):
+        """Record an access to a buffer."""
+        _budget_clock[0] += 1
+        self._access[name] = _budget_clock[0]
+        return
+
+    def _make_room(self, nbytes):
+        """Spill buffers of all budgeted caches until nbytes more fit."""
+        if self._budget is None:
+            return
+        caches = list(_budget_caches)
+        resident = 0
+        for cache in caches:
+            resident += np.sum([cache._nbytes(x) for x in cache._buffers])
+        if resident + nbytes <= self._budget:
+            return
+        # Buffers only referenced by their cache, least recently used first.
+        # The reference count includes the dictionary and the argument.
+        candidates = list()
+        for cache in caches:
+            for x in cache._buffers:
+                if sys.getrefcount(cache._buffers[x]) <= 2:
+                    candidates.append((cache._access[x], cache, x))
+        candidates.sort(key=lambda x: x[0])
+        for _, cache, name in candidates:
+            if resident + nbytes <= self._budget:
+                break
+            resident -= cache._nbytes(name)
+            cache._spill(name)
+        return
+
+    def _spill(self, name):
+        """Write a buffer to the scratch directory and free its memory."""
+        if self._pymem:
+            data = self._buffers[name]
+        else:
+            data = self._buffers[name].array()
+        fd, path = tempfile.mkstemp(prefix="toast_cache_", dir=self._spill_dir)
+        with os.fdopen(fd, "wb") as f:
+            if self._compress:
+                f.write(zlib.compress(data.tobytes(), 1))
+            else:
+                data.tofile(f)
+        del data
+        self._spilled[name] = path
+        if not self._pymem:
+            self._buffers[name].clear()
+        del self._buffers[name]
+        return
+
+    def _load(self, name):
+        """Read a spilled buffer back into memory.
+
+        The data are copied into a new aligned buffer rather than memory
+        mapped, since the compiled kernels expect aligned cache memory.
+        """
+        path = self._spilled[name]
+        ttype = self._dtypes[name]
+        flatshape = self._nbytes(name) // ttype.itemsize
+        self._make_room(self._nbytes(name))
+        buf = self._allocate(ttype, flatshape)
+        if self._pymem:
+            data = buf
+        else:
+            data = buf.array()
+        if self._compress:
+            with open(path, "rb") as f:
+                data[:] = np.frombuffer(zlib.decompress(f.read()), dtype=ttype)
+        elif flatshape > 0:
+            data[:] = np.memmap(path, dtype=ttype, mode="r", shape=(flatshape,))
+        del data
+        os.remove(path)
+        del self._spilled[name]
+        self._buffers[name] = buf
+        return
+
     def put(self, name, data, replace=False):
         """Create a named data buffer to hold the provided data.
 
@@ -187,6 +331,8 @@ class Cache(object):
             realname = name
             if name in self._aliases:
                 realname = self._aliases[name]
+            if realname in self._spilled:
+                self._load(realname)
             addr = None
             if self._pymem:
                 p_ref = self._buffers[realname].ctypes.data_as(ctypes.c_void_p).value
@@ -236,7 +382,7 @@ class Cache(object):
         """
         if alias is None or name is None:
             raise ValueError("Cache name or alias cannot be None")
-        names = list(self._buffers.keys())
+        names = self.keys()
         if name not in names:
             raise RuntimeError(
                 "Data buffer {} does not exist for alias {}".format(name, alias)
@@ -267,7 +413,7 @@ class Cache(object):
             # Name is an alias. Do not remove the buffer
             del self._aliases[name]
             return
-        names = list(self._buffers.keys())
+        names = self.keys()
         if name not in names:
             raise KeyError("Data buffer {} does not exist".format(name))
 
@@ -279,14 +425,19 @@ class Cache(object):
         for key in aliases_to_remove:
             del self._aliases[key]
 
-        # Forcibly resize this buffer to length zero
-        if not self._pymem:
-            self._buffers[name].clear()
+        if name in self._spilled:
+            os.remove(self._spilled[name])
+            del self._spilled[name]
+        else:
+            # Forcibly resize this buffer to length zero
+            if not self._pymem:
+                self._buffers[name].clear()
 
-        # Remove actual buffer
-        del self._buffers[name]
+            # Remove actual buffer
+            del self._buffers[name]
         del self._dtypes[name]
         del self._shapes[name]
+        del self._access[name]
         return
 
     def exists(self, name):
@@ -302,8 +453,7 @@ class Cache(object):
         if name in self._aliases:
             # We have an alias with this name, so it exists.
             return True
-        names = list(self._buffers.keys())
-        if name in names:
+        if name in self._buffers or name in self._spilled:
             return True
         return False
 
@@ -315,6 +465,8 @@ class Cache(object):
         will NOT attempt to free the memory (you must manually use the
         destroy method).
 
+        If the buffer was spilled to disk, it is first read back into memory.
+
         Args:
             name (str): the name of the buffer to return.
 
@@ -329,6 +481,9 @@ class Cache(object):
         if name in self._aliases:
             # This is an alias
             realname = self._aliases[name]
+        if realname in self._spilled:
+            self._load(realname)
+        self._touch(realname)
         if self._pymem:
             return self._buffers[realname].reshape(self._shapes[realname])
         else:
@@ -341,7 +496,7 @@ class Cache(object):
             (list): List of key strings.
 
         """
-        return sorted(list(self._buffers.keys()))
+        return sorted(list(self._buffers.keys()) + list(self._spilled.keys()))
 
     def aliases(self):
         """Return a dictionary of all the aliases to keys in the cache.
@@ -352,9 +507,20 @@ class Cache(object):
         """
         return self._aliases.copy()
 
+    def spilled(self):
+        """Return the size of the buffers spilled to disk.
+
+        Returns:
+            (int):  The spilled data in bytes.
+
+        """
+        return int(np.sum([self._nbytes(x) for x in self._spilled]))
+
     def report(self, silent=False):
         """Report memory usage.
 
+        Spilled buffers are listed but they are not part of the memory.
+
         Args:
             silent (bool):  Count and return the memory without printing.
 
@@ -367,12 +533,18 @@ class Cache(object):
             log.info("Cache memory usage:")
         tot = 0
         for key in self.keys():
-            ref = self.reference(key)
-            sz = ref.nbytes
-            del ref
+            sz = self._nbytes(key)
+            if key in self._spilled:
+                if not silent:
+                    log.info(" - {:25} {:5.2f} MB (spilled)".format(key, sz / 2 ** 20))
+                continue
             tot += sz
             if not silent:
                 log.info(" - {:25} {:5.2f} MB".format(key, sz / 2 ** 20))
         if not silent:
             log.info(" {:27} {:5.2f} MB".format("TOTAL", tot / 2 ** 20))
+            if len(self._spilled) > 0:
+                log.info(
+                    " {:27} {:5.2f} MB".format("SPILLED", self.spilled() / 2 ** 20)
+                )
         return tot
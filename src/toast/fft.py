@@ -13,8 +13,9 @@ def r1d_forward(indata):
     """High level forward FFT interface to internal library.
 
     This function uses the internal store of FFT plans to do a forward
-    1D real FFT.  Data is copied into the internal aligned memory
-    buffer inside the plan and the result is copied out and returned.
+    1D real FFT.  The plan is executed directly on the input data and on a
+    newly allocated output array, without passing through the internal
+    buffers of the plan.
 
     If a 2D array is passed, the first dimension is assumed to be the number of
     FFTs to batch at once.
@@ -41,27 +42,19 @@ def r1d_forward(indata):
     store = FFTPlanReal1DStore.get()
     plan = store.forward(length, count)
 
-    if count == 1:
-        plan.tdata(0)[:] = indata
-    else:
-        for indx in range(count):
-            plan.tdata(indx)[:] = indata[indx]
-    plan.exec()
-    if count == 1:
-        return np.array(plan.fdata(0))
-    else:
-        ret = np.zeros_like(indata)
-        for indx in range(count):
-            ret[indx, :] = plan.fdata(indx)
-        return ret
+    indata = np.ascontiguousarray(indata, dtype=np.float64)
+    ret = np.empty_like(indata)
+    plan.exec(indata, ret)
+    return ret
 
 
 def r1d_backward(indata):
     """High level backward FFT interface to internal library.
 
     This function uses the internal store of FFT plans to do a backward
-    1D real FFT.  Data is copied into the internal aligned memory
-    buffer inside the plan and the result is copied out and returned.
+    1D real FFT.  The plan is executed directly on the input data and on a
+    newly allocated output array, without passing through the internal
+    buffers of the plan.
 
     If a 2D array is passed, the first dimension is assumed to be the number of
     FFTs to batch at once.
@@ -89,16 +82,7 @@ def r1d_backward(indata):
     store = FFTPlanReal1DStore.get()
     plan = store.backward(length, count)
 
-    if count == 1:
-        plan.fdata(0)[:] = indata
-    else:
-        for indx in range(count):
-            plan.fdata(indx)[:] = indata[indx]
-    plan.exec()
-    if count == 1:
-        return np.array(plan.tdata(0))
-    else:
-        ret = np.zeros_like(indata)
-        for indx in range(count):
-            ret[indx, :] = plan.tdata(indx)
-        return ret
+    indata = np.ascontiguousarray(indata, dtype=np.float64)
+    ret = np.empty_like(indata)
+    plan.exec(indata, ret)
+    return ret
@@ -2,6 +2,11 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
-from .psd_math import autocov_psd, crosscov_psd
+from .psd_math import (
+    autocov_psd,
+    crosscov_psd,
+    fit_psds,
+    analytic_noise_from_psds,
+)
 
 from .noise_estimation import OpNoiseEstim
@@ -109,10 +109,10 @@ class OpNoiseEstim:
 
         for obs in data.obs:
             tod = obs["tod"]
-            if len(tod.local_dets) < len(tod.detectors):
-                raise RuntimeError(
-                    "Noise estimation does not work on " "detector-split data"
-                )
+            # Detector pairs must be on the same process, so the data is
+            # temporarily distributed by time.
+            detranks, _ = tod.grid_size
+            tod.redistribute(1)
             dets = {}
             for idet, det in enumerate(tod.detectors):
                 dets[det] = idet
@@ -179,10 +179,6 @@ class OpNoiseEstim:
                     gap_stop_nsum = min(offset + nsamp, gap_stop_nsum - offset)
                     gapflags_nsum[gap_start:gap_stop_nsum] = True
 
-            # FIXME: This operator needs to handle situations where
-            # det1 and det2 are not on the same process.  Then the
-            # check at the top of the loop can be removed.
-
             for det1, det2 in pairs:
                 if det1 not in dets or det2 not in dets:
                     # User-specified pair is invalid
@@ -212,6 +208,13 @@ class OpNoiseEstim:
                     det2,
                     intervals,
                 )
+                del signal1
+                del signal2
+                del flags1
+                del flags2
+
+            del timestamps
+            tod.redistribute(detranks)
 
         return
 
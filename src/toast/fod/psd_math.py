@@ -10,9 +10,9 @@ from ..mpi import MPI
 
 from ..timing import function_timer
 
-from .._libtoast import fod_autosums, fod_crosssums
+from .._libtoast import fod_autosums, fod_crosssums, fod_fit_psds
 
-from ..tod import flagged_running_average
+from ..tod import flagged_running_average, AnalyticNoise
 
 
 def highpass_flagged_signal(sig, good, naverage):
@@ -338,3 +338,132 @@ def smooth_with_hits(hits, cov, wbin):
     smooth_cov[good] /= smooth_hits[good]
 
     return smooth_hits, smooth_cov
+
+
+@function_timer
+def fit_psds(
+    freqs,
+    psds,
+    weights=None,
+    NET=None,
+    fknee=None,
+    alpha=None,
+    fmin=None,
+    fit_fmin=False,
+    maxiter=100,
+    tol=1.0e-10,
+):
+    """Fit the analytic noise model to a batch of PSDs.
+
+    The model NET^2 (f^alpha + fknee^alpha) / (f^alpha + fmin^alpha) used by
+    AnalyticNoise is fitted to the logarithm of every PSD in one threaded
+    call to compiled code.  By default the starting NET is estimated from
+    the highest quarter of the frequencies, the starting knee frequency is
+    where the PSD first exceeds twice the white noise level (scanning down
+    from the highest frequency) and the starting slope is one.  The high
+    pass frequency fmin is poorly constrained by most PSDs, so it is only
+    fitted if `fit_fmin` is True.  Note that the logarithm of a periodogram
+    averaged over N modes is biased low by about 1 / N, which translates
+    directly into the fitted NET^2.
+
+    Args:
+        freqs (array):  The frequencies of the PSD bins in Hz.
+        psds (array):  The (npsd, nfreq) PSDs.
+        weights (array):  Optional (npsd, nfreq) inverse uncertainties of
+            the log PSDs.  For a periodogram averaged over N modes this is
+            about sqrt(N).
+        NET (array):  Optional starting NET of each PSD.
+        fknee (array):  Optional starting knee frequency of each PSD.
+        alpha (array):  Optional starting slope of each PSD.
+        fmin (array):  Optional (starting) high pass frequency of each PSD.
+            Defaults to a tenth of the lowest positive frequency.
+        fit_fmin (bool):  Also fit fmin.
+        maxiter (int):  The maximum number of iterations.
+        tol (float):  The relative chi^2 improvement for convergence.
+
+    Returns:
+        (tuple):  The (npsd, 4) best fit (NET, fknee, alpha, fmin), their
+            (npsd, 4, 4) covariances and the chi^2 of each fit.
+
+    """
+    freqs = np.ascontiguousarray(freqs, dtype=np.float64)
+    psds = np.ascontiguousarray(np.atleast_2d(psds), dtype=np.float64)
+    npsd, nfreq = psds.shape
+    if nfreq != freqs.size:
+        raise RuntimeError("PSDs and frequencies have different sizes")
+
+    positive = freqs > 0
+    if not np.any(positive):
+        raise RuntimeError("Cannot fit PSDs without positive frequencies")
+    high = positive & (freqs >= np.percentile(freqs[positive], 75))
+
+    params = np.zeros([npsd, 4], dtype=np.float64)
+    for ipsd, psd in enumerate(psds):
+        white = np.median(psd[high])
+        params[ipsd, 0] = np.sqrt(white)
+        above = np.where(positive & (psd > 2 * white))[0]
+        below = np.where(positive & (psd <= 2 * white))[0]
+        if above.size > 0 and below.size > 0 and above[-1] < below[-1]:
+            params[ipsd, 1] = freqs[above[-1]]
+        else:
+            params[ipsd, 1] = 2 * np.amin(freqs[positive])
+    params[:, 2] = 1.0
+    params[:, 3] = 0.1 * np.amin(freqs[positive])
+    for ipar, value in enumerate([NET, fknee, alpha, fmin]):
+        if value is not None:
+            params[:, ipar] = value
+
+    if weights is None:
+        weights = np.empty(shape=0, dtype=np.float64)
+    else:
+        weights = np.ascontiguousarray(weights, dtype=np.float64)
+    fixed = np.array([0, 0, 0, not fit_fmin], dtype=np.uint8)
+    cov = np.zeros([npsd, 4, 4], dtype=np.float64)
+    chi2 = np.zeros(npsd, dtype=np.float64)
+
+    fod_fit_psds(freqs, psds, weights, fixed, maxiter, tol, params, cov, chi2)
+
+    return params, cov, chi2
+
+
+@function_timer
+def analytic_noise_from_psds(detectors, rate, freqs, psds, **kwargs):
+    """Build an AnalyticNoise model from measured PSDs.
+
+    The PSDs are fitted with fit_psds(), so that later operators can use
+    the analytic noise model instead of interpolating tabulated PSDs.
+
+    Args:
+        detectors (list):  The detector names.
+        rate (float or dict):  The sample rate in Hz, or a dictionary of
+            sample rates per detector.
+        freqs (array):  The frequencies of the PSD bins in Hz.
+        psds (dict or array):  The PSD of each detector, either as a
+            dictionary or as an (ndet, nfreq) array in the order of
+            `detectors`.
+        kwargs:  Passed to fit_psds().
+
+    Returns:
+        (tuple):  The AnalyticNoise model and a dictionary with the (4, 4)
+            covariance of (NET, fknee, alpha, fmin) for each detector.
+
+    """
+    if isinstance(psds, dict):
+        psds = np.vstack([psds[det] for det in detectors])
+    params, cov, _ = fit_psds(freqs, psds, **kwargs)
+    if not isinstance(rate, dict):
+        rate = {det: rate for det in detectors}
+
+    # AnalyticNoise requires the knee frequency to exceed the high pass
+    params[:, 1] = np.maximum(params[:, 1], params[:, 3])
+
+    noise = AnalyticNoise(
+        detectors=detectors,
+        rate={det: rate[det] for det in detectors},
+        NET={det: params[idet, 0] for idet, det in enumerate(detectors)},
+        fknee={det: params[idet, 1] for idet, det in enumerate(detectors)},
+        alpha={det: params[idet, 2] for idet, det in enumerate(detectors)},
+        fmin={det: params[idet, 3] for idet, det in enumerate(detectors)},
+    )
+    covs = {det: cov[idet] for idet, det in enumerate(detectors)}
+    return noise, covs
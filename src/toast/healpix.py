@@ -301,7 +301,7 @@ class Pixels(object):
         inpix = ensure_buffer_i64(nestpix)
         n = len(inpix)
         out = AlignedI64(n)
-        self.hpix.ring2nest(inpix, out)
+        self.hpix.nest2ring(inpix, out)
         if n == 1:
             if object_ndim(nestpix) == 1:
                 return out.array()
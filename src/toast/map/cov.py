@@ -13,6 +13,26 @@ from .._libtoast import cov_mult_diag, cov_apply_diag, cov_eigendecompose_diag
 from .pixels import DistPixels
 
 
+def _node_data(dist):
+    """Return the submaps of a distributed map updated by this process.
+
+    For node-shared data, this is the node range of this process.  Otherwise
+    it is all local data.
+
+    Args:
+        dist (DistPixels): The distributed map.
+
+    Returns:
+        (tuple):  The number of submaps and the flat view of their data.
+
+    """
+    if dist.flatdata is None:
+        return 0, np.empty(shape=0, dtype=np.float64)
+    first, nsub = dist.node_range()
+    nelem = dist.npix_submap * dist.nnz
+    return nsub, dist.flatdata[first * nelem : (first + nsub) * nelem]
+
+
 @function_timer
 def covariance_invert(npp, threshold, rcond=None):
     """Invert a diagonal noise covariance.
@@ -32,9 +52,7 @@ def covariance_invert(npp, threshold, rcond=None):
 
     """
     mapnnz = int(((np.sqrt(8 * npp.nnz) - 1) / 2) + 0.5)
-    nppdata = npp.flatdata
-    if nppdata is None:
-        nppdata = np.empty(shape=0, dtype=np.float64)
+    nsub, nppdata = _node_data(npp)
     if rcond is not None:
         if rcond.npix != npp.npix:
             raise RuntimeError(
@@ -48,18 +66,22 @@ def covariance_invert(npp, threshold, rcond=None):
         if rcond.nnz != 1:
             raise RuntimeError("condition number map should have NNZ = 1")
 
-        rdata = rcond.flatdata
-        if rdata is None:
-            rdata = np.empty(shape=0, dtype=np.float64)
+        if rcond.shared != npp.shared:
+            raise RuntimeError(
+                "covariance matrix and condition number map must both be node-shared"
+            )
+        _, rdata = _node_data(rcond)
         cov_eigendecompose_diag(
-            npp.nsubmap, npp.npix_submap, mapnnz, nppdata, rdata, threshold, True
+            nsub, npp.npix_submap, mapnnz, nppdata, rdata, threshold, True
         )
+        rcond.node_barrier()
 
     else:
-        temp = np.zeros(shape=(npp.nsubmap * npp.npix_submap), dtype=np.float64)
+        temp = np.zeros(shape=(nsub * npp.npix_submap), dtype=np.float64)
         cov_eigendecompose_diag(
-            npp.nsubmap, npp.npix_submap, mapnnz, nppdata, temp, threshold, True
+            nsub, npp.npix_submap, mapnnz, nppdata, temp, threshold, True
         )
+    npp.node_barrier()
     return
 
 
@@ -87,14 +109,13 @@ def covariance_multiply(npp1, npp2):
         raise RuntimeError("covariance matrices must have same submap size")
     if npp1.nnz != npp2.nnz:
         raise RuntimeError("covariance matrices must have same NNZ values")
+    if npp1.shared != npp2.shared:
+        raise RuntimeError("covariance matrices must both be node-shared")
 
-    npp1data = npp1.flatdata
-    if npp1data is None:
-        npp1data = np.empty(shape=0, dtype=np.float64)
-    npp2data = npp2.flatdata
-    if npp2data is None:
-        npp2data = np.empty(shape=0, dtype=np.float64)
-    cov_mult_diag(npp1.nsubmap, npp1.npix_submap, mapnnz, npp1data, npp2data)
+    nsub, npp1data = _node_data(npp1)
+    _, npp2data = _node_data(npp2)
+    cov_mult_diag(nsub, npp1.npix_submap, mapnnz, npp1data, npp2data)
+    npp1.node_barrier()
     return
 
 
@@ -121,14 +142,13 @@ def covariance_apply(npp, m):
         raise RuntimeError("covariance matrix and map must have same submap size")
     if m.nnz != mapnnz:
         raise RuntimeError("covariance matrix and map have incompatible NNZ values")
+    if m.shared != npp.shared:
+        raise RuntimeError("covariance matrix and map must both be node-shared")
 
-    nppdata = npp.flatdata
-    if nppdata is None:
-        nppdata = np.empty(shape=0, dtype=np.float64)
-    mdata = m.flatdata
-    if mdata is None:
-        mdata = np.empty(shape=0, dtype=np.float64)
-    cov_apply_diag(npp.nsubmap, npp.npix_submap, mapnnz, nppdata, mdata)
+    nsub, nppdata = _node_data(npp)
+    _, mdata = _node_data(m)
+    cov_apply_diag(nsub, npp.npix_submap, mapnnz, nppdata, mdata)
+    m.node_barrier()
     return
 
 
@@ -151,16 +171,12 @@ def covariance_rcond(npp):
 
     threshold = np.finfo(np.float64).eps
 
-    nppdata = npp.flatdata
-    if nppdata is None:
-        nppdata = np.empty(shape=0, dtype=np.float64)
-
-    rdata = rcond.flatdata
-    if rdata is None:
-        rdata = np.empty(shape=0, dtype=np.float64)
+    nsub, nppdata = _node_data(npp)
+    _, rdata = _node_data(rcond)
 
     cov_eigendecompose_diag(
-        npp.nsubmap, npp.npix_submap, mapnnz, nppdata, rdata, threshold, False
+        nsub, npp.npix_submap, mapnnz, nppdata, rdata, threshold, False
     )
+    rcond.node_barrier()
 
     return rcond
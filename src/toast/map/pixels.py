@@ -8,7 +8,7 @@ import numpy as np
 
 from ..timing import function_timer, Timer
 
-from ..mpi import MPI
+from ..mpi import MPI, MPIShared
 
 import healpy as hp
 
@@ -32,6 +32,17 @@ class DistPixels(object):
     locally, the lowest-rank process that has a given submap is the
     "owner" for operations like serialization.
 
+    In node-shared mode, the processes of a node allocate a single shared
+    memory buffer at construction, which holds the union of the node's
+    submaps.  These become the local submaps of every process on the node,
+    while process_submaps keeps the submaps of the process itself.  Shared
+    data must only be modified by one process per node, or by every
+    process on its own node_range() of local submaps followed by
+    node_barrier().  Accumulation (see OpAccumDiag) goes into a buffer of
+    the process submaps, which reduce_node() adds to the shared buffer, and
+    allreduce() only has to reduce between one process per node.
+    Construction is collective over the communicator in this mode.
+
     Args:
         data (toast.Data) : TOAST data object containing the
             pixelization metadata
@@ -43,6 +54,8 @@ class DistPixels(object):
         nnz (int): the number of values per pixel.
         nest (bool): nested pixel order flag
         pixels (str):  cache prefix used for pixel numbers
+        node_shared (bool):  If True, store one copy of the data per node
+            in shared memory.
     """
 
     def __init__(
@@ -56,6 +69,7 @@ class DistPixels(object):
         local_submaps=None,  # if data is None
         nest=True,
         pixels="pixels",
+        node_shared=False,
     ):
         if data is None:
             self._npix = npix
@@ -84,12 +98,38 @@ class DistPixels(object):
         self._cache = Cache()
         self._commsize = 5000000
 
+        # Node-shared mode is only meaningful with a communicator
+        self._node_shared = node_shared and (self._comm is not None)
+        self._shmem = None
+        self._nodecomm = None
+        self._leadercomm = None
+        self._process_submaps = None
+
         # our data is a 3D array of submap, pixel, values
         # we allocate this as a contiguous block
 
         self.data = None
         self.flatdata = None
-        if self._local_submaps is None:
+        if self._node_shared:
+            nodecomm = self._comm.Split_type(MPI.COMM_TYPE_SHARED, 0)
+            color = 0 if nodecomm.rank == 0 else MPI.UNDEFINED
+            leadercomm = self._comm.Split(color, self._comm.rank)
+            if leadercomm == MPI.COMM_NULL:
+                leadercomm = None
+            if self._local_submaps is None:
+                my_submaps = np.zeros(0, dtype=np.int64)
+            else:
+                my_submaps = np.array(self._local_submaps, dtype=np.int64)
+            node_submaps = np.unique(
+                np.hstack(nodecomm.allgather(my_submaps)).astype(np.int64)
+            )
+            if len(node_submaps) > 0 and (
+                self._npix_submap * node_submaps.max() > self._npix
+            ):
+                raise RuntimeError("local submap indices out of range")
+            self._process_submaps = my_submaps
+            self._share(nodecomm, leadercomm, node_submaps)
+        elif self._local_submaps is None:
             self._nsub = 0
         else:
             if len(self._local_submaps) == 0:
@@ -117,6 +157,8 @@ class DistPixels(object):
             del self._glob2loc
         if self.data is not None:
             del self.data
+        self.flatdata = None
+        self._shmem = None
         self._cache.clear()
 
     @property
@@ -144,6 +186,11 @@ class DistPixels(object):
         """(array): The list of local submaps or None if process has no data."""
         return self._local_submaps
 
+    @property
+    def global2local(self):
+        """(array): The local submap of each global submap (-1 if not local)."""
+        return self._glob2loc
+
     @property
     def npix_submap(self):
         """(int): The number of pixels in each submap."""
@@ -159,6 +206,81 @@ class DistPixels(object):
         """(bool): If True, data is HEALPix NESTED ordering."""
         return self._nest
 
+    @property
+    def process_submaps(self):
+        """(array): The submaps of this process (a subset of node-shared)."""
+        if self._process_submaps is None:
+            return self._local_submaps
+        return self._process_submaps
+
+    @property
+    def shared(self):
+        """(bool): If True, the data are shared by the processes of a node."""
+        return self._nodecomm is not None
+
+    def node_range(self):
+        """Find the local submaps that this process updates.
+
+        The local submaps of node-shared data are split between the
+        processes of the node, so that in-place operations can run in
+        parallel without overlapping writes.  Otherwise this is the full
+        range of local submaps.
+
+        Returns:
+            (tuple):  The first local submap and the number of submaps.
+
+        """
+        if self._nodecomm is None:
+            return (0, self._nsub)
+        nproc = self._nodecomm.size
+        rank = self._nodecomm.rank
+        nsub = self._nsub // nproc
+        leftover = self._nsub % nproc
+        first = rank * nsub + min(rank, leftover)
+        if rank < leftover:
+            nsub += 1
+        return (first, nsub)
+
+    @property
+    def node_rank(self):
+        """(int): The rank of this process among those sharing the data."""
+        if self._nodecomm is None:
+            return 0
+        return self._nodecomm.rank
+
+    def node_barrier(self):
+        """Wait until all processes of the node have updated shared data."""
+        if self._nodecomm is not None:
+            self._nodecomm.barrier()
+        return
+
+    def _share(self, nodecomm, leadercomm, node_submaps):
+        """Allocate the node-shared buffer of the given submaps.
+
+        The buffer is initialized to zero.  A node without any submaps has
+        no buffer, but still takes part in the node synchronization and the
+        reduction between nodes.
+
+        """
+        self._nodecomm = nodecomm
+        self._leadercomm = leadercomm
+        self._local_submaps = node_submaps
+        self._nsub = len(node_submaps)
+        if self._nsub == 0:
+            return
+        self._shmem = MPIShared(
+            (self._nsub, self._npix_submap, self._nnz), self._dtype, nodecomm
+        )
+        self._glob2loc = self._cache.create("glob2loc", np.int64, (self._nglob,))
+        self._glob2loc[:] = -1
+        self._glob2loc[node_submaps] = np.arange(self._nsub)
+        self.data = self._shmem.data
+        self.flatdata = self.data.view()
+        self.flatdata.shape = tuple([self._nsub * self._npix_submap * self._nnz])
+        # The buffer must be initialized before anyone writes into it
+        nodecomm.barrier()
+        return
+
     @function_timer
     def global_to_local(self, gl):
         """Convert global pixel indices into the local submap and pixel.
@@ -181,6 +303,26 @@ class DistPixels(object):
             (DistPixels): A copy of the object.
 
         """
+        if self.shared:
+            # Reuse the node communicators and copy the node range
+            ret = DistPixels(
+                None,
+                comm=self._comm,
+                npix=self._npix,
+                npix_submap=self._npix_submap,
+                local_submaps=None,
+                nnz=(self._nnz if nnz is None else nnz),
+                dtype=self._dtype,
+            )
+            ret._node_shared = True
+            ret._process_submaps = self._process_submaps
+            ret._share(self._nodecomm, self._leadercomm, self._local_submaps)
+            if copy:
+                if self.data is not None:
+                    first, nsub = self.node_range()
+                    ret.data[first : first + nsub] = self.data[first : first + nsub]
+                ret.node_barrier()
+            return ret
         ret = DistPixels(
             None,
             comm=self._comm,
@@ -213,6 +355,64 @@ class DistPixels(object):
             nsub = allsub
         return nsub
 
+    @function_timer
+    def reduce_node(self, local, comm_bytes=None):
+        """Add the data of the processes of a node to the local data.
+
+        This is collective over the node.  In node-shared mode, the data of
+        all processes on the node are summed into the shared buffer, one
+        buffer of submaps at a time and with each buffer added by a
+        different process.  Otherwise the data of this process are added.
+
+        Args:
+            local (array):  The (submap, pixel, value) data of this process,
+                one submap for each of process_submaps.
+            comm_bytes (int): The approximate message size to use.
+
+        Returns:
+            None.
+
+        """
+        if not self.shared:
+            if self.data is not None:
+                self.data += local
+            return
+
+        if comm_bytes is None:
+            comm_bytes = self._commsize
+        comm_submap = min(self._comm_nsubmap(comm_bytes), max(self._nsub, 1))
+
+        sendbuf = np.zeros(
+            comm_submap * self._npix_submap * self._nnz, dtype=self._dtype
+        )
+        sendview = sendbuf.reshape(comm_submap, self._npix_submap, self._nnz)
+
+        recvbuf = np.zeros(
+            comm_submap * self._npix_submap * self._nnz, dtype=self._dtype
+        )
+        recvview = recvbuf.reshape(comm_submap, self._npix_submap, self._nnz)
+
+        # The location of the process submaps in the shared buffer
+        nodeloc = np.zeros(0, dtype=np.int64)
+        if len(self._process_submaps) > 0:
+            nodeloc = self._glob2loc[self._process_submaps]
+
+        nodesize = self._nodecomm.size
+        for ibuf, submap_off in enumerate(range(0, self._nsub, comm_submap)):
+            ncomm = min(comm_submap, self._nsub - submap_off)
+            ind = np.flatnonzero(
+                np.logical_and(nodeloc >= submap_off, nodeloc < submap_off + ncomm)
+            )
+            sendview[nodeloc[ind] - submap_off] = local[ind]
+            root = ibuf % nodesize
+            self._nodecomm.Reduce(sendbuf, recvbuf, op=MPI.SUM, root=root)
+            if self._nodecomm.rank == root:
+                self.data[submap_off : submap_off + ncomm] += recvview[:ncomm]
+            sendbuf.fill(0)
+
+        self._nodecomm.barrier()
+        return
+
     @function_timer
     def allreduce(self, comm_bytes=None):
         """Perform a buffered allreduce of the pixel domain data.
@@ -229,6 +429,9 @@ class DistPixels(object):
 
         if comm_bytes is None:
             comm_bytes = self._commsize
+        if self.shared:
+            self._allreduce_node(comm_bytes)
+            return
         comm_submap = self._comm_nsubmap(comm_bytes)
         nsub = int(self._npix / self._npix_submap)
 
@@ -285,6 +488,66 @@ class DistPixels(object):
 
         return
 
+    @function_timer
+    def _allreduce_node(self, comm_bytes):
+        """Reduce the node-shared data between the nodes.
+
+        The processes of a node have accumulated into the same shared
+        buffer, so only the node leaders reduce it among themselves and
+        copy the result back.
+
+        """
+        # All processes must have finished updating the shared data
+        self._nodecomm.barrier()
+        leadercomm = self._leadercomm
+        if leadercomm is not None and leadercomm.size > 1:
+            comm_submap = self._comm_nsubmap(comm_bytes)
+            nsub = int(self._npix / self._npix_submap)
+
+            sendbuf = np.zeros(
+                comm_submap * self._npix_submap * self._nnz, dtype=self._dtype
+            )
+            sendview = sendbuf.reshape(comm_submap, self._npix_submap, self._nnz)
+
+            recvbuf = np.zeros(
+                comm_submap * self._npix_submap * self._nnz, dtype=self._dtype
+            )
+            recvview = recvbuf.reshape(comm_submap, self._npix_submap, self._nnz)
+
+            # Skip the buffers that have no submaps on any node
+            hit = np.zeros(nsub, dtype=np.int32)
+            hit[self._local_submaps] = 1
+            leadercomm.Allreduce(MPI.IN_PLACE, hit, op=MPI.MAX)
+
+            submap_off = 0
+            ncomm = comm_submap
+
+            while submap_off < nsub:
+                if submap_off + ncomm > nsub:
+                    ncomm = nsub - submap_off
+                if np.sum(hit[submap_off : submap_off + ncomm]) > 0:
+                    # A node without submaps only contributes zeros
+                    locs = list()
+                    if self._glob2loc is not None:
+                        for c in range(ncomm):
+                            loc = self._glob2loc[submap_off + c]
+                            if loc >= 0:
+                                sendview[c, :, :] = self.data[loc, :, :]
+                                locs.append((c, loc))
+
+                    leadercomm.Allreduce(sendbuf, recvbuf, op=MPI.SUM)
+
+                    for c, loc in locs:
+                        self.data[loc, :, :] = recvview[c, :, :]
+
+                    sendbuf.fill(0)
+                    recvbuf.fill(0)
+
+                submap_off += ncomm
+
+        self._nodecomm.barrier()
+        return
+
     @function_timer
     def read_healpix_fits(self, path, comm_bytes=None):
         """Read and broadcast a HEALPix FITS table.
@@ -310,6 +573,11 @@ class DistPixels(object):
             comm_bytes = self._commsize
         comm_submap = self._comm_nsubmap(comm_bytes)
 
+        # Only one process per node copies into node-shared data
+        local_submaps = self._local_submaps
+        if self.shared and self._nodecomm.rank != 0:
+            local_submaps = []
+
         # we make the assumption that FITS binary tables are still stored in
         # blocks of 2880 bytes just like always...
         dbytes = self._dtype(1).itemsize
@@ -393,7 +661,7 @@ class DistPixels(object):
                     self._comm.Bcast(buf, root=0)
                 # loop over these submaps, and copy any that we are assigned
                 for sm in range(submap_off, submap_off + comm_submap):
-                    if sm in self._local_submaps:
+                    if sm in local_submaps:
                         loc = self._glob2loc[sm]
                         self.data[loc, :, :] = view[sm - submap_off, :, :]
                 out_off = 0
@@ -407,9 +675,10 @@ class DistPixels(object):
                 self._comm.Bcast(buf, root=0)
             # loop over these submaps, and copy any that we are assigned
             for sm in range(submap_off, submap_off + comm_submap):
-                if sm in self._local_submaps:
+                if sm in local_submaps:
                     loc = self._glob2loc[sm]
                     self.data[loc, :, :] = view[sm - submap_off, :, :]
+        self.node_barrier()
         return
 
     @function_timer
@@ -435,6 +704,11 @@ class DistPixels(object):
             comm_bytes = self._commsize
         comm_submap = self._comm_nsubmap(comm_bytes)
 
+        # Only one process per node copies into node-shared data
+        local_submaps = self._local_submaps
+        if self.shared and self._nodecomm.rank != 0:
+            local_submaps = []
+
         # we make the assumption that FITS binary tables are still stored in
         # blocks of 2880 bytes just like always...
         dbytes = self._dtype(1).itemsize
@@ -481,7 +755,7 @@ class DistPixels(object):
                     self._comm.Bcast(buf, root=0)
                 # loop over these submaps, and copy any that we are assigned
                 for sm in range(submap_off, submap_off + comm_submap):
-                    if sm in self._local_submaps:
+                    if sm in local_submaps:
                         loc = self._glob2loc[sm]
                         self.data[loc, :, :] = view[sm - submap_off, :, :]
                 out_off = 0
@@ -496,9 +770,10 @@ class DistPixels(object):
                 self._comm.Bcast(buf, root=0)
             # loop over these submaps, and copy any that we are assigned
             for sm in range(submap_off, submap_off + comm_submap):
-                if sm in self._local_submaps:
+                if sm in local_submaps:
                     loc = self._glob2loc[sm]
                     self.data[loc, :, :] = view[sm - submap_off, :, :]
+        self.node_barrier()
         return
 
     @function_timer
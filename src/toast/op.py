@@ -2,6 +2,58 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+import hashlib
+
+import numpy as np
+
+from .mpi import MPI
+
+
+def _hash_update(hsh, value):
+    """Feed a configuration value into a hash.
+
+    Numbers, strings, numpy arrays, MPI communicators (by size), operators
+    and (nested) containers of these are hashed by value.
+
+    Args:
+        hsh (hashlib hash):  The hash to update.
+        value (object):  The value.
+
+    Returns:
+        (bool):  False if the value cannot be hashed reproducibly.
+
+    """
+    if value is None or isinstance(value, (bool, int, float, complex, str)):
+        hsh.update("{}:{!r};".format(type(value).__name__, value).encode())
+    elif isinstance(value, bytes):
+        hsh.update(b"bytes:" + value + b";")
+    elif isinstance(value, (np.ndarray, np.generic)):
+        arr = np.ascontiguousarray(value)
+        hsh.update("array:{}:{};".format(arr.dtype.str, arr.shape).encode())
+        hsh.update(arr.view(np.uint8).tobytes() if arr.size > 0 else b"")
+    elif isinstance(value, (list, tuple)):
+        hsh.update("{}:{};".format(type(value).__name__, len(value)).encode())
+        for item in value:
+            if not _hash_update(hsh, item):
+                return False
+    elif isinstance(value, (set, frozenset)):
+        return _hash_update(hsh, sorted(value, key=repr))
+    elif isinstance(value, dict):
+        hsh.update("dict:{};".format(len(value)).encode())
+        for key in sorted(value.keys(), key=repr):
+            if not _hash_update(hsh, key) or not _hash_update(hsh, value[key]):
+                return False
+    elif MPI is not None and isinstance(value, MPI.Comm):
+        hsh.update("comm:{};".format(value.size).encode())
+    elif isinstance(value, Operator):
+        digest = value.config_hash()
+        if digest is None:
+            return False
+        hsh.update("operator:{};".format(digest).encode())
+    else:
+        return False
+    return True
+
 
 class Operator(object):
     """Base class for an operator that acts on collections of observations.
@@ -27,3 +79,30 @@ class Operator(object):
 
         """
         return
+
+    def config_hash(self, exclude=()):
+        """Hash of the operator configuration.
+
+        This is used by OpCacheResults to decide whether stored outputs of a
+        previous run of this operator can be reused.  The default hashes the
+        class name and every instance attribute, provided that they are
+        numbers, strings, arrays, communicators, operators or containers of
+        these.  Operators holding other objects (files, maps, callables...)
+        should override this method to describe them, otherwise None is
+        returned and the results of the operator are never reused.
+
+        Args:
+            exclude (iterable):  Names of attributes that are derived from
+                the others or are not configuration, and are not hashed.
+
+        Returns:
+            (str):  The hexadecimal digest, or None.
+
+        """
+        hsh = hashlib.sha256()
+        cls = type(self)
+        hsh.update("{}.{};".format(cls.__module__, cls.__qualname__).encode())
+        config = {x: y for x, y in vars(self).items() if x not in exclude}
+        if not _hash_update(hsh, config):
+            return None
+        return hsh.hexdigest()
@@ -302,3 +302,52 @@ class CacheTest(MPITestCase):
         mem = memcache.report(silent=True)
         self.assertEqual(mem, 0)
         print("Cache now has {} bytes".format(mem), flush=True)
+        return
+
+    def test_spill(self):
+        nbytes = self.nsamp * 8
+        for pymem in [False, True]:
+            for compress in [False, True]:
+                memcache = Cache(pymem=pymem, budget=3 * nbytes, compress=compress)
+                for i in range(5):
+                    memcache.put("test-{}".format(i), np.arange(self.nsamp) + i)
+
+                # The oldest buffers are spilled
+                self.assertEqual(memcache.report(silent=True), 3 * nbytes)
+                self.assertEqual(memcache.spilled(), 2 * nbytes)
+                self.assertEqual(len(memcache), 5)
+
+                # Referenced buffers are paged in and stay in memory
+                held = memcache.reference("test-0")
+                for i in range(5):
+                    data = memcache.reference("test-{}".format(i))
+                    np.testing.assert_equal(data, np.arange(self.nsamp) + i)
+                    del data
+                np.testing.assert_equal(held, np.arange(self.nsamp))
+                del held
+
+                memcache.destroy("test-1")
+                memcache.clear()
+                self.assertEqual(memcache.spilled(), 0)
+        return
+
+    def test_spill_shared_budget(self):
+        # The budget limits the total memory of all budgeted caches
+        nbytes = self.nsamp * 8
+        first = Cache(pymem=True, budget=3 * nbytes)
+        second = Cache(pymem=True, budget=3 * nbytes)
+        for i in range(2):
+            first.put("test-{}".format(i), np.arange(self.nsamp) + i)
+        for i in range(2):
+            second.put("test-{}".format(i), np.arange(self.nsamp) + i)
+
+        # The least recently used buffer of the first cache is spilled
+        self.assertEqual(first.spilled(), nbytes)
+        self.assertEqual(second.spilled(), 0)
+        total = first.report(silent=True) + second.report(silent=True)
+        self.assertEqual(total, 3 * nbytes)
+        np.testing.assert_equal(first.reference("test-0"), np.arange(self.nsamp))
+
+        first.clear()
+        second.clear()
+        return
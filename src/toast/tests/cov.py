@@ -12,9 +12,11 @@ import numpy.testing as nt
 
 import healpy as hp
 
+from ..mpi import MPI
+
 from ..tod import AnalyticNoise, OpSimNoise
 from ..todmap import TODSatellite, OpPointingHpix, OpAccumDiag
-from ..todmap.todmap_math import cov_accum_diag
+from .._libtoast import cov_accum_diag
 from ..map import DistPixels, covariance_invert, covariance_rcond, covariance_multiply
 
 from ._helpers import (
@@ -39,18 +41,6 @@ class CovarianceTest(MPITestCase):
         self.rate = 40.0
         self.hwprpm = 50
 
-        # Create detectors
-        (
-            dnames,
-            dquat,
-            depsilon,
-            drate,
-            dnet,
-            dfmin,
-            dfknee,
-            dalpha,
-        ) = boresight_focalplane(self.ndet, samplerate=self.rate, net=7.0)
-
         # Samples per observation
         self.totsamp = 240000
 
@@ -69,11 +59,26 @@ class CovarianceTest(MPITestCase):
         self.precperiod = 50.0
         self.precangle = 65.0
 
+        self.create_observation(self.ndet)
+
+    def create_observation(self, ndet):
+        """Populate the single observation per group with ndet detectors"""
+
+        # Create detectors
+        (
+            dnames,
+            dquat,
+            depsilon,
+            drate,
+            dnet,
+            dfmin,
+            dfknee,
+            dalpha,
+        ) = boresight_focalplane(ndet, samplerate=self.rate, net=7.0)
+
         # One chunk per process
         chunks = uniform_chunks(self.totsamp, nchunk=self.data.comm.group_size)
 
-        # Populate the single observation per group
-
         tod = TODSatellite(
             self.data.comm.comm_group,
             dquat,
@@ -102,6 +107,7 @@ class CovarianceTest(MPITestCase):
 
         self.data.obs[0]["tod"] = tod
         self.data.obs[0]["noise"] = nse
+        return
 
     def tearDown(self):
         del self.data
@@ -322,6 +328,251 @@ class CovarianceTest(MPITestCase):
 
         return
 
+    def test_invnpp_node_shared(self):
+        op = OpSimNoise(realization=0)
+        op.exec(self.data)
+
+        pointing = OpPointingHpix(nside=self.map_nside, nest=True, mode="IQU")
+        pointing.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        nse = self.data.obs[0]["noise"]
+        detweights = {}
+        for d in tod.local_dets:
+            detweights[d] = 1.0 / (self.rate * nse.NET(d) ** 2)
+
+        # accumulate the same covariance with and without node-shared data
+
+        maps = list()
+        for shared in [False, True]:
+            invnpp = DistPixels(self.data, nnz=6, dtype=np.float64, node_shared=shared)
+            hits = DistPixels(self.data, nnz=1, dtype=np.int64, node_shared=shared)
+            maps.append((invnpp, hits))
+
+        (invnpp, hits), (invnpp_shared, hits_shared) = maps
+        if self.comm is not None:
+            self.assertTrue(invnpp_shared.shared)
+
+        # the node-shared submaps include all local submaps of this process
+        loc = invnpp_shared.global2local[invnpp.local_submaps]
+        self.assertTrue(np.all(loc >= 0))
+
+        # the second cycle accumulates into the same shared buffers again
+        for cycle in range(2):
+            for invnpp_cycle, hits_cycle in maps:
+                invnpp_cycle.data.fill(0.0)
+                hits_cycle.data.fill(0)
+                build_invnpp = OpAccumDiag(
+                    detweights=detweights,
+                    invnpp=invnpp_cycle,
+                    hits=hits_cycle,
+                    name="noise",
+                )
+                build_invnpp.exec(self.data)
+                invnpp_cycle.allreduce()
+                hits_cycle.allreduce()
+            nt.assert_almost_equal(invnpp_shared.data[loc], invnpp.data)
+            nt.assert_equal(hits_shared.data[loc], hits.data)
+
+        # invert both
+        covariance_invert(invnpp, 1.0e-3)
+        covariance_invert(invnpp_shared, 1.0e-3)
+        nt.assert_almost_equal(invnpp_shared.data[loc], invnpp.data)
+
+        return
+
+    def test_duplicate_node_shared(self):
+        nsubmap = 16
+        npix_submap = 64
+        rank = 0
+        nproc = 1
+        if self.comm is not None:
+            rank = self.comm.rank
+            nproc = self.comm.size
+
+        # Every process has a different, overlapping set of submaps
+        local_submaps = np.arange(rank % 3, nsubmap, 2, dtype=np.int64)
+        nhold = np.zeros(nsubmap, dtype=np.int64)
+        for proc in range(nproc):
+            nhold[np.arange(proc % 3, nsubmap, 2)] += 1
+
+        dist = DistPixels(
+            None,
+            comm=self.comm,
+            npix=nsubmap * npix_submap,
+            nnz=3,
+            dtype=np.float64,
+            npix_submap=npix_submap,
+            local_submaps=local_submaps,
+            node_shared=True,
+        )
+        # The shared buffer holds the union of the submaps on the node
+        for sm in local_submaps:
+            self.assertTrue(dist.global2local[sm] >= 0)
+
+        # Every process writes its own node range, so each node contributes
+        # once to the submaps it holds
+        first, nsub = dist.node_range()
+        dist.data[first : first + nsub] = (
+            dist.local_submaps[first : first + nsub, None, None] + 1.0
+        )
+        dist.allreduce()
+
+        nnode = np.zeros(nsubmap, dtype=np.int64)
+        if dist.node_rank == 0:
+            nnode[dist.local_submaps] = 1
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, nnode, op=MPI.SUM)
+        self.assertTrue(np.all(nnode[nhold > 0] > 0))
+        expected = (nnode * (np.arange(nsubmap) + 1.0))[dist.local_submaps]
+        nt.assert_almost_equal(dist.data[:, 0, 0], expected)
+
+        # Repeat to give any race between initializing and filling the
+        # shared buffer a chance to show up
+        for trial in range(10):
+            dup = dist.duplicate()
+            nt.assert_equal(dup.local_submaps, dist.local_submaps)
+            nt.assert_almost_equal(dup.data, dist.data)
+            del dup
+        return
+
+    def test_invnpp_split(self):
+        # Several detectors with different weights, so that a split that
+        # drops, double counts or misweights a detector differs from the
+        # reference accumulations.
+        self.create_observation(3)
+        tod = self.data.obs[0]["tod"]
+        dets = tod.detectors
+        detweights = {det: 2.0 ** idet for idet, det in enumerate(dets)}
+
+        op = OpSimNoise(realization=0)
+        op.exec(self.data)
+
+        pointing = OpPointingHpix(nside=self.map_nside, nest=True, mode="IQU")
+        pointing.exec(self.data)
+
+        # Split the samples into even and odd halves, and put the first two
+        # detectors into splits of their own that get all of their samples.
+
+        offset, nsamp = tod.local_samples
+        splits = (1 + (offset + np.arange(nsamp)) % 2).astype(np.uint64)
+        tod.cache.put("splits", splits)
+        detsplits = {dets[0]: 4, dets[1]: 8}
+
+        nsplit = 4
+        zmap = [DistPixels(self.data, nnz=3, dtype=np.float64) for x in range(nsplit)]
+        hits = [DistPixels(self.data, nnz=1, dtype=np.int64) for x in range(nsplit)]
+        invnpp = [DistPixels(self.data, nnz=6, dtype=np.float64) for x in range(nsplit)]
+        for obj in zmap + hits + invnpp:
+            obj.data.fill(0)
+
+        build = OpAccumDiag(
+            zmap=zmap,
+            hits=hits,
+            invnpp=invnpp,
+            detweights=detweights,
+            name="noise",
+            split_name="splits",
+            detector_splits=detsplits,
+        )
+        build.exec(self.data)
+
+        # The halves must add up to the accumulation of all detectors, and
+        # the detector splits must match the accumulation of one detector.
+
+        def accumulate(detectors):
+            check_zmap = DistPixels(self.data, nnz=3, dtype=np.float64)
+            check_hits = DistPixels(self.data, nnz=1, dtype=np.int64)
+            check_invnpp = DistPixels(self.data, nnz=6, dtype=np.float64)
+            for obj in [check_zmap, check_hits, check_invnpp]:
+                obj.data.fill(0)
+            build = OpAccumDiag(
+                zmap=check_zmap,
+                hits=check_hits,
+                invnpp=check_invnpp,
+                detweights=detweights,
+                name="noise",
+                detectors=detectors,
+            )
+            build.exec(self.data)
+            return [check_zmap, check_hits, check_invnpp]
+
+        full = accumulate(None)
+        single = [accumulate([dets[0]]), accumulate([dets[1]])]
+
+        for iobj, split in enumerate([zmap, hits, invnpp]):
+            check = full[iobj].data
+            nt.assert_almost_equal(split[0].data + split[1].data, check)
+            for idet in range(2):
+                nt.assert_almost_equal(split[2 + idet].data, single[idet][iobj].data)
+        self.assertTrue(np.sum(hits[0].data) > 0)
+        self.assertTrue(np.sum(hits[1].data) > 0)
+        self.assertEqual(np.sum(hits[2].data), np.sum(hits[3].data))
+        self.assertEqual(np.sum(full[1].data), 3 * np.sum(hits[2].data))
+
+        return
+
+    def test_invnpp_steps(self):
+        op = OpSimNoise(realization=0)
+        op.exec(self.data)
+
+        pointing = OpPointingHpix(nside=self.map_nside, nest=True, mode="IQU")
+        pointing.exec(self.data)
+
+        # Piecewise constant weights with a zero weight piece and unweighted
+        # samples at the start of the observation.
+
+        starts = np.array([1000, 50000, 120000, 180000], dtype=np.int64)
+        weights = np.array([2.0, 0.0, 0.5, 3.0])
+        tod = self.data.obs[0]["tod"]
+        self.data.obs[0]["steps"] = {x: (starts, weights) for x in tod.local_dets}
+
+        zmap = DistPixels(self.data, nnz=3, dtype=np.float64)
+        hits = DistPixels(self.data, nnz=1, dtype=np.int64)
+        invnpp = DistPixels(self.data, nnz=6, dtype=np.float64)
+        for obj in [zmap, hits, invnpp]:
+            obj.data.fill(0)
+        build = OpAccumDiag(
+            zmap=zmap, hits=hits, invnpp=invnpp, name="noise", step_weights="steps"
+        )
+        build.exec(self.data)
+
+        # Accumulate every piece separately with the piece weight as the
+        # detector weight.
+
+        check_zmap = DistPixels(self.data, nnz=3, dtype=np.float64)
+        check_hits = DistPixels(self.data, nnz=1, dtype=np.int64)
+        check_invnpp = DistPixels(self.data, nnz=6, dtype=np.float64)
+        for obj in [check_zmap, check_hits, check_invnpp]:
+            obj.data.fill(0)
+        offset, nsamp = tod.local_samples
+        samples = offset + np.arange(nsamp)
+        stops = np.append(starts[1:], self.totsamp)
+        for start, stop, weight in zip(starts, stops, weights):
+            if weight == 0:
+                continue
+            inside = np.logical_and(samples >= start, samples < stop)
+            for det in tod.local_dets:
+                pixels = tod.cache.reference("pixels_{}".format(det)).copy()
+                pixels[np.logical_not(inside)] = -1
+                tod.cache.put("piece_{}".format(det), pixels, replace=True)
+            build = OpAccumDiag(
+                zmap=check_zmap,
+                hits=check_hits,
+                invnpp=check_invnpp,
+                name="noise",
+                pixels="piece",
+                detweights={x: weight for x in tod.local_dets},
+            )
+            build.exec(self.data)
+
+        nt.assert_almost_equal(zmap.data, check_zmap.data)
+        nt.assert_equal(hits.data, check_hits.data)
+        nt.assert_almost_equal(invnpp.data, check_invnpp.data)
+        self.assertTrue(np.sum(hits.data) > 0)
+
+        return
+
     def test_distpix_init(self):
         # make a simple pointing matrix
         pointing = OpPointingHpix(nside=self.map_nside, nest=True, mode="IQU")
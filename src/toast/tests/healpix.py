@@ -91,3 +91,28 @@ class HealpixTest(MPITestCase):
         #         print(th, ph, nst, hnst, rng, hrng, flush=True)
         np.testing.assert_equal(pixnest, self.regcompnest)
         np.testing.assert_equal(pixring, self.regcompring)
+
+    def test_degrade_upgrade(self):
+        factor = 3
+        theta = np.array([x[0] for x in self.regular])
+        phi = np.array([x[1] for x in self.regular])
+        hpix = Pixels(nside=self.nside)
+        lowres_nside = self.nside // 2 ** factor
+        lowres = Pixels(nside=lowres_nside)
+
+        # Degrading the pixels of a position gives the low resolution pixel
+        # of the same position
+        pixnest = hpix.degrade_nest(factor, hpix.ang2nest(theta, phi))
+        pixring = hpix.degrade_ring(factor, hpix.ang2ring(theta, phi))
+        np.testing.assert_equal(pixnest, lowres.ang2nest(theta, phi))
+        np.testing.assert_equal(pixring, lowres.ang2ring(theta, phi))
+
+        # Upgrading returns the first of the subpixels
+        pixnest = np.arange(12 * lowres_nside ** 2, dtype=np.int64)
+        pixring = lowres.nest2ring(pixnest)
+        upnest = lowres.upgrade_nest(factor, pixnest)
+        upring = lowres.upgrade_ring(factor, pixring)
+        np.testing.assert_equal(upnest, pixnest * 4 ** factor)
+        np.testing.assert_equal(upring, hpix.nest2ring(upnest))
+        np.testing.assert_equal(hpix.degrade_nest(factor, upnest), pixnest)
+        np.testing.assert_equal(hpix.degrade_ring(factor, upring), pixring)
@@ -0,0 +1,146 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+import shutil
+
+import numpy as np
+
+from ..tod import AnalyticNoise, OpSimNoise, OpCacheResults
+from ..todmap import TODHpixSpiral, OpPointingHpix
+from .. import qarray as qa
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+class OpCacheResultsTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+        self.cachedir = os.path.join(self.outdir, "results")
+        if self.comm is None or self.comm.rank == 0:
+            shutil.rmtree(self.cachedir, ignore_errors=True)
+        if self.comm is not None:
+            self.comm.barrier()
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = 4
+        self.rate = 20.0
+
+        (
+            dnames,
+            dquat,
+            depsilon,
+            drate,
+            dnet,
+            dfmin,
+            dfknee,
+            dalpha,
+        ) = boresight_focalplane(
+            self.ndet, samplerate=self.rate, net=10.0, fmin=1.0e-5, fknee=0.1
+        )
+
+        self.dquat = dquat
+        tod = self.create_tod(dquat)
+        nse = AnalyticNoise(
+            rate=drate,
+            fmin=dfmin,
+            detectors=dnames,
+            fknee=dfknee,
+            alpha=dalpha,
+            NET=dnet,
+        )
+        self.data.obs[0]["tod"] = tod
+        self.data.obs[0]["noise"] = nse
+
+    def create_tod(self, dquat):
+        return TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            1000 * self.data.comm.group_size,
+            detranks=1,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+
+    def test_restore(self):
+        tod = self.data.obs[0]["tod"]
+
+        def run(realization, inputs=None):
+            tod.cache.clear("noise_.*")
+            op = OpCacheResults(
+                OpSimNoise(realization=realization),
+                outputs="noise_.*",
+                inputs=inputs,
+                cachedir=self.cachedir,
+            )
+            op.exec(self.data)
+            result = {x: tod.cache.reference(x).copy() for x in tod.cache.keys()}
+            return op.restored, result
+
+        restored, first = run(0)
+        self.assertFalse(restored)
+
+        # An identical rerun restores bit-identical outputs
+        restored, second = run(0)
+        self.assertTrue(restored)
+        self.assertEqual(sorted(first.keys()), sorted(second.keys()))
+        for name in first:
+            np.testing.assert_array_equal(first[name], second[name])
+
+        # A new realization is computed and stored next to the first one
+        restored, third = run(1)
+        self.assertFalse(restored)
+        for det in tod.local_dets:
+            name = "noise_{}".format(det)
+            self.assertFalse(np.all(first[name] == third[name]))
+        restored, _ = run(0)
+        self.assertTrue(restored)
+
+        # Changing a declared input invalidates and replaces the result
+        for det in tod.local_dets:
+            tod.cache.put("input_{}".format(det), np.zeros(10))
+        restored, _ = run(0, inputs="input_.*")
+        self.assertFalse(restored)
+        restored, _ = run(0, inputs="input_.*")
+        self.assertTrue(restored)
+        tod.cache.reference("input_{}".format(tod.local_dets[0]))[0] = 1
+        restored, _ = run(0, inputs="input_.*")
+        self.assertFalse(restored)
+        return
+
+    def test_pointing(self):
+        tod = self.data.obs[0]["tod"]
+        for attempt in range(2):
+            tod.cache.clear("(pixels|weights)_.*")
+            op = OpCacheResults(
+                OpPointingHpix(nside=64, nest=True, mode="IQU"),
+                outputs=["pixels_.*", "weights_.*"],
+                metadata=["pixels_local_submaps", "pixels_npix_submap"],
+                cachedir=self.cachedir,
+            )
+            op.exec(self.data)
+            self.assertEqual(op.restored, attempt == 1)
+            for det in tod.local_dets:
+                self.assertTrue(tod.cache.exists("pixels_{}".format(det)))
+                self.assertTrue(tod.cache.exists("weights_{}".format(det)))
+            self.assertTrue(self.data["pixels_local_submaps"].size > 0)
+            self.assertEqual(self.data["pixels_npix_submap"], 12 * 16 ** 2)
+
+        # A new focalplane under the same observation name is recomputed
+        rot = qa.rotation(np.array([1.0, 0, 0]), np.radians(1.0))
+        dquat = {det: qa.mult(rot, quat) for det, quat in self.dquat.items()}
+        tod = self.create_tod(dquat)
+        self.data.obs[0]["tod"] = tod
+        op.exec(self.data)
+        self.assertFalse(op.restored)
+
+        # Operators that cannot be hashed are always run
+        op = OpPointingHpix(nside=64, nest=True, mode="IQU")
+        op.hpix_cb = lambda x: x
+        self.assertIsNone(op.config_hash())
+        return
@@ -0,0 +1,178 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from ..map import DistPixels, covariance_invert, covariance_apply
+
+from ..todmap import TODHpixSpiral, OpAccumDiag, OpDemodulate
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+class OpDemodulateTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = self.data.comm.group_size
+        self.rate = 100.0
+        self.hwprate = 1.0
+        self.totsamp = 20000
+        self.npix = 16
+        self.map = np.random.RandomState(1234).randn(self.npix, 3)
+
+        dnames, dquat, _, _, _, _, _, _ = boresight_focalplane(
+            self.ndet, samplerate=self.rate
+        )
+
+        tod = TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            self.totsamp,
+            detranks=self.data.comm.group_size,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+        self.data.obs[0]["tod"] = tod
+
+        # A rotating HWP, slowly varying polarization angle and a pixel
+        # number that changes every ten seconds.
+
+        offset, nsamp = tod.local_samples
+        times = tod.local_times()
+        hwpang = 2 * np.pi * self.hwprate * times
+        tod.cache.put(tod.HWP_ANGLE_NAME, hwpang)
+        self.psi = 0.1 * times
+        pixels = (offset + np.arange(nsamp)) // 1000 % self.npix
+        for det in tod.local_dets:
+            ang = 2 * self.psi + 4 * hwpang
+            weights = np.vstack([np.ones(nsamp), np.cos(ang), np.sin(ang)]).T
+            signal = np.sum(weights * self.map[pixels], axis=1)
+            tod.cache.put("pixels_{}".format(det), pixels.astype(np.int64))
+            tod.cache.put("weights_{}".format(det), weights)
+            tod.cache.put("signal_{}".format(det), signal)
+            flags = np.zeros(nsamp, dtype=np.uint8)
+            flags[1000:1100] = 1
+            tod.cache.put("flags_{}".format(det), flags)
+
+    def test_demodulate(self):
+        decimation = 20
+        op = OpDemodulate(
+            name="signal",
+            flag_name="flags",
+            decimation=decimation,
+            ntap=401,
+        )
+        demod_data = op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        nsamp = tod.local_samples[1]
+        nout = (nsamp + decimation - 1) // decimation
+        demod_tod = demod_data.obs[0]["tod"]
+        self.assertEqual(demod_tod.local_samples[1], nout)
+        self.assertEqual(demod_tod.grid_size, tod.grid_size)
+        times = demod_tod.local_times()
+        self.assertEqual(times.size, nout)
+        psi = 0.1 * times
+        center = np.arange(nout) * decimation + decimation // 2
+        inside = (center % 1000 >= 200) & (center % 1000 < 800)
+        for det in tod.local_dets:
+            streams = op.stream_names(det)
+            for sdet in streams:
+                self.assertIn(sdet, demod_tod.local_dets)
+            signal = np.vstack([demod_tod.local_signal(x) for x in streams]).T
+            pixels = np.vstack(
+                [demod_tod.cache.reference("pixels_{}".format(x)) for x in streams]
+            ).T
+            weights = np.stack(
+                [demod_tod.cache.reference("weights_{}".format(x)) for x in streams],
+                axis=1,
+            )
+            flags = np.vstack([demod_tod.local_flags(x) for x in streams]).T
+            self.assertEqual(signal.shape, (nout, 3))
+            self.assertEqual(weights.shape, (nout, 3, 3))
+
+            # The flagged gap is wider than half of the filter
+            self.assertTrue(np.all(flags[53] != 0))
+            good = flags == 0
+            self.assertTrue(np.all(pixels[good] >= 0))
+
+            # Away from pixel boundaries the demodulated streams are exactly
+            # the demodulated weights applied to the map.
+            sel = good & inside[:, None]
+            model = np.sum(weights * self.map[pixels], axis=2)
+            np.testing.assert_allclose(signal[sel], model[sel], atol=1e-10)
+
+            # Away from the flags and the data edges the filter isolates the
+            # three Stokes parameters.
+            sel = np.arange(20, nout - 20)
+            sel = sel[(sel < 40) | (sel > 70)]
+            demod = weights[sel]
+            np.testing.assert_allclose(demod[:, 0, 0], 1, atol=1e-3)
+            np.testing.assert_allclose(demod[:, 0, 1:], 0, atol=1e-2)
+            np.testing.assert_allclose(demod[:, 1, 0], 0, atol=1e-2)
+            np.testing.assert_allclose(demod[:, 1, 1], np.cos(2 * psi[sel]), atol=1e-2)
+            np.testing.assert_allclose(demod[:, 1, 2], np.sin(2 * psi[sel]), atol=1e-2)
+            np.testing.assert_allclose(demod[:, 2, 1], -np.sin(2 * psi[sel]), atol=1e-2)
+            np.testing.assert_allclose(demod[:, 2, 2], np.cos(2 * psi[sel]), atol=1e-2)
+            del signal
+            del pixels
+            del weights
+            del flags
+        return
+
+    def test_bin(self):
+        decimation = 20
+        op = OpDemodulate(
+            name="signal",
+            flag_name="flags",
+            decimation=decimation,
+            ntap=401,
+        )
+        demod_data = op.exec(self.data)
+
+        # Flag the output samples whose filter reaches across a pixel
+        # boundary.  Binning must honor these flags to recover the map.
+
+        demod_tod = demod_data.obs[0]["tod"]
+        nout = demod_tod.local_samples[1]
+        center = np.arange(nout) * decimation + decimation // 2
+        inside = (center % 1000 >= 200) & (center % 1000 < 800)
+        for sdet in demod_tod.local_dets:
+            flags = demod_tod.local_flags(sdet)
+            flags[np.logical_not(inside)] |= 2
+            del flags
+
+        maps = list()
+        for nnz, dtype in [(6, np.float64), (1, np.int64), (3, np.float64)]:
+            maps.append(
+                DistPixels(
+                    None,
+                    comm=self.data.comm.comm_world,
+                    nnz=nnz,
+                    dtype=dtype,
+                    npix=self.npix,
+                    npix_submap=self.npix,
+                    local_submaps=np.array([0], dtype=np.int64),
+                )
+            )
+        invnpp, hits, zmap = maps
+
+        op_accum = OpAccumDiag(invnpp=invnpp, hits=hits, zmap=zmap)
+        op_accum.exec(demod_data)
+        for m in maps:
+            m.allreduce()
+
+        self.assertTrue(np.all(hits.data > 0))
+        covariance_invert(invnpp, 1.0e-3)
+        covariance_apply(invnpp, zmap)
+        np.testing.assert_allclose(zmap.data[0], self.map, atol=1e-8)
+        return
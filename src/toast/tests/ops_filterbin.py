@@ -23,12 +23,14 @@ from ..tod import (
     OpCacheInit,
 )
 from ..map import DistPixels
+from .._libtoast import noiseweight_obs_matrix
 from ..todmap import (
     TODHpixSpiral,
     OpSimGradient,
     OpPointingHpix,
     OpFilterBin,
     OpSimScan,
+    ObsMatrix,
 )
 
 from .. import qarray as qa
@@ -310,6 +312,28 @@ class OpFilterBinTest(MPITestCase):
 
             np.testing.assert_array_almost_equal(outmap, outmap_test)
 
+        if self.comm is not None:
+            self.comm.barrier()
+
+        # Apply the distributed observation matrix to several maps at once
+
+        rootname = os.path.join(self.outdir, outprefix + "obs_matrix")
+        obs_matrix = ObsMatrix(rootname, self.comm)
+
+        fname = os.path.join(self.outdir, outprefix + "filtered.fits.gz")
+        outmap = hp.read_map(fname, None, nest=True)
+        inmap = hp.read_map(inmapfile, None, nest=True)
+        inmaps = np.array([inmap, -2 * inmap, np.roll(inmap, 1, axis=1)])
+        outmaps = obs_matrix.apply(inmaps)
+
+        np.testing.assert_array_almost_equal(outmaps[0], outmap)
+        np.testing.assert_array_almost_equal(outmaps[1], -2 * outmap)
+        np.testing.assert_array_almost_equal(obs_matrix.apply(inmaps[2]), outmaps[2])
+
+        reference = scipy.sparse.load_npz(rootname + ".npz")
+        outmap_test = reference.dot(inmaps[2].ravel()).reshape([self.nnz, -1])
+        np.testing.assert_array_almost_equal(outmaps[2], outmap_test)
+
         return
 
     def test_filterbin_deproject(self):
@@ -451,3 +475,84 @@ class OpFilterBinTest(MPITestCase):
             np.testing.assert_array_almost_equal(outmap, outmap_test)
 
         return
+
+    def test_noiseweight_obs_matrix(self):
+        nside = 2
+        nnz = 3
+        ncov = nnz * (nnz + 1) // 2
+        filterbin = OpFilterBin(nside=nside, nnz=nnz, verbose=False)
+        npix = 12 * nside ** 2
+        npixtot = npix * nnz
+
+        # White noise covariance on all but one submap and with some empty pixels
+        npix_submap = 4
+        local_submaps = np.arange(1, npix // npix_submap, dtype=np.int64)
+        white_noise_cov = DistPixels(
+            None,
+            nnz=ncov,
+            npix=npix,
+            npix_submap=npix_submap,
+            local_submaps=local_submaps,
+        )
+        np.random.seed(self.rank)
+        white_noise_cov.data[:] = np.random.randn(*white_noise_cov.data.shape)
+        white_noise_cov.data[:, ::3] = 0
+
+        # Observation matrix where the rows of each pixel share their columns
+        pattern = scipy.sparse.random(npix, npixtot, density=0.2, format="csr")
+        obs_matrix = scipy.sparse.vstack(
+            [pattern.multiply(np.random.randn(npix, npixtot)) for inz in range(nnz)]
+        ).tocsr()
+        obs_matrix.eliminate_zeros()
+
+        # Reference from the general sparse product
+        filterbin.obs_matrix = obs_matrix.copy()
+        filterbin._noiseweight_obs_matrix_sparse(white_noise_cov.data, local_submaps)
+        reference = filterbin.obs_matrix.toarray()
+
+        for index_type in [np.int32, np.int64]:
+            filterbin.obs_matrix = obs_matrix.copy()
+            filterbin.obs_matrix.indices = obs_matrix.indices.astype(index_type)
+            filterbin.obs_matrix.indptr = obs_matrix.indptr.astype(index_type)
+            filterbin._noiseweight_obs_matrix(white_noise_cov)
+            np.testing.assert_array_almost_equal(
+                filterbin.obs_matrix.toarray(), reference
+            )
+
+        # Rows that do not share their sparsity pattern use the fallback
+        row = npix + npix_submap
+        obs_matrix.data[obs_matrix.indptr[row]] = 0
+        obs_matrix.eliminate_zeros()
+        filterbin.obs_matrix = obs_matrix.copy()
+        filterbin._noiseweight_obs_matrix_sparse(white_noise_cov.data, local_submaps)
+        reference = filterbin.obs_matrix.toarray()
+        filterbin.obs_matrix = obs_matrix.copy()
+        filterbin._noiseweight_obs_matrix(white_noise_cov)
+        np.testing.assert_array_almost_equal(filterbin.obs_matrix.toarray(), reference)
+
+        # Submaps that do not tile the map or fall outside it are rejected
+        bad_cov = np.zeros([1, 5, ncov])
+        with self.assertRaises(RuntimeError):
+            noiseweight_obs_matrix(
+                obs_matrix.data,
+                obs_matrix.indices,
+                obs_matrix.indptr,
+                bad_cov,
+                np.zeros(1, dtype=np.int64),
+                npix,
+                nnz,
+            )
+        bad_submaps = local_submaps.copy()
+        bad_submaps[-1] = npix // npix_submap
+        with self.assertRaises(RuntimeError):
+            noiseweight_obs_matrix(
+                obs_matrix.data,
+                obs_matrix.indices,
+                obs_matrix.indptr,
+                white_noise_cov.data,
+                bad_submaps,
+                npix,
+                nnz,
+            )
+
+        return
@@ -0,0 +1,119 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from ..tod import OpFlagGlitches
+from ..todmap import TODHpixSpiral
+
+from .._libtoast import running_median
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+class OpFlagGlitchesTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = 4
+        self.rate = 100.0
+        self.totsamp = 10000 * self.data.comm.group_size
+
+        dnames, dquat, _, _, _, _, _, _ = boresight_focalplane(
+            self.ndet, samplerate=self.rate
+        )
+
+        tod = TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            self.totsamp,
+            detranks=1,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+        self.data.obs[0]["tod"] = tod
+
+        # White noise on a slow drift, with glitches and one jump at known
+        # local samples of every detector.
+
+        offset, nsamp = tod.local_samples
+        self.glitches = [1000, 4321, 7777]
+        self.jump = 6000
+        rank = 0
+        if self.comm is not None:
+            rank = self.comm.rank
+        rng = np.random.RandomState(1234 + rank)
+        tod.cache.put("common_flags", np.zeros(nsamp, dtype=np.uint8))
+        for det in tod.local_dets:
+            signal = rng.randn(nsamp) + np.sin(np.arange(nsamp) / 2000.0)
+            signal[self.glitches] += 20.0
+            signal[self.jump :] += 5.0
+            signal[9000:9100] = 1000.0
+            flags = np.zeros(nsamp, dtype=np.uint8)
+            flags[9000:9100] = 2
+            tod.cache.put("signal_{}".format(det), signal)
+            tod.cache.put("flags_{}".format(det), flags)
+
+    def test_running_median(self):
+        signal = np.arange(100, dtype=np.float64)
+        flags = np.zeros(100, dtype=np.uint8)
+        flags[50] = 1
+        median = np.zeros(100)
+        running_median(11, signal, flags, 1, median)
+        np.testing.assert_array_equal(median[5:45], signal[5:45])
+        self.assertEqual(median[0], 2.5)
+        self.assertEqual(median[50], 50.0)
+        self.assertEqual(median[49], 48.5)
+        self.assertEqual(median[99], 96.5)
+        return
+
+    def test_flag_glitches(self):
+        dilation = 3
+        op = OpFlagGlitches(
+            name="signal",
+            flag_name="flags",
+            flag_mask=2,
+            common_flag_name="common_flags",
+            window=201,
+            glitch_threshold=8.0,
+            jump_width=50,
+            jump_threshold=10.0,
+            dilation=dilation,
+            glitch_flag_value=4,
+            jump_flag_value=8,
+        )
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        nsamp = tod.local_samples[1]
+        for det in tod.local_dets:
+            flags = tod.local_flags(det, "flags")
+
+            # Every glitch is flagged along with its neighbors
+            for glitch in self.glitches:
+                self.assertTrue(
+                    np.all(flags[glitch - dilation : glitch + dilation + 1] & 4)
+                )
+
+            # The jump is flagged once, at the right place
+            jumps = np.where(flags & 8)[0]
+            self.assertTrue(jumps.size > 0)
+            self.assertTrue(np.all(np.abs(jumps - self.jump) < 2 * dilation + 3))
+
+            # Pre-existing flags are preserved and the flagged samples were
+            # not used.
+            np.testing.assert_array_equal(flags[9000:9100] & 2, 2)
+            self.assertEqual(np.sum((flags[8990:9110] & 4) != 0), 0)
+
+            # Few false positives
+            self.assertTrue(np.sum(flags != 0) < 100 + 5 * (2 * dilation + 2))
+            del flags
+        return
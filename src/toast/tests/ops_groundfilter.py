@@ -10,6 +10,7 @@ import numpy as np
 
 from ..tod import AnalyticNoise, OpSimNoise
 from ..todmap import OpGroundFilter, TODGround
+from ..todmap.mapmaker import GroundTemplate, TemplateMatrix
 
 from ._helpers import create_outdir, create_distdata, boresight_focalplane
 
@@ -160,3 +161,40 @@ class OpGroundFilterTest(MPITestCase):
                     )
                 del y
         return
+
+    def test_ground_template(self):
+        detweights = []
+        for ob in self.data.obs:
+            detweights.append({det: 1.0 for det in ob["tod"].local_dets})
+        template = GroundTemplate(
+            self.data, detweights, az_resolution=0.5, common_flag_mask=0, flag_mask=0
+        )
+        templates = TemplateMatrix(self.data, self.data.comm.comm_world, [template])
+
+        # Scan a random ground map into the signal
+        amplitudes = templates.zero_amplitudes()
+        rng = np.random.RandomState(12345)
+        amplitudes[template.name][:] = rng.randn(template.namplitude)
+        signal = templates.apply(amplitudes)
+
+        # Every sample sees one ground pixel, so the preconditioner is the
+        # exact inverse of F^T F
+        estimate = templates.apply_precond(templates.apply_transpose(signal))
+        hit = template.norms != 0
+        self.assertTrue(np.sum(hit) > 1)
+        np.testing.assert_allclose(
+            estimate[template.name][hit],
+            amplitudes[template.name][hit],
+            rtol=1e-10,
+            atol=1e-10,
+        )
+
+        # Ensure the ground pickup is removed from all timestreams
+        templates.clean_signal(signal, estimate)
+        for iobs, ob in enumerate(self.data.obs):
+            tod = ob["tod"]
+            for det in tod.local_dets:
+                rms = np.std(signal[iobs, det, :])
+                if rms > 1.0e-10:
+                    raise RuntimeError("det {} rms = {}".format(det, rms))
+        return
@@ -0,0 +1,129 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from ..tod import OpLineFilter, Interval
+from ..todmap import TODHpixSpiral
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+class OpLineFilterTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = 4
+        self.rate = 100.0
+        self.totsamp = 10000
+
+        dnames, dquat, _, _, _, _, _, _ = boresight_focalplane(
+            self.ndet, samplerate=self.rate
+        )
+
+        tod = TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            self.totsamp,
+            detranks=1,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+        self.data.obs[0]["tod"] = tod
+
+        offset, nsamp = tod.local_samples
+        times = tod.local_times()
+        rank = 0
+        if self.comm is not None:
+            rank = self.comm.rank
+        rng = np.random.RandomState(4321 + rank)
+        self.input = dict()
+        self.lines = dict()
+        for idet, det in enumerate(tod.local_dets):
+            signal = rng.randn(nsamp) + 0.01 * np.cumsum(rng.randn(nsamp))
+            self.input[det] = signal
+            lines = np.zeros(nsamp)
+            for freq, amp in [(1.4, 3.0), (7.13, 1.0), (1.0, 2.0)]:
+                lines += amp * np.sin(2 * np.pi * freq * times + idet)
+            self.lines[det] = lines
+            tod.cache.put("signal_{}".format(det), signal + lines)
+            # Corrupt a flagged stretch of samples
+            flags = tod.local_flags(det)
+            flags[4000:4100] = 1
+            del flags
+            ref = tod.local_signal(det)
+            ref[4000:4100] = 1.0e3
+            del ref
+
+    def test_lines(self):
+        # The 1 Hz line is the second harmonic of the scan frequency
+        op = OpLineFilter(
+            lines=[(1.4, 0.1), (7.13, 0.1)],
+            scan_lines=[(2, 0.1)],
+            scan_frequency=0.5,
+        )
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        # Away from the ends, only the noise within the notches is removed
+        # along with the lines.
+        good = slice(2000, 8000)
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            resid = (signal - self.input[det])[good]
+            resid = np.concatenate([resid[:2000], resid[2100:]])
+            self.assertTrue(np.std(resid) < 0.3)
+            self.assertTrue(np.std(self.lines[det]) > 2.0)
+        return
+
+    def test_intervals(self):
+        # Filtering one interval leaves the other samples untouched
+        tod = self.data.obs[0]["tod"]
+        original = dict()
+        for det in tod.local_dets:
+            original[det] = tod.local_signal(det).copy()
+
+        intervals = tod.local_intervals(None)
+        intervals[0].last = 4999
+        self.data.obs[0]["intervals"] = intervals
+        op = OpLineFilter(lines=[(1.4, 0.1), (7.13, 0.1), (1.0, 0.1)])
+        op.exec(self.data)
+
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            np.testing.assert_array_equal(signal[5000:], original[det][5000:])
+            resid = (signal - self.input[det])[1500:3500]
+            self.assertTrue(np.std(resid) < 0.3)
+        return
+
+    def test_uneven_intervals(self):
+        # Intervals of different lengths share one zero padded length
+        intervals = list()
+        for first, last in [(0, 5299), (5300, self.totsamp - 1)]:
+            intervals.append(
+                Interval(
+                    start=first / self.rate,
+                    stop=last / self.rate,
+                    first=first,
+                    last=last,
+                )
+            )
+        self.data.obs[0]["intervals"] = intervals
+        op = OpLineFilter(lines=[(1.4, 0.1), (7.13, 0.1), (1.0, 0.1)])
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            for good in [slice(1500, 3500), slice(6500, 8500)]:
+                resid = (signal - self.input[det])[good]
+                self.assertTrue(np.std(resid) < 0.3)
+        return
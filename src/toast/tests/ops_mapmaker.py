@@ -11,6 +11,7 @@ import shutil
 
 import healpy as hp
 import numpy as np
+import scipy.linalg
 
 from ..timing import gather_timers, GlobalTimers
 from ..timing import dump as dump_timing
@@ -24,8 +25,9 @@ from ..todmap import (
     OpMapMaker,
     OpSimScan,
 )
-from ..todmap.mapmaker import TemplateMatrix, OffsetTemplate, Signal
+from ..todmap.mapmaker import TemplateMatrix, OffsetTemplate, Signal, CoarseCorrection
 from .. import qarray as qa
+from .._libtoast import offset_noise_filter, offset_banded_precond
 
 from ._helpers import create_outdir, create_distdata, boresight_focalplane
 
@@ -344,6 +346,379 @@ class OpMapMakerTest(MPITestCase):
 
     """
 
+    def test_offset_steps_adaptive(self):
+        # Add a long gap in the first interval
+        tod = self.data.obs[0]["tod"]
+        common_flags = tod.local_common_flags()
+        common_flags[2000:2500] = 1
+        del common_flags
+
+        detweights = []
+        for obs in self.data.obs:
+            detweights.append({det: 1.0 for det in obs["tod"].local_dets})
+
+        fixed = OffsetTemplate(
+            self.data, detweights, step_length=1, intervals="intervals"
+        )
+        adaptive = OffsetTemplate(
+            self.data, detweights, step_length=1, intervals="intervals", knee_periods=10
+        )
+
+        # The knee frequency is 1 Hz, so the steps are up to 10 s long
+        self.assertTrue(adaptive.namplitude < fixed.namplitude / 5)
+
+        coverage = {}
+        for itemplate, iobs, det, todslice, sigmasq in adaptive.offset_templates:
+            length = (todslice.stop - todslice.start) / self.rate
+            self.assertTrue(length <= 10 + 1 / self.rate)
+            self.assertFalse(todslice.start < 2000 and todslice.stop > 2500)
+            if (iobs, det) not in coverage:
+                coverage[iobs, det] = np.zeros(self.totsamp, dtype=np.int64)
+            coverage[iobs, det][todslice] += 1
+
+        # Every sample belongs to exactly one step
+        for hits in coverage.values():
+            np.testing.assert_array_equal(hits, 1)
+
+        # Only the last step before a gap or the end of an interval may be
+        # shorter than the step length of the noise prior
+        for iobs, offset_slices in enumerate(adaptive.offset_slices):
+            for det, slices in offset_slices.items():
+                step_length = adaptive.step_lengths[iobs][det]
+                for offset_slice, sigmasqs in slices:
+                    nshort = 0
+                    for itemplate in range(offset_slice.start, offset_slice.stop):
+                        todslice = adaptive.offset_templates[itemplate][3]
+                        length = (todslice.stop - todslice.start) / self.rate
+                        if length < step_length - 1 / self.rate:
+                            nshort += 1
+                    self.assertTrue(nshort <= 2)
+
+        return
+
+    def test_offset_filter(self):
+        # Compare the compiled noise filters and preconditioners against the
+        # original numpy implementation.
+        step_length = 2.0
+        freq = np.logspace(-5, 1.5, 1000)
+        offset_psd = 1e-3 * (1 + (0.1 / freq) ** 1.7)
+        logfreq = np.log(freq)
+        logpsd = np.log(offset_psd)
+        logfilter = np.log(1 / offset_psd)
+
+        def interpolate(x, psd):
+            result = np.zeros(x.size)
+            good = np.abs(x) > 1e-10
+            logx = np.log(np.abs(x[good]))
+            logresult = np.interp(logx, logfreq, psd)
+            result[good] = np.exp(logresult)
+            return result
+
+        def truncate(noisefilter, lim=1e-4):
+            icenter = noisefilter.size // 2
+            ind = np.abs(noisefilter[:icenter]) > np.abs(noisefilter[0]) * lim
+            icut = np.argwhere(ind)[-1][0]
+            if icut % 2 == 0:
+                icut += 1
+            noisefilter = np.roll(noisefilter, icenter)
+            noisefilter = noisefilter[icenter - icut : icenter + icut + 1]
+            return noisefilter
+
+        np.random.seed(12345)
+        for nstep in [1, 2, 3, 7, 50, 200]:
+            filterlen = nstep * 2 + 1
+            filterfreq = np.fft.rfftfreq(filterlen, step_length)
+            noisefilter = truncate(np.fft.irfft(interpolate(filterfreq, logfilter)))
+            prior = truncate(np.fft.irfft(interpolate(filterfreq, logpsd)))
+
+            test_filter = offset_noise_filter(logfreq, logfilter, step_length, nstep)
+            test_prior = offset_noise_filter(logfreq, logpsd, step_length, nstep)
+            np.testing.assert_allclose(
+                test_filter, noisefilter, rtol=1e-8, atol=1e-12 * noisefilter[0]
+            )
+            np.testing.assert_allclose(
+                test_prior, prior, rtol=1e-8, atol=1e-12 * prior[0]
+            )
+
+            sigmasqs = 1e-3 + 1e-2 * np.random.rand(nstep)
+            rhs = np.random.randn(nstep)
+            for precond_width in [2, 20]:
+                wband = min(precond_width, noisefilter.size // 2)
+                width = max(wband, min(precond_width, nstep))
+                icenter = noisefilter.size // 2
+                preconditioner = np.zeros([width, nstep], dtype=np.float64)
+                preconditioner[0] = sigmasqs
+                preconditioner[:wband, :] += np.repeat(
+                    noisefilter[icenter : icenter + wband, np.newaxis], nstep, 1
+                )
+                # The original code relied on overwrite_ab, which does not
+                # factor a C-ordered array in place.  Compare against the
+                # factor it intended to store.
+                preconditioner = scipy.linalg.cholesky_banded(
+                    preconditioner, lower=True, check_finite=True
+                )
+                test_precond = offset_banded_precond(
+                    sigmasqs, test_filter, precond_width
+                )
+                self.assertEqual(test_precond.shape, preconditioner.shape)
+                # Entries past the end of each band are not referenced
+                np.testing.assert_allclose(
+                    scipy.linalg.cho_solve_banded((test_precond, True), rhs),
+                    scipy.linalg.cho_solve_banded((preconditioner, True), rhs),
+                    rtol=1e-8,
+                )
+
+        return
+
+    def test_offset_precond_fallback(self):
+        # A noise filter whose band is not positive definite.  The
+        # preconditioner falls back to the diagonal of the banded matrix.
+        nstep = 20
+        sigmasqs = 1e-3 + 1e-2 * np.random.RandomState(1234).rand(nstep)
+        noisefilter = np.array([-2.0, -2.0, 1.0, -2.0, -2.0])
+        precond = offset_banded_precond(sigmasqs, noisefilter, 3)
+        self.assertEqual(precond.shape, (1, nstep))
+        np.testing.assert_allclose(precond[0], np.sqrt(sigmasqs + 1.0))
+
+        rhs = np.random.RandomState(4321).randn(nstep)
+        np.testing.assert_allclose(
+            scipy.linalg.cho_solve_banded((precond, True), rhs),
+            rhs / (sigmasqs + 1.0),
+        )
+        return
+
+    def test_mapmaker_coarse(self):
+        name = "testtod_coarse"
+
+        # make a simple pointing matrix
+        pointing = OpPointingHpix(
+            nside=self.map_nside, nest=True, mode=self.pointingmode
+        )
+        pointing.exec(self.data)
+
+        # Scan the signal from a map
+        distmap = DistPixels(self.data, nnz=self.nnz, dtype=np.float32)
+        distmap.read_healpix_fits(self.inmapfile)
+
+        scansim = OpSimScan(input_map=distmap, out=name)
+        scansim.exec(self.data)
+
+        # Add simulated noise
+        opnoise = OpSimNoise(realization=0, out=name)
+        opnoise.exec(self.data)
+
+        # The mapmaker cleans the signal in place, so keep a copy for the
+        # second run
+        name_coarse = name + "_copy"
+        cachecopy = OpCacheCopy(name, name_coarse)
+        cachecopy.exec(self.data)
+
+        niter = []
+        for signal_name, coarse_nside, outprefix in [
+            (name, None, "toast_nocoarse_"),
+            (name_coarse, self.map_nside // 4, "toast_coarse_"),
+        ]:
+            mapmaker = OpMapMaker(
+                nside=self.map_nside,
+                nnz=self.nnz,
+                name=signal_name,
+                outdir=self.outdir,
+                outprefix=outprefix,
+                baseline_length=1,
+                iter_max=100,
+                use_noise_prior=True,
+                coarse_nside=coarse_nside,
+            )
+            mapmaker.exec(self.data)
+            niter.append(mapmaker.niter)
+
+        # The coarse correction is a better preconditioner
+        self.assertTrue(niter[1] < niter[0])
+
+        failed = False
+        if self.rank == 0:
+            maps = [
+                hp.read_map(
+                    os.path.join(self.outdir, prefix + "destriped.fits"),
+                    None,
+                    nest=True,
+                )
+                for prefix in ["toast_nocoarse_", "toast_coarse_"]
+            ]
+            hits = hp.read_map(
+                os.path.join(self.outdir, "toast_nocoarse_hits.fits"), nest=True
+            )
+            good = hits > 0
+            # The overall offset is only weakly constrained by the prior
+            diff = (maps[1] - maps[0])[:, good]
+            diff[0] -= np.mean(diff[0])
+            rms = np.std(maps[0][:, good], axis=1)
+            if np.any(np.std(diff, axis=1) > 1e-3 * rms):
+                print(
+                    "Coarse solution differs: {} vs. {}".format(
+                        np.std(diff, axis=1), rms
+                    )
+                )
+                failed = True
+        if self.comm is not None:
+            failed = self.comm.bcast(failed, root=0)
+        self.assertFalse(failed)
+
+        return
+
+    def test_coarse_build_cost(self):
+        # Pointing in both orderings
+        for nest, prefix in [(True, ""), (False, "ring")]:
+            pointing = OpPointingHpix(
+                nside=self.map_nside,
+                nest=nest,
+                mode=self.pointingmode,
+                pixels=prefix + "pixels",
+                weights=prefix + "weights",
+            )
+            pointing.exec(self.data)
+
+        detweights = []
+        for obs in self.data.obs:
+            detweights.append({det: 1.0 for det in obs["tod"].local_dets})
+        offset_template = OffsetTemplate(
+            self.data, detweights, step_length=1, intervals="intervals"
+        )
+        templates = TemplateMatrix(self.data, self.comm, [offset_template])
+
+        # Count the passes over the detector data
+        nread = [0]
+        for obs in self.data.obs:
+            tod = obs["tod"]
+
+            def counting_flags(*args, tod=tod, **kwargs):
+                nread[0] += 1
+                return type(tod).local_flags(tod, *args, **kwargs)
+
+            tod.local_flags = counting_flags
+
+        # Building E must not apply A once per coarse pixel
+        costs = []
+        for coarse_nside in [self.map_nside // 8, self.map_nside // 2]:
+            nread[0] = 0
+            coarse = CoarseCorrection(
+                self.data, self.comm, templates, self.map_nside, coarse_nside
+            )
+            coarse.build()
+            costs.append(nread[0])
+        self.assertEqual(costs[0], costs[1])
+
+        # RING ordered pixels give the same coarse space
+        ring = CoarseCorrection(
+            self.data,
+            self.comm,
+            templates,
+            self.map_nside,
+            self.map_nside // 2,
+            pixels="ringpixels",
+            weights="ringweights",
+            nest=False,
+        )
+        ring.build()
+        np.testing.assert_array_equal(ring.active, coarse.active)
+        np.testing.assert_allclose(ring.basis.toarray(), coarse.basis.toarray())
+        np.testing.assert_allclose(
+            ring.coarse_inverse, coarse.coarse_inverse, rtol=1e-6, atol=1e-12
+        )
+
+        for obs in self.data.obs:
+            del obs["tod"].local_flags
+
+        return
+
+    def test_mapmaker_incremental(self):
+        # make a simple pointing matrix
+        pointing = OpPointingHpix(
+            nside=self.map_nside, nest=True, mode=self.pointingmode
+        )
+        pointing.exec(self.data)
+
+        distmap = DistPixels(self.data, nnz=self.nnz, dtype=np.float32)
+        distmap.read_healpix_fits(self.inmapfile)
+
+        statedir = os.path.join(self.outdir, "incremental_state")
+        if self.rank == 0 and os.path.isdir(statedir):
+            shutil.rmtree(statedir)
+        if self.comm is not None:
+            self.comm.barrier()
+
+        # Fold the same observations in twice under different names, so that
+        # the second run has twice the hits of the first one.
+
+        for run in range(2):
+            name = "incremental{}".format(run)
+            scansim = OpSimScan(input_map=distmap, out=name)
+            scansim.exec(self.data)
+            opnoise = OpSimNoise(realization=run, out=name)
+            opnoise.exec(self.data)
+            if run == 1:
+                for obs in self.data.obs:
+                    obs["name"] += "-rerun"
+            mapmaker = OpMapMaker(
+                nside=self.map_nside,
+                nnz=self.nnz,
+                name=name,
+                outdir=self.outdir,
+                outprefix="toast_incremental{}_".format(run),
+                baseline_length=1,
+                iter_max=100,
+                use_noise_prior=True,
+                state_dir=statedir,
+            )
+            mapmaker.exec(self.data)
+
+        # Folding in an observation twice is an error
+        mapmaker = OpMapMaker(
+            nside=self.map_nside,
+            nnz=self.nnz,
+            name="incremental1",
+            outdir=self.outdir,
+            outprefix="toast_incremental2_",
+            baseline_length=1,
+            state_dir=statedir,
+        )
+        with self.assertRaises(RuntimeError):
+            mapmaker.exec(self.data)
+
+        failed = False
+        if self.rank == 0:
+            hits = [
+                hp.read_map(
+                    os.path.join(
+                        self.outdir, "toast_incremental{}_hits.fits".format(x)
+                    ),
+                    nest=True,
+                )
+                for x in range(2)
+            ]
+            if not np.allclose(hits[1], 2 * hits[0]):
+                print("Incremental hits do not accumulate")
+                failed = True
+            rms = []
+            for run in range(2):
+                m = hp.read_map(
+                    os.path.join(
+                        self.outdir, "toast_incremental{}_destriped.fits".format(run)
+                    ),
+                    None,
+                    nest=True,
+                )
+                good = hits[0] > 0
+                rms.append(np.std((m[0] - self.inmap[0])[good]))
+            if not rms[1] < rms[0]:
+                print("Incremental map is not better: {}".format(rms))
+                failed = True
+        if self.comm is not None:
+            failed = self.comm.bcast(failed, root=0)
+        self.assertFalse(failed)
+
+        return
+
     def test_mapmaker_madam(self):
 
         name = "testtod2"
@@ -11,7 +11,7 @@ import numpy as np
 
 from .._libtoast import pointing_matrix_healpix
 from ..healpix import HealpixPixels
-from ..todmap import TODHpixSpiral, OpPointingHpix
+from ..todmap import TODHpixSpiral, OpPointingHpix, OpPairSumDiff, find_detector_pairs
 from .. import qarray as qa
 
 from ._helpers import create_outdir, create_distdata, boresight_focalplane
@@ -283,3 +283,79 @@ class OpPointingHpixTest(MPITestCase):
         if rank == 0:
             handle.close()
         return
+
+    def test_hpix_pairs(self):
+        # Detector pairs, with all detectors of the observation local
+        data = create_distdata(self.comm, obs_per_group=1)
+        dnames, dquat, depsilon, _, _, _, _, _ = boresight_focalplane(
+            4, epsilon=0.01, pairs=True
+        )
+        tod = TODHpixSpiral(
+            data.comm.comm_group, dquat, 1000, detranks=1, rate=10.0, nside=512
+        )
+        data.obs[0]["tod"] = tod
+
+        pairs, singles = find_detector_pairs(tod.detoffset(), tod.local_dets)
+        self.assertEqual(len(pairs), 2)
+        self.assertEqual(len(singles), 0)
+        for det_a, det_b, dpsi in pairs:
+            self.assertTrue(np.abs(dpsi - np.pi / 2) < 1.0e-10)
+
+        cal = {x: 1.0 + 0.1 * i for i, x in enumerate(dnames)}
+        op = OpPointingHpix(
+            pixels="pixels_ref",
+            weights="weights_ref",
+            nside=64,
+            mode="IQU",
+            cal=cal,
+            epsilon=depsilon,
+        )
+        op.exec(data)
+        op = OpPointingHpix(nside=64, mode="IQU", cal=cal, epsilon=depsilon, pairs=True)
+        op.exec(data)
+        for det in tod.local_dets:
+            np.testing.assert_array_equal(
+                tod.cache.reference("pixels_{}".format(det)),
+                tod.cache.reference("pixels_ref_{}".format(det)),
+            )
+            np.testing.assert_allclose(
+                tod.cache.reference("weights_{}".format(det)),
+                tod.cache.reference("weights_ref_{}".format(det)),
+                rtol=0,
+                atol=1.0e-12,
+            )
+
+        # Sums and differences
+        for det in tod.local_dets:
+            tod.cache.put("signal_{}".format(det), np.random.randn(1000))
+        op = OpPairSumDiff(weights="weights")
+        op.exec(data)
+        self.assertEqual(op.detectors, [x[0] for x in pairs])
+        for det_a, det_b, dpsi in pairs:
+            sig_a = tod.local_signal(det_a)
+            sig_b = tod.local_signal(det_b)
+            np.testing.assert_allclose(
+                tod.cache.reference("sum_{}".format(det_a)), 0.5 * (sig_a + sig_b)
+            )
+            np.testing.assert_allclose(
+                tod.cache.reference("diff_{}".format(det_a)), 0.5 * (sig_a - sig_b)
+            )
+            weights_a = tod.cache.reference("weights_{}".format(det_a))
+            weights_b = tod.cache.reference("weights_{}".format(det_b))
+            weights_sum = tod.cache.reference("weights_sum_{}".format(det_a))
+            weights_diff = tod.cache.reference("weights_diff_{}".format(det_a))
+            self.assertEqual(weights_sum.shape, (1000, 1))
+            self.assertEqual(weights_diff.shape, (1000, 2))
+            np.testing.assert_allclose(
+                weights_sum[:, 0], 0.5 * (cal[det_a] + cal[det_b])
+            )
+            # The polarization angles of orthogonal detectors are opposite
+            eta_a = (1 - depsilon[det_a]) / (1 + depsilon[det_a])
+            eta_b = (1 - depsilon[det_b]) / (1 + depsilon[det_b])
+            scale = (
+                0.5 * (eta_a * cal[det_a] + eta_b * cal[det_b]) / (eta_a * cal[det_a])
+            )
+            np.testing.assert_allclose(
+                weights_diff, scale * weights_a[:, 1:], rtol=0, atol=1.0e-12
+            )
+        return
@@ -0,0 +1,201 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from .. import qarray as qa
+
+from ..todmap import TODHpixSpiral, OpSimSources
+
+from .._libtoast import SourceIndex
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+def brute_force(quats, times, dirs, vels, tref, flux, fwhm, fwhm_minor, psi, nsig):
+    """Evaluate the sources for every sample without the index."""
+    sigma = fwhm / np.sqrt(8 * np.log(2))
+    sigma_minor = fwhm_minor / np.sqrt(8 * np.log(2))
+    xaxis = qa.rotate(quats, np.array([1.0, 0.0, 0.0]))
+    yaxis = qa.rotate(quats, np.array([0.0, 1.0, 0.0]))
+    zaxis = qa.rotate(quats, np.array([0.0, 0.0, 1.0]))
+    result = np.zeros(len(quats))
+    for i in range(len(quats)):
+        pos = dirs
+        if vels is not None:
+            pos = dirs + vels * (times[i] - tref)
+            pos = pos / np.linalg.norm(pos, axis=1)[:, None]
+        dx = np.dot(pos, xaxis[i])
+        dy = np.dot(pos, yaxis[i])
+        dz = np.dot(pos, zaxis[i])
+        rho = np.maximum(np.hypot(dx, dy), 1.0e-300)
+        r = np.arctan2(rho, dz)
+        x = r * dx / rho
+        y = r * dy / rho
+        u = x * np.cos(psi) + y * np.sin(psi)
+        v = -x * np.sin(psi) + y * np.cos(psi)
+        good = r < nsig * sigma
+        chi2 = u[good] ** 2 / sigma ** 2 + v[good] ** 2 / sigma_minor ** 2
+        result[i] = np.sum(flux[good] * np.exp(-0.5 * chi2)) / (
+            2 * np.pi * sigma * sigma_minor
+        )
+    return result
+
+
+class OpSimSourcesTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = 4
+        self.rate = 20.0
+
+        dnames, dquat, _, _, _, _, _, _ = boresight_focalplane(
+            self.ndet, samplerate=self.rate
+        )
+        self.dnames = dnames
+
+        tod = TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            1000 * self.data.comm.group_size,
+            detranks=1,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+        self.data.obs[0]["tod"] = tod
+
+        # A dense random catalog, and a few sources right on the local scan
+        # of the first detector.
+
+        rng = np.random.RandomState(12345)
+        nrand = 20000
+        self.lon = rng.uniform(0, 360, nrand)
+        self.lat = np.degrees(np.arcsin(rng.uniform(-1, 1, nrand)))
+        pntg = qa.rotate(tod.read_pntg(detector=dnames[0]), np.array([0, 0, 1.0]))
+        self.hits = [100, 400, 800]
+        lon = np.degrees(np.arctan2(pntg[self.hits, 1], pntg[self.hits, 0]))
+        lat = np.degrees(np.arcsin(pntg[self.hits, 2]))
+        self.lon = np.concatenate([self.lon, lon])
+        self.lat = np.concatenate([self.lat, lat])
+        self.flux = rng.uniform(1, 2, self.lon.size)
+
+    def test_index(self):
+        lon = np.radians(self.lon)
+        lat = np.radians(self.lat)
+        dirs = np.column_stack(
+            [np.cos(lat) * np.cos(lon), np.cos(lat) * np.sin(lon), np.sin(lat)]
+        )
+        index = SourceIndex(dirs.ravel(), np.zeros(0), 0.0, 16, 8)
+        self.assertEqual(index.nsource(), lon.size)
+        rng = np.random.RandomState(0)
+        for trial in range(10):
+            center = rng.randn(3)
+            center /= np.linalg.norm(center)
+            radius = rng.uniform(0, 0.3)
+            found = np.sort(index.query(center, radius))
+            dist = np.arccos(np.clip(np.dot(dirs, center), -1, 1))
+            np.testing.assert_array_equal(found, np.where(dist <= radius)[0])
+        return
+
+    def test_static(self):
+        fwhm = 30.0
+        fwhm_minor = 20.0
+        beam_angle = 30.0
+        op = OpSimSources(
+            self.lon,
+            self.lat,
+            self.flux,
+            fwhm,
+            fwhm_minor=fwhm_minor,
+            beam_angle=beam_angle,
+            out="sources",
+        )
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        lon = np.radians(self.lon)
+        lat = np.radians(self.lat)
+        dirs = np.column_stack(
+            [np.cos(lat) * np.cos(lon), np.cos(lat) * np.sin(lon), np.sin(lat)]
+        )
+        for det in tod.local_dets:
+            signal = tod.cache.reference("sources_{}".format(det))
+            expected = brute_force(
+                tod.read_pntg(detector=det),
+                tod.local_times(),
+                dirs,
+                None,
+                0.0,
+                self.flux,
+                np.radians(fwhm / 60),
+                np.radians(fwhm_minor / 60),
+                np.radians(beam_angle),
+                5.0,
+            )
+            np.testing.assert_allclose(signal, expected, rtol=1e-8, atol=1e-8)
+
+        # The sources on the scan of the first detector are seen at their
+        # peak amplitude.
+        if self.dnames[0] in tod.local_dets:
+            signal = tod.cache.reference("sources_{}".format(self.dnames[0]))
+            sigma = np.radians(fwhm / 60) / np.sqrt(8 * np.log(2))
+            sigma_minor = np.radians(fwhm_minor / 60) / np.sqrt(8 * np.log(2))
+            peak = self.flux[-3:] / (2 * np.pi * sigma * sigma_minor)
+            self.assertTrue(np.all(signal[self.hits] >= peak))
+        return
+
+    def test_moving(self):
+        fwhm = 60.0
+        lon_rate = np.full(self.lon.size, 0.01)
+        lat_rate = np.full(self.lon.size, -0.005)
+        op = OpSimSources(
+            self.lon,
+            self.lat,
+            self.flux,
+            fwhm,
+            lon_rate=lon_rate,
+            lat_rate=lat_rate,
+            tref=10.0,
+            out="sources",
+        )
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        lon = np.radians(self.lon)
+        lat = np.radians(self.lat)
+        dirs = np.column_stack(
+            [np.cos(lat) * np.cos(lon), np.cos(lat) * np.sin(lon), np.sin(lat)]
+        )
+        dlon = np.radians(lon_rate)
+        dlat = np.radians(lat_rate)
+        vels = np.column_stack(
+            [
+                -dlon * np.cos(lat) * np.sin(lon) - dlat * np.sin(lat) * np.cos(lon),
+                dlon * np.cos(lat) * np.cos(lon) - dlat * np.sin(lat) * np.sin(lon),
+                dlat * np.cos(lat),
+            ]
+        )
+        for det in tod.local_dets:
+            signal = tod.cache.reference("sources_{}".format(det))
+            expected = brute_force(
+                tod.read_pntg(detector=det),
+                tod.local_times(),
+                dirs,
+                vels,
+                10.0,
+                self.flux,
+                np.radians(fwhm / 60),
+                np.radians(fwhm / 60),
+                0.0,
+                5.0,
+            )
+            np.testing.assert_allclose(signal, expected, rtol=1e-8, atol=1e-8)
+        return
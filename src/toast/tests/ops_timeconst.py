@@ -0,0 +1,154 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from ..tod import OpTimeConstant
+from ..todmap import TODHpixSpiral
+
+from ._helpers import create_outdir, create_distdata, boresight_focalplane
+
+
+def exponential_filter(signal, rate, tau, tau2=0.0, fraction=0.0):
+    """Apply the sampled time constant response with a direct recursion."""
+    result = np.zeros_like(signal)
+    for t, w in [(tau, 1 - fraction), (tau2, fraction)]:
+        if w == 0:
+            continue
+        a = np.exp(-1 / (t * rate))
+        y = signal[0]
+        out = np.zeros_like(signal)
+        for i, x in enumerate(signal):
+            y = a * y + (1 - a) * x
+            out[i] = y
+        result += w * out
+    return result
+
+
+class OpTimeConstantTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+
+        self.data = create_distdata(self.comm, obs_per_group=1)
+        self.ndet = 4
+        self.rate = 100.0
+        self.totsamp = 5000 * self.data.comm.group_size
+
+        dnames, dquat, _, _, _, _, _, _ = boresight_focalplane(
+            self.ndet, samplerate=self.rate
+        )
+
+        tod = TODHpixSpiral(
+            self.data.comm.comm_group,
+            dquat,
+            self.totsamp,
+            detranks=self.data.comm.group_size,
+            firsttime=0.0,
+            rate=self.rate,
+            nside=512,
+        )
+        self.data.obs[0]["tod"] = tod
+
+        # Different time constants for every detector, with a second time
+        # constant for half of them.
+        focalplane = dict()
+        for idet, det in enumerate(dnames):
+            props = {"quat": dquat[det], "tau": 0.01 * (idet + 1)}
+            if idet % 2 == 1:
+                props["tau2"] = 0.2
+                props["fraction"] = 0.1
+            focalplane[det] = props
+        self.data.obs[0]["focalplane"] = focalplane
+
+        offset, nsamp = tod.local_samples
+        rank = 0
+        if self.comm is not None:
+            rank = self.comm.rank
+        rng = np.random.RandomState(4321 + rank)
+        self.input = dict()
+        for det in tod.local_dets:
+            signal = rng.randn(nsamp) + 0.01 * np.cumsum(rng.randn(nsamp))
+            self.input[det] = signal
+            tod.cache.put("signal_{}".format(det), signal.copy())
+
+    def test_convolve(self):
+        # The shortest block length for the margin of the longest (0.2 s)
+        # time constant
+        op = OpTimeConstant(fftlen=1200)
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        focalplane = self.data.obs[0]["focalplane"]
+        for det in tod.local_dets:
+            props = focalplane[det]
+            expected = exponential_filter(
+                self.input[det],
+                self.rate,
+                props["tau"],
+                props.get("tau2", 0.0),
+                props.get("fraction", 0.0),
+            )
+            signal = tod.local_signal(det)
+            np.testing.assert_allclose(signal, expected, rtol=0, atol=1e-8)
+        return
+
+    def test_roundtrip(self):
+        op = OpTimeConstant()
+        op.exec(self.data)
+        tod = self.data.obs[0]["tod"]
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            self.assertTrue(np.std(signal - self.input[det]) > 0.1)
+
+        op = OpTimeConstant(deconvolve=True)
+        op.exec(self.data)
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            np.testing.assert_allclose(signal, self.input[det], rtol=0, atol=1e-8)
+
+        # Regularization suppresses the high frequencies
+        op = OpTimeConstant()
+        op.exec(self.data)
+        op = OpTimeConstant(deconvolve=True, epsilon=0.1)
+        op.exec(self.data)
+        for det in tod.local_dets:
+            signal = tod.local_signal(det)
+            self.assertTrue(np.std(signal) < np.std(self.input[det]))
+        return
+
+    def test_short_blocks(self):
+        # Short blocks span many batches, so the first block of each batch
+        # reads the input carried over from the previous batch.
+        op = OpTimeConstant(tau=0.01, fftlen=64)
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        for det in tod.local_dets:
+            expected = exponential_filter(self.input[det], self.rate, 0.01)
+            signal = tod.local_signal(det)
+            np.testing.assert_allclose(signal, expected, rtol=0, atol=1e-8)
+
+        # The kept part of a block must cover the 20 sample margin
+        op = OpTimeConstant(tau=0.01, fftlen=59)
+        if len(tod.local_dets) > 0:
+            with self.assertRaises(RuntimeError):
+                op.exec(self.data)
+        return
+
+    def test_override(self):
+        # A time constant given to the operator replaces the focalplane
+        op = OpTimeConstant(tau=0.05)
+        op.exec(self.data)
+
+        tod = self.data.obs[0]["tod"]
+        for det in tod.local_dets:
+            expected = exponential_filter(self.input[det], self.rate, 0.05)
+            signal = tod.local_signal(det)
+            np.testing.assert_allclose(signal, expected, rtol=0, atol=1e-8)
+        return
@@ -11,7 +11,7 @@ import numpy as np
 from ..tod import AnalyticNoise, OpSimNoise
 from ..todmap import TODHpixSpiral
 
-from ..fod import autocov_psd
+from ..fod import autocov_psd, fit_psds, analytic_noise_from_psds
 
 from ._helpers import (
     create_outdir,
@@ -234,3 +234,47 @@ class PSDTest(MPITestCase):
                 del noisetod
 
         return
+
+    def test_fit_psds(self):
+        # A batch of analytic noise models with log-normal scatter, as for
+        # bin-averaged periodograms
+        nmode = 50
+        npsd = 200
+        freqs = np.logspace(-3, np.log10(self.rate / 2), 200)
+        rng = np.random.RandomState(12345)
+        net = rng.uniform(5, 20, npsd)
+        fknee = rng.uniform(0.05, 0.5, npsd)
+        alpha = rng.uniform(1.0, 2.5, npsd)
+        fmin = 1.0e-5
+        truth = (freqs ** alpha[:, None] + fknee[:, None] ** alpha[:, None]) / (
+            freqs ** alpha[:, None] + fmin ** alpha[:, None]
+        )
+        truth *= net[:, None] ** 2
+        psds = truth * np.exp(rng.randn(*truth.shape) / np.sqrt(nmode))
+        weights = np.full(psds.shape, np.sqrt(nmode))
+
+        params, cov, chi2 = fit_psds(freqs, psds, weights=weights, fmin=fmin)
+
+        # The fits agree with the inputs within their uncertainties, and the
+        # fixed high pass is untouched.
+        for ipar, value in enumerate([net, fknee, alpha]):
+            sigma = np.sqrt(cov[:, ipar, ipar])
+            self.assertTrue(np.all(sigma > 0))
+            pull = (params[:, ipar] - value) / sigma
+            self.assertTrue(np.abs(np.mean(pull)) < 0.5)
+            self.assertTrue(np.std(pull) < 1.5)
+        np.testing.assert_array_equal(params[:, 3], fmin)
+        np.testing.assert_array_equal(cov[:, 3], 0)
+        self.assertTrue(np.all(chi2 < 2 * freqs.size))
+
+        dets = ["d{:03d}".format(x) for x in range(npsd)]
+        nse, covs = analytic_noise_from_psds(
+            dets, self.rate, freqs, psds, weights=weights, fmin=fmin
+        )
+        for idet, det in enumerate(dets):
+            self.assertEqual(nse.NET(det), params[idet, 0])
+            self.assertEqual(nse.fknee(det), params[idet, 1])
+            self.assertEqual(nse.alpha(det), params[idet, 2])
+            self.assertEqual(nse.rate(det), self.rate)
+            np.testing.assert_array_equal(covs[det], cov[idet])
+        return
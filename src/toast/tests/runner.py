@@ -37,6 +37,12 @@ from . import ops_sim_sss as testopssimsss
 
 from . import ops_polyfilter as testopspolyfilter
 from . import ops_groundfilter as testopsgroundfilter
+from . import ops_demod as testopsdemod
+from . import ops_glitch as testopsglitch
+from . import ops_cacheresults as testopscacheresults
+from . import ops_sim_sources as testopssimsources
+from . import ops_timeconst as testopstimeconst
+from . import ops_linefilter as testopslinefilter
 
 from . import ops_gainscrambler as testopsgainscrambler
 from . import ops_applygain as testopsapplygain
@@ -65,6 +71,8 @@ if pysm is not None:
 
 from . import ops_sim_atm as testopsatm
 
+from . import weather as testweather
+
 from ..tod import tidas_available
 
 # if tidas_available:
@@ -134,6 +142,12 @@ def test(name=None, verbosity=2):
         suite.addTest(loader.loadTestsFromModule(testopsgroundfilter))
         suite.addTest(loader.loadTestsFromModule(testsimfocalplane))
         suite.addTest(loader.loadTestsFromModule(testopspolyfilter))
+        suite.addTest(loader.loadTestsFromModule(testopsdemod))
+        suite.addTest(loader.loadTestsFromModule(testopsglitch))
+        suite.addTest(loader.loadTestsFromModule(testopscacheresults))
+        suite.addTest(loader.loadTestsFromModule(testopssimsources))
+        suite.addTest(loader.loadTestsFromModule(testopstimeconst))
+        suite.addTest(loader.loadTestsFromModule(testopslinefilter))
         suite.addTest(loader.loadTestsFromModule(testopsmemorycounter))
         suite.addTest(loader.loadTestsFromModule(testopsgainscrambler))
         suite.addTest(loader.loadTestsFromModule(testpsdmath))
@@ -145,6 +159,7 @@ def test(name=None, verbosity=2):
         suite.addTest(loader.loadTestsFromModule(testmapground))
         suite.addTest(loader.loadTestsFromModule(testbinned))
         suite.addTest(loader.loadTestsFromModule(testopsatm))
+        suite.addTest(loader.loadTestsFromModule(testweather))
         # These tests segfault locally.  Re-enable once we are doing bandpass
         # integration on on the fly.
         # if pysm is not None:
@@ -127,3 +127,50 @@ class TimingTest(MPITestCase):
                     print("  {} = {}".format(k, props[k]), flush=True)
             out = os.path.join(self.outdir, "test_dump")
             dump(result, out)
+
+    def test_gather(self):
+        gt = GlobalTimers.get()
+        gt.stop_all()
+        gt.clear_all()
+        nproc = 1
+        rank = 0
+        if self.comm is not None:
+            nproc = self.comm.size
+            rank = self.comm.rank
+        # A timer shared by all processes with a different number of calls on
+        # each, and one timer that only exists on a single process.
+        for i in range(rank + 1):
+            gt.start("gather_common")
+            time.sleep(0.01 * (rank + 1))
+            gt.stop("gather_common")
+        gt.start("gather_rank_{}".format(rank))
+        gt.stop("gather_rank_{}".format(rank))
+
+        result = gather_timers(comm=self.comm)
+        if rank == 0:
+            names = set(["gather_common"])
+            for p in range(nproc):
+                names.add("gather_rank_{}".format(p))
+            self.assertEqual(set(result.keys()), names)
+            for p in range(nproc):
+                props = result["gather_rank_{}".format(p)]
+                self.assertEqual(props["participating"], 1)
+                self.assertEqual(props["call_min"], 1)
+                self.assertEqual(props["call_max"], 1)
+            props = result["gather_common"]
+            self.assertEqual(props["participating"], nproc)
+            self.assertEqual(props["call_min"], 1)
+            self.assertEqual(props["call_max"], nproc)
+            ranks = np.arange(1, nproc + 1)
+            np.testing.assert_allclose(props["call_median"], np.median(ranks), rtol=0.3)
+            # Process p sleeps (p + 1) times for 10 * (p + 1) milliseconds.
+            np.testing.assert_allclose(
+                props["time_median"], np.median(0.01 * ranks**2), rtol=0.5
+            )
+            self.assertTrue(props["time_min"] <= props["time_median"])
+            self.assertTrue(props["time_median"] <= props["time_max"])
+            self.assertTrue(props["time_std"] >= 0.0)
+            if nproc == 1:
+                self.assertEqual(props["time_std"], 0.0)
+        gt.clear_all()
+        return
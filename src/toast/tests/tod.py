@@ -113,3 +113,40 @@ class TODTest(MPITestCase):
         for d in self.dets:
             data = self.tod.local_signal(d)
             np.testing.assert_almost_equal(data, self.datavec)
+
+    def test_redistribute(self):
+        nproc = 1
+        if self.comm is not None:
+            nproc = self.comm.size
+        # Every sample of every detector has a unique value
+        full = dict()
+        for idet, d in enumerate(self.dets):
+            full[d] = np.arange(self.totsamp, dtype=np.float64) + idet * self.totsamp
+        stamps = np.arange(self.totsamp, dtype=np.float64)
+
+        tod = TODCache(self.comm, self.dets, self.totsamp, detranks=1)
+        offset, nsamp = tod.local_samples
+        tod.write_times(stamps=stamps[offset : offset + nsamp])
+        for d in tod.local_dets:
+            tod.write(detector=d, data=full[d][offset : offset + nsamp])
+            tod.write_flags(
+                detector=d,
+                flags=(full[d][offset : offset + nsamp] % 2).astype(np.uint8),
+            )
+
+        # Distribute by detector and back by time, with small buffers.
+        for detranks in [nproc, 1]:
+            tod.redistribute(detranks, buffer_bytes=40)
+            self.assertEqual(tod.grid_size, (detranks, nproc // detranks))
+            offset, nsamp = tod.local_samples
+            np.testing.assert_equal(tod.local_times(), stamps[offset : offset + nsamp])
+            for d in tod.local_dets:
+                expected = full[d][offset : offset + nsamp]
+                np.testing.assert_equal(tod.read(detector=d), expected)
+                np.testing.assert_equal(
+                    tod.read_flags(detector=d), (expected % 2).astype(np.uint8)
+                )
+            for d in self.dets:
+                if d not in tod.local_dets:
+                    self.assertFalse(tod.cache.exists("signal_{}".format(d)))
+        return
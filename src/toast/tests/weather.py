@@ -0,0 +1,56 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+from .mpi import MPITestCase
+
+import os
+
+import numpy as np
+
+from ..weather import Weather
+
+from ._helpers import create_outdir, create_weather
+
+
+class WeatherTest(MPITestCase):
+    def setUp(self):
+        fixture_name = os.path.splitext(os.path.basename(__file__))[0]
+        self.outdir = create_outdir(self.comm, fixture_name)
+        self.wfile = os.path.join(self.outdir, "weather.fits")
+        if self.comm is None or self.comm.rank == 0:
+            create_weather(self.wfile)
+        if self.comm is not None:
+            self.comm.barrier()
+
+    def test_sample(self):
+        # The batch sampler must reproduce the single-time properties exactly
+        props = {
+            "TQI": "ice_water",
+            "TQL": "liquid_water",
+            "TQV": "pwv",
+            "QV10M": "humidity",
+            "PS": "surface_pressure",
+            "TS": "surface_temperature",
+            "T10M": "air_temperature",
+            "U10M": "west_wind",
+            "V10M": "south_wind",
+        }
+        nsamp = 50
+        times = np.linspace(1.5e9, 1.6e9, nsamp)
+        sites = np.arange(nsamp) % 3
+        realizations = np.arange(nsamp) % 4
+        for fname in [self.wfile, None]:
+            weather = Weather(fname)
+            values = weather.sample(times, sites, realizations)
+            for i in range(nsamp):
+                weather.set(int(sites[i]), int(realizations[i]), times[i])
+                for name, prop in props.items():
+                    self.assertEqual(values[name][i], getattr(weather, prop))
+            # A subset of variables for the current site and realization
+            weather.set(7, 2, times[0])
+            values = weather.sample(times, names=["TQV", "PS"])
+            self.assertEqual(sorted(values.keys()), ["PS", "TQV"])
+            self.assertEqual(values["TQV"][0], weather.pwv)
+            self.assertEqual(values["PS"][0], weather.surface_pressure)
+        return
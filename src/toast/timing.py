@@ -16,6 +16,8 @@ from ._libtoast import Timer, GlobalTimers
 
 from .utils import Environment
 
+from .mpi import MPI
+
 
 def function_timer(f):
     env = Environment.get()
@@ -49,7 +51,8 @@ def compute_stats(plist, full=False):
     """Compute the global timer properties.
 
     Given a list of dictionaries (one per process), examine the timers in each
-    and compute the min / max / mean of the values and number of calls.
+    and compute the min / max / mean / standard deviation of the values and
+    number of calls.
 
     Args:
         plist (list):  The list of per-process results.
@@ -94,15 +97,76 @@ def compute_stats(plist, full=False):
         result[nm]["time_max"] = np.max(seconds[nm][good])
         result[nm]["time_mean"] = np.mean(seconds[nm][good])
         result[nm]["time_median"] = np.median(seconds[nm][good])
+        result[nm]["time_std"] = np.std(seconds[nm][good])
         if full:
             result[nm]["calls"] = calls[nm]
             result[nm]["times"] = seconds[nm]
     return result
 
 
+# Logarithmic histogram bins used to estimate the median of timer values across
+# processes without gathering the individual values.
+_hist_time_edges = np.logspace(-6, 6, 121)
+_hist_call_edges = np.logspace(0, 9, 91)
+
+
+def _global_timer_names(comm, root, local_names):
+    """Agree on the sorted union of timer names across a communicator.
+
+    The name sets are merged pairwise up a binary tree to the root process, so
+    that each process sends a single message and the root only receives the
+    already merged names from log(P) partners.
+
+    """
+    rank = (comm.rank - root) % comm.size
+    names = set(local_names)
+    step = 1
+    while step < comm.size:
+        if rank % (2 * step) == step:
+            comm.send(names, dest=(rank - step + root) % comm.size, tag=step)
+            break
+        if rank + step < comm.size:
+            names |= comm.recv(source=(rank + step + root) % comm.size, tag=step)
+        step *= 2
+    return comm.bcast(sorted(names), root=root)
+
+
+def _histogram_median(hist, edges, vmin, vmax):
+    """Estimate the median from a logarithmic histogram.
+
+    Each of the (one or two) middle ranked values is placed geometrically
+    within its bin and clipped to the known extrema, and these are averaged
+    like the numpy median.
+
+    """
+    nvals = np.sum(hist)
+    cumulative = np.cumsum(hist)
+    estimates = list()
+    for irank in [(nvals - 1) // 2, nvals // 2]:
+        ibin = np.searchsorted(cumulative, irank, side="right")
+        before = cumulative[ibin] - hist[ibin]
+        frac = (irank - before + 0.5) / hist[ibin]
+        low = edges[ibin]
+        high = edges[ibin + 1]
+        estimates.append(min(max(low * (high / low) ** frac, vmin), vmax))
+    return 0.5 * (estimates[0] + estimates[1])
+
+
+def _log_bins(values, edges):
+    """Return the histogram bin of each value, clamping to the outer bins."""
+    bins = np.searchsorted(edges, values, side="right") - 1
+    return np.clip(bins, 0, len(edges) - 2)
+
+
 def gather_timers(comm=None, root=0):
     """Gather global timer information from across a communicator.
 
+    The processes first agree on a common table of timer names and then reduce
+    fixed size numerical records (extrema, sums, sums of squares and
+    logarithmic histograms for the medians) with MPI reductions.  This avoids
+    serializing the timers of every process to the root.  With more than one
+    process the medians are estimated from the histograms.
+
     Args:
         comm (MPI.Comm):  The communicator or None.
         root (int):  The process returning the results.
@@ -112,15 +176,75 @@ def gather_timers(comm=None, root=0):
 
     """
     gt = GlobalTimers.get()
-    local = gt.collect()
-    all = None
-    if comm is None:
-        all = [local]
-    else:
-        all = comm.gather(local, root=root)
-    result = None
-    if (comm is None) or (comm.rank == root):
-        result = compute_stats(all)
+    if comm is None or comm.size == 1:
+        return compute_stats([gt.collect()])
+
+    names = _global_timer_names(comm, root, gt.names())
+    nname = len(names)
+    seconds, calls = gt.collect_table(names)
+    good = calls >= 0
+
+    # Per-name records:  participating, sum of calls, sum of seconds and
+    # sum of squared seconds.
+    local_sum = np.zeros((4, nname), dtype=np.float64)
+    local_sum[0, good] = 1
+    local_sum[1, good] = calls[good]
+    local_sum[2, good] = seconds[good]
+    local_sum[3, good] = seconds[good] ** 2
+
+    # Extrema, with the sign flipped for the maxima so that a single MIN
+    # reduction gives both.
+    local_min = np.full((4, nname), np.inf, dtype=np.float64)
+    local_min[0, good] = calls[good]
+    local_min[1, good] = -calls[good]
+    local_min[2, good] = seconds[good]
+    local_min[3, good] = -seconds[good]
+
+    ntbin = len(_hist_time_edges) - 1
+    ncbin = len(_hist_call_edges) - 1
+    local_hist = np.zeros((nname, ntbin + ncbin), dtype=np.int64)
+    igood = np.arange(nname)[good]
+    local_hist[igood, _log_bins(seconds[good], _hist_time_edges)] = 1
+    local_hist[igood, ntbin + _log_bins(calls[good], _hist_call_edges)] = 1
+
+    all_sum = None
+    all_min = None
+    all_hist = None
+    if comm.rank == root:
+        all_sum = np.zeros_like(local_sum)
+        all_min = np.zeros_like(local_min)
+        all_hist = np.zeros_like(local_hist)
+    comm.Reduce(local_sum, all_sum, op=MPI.SUM, root=root)
+    comm.Reduce(local_min, all_min, op=MPI.MIN, root=root)
+    comm.Reduce(local_hist, all_hist, op=MPI.SUM, root=root)
+
+    if comm.rank != root:
+        return None
+
+    result = dict()
+    for inm, nm in enumerate(names):
+        nproc = int(all_sum[0, inm])
+        call_min = int(all_min[0, inm])
+        call_max = int(-all_min[1, inm])
+        time_min = all_min[2, inm]
+        time_max = -all_min[3, inm]
+        time_mean = all_sum[2, inm] / nproc
+        time_var = max(all_sum[3, inm] / nproc - time_mean**2, 0.0)
+        result[nm] = dict()
+        result[nm]["participating"] = nproc
+        result[nm]["call_min"] = call_min
+        result[nm]["call_max"] = call_max
+        result[nm]["call_mean"] = all_sum[1, inm] / nproc
+        result[nm]["call_median"] = _histogram_median(
+            all_hist[inm, ntbin:], _hist_call_edges, call_min, call_max
+        )
+        result[nm]["time_min"] = time_min
+        result[nm]["time_max"] = time_max
+        result[nm]["time_mean"] = time_mean
+        result[nm]["time_median"] = _histogram_median(
+            all_hist[inm, :ntbin], _hist_time_edges, time_min, time_max
+        )
+        result[nm]["time_std"] = np.sqrt(time_var)
     return result
 
 
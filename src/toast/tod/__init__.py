@@ -15,6 +15,7 @@ from .tod_math import (
     OpCacheClear,
     flagged_running_average,
     OpCacheInit,
+    OpCacheResults,
     OpFlagsApply,
 )
 
@@ -37,6 +38,12 @@ from .noise import Noise
 
 from .polyfilter import OpPolyFilter, OpPolyFilter2D, OpCommonModeFilter
 
+from .glitch import OpFlagGlitches
+
+from .timeconst import OpTimeConstant
+
+from .linefilter import OpLineFilter
+
 from .gainscrambler import OpGainScrambler
 from .applygain import OpApplyGain, write_calibration_file
 from .crosstalk import OpCrosstalk, SimpleCrosstalkMatrix
@@ -0,0 +1,128 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import numpy as np
+
+from .._libtoast import flag_glitches
+
+from ..op import Operator
+
+from ..timing import function_timer
+
+
+class OpFlagGlitches(Operator):
+    """Operator which flags glitches and jumps in detector timestreams.
+
+    The noise level of each detector is tracked with a running median and
+    a running median absolute deviation (MAD).  Samples further than
+    `glitch_threshold` robust standard deviations (1.4826 MAD) from the
+    running median are flagged as glitches.  A matched filter comparing the
+    mean of `jump_width` samples on either side of each sample boundary
+    finds jumps larger than `jump_threshold` standard deviations.  Flagged
+    regions are extended by `dilation` samples on either side.
+
+    The flag values are OR-ed into the detector flags in place, so they are
+    seen by OpFlagsApply and by the mapmaking operators through their flag
+    masks.  All local detectors of an observation are processed in parallel
+    in compiled code.
+
+    Args:
+        name (str):  Name of the signal cache objects <name>_<detector>.
+            If None, the TOD signal is used.
+        flag_name (str):  Name of the detector flags to update.  If None,
+            the TOD flags are used.
+        flag_mask (byte):  Detector flag bits excluded from the statistics.
+        common_flag_name (str):  Name of the common flags.  If None, the
+            TOD common flags are used.
+        common_flag_mask (byte):  Common flag bits excluded from the
+            statistics.
+        window (int):  The running median window in samples.
+        glitch_threshold (float):  The glitch threshold.  Zero disables
+            glitch detection.
+        jump_width (int):  The width of each side of the jump filter in
+            samples.
+        jump_threshold (float):  The jump threshold.  Zero disables jump
+            detection.
+        dilation (int):  The number of samples flagged on either side of a
+            glitch or jump.
+        glitch_flag_value (byte):  Flag bits set for glitches.
+        jump_flag_value (byte):  Flag bits set for jumps.
+
+    """
+
+    def __init__(
+        self,
+        name=None,
+        flag_name=None,
+        flag_mask=255,
+        common_flag_name=None,
+        common_flag_mask=255,
+        window=1000,
+        glitch_threshold=5.0,
+        jump_width=100,
+        jump_threshold=10.0,
+        dilation=10,
+        glitch_flag_value=1,
+        jump_flag_value=1,
+    ):
+        self._name = name
+        self._flag_name = flag_name
+        self._flag_mask = flag_mask
+        self._common_flag_name = common_flag_name
+        self._common_flag_mask = common_flag_mask
+        self._window = window
+        self._glitch_threshold = glitch_threshold
+        self._jump_width = jump_width
+        self._jump_threshold = jump_threshold
+        self._dilation = dilation
+        self._glitch_flag_value = glitch_flag_value
+        self._jump_flag_value = jump_flag_value
+
+        # We call the parent class constructor, which currently does nothing
+        super().__init__()
+
+    @function_timer
+    def exec(self, data):
+        """Flag glitches and jumps in all local detectors.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            None
+
+        """
+        for obs in data.obs:
+            tod = obs["tod"]
+            common = tod.local_common_flags(self._common_flag_name)
+
+            signals = list()
+            flags = list()
+            for det in tod.local_dets:
+                signals.append(
+                    np.ascontiguousarray(
+                        tod.local_signal(det, self._name), dtype=np.float64
+                    )
+                )
+                flags.append(tod.local_flags(det, self._flag_name))
+
+            flag_glitches(
+                self._window,
+                self._glitch_threshold,
+                self._jump_width,
+                self._jump_threshold,
+                self._dilation,
+                self._glitch_flag_value,
+                self._jump_flag_value,
+                self._flag_mask,
+                common,
+                self._common_flag_mask,
+                signals,
+                flags,
+            )
+            del signals
+            del flags
+            del common
+
+        return
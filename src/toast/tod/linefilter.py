@@ -0,0 +1,195 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import re
+
+import numpy as np
+
+from .._libtoast import filter_lines
+
+from ..op import Operator
+
+from ..timing import function_timer
+
+
+class OpLineFilter(Operator):
+    """Operator which removes narrow spectral lines from the TOD.
+
+    Every line is removed with a notch in the Fourier domain, one valid
+    interval at a time.  The lines are either given at fixed frequencies
+    (for example pulse tube or readout lines) or as harmonics of the
+    azimuth scan frequency.  Flagged samples are replaced with a linear
+    interpolation before the transform, and the line estimate is
+    subtracted from all samples of the interval.  The removal is
+    incomplete within about one inverse width of the interval ends.
+
+    All local detectors of an observation are filtered together in
+    compiled code, with batched FFT plans.  Each process filters its local
+    samples, so the data should be distributed by detector.
+
+    Args:
+        lines (list):  List of (frequency, width) tuples in Hz of the fixed
+            lines.  The width is the full width of the notch.
+        scan_lines (list):  List of (harmonic, width) tuples of the lines
+            at multiples of the scan frequency.
+        scan_frequency (float):  The azimuth scan frequency in Hz.  If None
+            and scan_lines are given, it is measured from the turnarounds of
+            the boresight azimuth.
+        pattern (str):  Regex pattern to match against detector names.
+            Only detectors that match the pattern are filtered.
+        name (str):  Name of the signal cache objects <name>_<detector>,
+            filtered in place.  If None, the TOD signal is used.
+        common_flag_name (str):  Cache name of the common flags.  If None,
+            the flags are read from the tod object.
+        common_flag_mask (byte):  Bitmask to use when flagging data
+           based on the common flags.
+        flag_name (str):  Cache name of the detector flags
+            <flag_name>_<detector>.  If None, the flags are read from the
+            tod object.
+        flag_mask (byte):  Bitmask to use when flagging data
+           based on the detector flags.
+        intervals (str):  Name of the valid intervals in observation.
+        rate (float):  The sample rate in Hz.  If None, it is measured from
+            the timestamps.
+
+    """
+
+    def __init__(
+        self,
+        lines=None,
+        scan_lines=None,
+        scan_frequency=None,
+        pattern=r".*",
+        name=None,
+        common_flag_name=None,
+        common_flag_mask=255,
+        flag_name=None,
+        flag_mask=255,
+        intervals="intervals",
+        rate=None,
+    ):
+        self._lines = lines
+        self._scan_lines = scan_lines
+        self._scan_frequency = scan_frequency
+        self._pattern = pattern
+        self._name = name
+        self._common_flag_name = common_flag_name
+        self._common_flag_mask = common_flag_mask
+        self._flag_name = flag_name
+        self._flag_mask = flag_mask
+        self._intervals = intervals
+        self._rate = rate
+
+        # Call the parent class constructor.
+        super().__init__()
+
+    def _measure_scan_frequency(self, tod):
+        """Estimate the scan frequency from the azimuth turnarounds.
+
+        The turnarounds are collected from all processes of the observation,
+        so that every process finds the same frequency.
+
+        """
+        if not hasattr(tod, "read_boresight_az"):
+            raise RuntimeError(
+                "Cannot measure the scan frequency without boresight azimuth"
+            )
+        times = tod.local_times()
+        turns = np.zeros(0, dtype=np.float64)
+        if times.size > 2:
+            az = np.unwrap(tod.read_boresight_az())
+            direction = np.sign(np.diff(az))
+            iturns = np.where(direction[1:] * direction[:-1] < 0)[0] + 1
+            turns = times[iturns]
+            del az
+        del times
+        comm = tod.mpicomm
+        if comm is not None:
+            # Processes that share samples find the same turnarounds
+            turns = np.unique(np.hstack(comm.allgather(turns)))
+        if len(turns) < 3:
+            raise RuntimeError("Too few scan turnarounds to measure the scan frequency")
+        # Two turnarounds per scan period.  The median is insensitive to
+        # turnarounds missed at the boundaries between processes.
+        half_period = np.median(np.diff(turns))
+        return 0.5 / half_period
+
+    @function_timer
+    def exec(self, data):
+        """Remove the lines from all local detectors.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            None
+
+        """
+        pat = re.compile(self._pattern)
+
+        for obs in data.obs:
+            tod = obs["tod"]
+            # All processes of the observation take part in measuring the
+            # scan frequency, even if they have nothing to filter.
+            fscan = self._scan_frequency
+            if fscan is None and self._scan_lines is not None:
+                if len(self._scan_lines) > 0:
+                    fscan = self._measure_scan_frequency(tod)
+            if self._intervals in obs:
+                intervals = obs[self._intervals]
+            else:
+                intervals = None
+            local_intervals = tod.local_intervals(intervals)
+            if len(local_intervals) == 0:
+                # No intervals to filter
+                continue
+
+            times = tod.local_times()
+            rate = self._rate
+            if rate is None:
+                if times.size < 2:
+                    continue
+                rate = 1.0 / np.median(np.diff(times))
+
+            lines = list()
+            if self._lines is not None:
+                lines.extend(self._lines)
+            if self._scan_lines is not None and len(self._scan_lines) > 0:
+                for harmonic, width in self._scan_lines:
+                    lines.append((harmonic * fscan, width))
+            del times
+            if len(lines) == 0:
+                continue
+            freqs = np.array([x[0] for x in lines], dtype=np.float64)
+            widths = np.array([x[1] for x in lines], dtype=np.float64)
+
+            local_starts = np.array(
+                [ival.first for ival in local_intervals], dtype=np.int64
+            )
+            local_stops = np.array(
+                [ival.last for ival in local_intervals], dtype=np.int64
+            )
+
+            common_flags = (
+                tod.local_common_flags(self._common_flag_name) & self._common_flag_mask
+            )
+            signals = list()
+            flags = list()
+            for det in tod.local_dets:
+                if pat.match(det) is None:
+                    continue
+                signals.append(tod.local_signal(det, self._name))
+                flg = tod.local_flags(det, self._flag_name) & self._flag_mask
+                flg |= common_flags
+                flags.append(flg.astype(np.uint8))
+
+            if len(signals) == 0:
+                continue
+
+            filter_lines(rate, freqs, widths, local_starts, local_stops, flags, signals)
+            del signals
+            del flags
+            del common_flags
+
+        return
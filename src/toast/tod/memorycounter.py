@@ -15,7 +15,8 @@ class OpMemoryCounter(Operator):
     """Compute total memory used by TOD objects.
 
     Operator which loops over the TOD objects and computes the total
-    amount of memory allocated.
+    amount of memory allocated.  Cached data which was spilled to disk is
+    reported separately and is not part of the total.
 
     Args:
         silent (bool):  Only count and return the memory without
@@ -51,39 +52,51 @@ class OpMemoryCounter(Operator):
         cgroup = comm.comm_group
 
         tot_task = 0
+        spill_task = 0
         for obj in self._objects:
             try:
                 tot_task += obj.cache.report(silent=True)
+                spill_task += obj.cache.spilled()
             except:
                 pass
             try:
                 tot_task += obj._cache.report(silent=True)
+                spill_task += obj._cache.spilled()
             except:
                 pass
 
         for obs in data.obs:
             tod = obs["tod"]
             tot_task += tod.cache.report(silent=True)
+            spill_task += tod.cache.spilled()
 
         tot_group = tot_task
         tot_world = tot_task
         tot_task_max = tot_task
         tot_group_max = tot_task
+        spill_world = spill_task
+        spill_task_max = spill_task
         if cworld is not None:
             tot_group = cgroup.allreduce(tot_task, op=MPI.SUM)
             tot_world = cworld.allreduce(tot_task, op=MPI.SUM)
             tot_task_max = cworld.allreduce(tot_task, op=MPI.MAX)
             tot_group_max = cgroup.allreduce(tot_group, op=MPI.MAX)
+            spill_world = cworld.allreduce(spill_task, op=MPI.SUM)
+            spill_task_max = cworld.allreduce(spill_task, op=MPI.MAX)
 
         if (not self._silent) and (cworld is None or cworld.rank == 0):
             msg = "Memory usage statistics:\n\
                 - Max memory (task): {:.2f} GB\n\
                 - Max memory (group): {:.2f} GB\n\
                 Total memory: {:.2f} GB\n\
+                - Max spilled to disk (task): {:.2f} GB\n\
+                Total spilled to disk: {:.2f} GB\n\
                 ".format(
                 (tot_task_max / 2 ** 30),
                 (tot_group_max / 2 ** 30),
                 (tot_world / 2 ** 30),
+                (spill_task_max / 2 ** 30),
+                (spill_world / 2 ** 30),
             )
             log.info(msg)
 
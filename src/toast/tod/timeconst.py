@@ -0,0 +1,158 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import numpy as np
+
+from .._libtoast import filter_time_constant
+
+from ..op import Operator
+
+from ..timing import function_timer
+
+
+class OpTimeConstant(Operator):
+    """Operator which applies or removes bolometer time constants.
+
+    The response of each detector is a single exponential with time
+    constant `tau`, or the sum of two exponentials where a `fraction` of the
+    response has the time constant `tau2`.  The signal is either convolved
+    with this response (to simulate the time constants) or deconvolved with
+    the regularized inverse conj(H) / (|H|^2 + epsilon).  A positive epsilon
+    limits the amplification of high frequency noise by the deconvolution.
+
+    By default the time constants of every detector are read from the
+    observation focalplane dictionary.  Detectors without a time constant
+    are not modified.  All local detectors of an observation are filtered
+    together in compiled code, with overlap-save FFT blocks that are
+    transformed in batches.  Each process filters its local samples, so
+    the data must be distributed by detector (see TOD.redistribute).
+
+    Args:
+        name (str):  Name of the signal cache objects <name>_<detector>,
+            filtered in place.  If None, the TOD signal is used.
+        tau (float or dict):  The time constant in seconds, for all
+            detectors or per detector.  If None, all time constants are
+            read from the focalplane.
+        tau2 (float or dict):  The optional second time constant.
+        fraction (float or dict):  The fraction of the response with the
+            second time constant.
+        tau_key (str):  The focalplane key of the time constant.
+        tau2_key (str):  The focalplane key of the second time constant.
+        fraction_key (str):  The focalplane key of the second fraction.
+        deconvolve (bool):  If True, remove the time constants instead of
+            applying them.
+        epsilon (float):  Regularization of the deconvolution.
+        fftlen (int):  The FFT block length.  Zero selects a length from
+            the time constants.
+        rate (float):  The sample rate in Hz.  If None, it is measured from
+            the timestamps.
+
+    """
+
+    def __init__(
+        self,
+        name=None,
+        tau=None,
+        tau2=None,
+        fraction=None,
+        tau_key="tau",
+        tau2_key="tau2",
+        fraction_key="fraction",
+        deconvolve=False,
+        epsilon=0.0,
+        fftlen=0,
+        rate=None,
+    ):
+        self._name = name
+        self._tau = tau
+        self._tau2 = tau2
+        self._fraction = fraction
+        self._tau_key = tau_key
+        self._tau2_key = tau2_key
+        self._fraction_key = fraction_key
+        self._deconvolve = deconvolve
+        self._epsilon = epsilon
+        self._fftlen = fftlen
+        self._rate = rate
+
+        # We call the parent class constructor, which currently does nothing
+        super().__init__()
+
+    def _det_value(self, value, key, focalplane, det):
+        """Find the value of a parameter from the arguments or focalplane."""
+        if value is not None:
+            if isinstance(value, dict):
+                return value.get(det, None)
+            return value
+        if focalplane is None or key is None or det not in focalplane:
+            return None
+        return focalplane[det].get(key, None)
+
+    @function_timer
+    def exec(self, data):
+        """Filter the time constants of all local detectors.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            None
+
+        """
+        for obs in data.obs:
+            tod = obs["tod"]
+            if tod.grid_size[1] > 1:
+                raise RuntimeError(
+                    "OpTimeConstant requires data distributed by detector, "
+                    "not a process grid of {}".format(tod.grid_size)
+                )
+            focalplane = obs.get("focalplane", None)
+
+            rate = self._rate
+            if rate is None:
+                times = tod.local_times()
+                if times.size < 2:
+                    continue
+                rate = 1.0 / np.median(np.diff(times))
+                del times
+
+            tau = list()
+            tau2 = list()
+            fraction = list()
+            signals = list()
+            for det in tod.local_dets:
+                dtau = self._det_value(self._tau, self._tau_key, focalplane, det)
+                if dtau is None:
+                    continue
+                # Time constants given to the operator replace all focalplane
+                # values.
+                fp = focalplane
+                if self._tau is not None:
+                    fp = None
+                dtau2 = self._det_value(self._tau2, self._tau2_key, fp, det)
+                dfrac = self._det_value(self._fraction, self._fraction_key, fp, det)
+                if dtau2 is None or dfrac is None:
+                    dtau2 = 0.0
+                    dfrac = 0.0
+                tau.append(dtau)
+                tau2.append(dtau2)
+                fraction.append(dfrac)
+                signals.append(tod.local_signal(det, self._name))
+
+            if len(signals) == 0:
+                continue
+
+            filter_time_constant(
+                rate,
+                np.array(tau, dtype=np.float64),
+                np.array(tau2, dtype=np.float64),
+                np.array(fraction, dtype=np.float64),
+                self._deconvolve,
+                self._epsilon,
+                self._fftlen,
+                signals,
+            )
+            del signals
+
+        return
@@ -60,43 +60,15 @@ class TOD(object):
         meta=None,
     ):
         self._mpicomm = mpicomm
-        self._detranks = detranks
 
-        self._sampranks = 1
-        self._rank_det = 0
-        self._rank_samp = 0
         self._comm_row = None
         self._comm_col = None
 
         rank = 0
-
-        if mpicomm is None:
-            if detranks != 1:
-                raise RuntimeError("MPI is disabled, so detranks must equal 1")
-        else:
+        if mpicomm is not None:
             rank = mpicomm.rank
-            if mpicomm.size % detranks != 0:
-                raise RuntimeError(
-                    "The number of detranks ({}) does not divide evenly into the "
-                    "communicator size ({})".format(detranks, mpicomm.size)
-                )
-            self._sampranks = mpicomm.size // detranks
-            self._rank_det = mpicomm.rank // self._sampranks
-            self._rank_samp = mpicomm.rank % self._sampranks
-
-            # Split the main communicator into process row and column
-            # communicators, since this is useful for gathering data in some
-            # operations.
 
-            if self._sampranks == 1:
-                self._comm_row = MPI.COMM_SELF
-            else:
-                self._comm_row = self._mpicomm.Split(self._rank_det, self._rank_samp)
-
-            if self._detranks == 1:
-                self._comm_col = MPI.COMM_SELF
-            else:
-                self._comm_col = self._mpicomm.Split(self._rank_samp, self._rank_det)
+        self._create_grid(detranks)
 
         self._dets = detectors
 
@@ -104,6 +76,11 @@ class TOD(object):
 
         self._sizes = sampsizes
 
+        # Keep the distribution constraints for redistributing the data
+        self._detbreaks = detbreaks
+        self._sampsizes = sampsizes
+        self._sampbreaks = sampbreaks
+
         self.meta = meta
         if meta is None:
             self.meta = {}
@@ -157,6 +134,46 @@ class TOD(object):
 
         self.cache = Cache()
 
+    def _create_grid(self, detranks):
+        """Set the process grid dimensions and communicators."""
+        self._detranks = detranks
+        self._sampranks = 1
+        self._rank_det = 0
+        self._rank_samp = 0
+
+        if self._mpicomm is None:
+            if detranks != 1:
+                raise RuntimeError("MPI is disabled, so detranks must equal 1")
+            return
+
+        if self._mpicomm.size % detranks != 0:
+            raise RuntimeError(
+                "The number of detranks ({}) does not divide evenly into the "
+                "communicator size ({})".format(detranks, self._mpicomm.size)
+            )
+        self._sampranks = self._mpicomm.size // detranks
+        self._rank_det = self._mpicomm.rank // self._sampranks
+        self._rank_samp = self._mpicomm.rank % self._sampranks
+
+        # Split the main communicator into process row and column
+        # communicators, since this is useful for gathering data in some
+        # operations.
+
+        for comm in self._comm_row, self._comm_col:
+            if comm is not None and comm != MPI.COMM_SELF:
+                comm.Free()
+
+        if self._sampranks == 1:
+            self._comm_row = MPI.COMM_SELF
+        else:
+            self._comm_row = self._mpicomm.Split(self._rank_det, self._rank_samp)
+
+        if self._detranks == 1:
+            self._comm_col = MPI.COMM_SELF
+        else:
+            self._comm_col = self._mpicomm.Split(self._rank_samp, self._rank_det)
+        return
+
     TIMESTAMP_NAME = "timestamps"
     """Default cache name for timestamps."""
 
@@ -543,6 +560,275 @@ class TOD(object):
         """
         return self._comm_col
 
+    def _redistribute_objects(self, old_dets, old_samples, new_dets, new_samples):
+        """Find the cached objects that follow the sample distribution.
+
+        Every cache object whose leading dimension is the number of local
+        samples is distributed with the data.  Objects named
+        <prefix>_<detector> which only exist on the processes that hold the
+        detector are per-detector objects, all others are common to all
+        detectors.
+
+        Returns:
+            (list):  One tuple (name, dtype, trailing shape, source ranks,
+                destination ranks) for every object.
+
+        """
+        comm = self._mpicomm
+        nproc = comm.size
+        local = dict()
+        for name in self.cache.keys():
+            ref = self.cache.reference(name)
+            local[name] = (ref.dtype.str, ref.shape)
+            del ref
+        allmeta = comm.allgather(local)
+
+        # Longest names first, in case detector names contain underscores.
+        detnames = sorted(self._dets, key=len, reverse=True)
+
+        objects = list()
+        for name in sorted(set([x for meta in allmeta for x in meta])):
+            holders = [p for p in range(nproc) if name in allmeta[p]]
+            if any(allmeta[p][name][1][0:1] != (old_samples[p][1],) for p in holders):
+                # Not indexed by the local samples
+                continue
+            dtype, shape = allmeta[holders[0]][name]
+            for p in holders:
+                if allmeta[p][name][0] != dtype or allmeta[p][name][1][1:] != shape[1:]:
+                    raise RuntimeError(
+                        "Cache object {} has inconsistent types or shapes "
+                        "across processes".format(name)
+                    )
+            det = None
+            for d in detnames:
+                if name.endswith("_" + d) and all(d in old_dets[p] for p in holders):
+                    det = d
+                    break
+            # Every sample must be available on one source process.
+            sources = list()
+            if det is None:
+                destinations = list(range(nproc))
+                columns = dict()
+                for p in holders:
+                    if old_samples[p] not in columns:
+                        columns[old_samples[p]] = p
+                needed = sorted(set([x for x in old_samples if x[1] > 0]))
+                sources = [columns[x] for x in needed if x in columns]
+            else:
+                destinations = [p for p in range(nproc) if det in new_dets[p]]
+                needed = [p for p in range(nproc) if det in old_dets[p]]
+                needed = [p for p in needed if old_samples[p][1] > 0]
+                sources = [p for p in needed if p in holders]
+            if len(sources) != len(needed):
+                raise RuntimeError(
+                    "Cache object {} does not exist for all samples, cannot "
+                    "redistribute it".format(name)
+                )
+            objects.append((name, np.dtype(dtype), shape[1:], sources, destinations))
+        return objects
+
+    @function_timer
+    def redistribute(self, detranks, buffer_bytes=100000000):
+        """Change the shape of the process grid.
+
+        All cached data that follows the sample distribution is moved to
+        the processes that hold it in the new grid:  the per-detector
+        objects <prefix>_<detector> (signal, flags, pointing, ...) and the
+        common objects (timestamps, common flags, boresight, ...).  The
+        constraints on the distribution given to the constructor still
+        apply.  For example, simulations can run on data distributed by
+        time and filters on data distributed by detector.
+
+        The data is exchanged with a sequence of MPI Alltoallv calls.  Each
+        call sends and receives about buffer_bytes per process, so the
+        memory overhead is roughly one cache object plus the communication
+        buffers.  Cache objects whose leading dimension is not the number
+        of local samples are not modified.  Derived classes that keep local
+        sample vectors outside of the cache must override this method and
+        move them too.
+
+        Args:
+            detranks (int):  The new dimension of the process grid in the
+                detector direction.
+            buffer_bytes (int):  The size of the communication blocks.
+
+        Returns:
+            None
+
+        """
+        if self._mpicomm is None:
+            if detranks != 1:
+                raise RuntimeError("MPI is disabled, so detranks must equal 1")
+            return
+        if detranks == self._detranks:
+            return
+
+        comm = self._mpicomm
+        nproc = comm.size
+        rank = comm.rank
+        if nproc % detranks != 0:
+            raise RuntimeError(
+                "The number of detranks ({}) does not divide evenly into the "
+                "communicator size ({})".format(detranks, nproc)
+            )
+        sampranks = nproc // detranks
+
+        (dist_dets, dist_samples, dist_sizes) = distribute_samples(
+            comm,
+            self._dets,
+            self._nsamp,
+            detranks=detranks,
+            detbreaks=self._detbreaks,
+            sampsizes=self._sampsizes,
+            sampbreaks=self._sampbreaks,
+        )
+
+        # The detectors and samples of every process before and after.
+        old_dets = [set(self._dist_dets[p // self._sampranks]) for p in range(nproc)]
+        old_samples = [self._dist_samples[p % self._sampranks] for p in range(nproc)]
+        new_dets = [set(dist_dets[p // sampranks]) for p in range(nproc)]
+        new_samples = [dist_samples[p % sampranks] for p in range(nproc)]
+
+        aliases = self.cache.aliases()
+        objects = self._redistribute_objects(
+            old_dets, old_samples, new_dets, new_samples
+        )
+
+        # Plan the transfers.  Each object is split into windows of samples
+        # and the windows are grouped into batches that fit the buffers.
+        # All processes build the same plan.
+
+        batches = list()
+        last_batch = dict()
+        batch = list()
+        sendbytes = np.zeros(nproc, dtype=np.int64)
+        recvbytes = np.zeros(nproc, dtype=np.int64)
+        for iobj, (name, dtype, shape, sources, destinations) in enumerate(objects):
+            rowbytes = dtype.itemsize * int(np.prod(shape))
+            window = max(1, buffer_bytes // max(1, rowbytes))
+            for first in range(0, self._nsamp, window):
+                last = min(first + window, self._nsamp)
+                transfers = list()
+                wsend = np.zeros(nproc, dtype=np.int64)
+                wrecv = np.zeros(nproc, dtype=np.int64)
+                for src in sources:
+                    start = max(first, old_samples[src][0])
+                    stop = min(last, old_samples[src][0] + old_samples[src][1])
+                    if start >= stop:
+                        continue
+                    for dst in destinations:
+                        dstart = max(start, new_samples[dst][0])
+                        dstop = min(stop, new_samples[dst][0] + new_samples[dst][1])
+                        if dstart >= dstop:
+                            continue
+                        transfers.append((iobj, src, dst, dstart, dstop - dstart))
+                        wsend[src] += (dstop - dstart) * rowbytes
+                        wrecv[dst] += (dstop - dstart) * rowbytes
+                if len(transfers) == 0:
+                    continue
+                if len(batch) > 0 and (
+                    np.amax(sendbytes + wsend) > buffer_bytes
+                    or np.amax(recvbytes + wrecv) > buffer_bytes
+                ):
+                    batches.append(batch)
+                    batch = list()
+                    sendbytes[:] = 0
+                    recvbytes[:] = 0
+                batch.extend(transfers)
+                sendbytes += wsend
+                recvbytes += wrecv
+                last_batch[iobj] = len(batches)
+        if len(batch) > 0:
+            batches.append(batch)
+
+        def finish(iobj, staged):
+            # Replace the local piece of an object once all of its data
+            # has been exchanged.
+            name, dtype, shape, _, destinations = objects[iobj]
+            if name in self.cache.keys():
+                self.cache.destroy(name)
+            if rank in destinations:
+                if iobj not in staged:
+                    # No local samples
+                    staged[iobj] = np.zeros((0,) + shape, dtype=dtype)
+                self.cache.put(name, staged.pop(iobj))
+            return
+
+        staged = dict()
+        finished = 0
+        for ibatch, batch in enumerate(batches):
+            sendcounts = np.zeros(nproc, dtype=np.int64)
+            recvcounts = np.zeros(nproc, dtype=np.int64)
+            for iobj, src, dst, first, n in batch:
+                name, dtype, shape, _, _ = objects[iobj]
+                nbytes = n * dtype.itemsize * int(np.prod(shape))
+                if src == rank:
+                    sendcounts[dst] += nbytes
+                if dst == rank:
+                    recvcounts[src] += nbytes
+            senddispls = np.zeros(nproc, dtype=np.int64)
+            senddispls[1:] = np.cumsum(sendcounts)[:-1]
+            recvdispls = np.zeros(nproc, dtype=np.int64)
+            recvdispls[1:] = np.cumsum(recvcounts)[:-1]
+
+            sendbuf = np.zeros(np.sum(sendcounts), dtype=np.uint8)
+            offsets = senddispls.copy()
+            for iobj, src, dst, first, n in batch:
+                if src != rank:
+                    continue
+                ref = self.cache.reference(objects[iobj][0])
+                local = first - old_samples[rank][0]
+                piece = ref[local : local + n].reshape(-1).view(np.uint8)
+                sendbuf[offsets[dst] : offsets[dst] + piece.size] = piece
+                offsets[dst] += piece.size
+                del piece
+                del ref
+
+            recvbuf = np.zeros(np.sum(recvcounts), dtype=np.uint8)
+            comm.Alltoallv(
+                [sendbuf, (sendcounts, senddispls), MPI.BYTE],
+                [recvbuf, (recvcounts, recvdispls), MPI.BYTE],
+            )
+            del sendbuf
+
+            offsets = recvdispls.copy()
+            for iobj, src, dst, first, n in batch:
+                if dst != rank:
+                    continue
+                name, dtype, shape, _, _ = objects[iobj]
+                if iobj not in staged:
+                    staged[iobj] = np.zeros(
+                        (new_samples[rank][1],) + shape, dtype=dtype
+                    )
+                local = first - new_samples[rank][0]
+                nbytes = n * dtype.itemsize * int(np.prod(shape))
+                piece = recvbuf[offsets[src] : offsets[src] + nbytes]
+                staged[iobj][local : local + n] = piece.view(dtype).reshape(
+                    (n,) + shape
+                )
+                offsets[src] += nbytes
+            del recvbuf
+
+            while finished < len(objects) and last_batch.get(finished, -1) <= ibatch:
+                finish(finished, staged)
+                finished += 1
+
+        while finished < len(objects):
+            finish(finished, staged)
+            finished += 1
+
+        for alias, name in aliases.items():
+            if name in self.cache.keys() and not self.cache.exists(alias):
+                self.cache.add_alias(alias, name)
+
+        self._create_grid(detranks)
+        self._dist_dets = dist_dets
+        self._dist_samples = dist_samples
+        self._dist_sizes = dist_sizes
+        if self._sampsizes is None:
+            self._sizes = [self._dist_samples[x][1] for x in range(self._sampranks)]
+        return
+
     def _get(self, detector, start, n):
         raise NotImplementedError("Fell through to TOD._get base class method")
         return None
@@ -2,12 +2,18 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+import os
+import re
+import hashlib
+
 import numpy as np
 
 import scipy.interpolate as si
 from scipy.signal import fftconvolve
 
-from ..op import Operator
+from ..mpi import MPI
+
+from ..op import Operator, _hash_update
 
 from ..timing import function_timer
 
@@ -374,6 +380,214 @@ class OpCacheClear(Operator):
         return
 
 
+class OpCacheResults(Operator):
+    """Operator which reuses the outputs of another operator across runs.
+
+    The wrapped operator is run once and the cache objects it produces are
+    stored on disk, one compressed file per process.  Later runs that find
+    a valid file restore the outputs instead of running the operator again.
+
+    A stored result is only reused if it was produced with the same key.
+    The key combines the configuration hash of the operator (see
+    Operator.config_hash), the contents of the input cache objects, the
+    process layout and the name, ID, noise model, detectors, detector
+    quaternions, sample range and local boresight pointing of every local
+    observation.  Any change to these leads to recomputation, and the
+    stale file of the process is replaced.  The outputs are reused only if
+    every process has a valid file, because the operator may communicate.
+    If the configuration cannot be hashed, the operator is simply run.
+
+    Everything else the operator reads from the cache must be declared in
+    `inputs`.  This includes outputs that the operator adds to rather than
+    creates:  OpSimNoise accumulating into an existing "signal" must list
+    "signal_.*" as an input, or the stored sum would be restored whatever
+    the signal held before.
+
+    Only the TOD cache objects matching the output patterns and the listed
+    Data metadata entries are restored.  Any other side effect of the
+    operator (for example state kept on the operator) is not.
+
+    Args:
+        operator (Operator):  The operator to run.
+        outputs (list):  Regular expressions matching the names of the
+            cache objects produced by the operator.
+        inputs (list):  Regular expressions matching the names of the cache
+            objects the operator reads.  Their contents are part of the key.
+        metadata (list):  Names of Data metadata entries set by the
+            operator, for example "pixels_local_submaps" for OpPointingHpix.
+            The values must be numbers or arrays.
+        cachedir (str):  The directory for the stored results.  If None,
+            the TOAST_RESULT_CACHE environment variable is used and if that
+            is not set, the operator is always run.
+
+    """
+
+    def __init__(self, operator, outputs, inputs=None, metadata=None, cachedir=None):
+        # Call the parent class constructor.
+        super().__init__()
+        self._operator = operator
+        if isinstance(outputs, str):
+            outputs = [outputs]
+        self._outputs = [re.compile(x) for x in outputs]
+        if inputs is None:
+            inputs = list()
+        elif isinstance(inputs, str):
+            inputs = [inputs]
+        self._inputs = [re.compile(x) for x in inputs]
+        if metadata is None:
+            metadata = list()
+        elif isinstance(metadata, str):
+            metadata = [metadata]
+        self._metadata = list(metadata)
+        if cachedir is None:
+            cachedir = os.environ.get("TOAST_RESULT_CACHE", None)
+        self._cachedir = cachedir
+        self._restored = False
+
+    @property
+    def restored(self):
+        """(bool):  True if the last exec() restored stored results."""
+        return self._restored
+
+    def _matching(self, tod, patterns):
+        return [x for x in tod.cache.keys() if any(p.match(x) for p in patterns)]
+
+    def _key(self, data, ophash):
+        """Hash of everything that determines the outputs on this process."""
+        hsh = hashlib.sha256()
+        comm = data.comm
+        hsh.update(
+            "{};{};{};{};{};".format(
+                ophash,
+                comm.world_size,
+                comm.world_rank,
+                comm.ngroups,
+                comm.group,
+            ).encode()
+        )
+        for obs in data.obs:
+            tod = obs["tod"]
+            for name in ["name", "id", "telescope_id", "site_id"]:
+                if name in obs:
+                    _hash_update(hsh, obs[name])
+            if "noise" in obs:
+                nse = obs["noise"]
+                for key in nse.keys:
+                    _hash_update(
+                        hsh, [key, nse.index(key), nse.freq(key), nse.psd(key)]
+                    )
+                for det in nse.detectors:
+                    _hash_update(hsh, [nse.weight(det, key) for key in nse.keys])
+            _hash_update(hsh, tod.local_samples)
+            _hash_update(hsh, list(tod.local_dets))
+            # The pointing, for TOD classes that provide it
+            try:
+                _hash_update(hsh, tod.detoffset())
+            except NotImplementedError:
+                pass
+            if tod.local_samples[1] > 0:
+                try:
+                    _hash_update(hsh, tod.read_boresight())
+                except NotImplementedError:
+                    pass
+            for name in self._matching(tod, self._inputs):
+                _hash_update(hsh, name)
+                _hash_update(hsh, tod.cache.reference(name))
+        return hsh.hexdigest()
+
+    def _restore(self, data, path, key):
+        """Load the stored outputs of this process, if they are valid."""
+        try:
+            with np.load(path, allow_pickle=False) as stored:
+                if str(stored["key"]) != key:
+                    return None
+                nobs = int(stored["nobs"])
+                if nobs != len(data.obs):
+                    return None
+                metadata = dict()
+                for name in self._metadata:
+                    value = stored["meta::{}".format(name)]
+                    metadata[name] = value.item() if value.ndim == 0 else value
+                outputs = list()
+                for iobs in range(nobs):
+                    prefix = "{}::".format(iobs)
+                    outputs.append(
+                        {
+                            x[len(prefix) :]: stored[x]
+                            for x in stored.files
+                            if x.startswith(prefix)
+                        }
+                    )
+                return metadata, outputs
+        except Exception:
+            return None
+
+    def _store(self, data, path, key):
+        """Write the outputs of this process, replacing any earlier file."""
+        arrays = dict()
+        arrays["key"] = np.array(key)
+        arrays["nobs"] = np.array(len(data.obs))
+        for name in self._metadata:
+            arrays["meta::{}".format(name)] = np.asarray(data[name])
+        for iobs, obs in enumerate(data.obs):
+            tod = obs["tod"]
+            for name in self._matching(tod, self._outputs):
+                arrays["{}::{}".format(iobs, name)] = tod.cache.reference(name)
+        # Write to a temporary file and move it in place, so that an
+        # interrupted run never leaves a partial result behind.
+        tmppath = "{}.tmp.npz".format(path[: -len(".npz")])
+        np.savez_compressed(tmppath, **arrays)
+        os.replace(tmppath, path)
+        return
+
+    @function_timer
+    def exec(self, data):
+        """Restore the outputs of the operator or run it.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        """
+        self._restored = False
+        ophash = self._operator.config_hash()
+        if self._cachedir is None or ophash is None:
+            self._operator.exec(data)
+            return
+
+        comm = data.comm.comm_world
+        opdir = os.path.join(
+            self._cachedir, "{}_{}".format(type(self._operator).__name__, ophash)
+        )
+        if comm is None or comm.rank == 0:
+            os.makedirs(opdir, exist_ok=True)
+        if comm is not None:
+            comm.barrier()
+        path = os.path.join(opdir, "rank_{:06d}.npz".format(data.comm.world_rank))
+
+        key = self._key(data, ophash)
+        restored = None
+        if os.path.isfile(path):
+            restored = self._restore(data, path, key)
+        valid = restored is not None
+        if comm is not None:
+            valid = comm.allreduce(valid, op=MPI.LAND)
+
+        if valid:
+            metadata, outputs = restored
+            for name, value in metadata.items():
+                data[name] = value
+            for obs, stored in zip(data.obs, outputs):
+                tod = obs["tod"]
+                for name, value in stored.items():
+                    tod.cache.put(name, value, replace=True)
+            self._restored = True
+            return
+
+        self._operator.exec(data)
+        self._store(data, path, key)
+        return
+
+
 @function_timer
 def flagged_running_average(
     signal, flag, wkernel, return_flags=False, downsample=False
@@ -18,6 +18,10 @@ from .todmap_math import (
 
 from .pointing import OpPointingHpix, OpMuellerPointingHpix
 
+from .pairs import find_detector_pairs, OpPairSumDiff
+
+from .demod import OpDemodulate
+
 from .sim_tod import (
     satellite_scanning,
     TODHpixSpiral,
@@ -30,6 +34,8 @@ from .sim_det_map import OpSimGradient, OpSimScan
 
 from .sim_det_dipole import OpSimDipole
 
+from .sim_det_sources import OpSimSources
+
 from .sim_det_pysm import OpSimPySM
 
 from .sim_det_atm import OpSimAtmosphere
@@ -47,4 +53,4 @@ from .mapsampler import MapSampler
 
 from .madam import OpMadam
 from .mapmaker import OpMapMaker
-from .filterbin import OpFilterBin
+from .filterbin import OpFilterBin, ObsMatrix
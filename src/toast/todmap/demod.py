@@ -0,0 +1,284 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import numpy as np
+
+from .._libtoast import hwp_demodulate
+
+from ..dist import Data
+
+from ..op import Operator
+
+from ..tod import TODCache
+
+from ..timing import function_timer
+
+
+class OpDemodulate(Operator):
+    """Operator which demodulates HWP-modulated timestreams.
+
+    Each detector signal is lock-in demodulated against the cached HWP angle
+    (chi): it is multiplied by 1, 2 cos(4 chi) and 2 sin(4 chi), low-pass
+    filtered and decimated.  The pointing weights (for example from
+    OpMuellerPointingHpix) go through exactly the same operation, so the
+    three demodulated streams remain linear in the I/Q/U map and can be
+    binned or destriped like ordinary samples.
+
+    The output is a new Data object with one observation per input
+    observation.  Its TOD is a TODCache at the decimated sample rate with
+    three detectors per input detector, named
+
+        demod0_<detector>  :  the low-passed signal
+        demod4r_<detector>  :  the 2 cos(4 chi) demodulated signal
+        demod4i_<detector>  :  the 2 sin(4 chi) demodulated signal
+
+    which hold the signal, flags (nonzero for bad samples), time stamps and
+    common flags (all zero) of the TOD itself, and the cache objects
+    <pixels_out>_<stream> and <weights_out>_<stream>.  The default names
+    match the usual pointing names, so the output can be binned with the
+    default arguments of the mapmaking operators.  The other observation
+    entries are shared with the input, except for the intervals and the
+    noise model which refer to the original sampling.
+
+    Output sample j is centered on local input sample j * decimation +
+    decimation // 2.  The filter does not reach across process boundaries
+    in time, and the output has the same process grid as the input.
+
+    Args:
+        name (str):  Name of the input signal cache object
+            <name>_<detector>.  If None, the TOD signal is used.
+        pixels (str):  Name of the input pixel cache objects.
+        weights (str):  Name of the input pointing weight cache objects.
+        flag_name (str):  Name of the input detector flags.
+        flag_mask (byte):  Bitmask applied to the detector flags.
+        common_flag_name (str):  Name of the input common flags.
+        common_flag_mask (byte):  Bitmask applied to the common flags.
+        hwp_angle (str):  Name of the cached HWP angle.
+        decimation (int):  The decimation factor.
+        fir (array):  Optional low-pass filter taps (odd length).  By default
+            a Hamming windowed sinc with `ntap` taps and a cutoff at the
+            Nyquist frequency of the decimated stream is used.
+        ntap (int):  The number of taps for the default filter.  Defaults
+            to 4 * decimation + 1.
+        pixels_out (str):  Name of the output pixel cache objects.
+        weights_out (str):  Name of the output pointing weight objects.
+
+    """
+
+    # The output detector prefixes of the three demodulated streams
+    STREAMS = ["demod0", "demod4r", "demod4i"]
+
+    def __init__(
+        self,
+        name=None,
+        pixels="pixels",
+        weights="weights",
+        flag_name=None,
+        flag_mask=255,
+        common_flag_name=None,
+        common_flag_mask=255,
+        hwp_angle=None,
+        decimation=10,
+        fir=None,
+        ntap=None,
+        pixels_out="pixels",
+        weights_out="weights",
+    ):
+        self._name = name
+        self._pixels = pixels
+        self._weights = weights
+        self._flag_name = flag_name
+        self._flag_mask = flag_mask
+        self._common_flag_name = common_flag_name
+        self._common_flag_mask = common_flag_mask
+        self._hwp_angle = hwp_angle
+        self._decimation = decimation
+        if fir is None:
+            if ntap is None:
+                ntap = 4 * decimation + 1
+            lag = np.arange(ntap) - ntap // 2
+            fir = np.sinc(lag / decimation) * np.hamming(ntap)
+            fir /= np.sum(fir)
+        self._fir = np.ascontiguousarray(fir, dtype=np.float64)
+        if self._fir.size % 2 != 1:
+            raise RuntimeError("Demodulation filter must have an odd length")
+        self._pixels_out = pixels_out
+        self._weights_out = weights_out
+
+        # We call the parent class constructor, which currently does nothing
+        super().__init__()
+
+    @property
+    def fir(self):
+        """(array): The low-pass filter taps."""
+        return self._fir
+
+    def stream_names(self, det):
+        """The names of the demodulated detectors of one input detector.
+
+        Args:
+            det (str):  The input detector name.
+
+        Returns:
+            (list):  The three output detector names.
+
+        """
+        return ["{}_{}".format(x, det) for x in self.STREAMS]
+
+    def _demod_tod(self, tod):
+        """Create the decimated TOD with the process grid of the input."""
+        detranks, sampranks = tod.grid_size
+
+        # One indivisible chunk and one forced break per process column
+        # reproduce the sample distribution of the input.
+
+        sampsizes = [
+            (x[1] + self._decimation - 1) // self._decimation for x in tod.dist_samples
+        ]
+        sampbreaks = None
+        if sampranks > 1:
+            sampbreaks = list(range(1, sampranks))
+
+        # Break the stream detectors at the boundaries of the input rows
+
+        detbreaks = None
+        if detranks > 1:
+            rowsizes = tod.grid_comm_col.allgather(len(tod.local_dets))
+            detbreaks = list(3 * np.cumsum(rowsizes)[:-1])
+
+        detectors = []
+        detindx = {}
+        for det in tod.detectors:
+            for istream, sdet in enumerate(self.stream_names(det)):
+                detectors.append(sdet)
+                detindx[sdet] = 3 * tod.detindx[det] + istream
+
+        demod_tod = TODCache(
+            tod.mpicomm,
+            detectors,
+            int(np.sum(sampsizes)),
+            detindx=detindx,
+            detranks=detranks,
+            detbreaks=detbreaks,
+            sampsizes=sampsizes,
+            sampbreaks=sampbreaks,
+        )
+
+        expected = []
+        for det in tod.local_dets:
+            expected.extend(self.stream_names(det))
+        if (
+            demod_tod.local_samples[1] != sampsizes[tod.grid_ranks[1]]
+            or demod_tod.local_dets != expected
+        ):
+            raise RuntimeError(
+                "Cannot reproduce the data distribution at the decimated rate"
+            )
+        return demod_tod
+
+    @function_timer
+    def exec(self, data):
+        """Demodulate and decimate all local detectors.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            (toast.Data):  The demodulated data.
+
+        """
+        demod_data = Data(data.comm)
+
+        for obs in data.obs:
+            tod = obs["tod"]
+            nsamp = tod.local_samples[1]
+            nout = (nsamp + self._decimation - 1) // self._decimation
+            centers = np.arange(nout) * self._decimation + self._decimation // 2
+            centers[centers > nsamp - 1] = nsamp - 1
+
+            hwpang = tod.local_hwp_angle(self._hwp_angle)
+            if hwpang is None:
+                raise RuntimeError("Cannot demodulate without a HWP angle")
+            hwpang = np.ascontiguousarray(hwpang, dtype=np.float64)
+
+            demod_tod = self._demod_tod(tod)
+            demod_tod.write_times(stamps=tod.local_times()[centers])
+            demod_tod.write_common_flags(flags=np.zeros(nout, dtype=np.uint8))
+
+            common = tod.local_common_flags(self._common_flag_name)
+            common = common & self._common_flag_mask
+
+            for det in tod.local_dets:
+                signal = tod.local_signal(det, self._name)
+                flags = tod.local_flags(det, self._flag_name)
+                flags = (flags & self._flag_mask) | common
+                pixels = np.ascontiguousarray(
+                    tod.cache.reference("{}_{}".format(self._pixels, det)),
+                    dtype=np.int64,
+                )
+                weights = np.ascontiguousarray(
+                    tod.cache.reference("{}_{}".format(self._weights, det)),
+                    dtype=np.float64,
+                ).reshape([nsamp, -1])
+                nnz = weights.shape[1]
+
+                # The kernel interleaves the three streams of each output
+                # sample.
+
+                out_signal = np.zeros(3 * nout, dtype=np.float64)
+                out_pixels = np.zeros(3 * nout, dtype=np.int64)
+                out_weights = np.zeros([3 * nout, nnz], dtype=np.float64)
+                out_flags = np.zeros(3 * nout, dtype=np.uint8)
+
+                hwp_demodulate(
+                    hwpang,
+                    signal,
+                    flags.astype(np.uint8),
+                    255,
+                    pixels,
+                    weights,
+                    self._fir,
+                    self._decimation,
+                    out_signal,
+                    out_pixels,
+                    out_weights,
+                    out_flags,
+                )
+
+                for istream, sdet in enumerate(self.stream_names(det)):
+                    demod_tod.write(
+                        detector=sdet, data=np.ascontiguousarray(out_signal[istream::3])
+                    )
+                    demod_tod.write_flags(
+                        detector=sdet, flags=np.ascontiguousarray(out_flags[istream::3])
+                    )
+                    demod_tod.cache.put(
+                        "{}_{}".format(self._pixels_out, sdet),
+                        np.ascontiguousarray(out_pixels[istream::3]),
+                        replace=True,
+                    )
+                    demod_tod.cache.put(
+                        "{}_{}".format(self._weights_out, sdet),
+                        np.ascontiguousarray(out_weights[istream::3]),
+                        replace=True,
+                    )
+                del signal
+                del pixels
+                del weights
+                del out_signal
+                del out_pixels
+                del out_weights
+                del out_flags
+
+            del common
+            del hwpang
+
+            demod_obs = dict()
+            for key, value in obs.items():
+                if key not in ["tod", "intervals", "noise"]:
+                    demod_obs[key] = value
+            demod_obs["tod"] = demod_tod
+            demod_data.obs.append(demod_obs)
+
+        return demod_data
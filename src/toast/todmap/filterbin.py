@@ -4,6 +4,7 @@
 
 from ..mpi import MPI
 
+import glob
 import os
 import re
 from time import time
@@ -18,6 +19,8 @@ from .._libtoast import (
     accumulate_observation_matrix,
     expand_matrix,
     build_template_covariance,
+    noiseweight_obs_matrix,
+    multiply_obs_matrix,
 )
 from ..map import covariance_apply, covariance_invert, DistPixels, covariance_rcond
 from ..op import Operator
@@ -455,30 +458,62 @@ class OpFilterBin(Operator):
     def _noiseweight_obs_matrix(self, white_noise_cov):
         if self.obs_matrix is None:
             return
-        # Apply the white noise covariance to the observation matrix
+        # Apply the white noise covariance to the observation matrix.
+        # All rows belonging to one pixel share the same sparsity pattern
+        # so the compiled kernel can apply the nnz x nnz pixel blocks to
+        # the CSR rows in place.
+        self.obs_matrix.sort_indices()
+        if white_noise_cov.data is None:
+            cov = np.zeros([0, white_noise_cov.npix_submap, self._ncov])
+            local_submaps = np.zeros(0, dtype=np.int64)
+        else:
+            cov = white_noise_cov.data
+            local_submaps = white_noise_cov.local_submaps
+        success = noiseweight_obs_matrix(
+            self.obs_matrix.data,
+            self.obs_matrix.indices,
+            self.obs_matrix.indptr,
+            cov,
+            local_submaps,
+            self._npix,
+            self._nnz,
+        )
+        if not success:
+            # The pixel rows do not share their sparsity pattern.  Fall back to
+            # a general sparse product with the block diagonal covariance.
+            self._noiseweight_obs_matrix_sparse(cov, local_submaps)
+        self.obs_matrix.eliminate_zeros()
+        return
+
+    @function_timer
+    def _noiseweight_obs_matrix_sparse(self, cov, local_submaps):
         npix = self._npix
         nnz = self._nnz
         npixtot = self._npixtot
-        cc = scipy.sparse.dok_matrix((npixtot, npixtot), dtype=np.float64)
-        nsubmap = white_noise_cov.nsubmap
-        npix_submap = white_noise_cov.npix_submap
-        for isubmap_local, isubmap_global in enumerate(white_noise_cov.local_submaps):
-            submap = white_noise_cov.data[isubmap_local]
-            offset = isubmap_global * npix_submap
-            for pix_local in range(npix_submap):
-                if np.all(submap[pix_local] == 0):
-                    continue
-                pix = pix_local + offset
-                icov = 0
-                for inz in range(nnz):
-                    for jnz in range(inz, nnz):
-                        cc[pix + inz * npix, pix + jnz * npix] = submap[pix_local, icov]
-                        if inz != jnz:
-                            cc[pix + jnz * npix, pix + inz * npix] = submap[
-                                pix_local, icov
-                            ]
-                        icov += 1
-        cc = cc.tocsr()
+        npix_submap = cov.shape[1]
+        pixels = (
+            np.asarray(local_submaps, dtype=np.int64)[:, None] * npix_submap
+            + np.arange(npix_submap)[None, :]
+        ).ravel()
+        values = cov.reshape([-1, self._ncov])
+        rows = []
+        cols = []
+        vals = []
+        icov = 0
+        for inz in range(nnz):
+            for jnz in range(inz, nnz):
+                rows.append(pixels + inz * npix)
+                cols.append(pixels + jnz * npix)
+                vals.append(values[:, icov])
+                if inz != jnz:
+                    rows.append(pixels + jnz * npix)
+                    cols.append(pixels + inz * npix)
+                    vals.append(values[:, icov])
+                icov += 1
+        cc = scipy.sparse.coo_matrix(
+            (np.hstack(vals), (np.hstack(rows), np.hstack(cols))),
+            shape=(npixtot, npixtot),
+        ).tocsr()
         self.obs_matrix = cc.dot(self.obs_matrix)
         return
 
@@ -921,3 +956,167 @@ class OpFilterBin(Operator):
             print("OpFilterBin: Completed in {:.1f} s".format(time() - t0), flush=True)
 
         return
+
+
+class ObsMatrix(object):
+    """Observation matrix written by OpFilterBin, distributed by rows.
+
+    OpFilterBin writes the observation matrix as CSR row slices in
+    <rootname>.<row_start>.<row_stop>.<nrow>.{data,indices,indptr}.npy.
+    The slice files are memory-mapped and the rows are split between the
+    processes so that every process has about the same number of nonzeros.
+    The matrix can then be applied to many input maps at once, which is
+    much cheaper than simulating and filtering the TOD of every map.
+
+    Args:
+        rootname (str):  Path and prefix of the slice files, for example
+            os.path.join(outdir, outprefix + "obs_matrix").
+        comm (mpi4py.MPI.Comm):  The processes sharing the matrix.  If
+            None, this process applies the whole matrix.
+
+    """
+
+    def __init__(self, rootname, comm=None):
+        self._comm = comm
+        if comm is None:
+            rank = 0
+            ntask = 1
+        else:
+            rank = comm.rank
+            ntask = comm.size
+
+        pattern = f"{rootname}.*.*.*.data.npy"
+        datafiles = sorted(glob.glob(pattern))
+        if len(datafiles) == 0:
+            raise RuntimeError(f"No observation matrix files match '{pattern}'")
+
+        # Find the row range and the number of nonzeros of every slice.  The
+        # row indices in the file names are zero-padded, so sorting the names
+        # sorts the slices.
+
+        self._nrow = None
+        roots = []
+        row_starts = []
+        row_stops = []
+        slice_nnz = []
+        for datafile in datafiles:
+            parts = datafile.split(".")
+            nrow = int(parts[-3])
+            if self._nrow is None:
+                self._nrow = nrow
+            elif nrow != self._nrow:
+                raise RuntimeError(f"{datafile} has {nrow} rows, expected {self._nrow}")
+            root = datafile[: -len(".data.npy")]
+            indptr = np.load(root + ".indptr.npy", mmap_mode="r")
+            roots.append(root)
+            row_starts.append(int(parts[-5]))
+            # The last slice may be shorter than the file name suggests
+            row_stops.append(int(parts[-5]) + indptr.size - 1)
+            slice_nnz.append(int(indptr[-1]))
+            del indptr
+        nnz_offsets = np.zeros(len(roots) + 1, dtype=np.int64)
+        nnz_offsets[1:] = np.cumsum(slice_nnz)
+        nnz_tot = nnz_offsets[-1]
+
+        # Split the rows between the processes at the rows where the
+        # cumulative number of nonzeros crosses equal fractions of the total.
+
+        self._row_bounds = np.zeros(ntask + 1, dtype=np.int64)
+        for itask in range(1, ntask):
+            target = (nnz_tot * itask) // ntask
+            islice = np.searchsorted(nnz_offsets, target, side="right") - 1
+            if islice >= len(roots):
+                self._row_bounds[itask] = self._nrow
+                continue
+            indptr = np.load(roots[islice] + ".indptr.npy", mmap_mode="r")
+            row = np.searchsorted(indptr, target - nnz_offsets[islice])
+            self._row_bounds[itask] = row_starts[islice] + row
+            del indptr
+        self._row_bounds[ntask] = self._nrow
+        self._first_row = self._row_bounds[rank]
+        self._last_row = self._row_bounds[rank + 1]
+
+        # Memory-map the parts of the slices with our rows
+
+        self._segments = []
+        for root, row_start, row_stop in zip(roots, row_starts, row_stops):
+            first = max(row_start, self._first_row)
+            last = min(row_stop, self._last_row)
+            if first >= last:
+                continue
+            data = np.load(root + ".data.npy", mmap_mode="r")
+            indices = np.load(root + ".indices.npy", mmap_mode="r")
+            indptr = np.load(root + ".indptr.npy", mmap_mode="r")
+            if indptr.dtype != indices.dtype:
+                indptr = np.array(indptr, dtype=indices.dtype)
+            self._segments.append(
+                (
+                    data,
+                    indices,
+                    indptr,
+                    first - row_start,
+                    last - row_start,
+                    first - self._first_row,
+                )
+            )
+
+    @property
+    def nrow(self):
+        """(int): The number of rows (and columns) of the matrix."""
+        return self._nrow
+
+    @property
+    def local_rows(self):
+        """(tuple): The first and last (exclusive) row of this process."""
+        return (self._first_row, self._last_row)
+
+    @function_timer
+    def apply(self, maps):
+        """Apply the observation matrix to a set of maps.
+
+        Args:
+            maps (array):  The input maps with shape (nmap, nnz, npix) or
+                (nnz, npix) in the pixel ordering of the matrix.  Every
+                process must have all of the input maps.
+
+        Returns:
+            (array):  The filtered and binned maps with the same shape as the
+                input, on every process.
+
+        """
+        maps = np.asarray(maps, dtype=np.float64)
+        if maps.size == 0 or maps.size % self._nrow != 0:
+            raise RuntimeError(
+                f"Input maps of shape {maps.shape} do not match "
+                f"{self._nrow} matrix columns"
+            )
+        nmap = maps.size // self._nrow
+
+        # Store all values of one pixel contiguously, so that each nonzero of
+        # the matrix updates all maps at once.
+        maps_t = np.ascontiguousarray(maps.reshape([nmap, self._nrow]).T)
+        local = np.zeros([self._last_row - self._first_row, nmap], dtype=np.float64)
+        for data, indices, indptr, row_start, row_stop, offset in self._segments:
+            multiply_obs_matrix(
+                data, indices, indptr, row_start, row_stop, maps_t, local, offset
+            )
+        del maps_t
+
+        if self._comm is None:
+            result = local
+        else:
+            # Gather whole rows of nmap values, so that the counts and
+            # displacements are row numbers and do not overflow the 32 bit
+            # MPI counts for many maps.
+            result = np.zeros([self._nrow, nmap], dtype=np.float64)
+            counts = np.diff(self._row_bounds)
+            displs = self._row_bounds[:-1]
+            rowtype = MPI.DOUBLE.Create_contiguous(nmap).Commit()
+            try:
+                self._comm.Allgatherv(
+                    [local, counts[self._comm.rank], rowtype],
+                    [result, counts, displs, rowtype],
+                )
+            finally:
+                rowtype.Free()
+        return np.ascontiguousarray(result.T).reshape(maps.shape)
@@ -1,10 +1,12 @@
 from collections import OrderedDict
+import hashlib
 import os
 import sys
 
 import numpy as np
 import scipy.linalg
 import scipy.signal
+import scipy.sparse
 
 from toast import Operator
 from toast.mpi import MPI
@@ -13,12 +15,21 @@ from ..timing import gather_timers, GlobalTimers
 from toast.timing import function_timer, Timer
 from toast.utils import Logger, Environment
 from .sim_det_map import OpSimScan
-from .todmap_math import OpAccumDiag, OpScanScale, OpScanMask
+from .todmap_math import OpAccumDiag, OpScanScale, OpScanMask, local_step_weights
 from ..tod import OpCacheClear, OpCacheCopy, OpCacheInit, OpFlagsApply, OpFlagGaps
 from ..map import covariance_apply, covariance_invert, DistPixels, covariance_rcond
 from .. import qarray as qa
 
-from .._libtoast import add_offsets_to_signal, project_signal_offsets
+from .._libtoast import (
+    add_offsets_to_signal,
+    project_signal_offsets,
+    offset_noise_filter,
+    offset_banded_precond,
+    add_ground_to_signal,
+    project_signal_ground,
+    offset_steps,
+    HealpixPixels,
+)
 
 
 XAXIS, YAXIS, ZAXIS = np.eye(3)
@@ -660,8 +671,288 @@ class Fourier2DTemplate(TODTemplate):
         return
 
 
+class GroundTemplate(TODTemplate):
+    """This class represents ground pickup as a map in horizon coordinates.
+
+    The amplitudes are a rectangular grid of azimuth and elevation bins.
+    Every observation has its own grid, shared by all of its detectors, or
+    a single grid is shared by all observations.  Each sample picks up the
+    ground map at the Az/El pointing of its detector, so the ground is
+    solved jointly with the sky and the other templates.  The ground pixel
+    numbers of all local samples are kept in memory.
+    """
+
+    name = "ground"
+
+    def __init__(
+        self,
+        data,
+        detweights,
+        az_resolution=1.0,  # degrees
+        el_resolution=None,  # degrees
+        shared=False,
+        common_flags=None,
+        common_flag_mask=1,
+        flags=None,
+        flag_mask=1,
+    ):
+        self.data = data
+        if shared:
+            self.comm = data.comm.comm_world
+        else:
+            self.comm = data.comm.comm_group
+        self.detweights = detweights
+        self.az_resolution = np.radians(az_resolution)
+        if el_resolution is None:
+            self.el_resolution = self.az_resolution
+        else:
+            self.el_resolution = np.radians(el_resolution)
+        self.shared = shared
+        self.common_flags = common_flags
+        self.common_flag_mask = common_flag_mask
+        self.flags = flags
+        self.flag_mask = flag_mask
+        self._get_pixels()
+        self._get_preconditioner()
+        return
+
+    def _get_azel(self, tod, det):
+        """Return the azimuth and elevation of one detector"""
+        try:
+            azelquat = tod.read_pntg(detector=det, azel=True)
+        except Exception as e:
+            raise RuntimeError(
+                "Failed to get detector Az/El from TOD.  Perhaps it is "
+                'not ground TOD? "{}"'.format(e)
+            )
+        theta, phi = qa.to_position(azelquat)
+        # Azimuth is measured in the opposite direction than longitude
+        az = 2 * np.pi - phi
+        el = np.pi / 2 - theta
+        return az, el
+
+    @function_timer
+    def _get_pixels(self):
+        """Find the extent of the ground grids and pixelize the pointing"""
+        nobs = len(self.data.obs)
+        if self.shared:
+            ngrid = 1
+        else:
+            ngrid = nobs
+
+        # The azimuth is measured from the mean direction of each grid, so
+        # that the grid does not straddle the zero meridian.
+        azel = []
+        azsum = np.zeros([ngrid, 2])
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            igrid = 0 if self.shared else iobs
+            obs_azel = {}
+            for det in tod.local_dets:
+                az, el = self._get_azel(tod, det)
+                azsum[igrid] += np.sum(np.cos(az)), np.sum(np.sin(az))
+                obs_azel[det] = az, el
+            azel.append(obs_azel)
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, azsum, op=MPI.SUM)
+        az0 = np.arctan2(azsum[:, 1], azsum[:, 0])
+
+        lower = np.zeros([ngrid, 2]) + np.inf
+        upper = np.zeros([ngrid, 2]) - np.inf
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            igrid = 0 if self.shared else iobs
+            for det in tod.local_dets:
+                az, el = azel[iobs][det]
+                az[:] = (az - az0[igrid] + np.pi) % (2 * np.pi) - np.pi
+                lower[igrid] = np.minimum(lower[igrid], [np.amin(az), np.amin(el)])
+                upper[igrid] = np.maximum(upper[igrid], [np.amax(az), np.amax(el)])
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, lower, op=MPI.MIN)
+            self.comm.Allreduce(MPI.IN_PLACE, upper, op=MPI.MAX)
+
+        resolution = np.array([self.az_resolution, self.el_resolution])
+        extent = np.where(upper > lower, upper - lower, 0)
+        shape = np.maximum(np.ceil(extent / resolution), 1).astype(np.int64)
+        self.grid_offsets = np.zeros(ngrid, dtype=np.int64)
+        self.grid_offsets[1:] = np.cumsum(shape[:-1, 0] * shape[:-1, 1])
+        self.namplitude = int(np.sum(shape[:, 0] * shape[:, 1]))
+        self.grid_az0 = az0
+        self.grid_lower = lower
+        self.grid_shape = shape
+
+        # Pixel numbers of every sample, relative to the grid offset
+        self.pixels = []
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            igrid = 0 if self.shared else iobs
+            naz, nel = shape[igrid]
+            obs_pixels = {}
+            for det in tod.local_dets:
+                az, el = azel[iobs][det]
+                iaz = ((az - lower[igrid, 0]) / resolution[0]).astype(np.int64)
+                iel = ((el - lower[igrid, 1]) / resolution[1]).astype(np.int64)
+                obs_pixels[det] = np.minimum(iel, nel - 1) * naz + np.minimum(
+                    iaz, naz - 1
+                )
+            self.pixels.append(obs_pixels)
+        return
+
+    @function_timer
+    def _get_preconditioner(self):
+        """Evaluate the inverse of the weighted hits in each ground pixel"""
+        norms = np.zeros(self.namplitude)
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            offset = self.grid_offsets[0 if self.shared else iobs]
+            common_flags = tod.local_common_flags(self.common_flags)
+            common_flags = (common_flags & self.common_flag_mask) != 0
+            for det in tod.local_dets:
+                flags = tod.local_flags(det, self.flags)
+                good = np.logical_and((flags & self.flag_mask) == 0, ~common_flags)
+                pixels = self.pixels[iobs][det][good] + offset
+                norms += self.detweights[iobs][det] * np.bincount(
+                    pixels, minlength=self.namplitude
+                )
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, norms, op=MPI.SUM)
+        good = norms != 0
+        norms[good] = 1 / norms[good]
+        self.norms = norms
+        return
+
+    @function_timer
+    def add_to_signal(self, signal, amplitudes):
+        """signal += F.a"""
+        ground_amplitudes = amplitudes[self.name]
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            offset = self.grid_offsets[0 if self.shared else iobs]
+            for det in tod.local_dets:
+                add_ground_to_signal(
+                    signal[iobs, det, :],
+                    self.pixels[iobs][det],
+                    ground_amplitudes,
+                    offset,
+                )
+        return
+
+    @function_timer
+    def project_signal(self, signal, amplitudes):
+        """a += F^T.signal"""
+        ground_amplitudes = amplitudes[self.name]
+        if self.comm is not None:
+            my_amplitudes = np.zeros_like(ground_amplitudes)
+        else:
+            my_amplitudes = ground_amplitudes
+        for iobs, obs in enumerate(self.data.obs):
+            tod = obs["tod"]
+            offset = self.grid_offsets[0 if self.shared else iobs]
+            for det in tod.local_dets:
+                project_signal_ground(
+                    signal[iobs, det, :], self.pixels[iobs][det], my_amplitudes, offset
+                )
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, my_amplitudes, op=MPI.SUM)
+            ground_amplitudes += my_amplitudes
+        return
+
+    def apply_precond(self, amplitudes_in, amplitudes_out):
+        """a' = M^{-1}.a"""
+        ground_amplitudes_in = amplitudes_in[self.name]
+        ground_amplitudes_out = amplitudes_out[self.name]
+        ground_amplitudes_out[:] = ground_amplitudes_in * self.norms
+        return
+
+
+class OffsetFilterFactory:
+    """Memoized construction of offset template noise filters.
+
+    Many detectors share a noise PSD and many intervals share a step count,
+    so the filters and banded preconditioners are cached by a fingerprint of
+    their inputs and only computed once per unique combination.
+
+    Args:
+        step_length (float):  The default baseline length in seconds.
+        precond_width (int):  Width of the banded preconditioner.
+    """
+
+    def __init__(self, step_length, precond_width):
+        self.step_length = step_length
+        self.precond_width = precond_width
+        self._offset_psds = {}
+        self._filters = {}
+        self._preconditioners = {}
+
+    @staticmethod
+    def fingerprint(*args):
+        """Return a digest of the numerical content of the arguments."""
+        digest = hashlib.sha1()
+        for arg in args:
+            digest.update(np.ascontiguousarray(arg, dtype=np.float64).view(np.uint8))
+        return digest.hexdigest()
+
+    def offset_psd(self, noise, freq, det, compute, step_length=None):
+        """Return the key of the offset PSD table for a detector.
+
+        `compute(noise, freq, det, step_length)` is only called for PSDs and
+        baseline lengths not seen before.
+        """
+        if step_length is None:
+            step_length = self.step_length
+        key = self.fingerprint(
+            noise.freq(det), noise.psd(det), noise.rate(det), freq, step_length
+        )
+        if key not in self._offset_psds:
+            offset_psd = compute(noise, freq, det, step_length)
+            self._offset_psds[key] = (np.log(freq), np.log(offset_psd), step_length)
+        return key
+
+    def filter_and_preconditioner(self, psd_key, sigmasqs):
+        """Return the noise filter and preconditioner for one interval."""
+        nstep = len(sigmasqs)
+        filter_key = (psd_key, nstep)
+        if filter_key not in self._filters:
+            logfreq, logpsd, step_length = self._offset_psds[psd_key]
+            noisefilter = offset_noise_filter(logfreq, -logpsd, step_length, nstep)
+            self._filters[filter_key] = noisefilter
+        noisefilter = self._filters[filter_key]
+
+        sigmasqs = np.ascontiguousarray(sigmasqs, dtype=np.float64)
+        precond_key = (psd_key, nstep, self.fingerprint(sigmasqs))
+        if precond_key not in self._preconditioners:
+            if self.precond_width <= 1:
+                # Compute C_a prior
+                logfreq, logpsd, step_length = self._offset_psds[psd_key]
+                preconditioner = offset_noise_filter(
+                    logfreq, logpsd, step_length, nstep
+                )
+            else:
+                # Compute Cholesky decomposition prior
+                preconditioner = offset_banded_precond(
+                    sigmasqs, noisefilter, self.precond_width
+                )
+            self._preconditioners[precond_key] = (preconditioner, True)
+        return noisefilter, self._preconditioners[precond_key]
+
+    def clear(self):
+        self._offset_psds.clear()
+        self._filters.clear()
+        self._preconditioners.clear()
+
+
 class OffsetTemplate(TODTemplate):
-    """This class represents noise fluctuations as a step function"""
+    """This class represents noise fluctuations as a step function
+
+    By default, every interval is divided into steps of `step_length`
+    seconds.  If `knee_periods` is set, the steps are chosen separately for
+    each detector:  the step length is `knee_periods` / fknee, but at least
+    `step_length`, so detectors with a low knee frequency get long
+    baselines.  The steps are also split at flagged gaps longer than
+    `step_length`.  Like the default steps, every stretch between gaps is
+    divided into steps of the chosen length and a shorter last step, so
+    that the noise prior matches the step length.
+    """
 
     name = "offset"
 
@@ -677,10 +968,12 @@ class OffsetTemplate(TODTemplate):
         flags=None,
         flag_mask=1,
         precond_width=20,
+        knee_periods=None,
     ):
         self.data = data
         self.detweights = detweights
         self.step_length = step_length
+        self.knee_periods = knee_periods
         self.intervals = intervals
         self.common_flags = common_flags
         self.common_flag_mask = common_flag_mask
@@ -701,6 +994,7 @@ class OffsetTemplate(TODTemplate):
         log = Logger.get()
         self.filters = []  # all observations
         self.preconditioners = []  # all observations
+        factory = OffsetFilterFactory(self.step_length, self.precond_width)
         for iobs, obs in enumerate(self.data.obs):
             if "noise" not in obs:
                 # If the observations do not include noise PSD:s, we
@@ -717,30 +1011,37 @@ class OffsetTemplate(TODTemplate):
             dtime = np.amin(np.diff(times))
             fsample = 1 / dtime
             obstime = times[-1] - times[0]
-            tbase = self.step_length
-            fbase = 1 / tbase
-            powmin = np.floor(np.log10(1 / obstime)) - 1
-            powmax = min(np.ceil(np.log10(1 / tbase)) + 2, fsample)
-            freq = np.logspace(powmin, powmax, 1000)
+            freqs = {}
             # Now build the filter for each detector
             noise = obs["noise"]
             noisefilters = {}  # this observation
             preconditioners = {}  # this observation
             for det in tod.local_dets:
-                offset_psd = self._get_offset_psd(noise, freq, det)
-                # Store real space filters for every interval and every detector.
-                (
-                    noisefilters[det],
-                    preconditioners[det],
-                ) = self._get_noisefilter_and_preconditioner(
-                    freq, offset_psd, self.offset_slices[iobs][det]
+                tbase = self.step_lengths[iobs][det]
+                if tbase not in freqs:
+                    powmin = np.floor(np.log10(1 / obstime)) - 1
+                    powmax = min(np.ceil(np.log10(1 / tbase)) + 2, fsample)
+                    freqs[tbase] = np.logspace(powmin, powmax, 1000)
+                psd_key = factory.offset_psd(
+                    noise, freqs[tbase], det, self._get_offset_psd, tbase
                 )
+                # Store real space filters for every interval and every detector.
+                # Identical filters are shared between detectors and intervals.
+                noisefilters[det] = []
+                preconditioners[det] = []
+                for offset_slice, sigmasqs in self.offset_slices[iobs][det]:
+                    noisefilter, preconditioner = factory.filter_and_preconditioner(
+                        psd_key, sigmasqs
+                    )
+                    noisefilters[det].append(noisefilter)
+                    preconditioners[det].append(preconditioner)
             self.filters.append(noisefilters)
             self.preconditioners.append(preconditioners)
+        factory.clear()
         return
 
     @function_timer
-    def _get_offset_psd(self, noise, freq, det):
+    def _get_offset_psd(self, noise, freq, det, step_length):
         psdfreq = noise.freq(det)
         psd = noise.psd(det)
         rate = noise.rate(det)
@@ -771,7 +1072,7 @@ class OffsetTemplate(TODTemplate):
             result[good] = (np.sin(arg) / arg) ** 2
             return result
 
-        tbase = self.step_length
+        tbase = step_length
         fbase = 1 / tbase
         offset_psd = interpolate_psd(freq) * g(freq * tbase)
         for m in range(1, 2):
@@ -780,64 +1081,12 @@ class OffsetTemplate(TODTemplate):
         offset_psd *= fbase
         return offset_psd
 
-    @function_timer
-    def _get_noisefilter_and_preconditioner(self, freq, offset_psd, offset_slices):
-        logfreq = np.log(freq)
-        logpsd = np.log(offset_psd)
-        logfilter = np.log(1 / offset_psd)
-
-        def interpolate(x, psd):
-            result = np.zeros(x.size)
-            good = np.abs(x) > 1e-10
-            logx = np.log(np.abs(x[good]))
-            logresult = np.interp(logx, logfreq, psd)
-            result[good] = np.exp(logresult)
-            return result
-
-        def truncate(noisefilter, lim=1e-4):
-            icenter = noisefilter.size // 2
-            ind = np.abs(noisefilter[:icenter]) > np.abs(noisefilter[0]) * lim
-            icut = np.argwhere(ind)[-1][0]
-            if icut % 2 == 0:
-                icut += 1
-            noisefilter = np.roll(noisefilter, icenter)
-            noisefilter = noisefilter[icenter - icut : icenter + icut + 1]
-            return noisefilter
-
-        noisefilters = []
-        preconditioners = []
-        for offset_slice, sigmasqs in offset_slices:
-            nstep = offset_slice.stop - offset_slice.start
-            filterlen = nstep * 2 + 1
-            filterfreq = np.fft.rfftfreq(filterlen, self.step_length)
-            noisefilter = truncate(np.fft.irfft(interpolate(filterfreq, logfilter)))
-            noisefilters.append(noisefilter)
-            # Build the band-diagonal preconditioner
-            if self.precond_width <= 1:
-                # Compute C_a prior
-                preconditioner = truncate(np.fft.irfft(interpolate(filterfreq, logpsd)))
-            else:
-                # Compute Cholesky decomposition prior
-                wband = min(self.precond_width, noisefilter.size // 2)
-                precond_width = max(wband, min(self.precond_width, nstep))
-                icenter = noisefilter.size // 2
-                preconditioner = np.zeros([precond_width, nstep], dtype=np.float64)
-                preconditioner[0] = sigmasqs
-                preconditioner[:wband, :] += np.repeat(
-                    noisefilter[icenter : icenter + wband, np.newaxis], nstep, 1
-                )
-                lower = True
-                scipy.linalg.cholesky_banded(
-                    preconditioner, overwrite_ab=True, lower=lower, check_finite=True
-                )
-            preconditioners.append((preconditioner, lower))
-        return noisefilters, preconditioners
-
     @function_timer
     def get_steps(self):
         """Divide each interval into offset steps"""
         self.offset_templates = []
         self.offset_slices = []  # slices in all observations
+        self.step_lengths = []  # nominal step lengths in all observations
         for iobs, obs in enumerate(self.data.obs):
             tod = obs["tod"]
             common_flags = tod.local_common_flags(self.common_flags)
@@ -848,6 +1097,12 @@ class OffsetTemplate(TODTemplate):
                 intervals = None
             local_intervals = tod.local_intervals(intervals)
             times = tod.local_times()
+            if self.knee_periods is not None:
+                self._get_adaptive_steps(
+                    iobs, obs, tod, times, local_intervals, common_flags
+                )
+                continue
+            self.step_lengths.append({det: self.step_length for det in tod.local_dets})
             offset_slices = {}  # slices in this observation
             for ival in local_intervals:
                 length = times[ival.last] - times[ival.first]
@@ -884,6 +1139,73 @@ class OffsetTemplate(TODTemplate):
             self.offset_slices.append(offset_slices)
         return
 
+    def _get_fknee(self, noise, det):
+        """Return the knee frequency of a detector.
+
+        If the noise model has no knee frequencies, this is the highest
+        frequency where the PSD is twice the white noise level.
+        """
+        if hasattr(noise, "fknee"):
+            return noise.fknee(det)
+        freq = noise.freq(det)
+        psd = noise.psd(det)
+        white = np.median(psd[freq > 0.5 * freq[-1]])
+        high = np.flatnonzero(psd > 2 * white)
+        if high.size == 0:
+            return 0
+        return freq[high[-1]]
+
+    @function_timer
+    def _get_adaptive_steps(self, iobs, obs, tod, times, local_intervals, common_flags):
+        """Divide each interval into offset steps based on the noise model"""
+        obstime = times[-1] - times[0]
+        firsts = np.array([ival.first for ival in local_intervals], dtype=np.int64)
+        lasts = np.array([ival.last for ival in local_intervals], dtype=np.int64)
+        step_lengths = {}
+        offset_slices = {}  # slices in this observation
+        for det in tod.local_dets:
+            step_length = self.step_length
+            if "noise" in obs:
+                fknee = self._get_fknee(obs["noise"], det)
+                if fknee > 0:
+                    step_length = max(step_length, self.knee_periods / fknee)
+                else:
+                    # White noise only needs one baseline per interval
+                    step_length = max(step_length, obstime)
+            # The nominal length also sets the frequency binning of the prior
+            step_length = min(step_length, max(obstime, self.step_length))
+            step_lengths[det] = step_length
+            flags = tod.local_flags(det, self.flags) & self.flag_mask
+            flags[common_flags] = 1
+            starts, stops, ivals, sigmasqs = offset_steps(
+                times,
+                flags.astype(np.uint8),
+                firsts,
+                lasts,
+                step_length,
+                self.step_length,
+                self.detweights[iobs][det],
+            )
+            del flags
+            # Register the baseline offsets.  Offsets of one detector and one
+            # interval are contiguous, which is the domain of the noise filter.
+            offset_slices[det] = []
+            for ival in np.unique(ivals):
+                ind = np.flatnonzero(ivals == ival)
+                istart = self.namplitude
+                for istep in ind:
+                    todslice = slice(starts[istep], stops[istep])
+                    self.offset_templates.append(
+                        [self.namplitude, iobs, det, todslice, sigmasqs[istep]]
+                    )
+                    self.namplitude += 1
+                offset_slices[det].append(
+                    (slice(istart, self.namplitude), list(sigmasqs[ind]))
+                )
+        self.step_lengths.append(step_lengths)
+        self.offset_slices.append(offset_slices)
+        return
+
     @function_timer
     def _get_sigmasq(self, tod, det, todslice, common_flags, detweight):
         """calculate a rough estimate of the baseline variance
@@ -1165,7 +1487,7 @@ class TemplateAmplitudes(TOASTVector):
 
     @function_timer
     def __setitem__(self, key, value):
-        self.amplitudes[name][:] = value
+        self.amplitudes[key][:] = value
         return
 
     @function_timer
@@ -1218,6 +1540,266 @@ class TemplateCovariance(TOASTMatrix):
         pass
 
 
+class CoarseCorrection:
+    """Two-level coarse grid correction for the offset preconditioner.
+
+    Offset amplitudes that trace a large scale sky mode are nearly
+    degenerate with the map and converge slowly under the block-diagonal
+    preconditioner.  The coarse space is spanned by one vector per pixel
+    of a degraded, NESTED HEALPix map:  element (k, p) is the fraction
+    of the good samples in baseline `k` that fall in coarse pixel `p`.
+    The preconditioner becomes
+        M^{-1} = M_bd^{-1} + Z E^+ Z^T
+    where E approximates the Galerkin operator Z^T A Z.  E is assembled
+    in one pass over the TOD rather than by applying A to every coarse
+    vector:  the binned map in A is replaced by a map binned at the coarse
+    resolution,
+        E = Z^T (F^T N^{-1} F - F^T N^{-1} P_c (P_c^T N^{-1} P_c)^{-1}
+            P_c^T N^{-1} F + C_a^{-1}) Z,
+    and N^{-1} only includes the detector weights.  Because a coarse map
+    is a subspace of the full resolution map, E bounds Z^T A Z from above
+    and the correction is never too large.
+
+    Args:
+        data (toast.Data):  The distributed data.
+        comm (mpi4py.MPI.Comm):  The communicator for the reductions.
+        templates (TemplateMatrix):  The templates being solved for.
+        nside (int):  The NSIDE of the pixel numbers in the cache.
+        coarse_nside (int):  The NSIDE of the coarse grid.
+        pixels (str):  Cache prefix of the pixel numbers.
+        weights (str):  Cache prefix of the pointing weights.
+        nnz (int):  The number of pointing weights per sample.
+        nest (bool):  True if the pixel numbers are NESTED, False if
+            they are RING ordered.
+        rcond_limit (float):  Eigenvalues of E below this fraction of
+            the largest one are treated as degenerate.
+
+    """
+
+    def __init__(
+        self,
+        data,
+        comm,
+        templates,
+        nside,
+        coarse_nside,
+        pixels="pixels",
+        weights="weights",
+        nnz=3,
+        nest=True,
+        rcond_limit=1e-10,
+    ):
+        self.data = data
+        self.comm = comm
+        self.templates = templates
+        self.pixels = pixels
+        self.weights = weights
+        self.nnz = nnz
+        self.nest = nest
+        self.rcond_limit = rcond_limit
+        factor = 0
+        while coarse_nside * 2 ** factor < nside:
+            factor += 1
+        if coarse_nside * 2 ** factor != nside:
+            raise RuntimeError(
+                "Coarse NSIDE {} does not divide NSIDE {}".format(coarse_nside, nside)
+            )
+        self.shift = 2 * factor
+        self.hpix = None
+        if not self.nest:
+            self.hpix = HealpixPixels(nside)
+        self.ncoarse = 12 * coarse_nside ** 2
+        self.offset = templates.templates[OffsetTemplate.name]
+        # Group the baselines by observation and detector
+        self.baselines = OrderedDict()
+        for itemplate, iobs, det, todslice, sigmasq in self.offset.offset_templates:
+            key = (iobs, det)
+            if key not in self.baselines:
+                self.baselines[key] = []
+            self.baselines[key].append((itemplate, todslice))
+        self.basis = self._get_basis()
+        # Only the coarse pixels that are observed span the coarse space
+        hits = np.asarray(self.basis.getnnz(axis=0), dtype=np.int64)
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, hits, op=MPI.SUM)
+        self.active = np.flatnonzero(hits)
+        self.basis = self.basis.tocsc()[:, self.active].tocsr()
+        self.coarse_inverse = None
+        return
+
+    def _get_good(self, iobs, det):
+        """Return the TOD, good sample mask and pixel numbers of a detector"""
+        offset = self.offset
+        tod = self.data.obs[iobs]["tod"]
+        common_flags = tod.local_common_flags(offset.common_flags)
+        common_flags = (common_flags & offset.common_flag_mask) != 0
+        flags = tod.local_flags(det, offset.flags)
+        good = (flags & offset.flag_mask) == 0
+        good[common_flags] = False
+        pixels = tod.cache.reference("{}_{}".format(self.pixels, det))
+        good[pixels < 0] = False
+        return tod, good, pixels
+
+    def _degrade(self, pixels):
+        """Return the NESTED coarse pixels of valid pixel numbers"""
+        if self.nest:
+            return pixels >> self.shift
+        nested = np.zeros(pixels.size, dtype=np.int64)
+        self.hpix.ring2nest(np.ascontiguousarray(pixels, dtype=np.int64), nested)
+        return nested >> self.shift
+
+    @function_timer
+    def _get_basis(self):
+        """Assemble the sparse prolongation from coarse pixels to offsets"""
+        rows = []
+        cols = []
+        vals = []
+        for (iobs, det), baselines in self.baselines.items():
+            tod, good, pixels = self._get_good(iobs, det)
+            for itemplate, todslice in baselines:
+                coarse = self._degrade(pixels[todslice][good[todslice]])
+                if coarse.size == 0:
+                    continue
+                coarse, counts = np.unique(coarse, return_counts=True)
+                rows.append(np.full(coarse.size, itemplate))
+                cols.append(coarse)
+                vals.append(counts / np.sum(counts))
+        if len(rows) == 0:
+            rows = cols = vals = [np.zeros(0)]
+        basis = scipy.sparse.csr_matrix(
+            (np.hstack(vals), (np.hstack(rows), np.hstack(cols))),
+            shape=(self.offset.namplitude, self.ncoarse),
+        )
+        return basis
+
+    def _restrict(self, amplitudes):
+        """Return the globally reduced Z^T.a"""
+        result = self.basis.T.dot(amplitudes[self.offset.name])
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, result, op=MPI.SUM)
+        return result
+
+    @function_timer
+    def build(self):
+        """Assemble and invert the coarse operator E in one pass over the TOD"""
+        offset = self.offset
+        nnz = self.nnz
+        # F^T N^{-1} F is diagonal:  the weighted number of good samples
+        diagonal = np.zeros(offset.namplitude)
+        # P_c^T N^{-1} F with one row per coarse pixel and pointing weight
+        rows = []
+        cols = []
+        vals = []
+        # The coarse white noise matrix, P_c^T N^{-1} P_c
+        coarse_cov = np.zeros([self.ncoarse, nnz, nnz])
+        for (iobs, det), baselines in self.baselines.items():
+            detweight = offset.detweights[iobs][det]
+            if detweight == 0:
+                continue
+            tod, good, pixels = self._get_good(iobs, det)
+            weights = tod.cache.reference("{}_{}".format(self.weights, det))
+            samples = []
+            amplitudes = []
+            for itemplate, todslice in baselines:
+                ind = np.flatnonzero(good[todslice]) + todslice.start
+                diagonal[itemplate] = detweight * ind.size
+                samples.append(ind)
+                amplitudes.append(np.full(ind.size, itemplate))
+            samples = np.hstack(samples)
+            if samples.size == 0:
+                continue
+            amplitudes = np.hstack(amplitudes)
+            coarse = self._degrade(pixels[samples])
+            detweights = weights[samples].reshape([-1, nnz])
+            for inz in range(nnz):
+                for jnz in range(nnz):
+                    coarse_cov[:, inz, jnz] += detweight * np.bincount(
+                        coarse,
+                        weights=detweights[:, inz] * detweights[:, jnz],
+                        minlength=self.ncoarse,
+                    )
+            detweights *= detweight
+            # Sum the samples of each baseline before keeping them
+            detbinned = scipy.sparse.csr_matrix(
+                (
+                    detweights.ravel(),
+                    (
+                        (coarse[:, np.newaxis] * nnz + np.arange(nnz)).ravel(),
+                        np.repeat(amplitudes, nnz),
+                    ),
+                ),
+                shape=(self.ncoarse * nnz, offset.namplitude),
+            ).tocoo()
+            rows.append(detbinned.row)
+            cols.append(detbinned.col)
+            vals.append(detbinned.data)
+        if len(rows) == 0:
+            rows = cols = vals = [np.zeros(0, dtype=np.int64)]
+        binned = scipy.sparse.csr_matrix(
+            (np.hstack(vals), (np.hstack(rows), np.hstack(cols))),
+            shape=(self.ncoarse * nnz, offset.namplitude),
+        )
+        # Z^T F^T N^{-1} F Z and the noise prior, Z^T C_a^{-1} Z
+        coarse_matrix = self.basis.T.dot(
+            self.basis.multiply(diagonal[:, np.newaxis])
+        ).toarray()
+        if offset.use_noise_prior:
+            for iobs, obs in enumerate(self.data.obs):
+                for det in obs["tod"].local_dets:
+                    slices = offset.offset_slices[iobs][det]
+                    filters = offset.filters[iobs][det]
+                    for (offsetslice, sigmasqs), noisefilter in zip(slices, filters):
+                        block = self.basis[offsetslice]
+                        touched = np.unique(block.indices)
+                        if touched.size == 0:
+                            continue
+                        block = block[:, touched].toarray()
+                        filtered = scipy.signal.convolve(
+                            block, noisefilter[:, np.newaxis], mode="same"
+                        )
+                        coarse_matrix[np.ix_(touched, touched)] += np.dot(
+                            block.T, filtered
+                        )
+        # Z^T F^T N^{-1} P_c is sparse:  a coarse pixel only couples to the
+        # coarse pixels that share its baselines.
+        binned = binned.dot(self.basis).tocoo()
+        if self.comm is not None:
+            self.comm.Allreduce(MPI.IN_PLACE, coarse_matrix, op=MPI.SUM)
+            self.comm.Allreduce(MPI.IN_PLACE, coarse_cov, op=MPI.SUM)
+            parts = self.comm.allgather((binned.row, binned.col, binned.data))
+            binned = scipy.sparse.coo_matrix(
+                (
+                    np.hstack([x[2] for x in parts]),
+                    (
+                        np.hstack([x[0] for x in parts]),
+                        np.hstack([x[1] for x in parts]),
+                    ),
+                ),
+                shape=binned.shape,
+            )
+        binned = binned.tocsr()
+        # Subtract the part of the coarse vectors that a coarse map absorbs.
+        # Poorly conditioned coarse pixels are inverted on the subspace they
+        # constrain.
+        coarse_inverse = np.linalg.pinv(coarse_cov, rcond=self.rcond_limit)
+        coarse_inverse = scipy.sparse.block_diag(coarse_inverse, format="csr")
+        coarse_matrix -= binned.T.dot(coarse_inverse.dot(binned)).toarray()
+        coarse_matrix = 0.5 * (coarse_matrix + coarse_matrix.T)
+        # The overall offset is degenerate with the monopole:  invert E
+        # on the subspace it constrains.
+        evals, evecs = np.linalg.eigh(coarse_matrix)
+        good = evals > self.rcond_limit * np.amax(np.abs(evals))
+        self.coarse_inverse = np.dot(evecs[:, good] / evals[good], evecs[:, good].T)
+        return
+
+    @function_timer
+    def apply(self, amplitudes_in, amplitudes_out):
+        """Compute a' += Z E^+ Z^T.a"""
+        coarse = np.dot(self.coarse_inverse, self._restrict(amplitudes_in))
+        amplitudes_out[self.offset.name] += self.basis.dot(coarse)
+        return
+
+
 class ProjectionMatrix(TOASTMatrix):
     """Projection matrix:
         Z = I - P (P^T N^{-1} P)^{-1} P^T N^{-1}
@@ -1226,6 +1808,13 @@ class ProjectionMatrix(TOASTMatrix):
          `P` is the pointing matrix
          `N` is the noise matrix and
          `B` is the binning operator
+    The optional `step_weights` names the observation entry with piecewise
+    constant detector weights (see OpAccumDiag).  The optional `prior_zmap`
+    is a noise weighted map of data that is not part of the signal (for
+    example previously destriped observations).  It is only added when
+    binning the right hand side, `prior=True`, so that the linear part of
+    the projection is unchanged.  With `node_shared`, the binned map is
+    stored once per node like the white noise covariance.
     """
 
     def __init__(
@@ -1237,19 +1826,26 @@ class ProjectionMatrix(TOASTMatrix):
         white_noise_cov_matrix,
         common_flag_mask=1,
         flag_mask=1,
+        step_weights=None,
+        prior_zmap=None,
+        node_shared=False,
     ):
         self.data = data
         self.comm = comm
         self.detweights = detweights
-        self.dist_map = DistPixels(data, comm=self.comm, nnz=nnz, dtype=np.float64)
+        self.dist_map = DistPixels(
+            data, comm=self.comm, nnz=nnz, dtype=np.float64, node_shared=node_shared
+        )
         self.white_noise_cov_matrix = white_noise_cov_matrix
         self.common_flag_mask = common_flag_mask
         self.flag_mask = flag_mask
+        self.step_weights = step_weights
+        self.prior_zmap = prior_zmap
 
     @function_timer
-    def apply(self, signal):
+    def apply(self, signal, prior=False):
         """Return Z.y"""
-        self.bin_map(signal.name)
+        self.bin_map(signal.name, prior=prior)
         new_signal = signal.copy()
         scanned_signal = Signal(self.data, temporary=True, init_val=0)
         self.scan_map(scanned_signal.name)
@@ -1257,7 +1853,7 @@ class ProjectionMatrix(TOASTMatrix):
         return new_signal
 
     @function_timer
-    def bin_map(self, name):
+    def bin_map(self, name, prior=False):
         if self.dist_map.data is not None:
             self.dist_map.data.fill(0.0)
         # FIXME: OpAccumDiag should support separate detweights for each observation
@@ -1267,8 +1863,11 @@ class ProjectionMatrix(TOASTMatrix):
             detweights=self.detweights[0],
             common_flag_mask=self.common_flag_mask,
             flag_mask=self.flag_mask,
+            step_weights=self.step_weights,
         )
         build_dist_map.exec(self.data)
+        if prior and self.prior_zmap is not None and self.dist_map.data is not None:
+            self.dist_map.data += self.prior_zmap.data
         self.dist_map.allreduce()
         covariance_apply(self.white_noise_cov_matrix, self.dist_map)
         return
@@ -1282,28 +1881,50 @@ class ProjectionMatrix(TOASTMatrix):
 
 class NoiseMatrix(TOASTMatrix):
     def __init__(
-        self, comm, detweights, weightmap=None, common_flag_mask=1, flag_mask=1
+        self,
+        comm,
+        detweights,
+        weightmap=None,
+        common_flag_mask=1,
+        flag_mask=1,
+        step_weights=None,
     ):
         self.comm = comm
         self.detweights = detweights
         self.weightmap = weightmap
         self.common_flag_mask = common_flag_mask
         self.flag_mask = flag_mask
+        self.step_weights = step_weights
 
     @function_timer
     def apply(self, signal, in_place=False):
         """Multiplies the signal with N^{-1}.
 
         Note that the quality flags cause the corresponding diagonal
-        elements of N^{-1} to be zero.
+        elements of N^{-1} to be zero.  Piecewise constant step weights
+        scale the detector weights one piece at a time.
         """
         if in_place:
             new_signal = signal
         else:
             new_signal = signal.copy()
         for iobs, detweights in enumerate(self.detweights):
+            obs = new_signal.data.obs[iobs]
+            steps = None
+            if self.step_weights is not None and self.step_weights in obs:
+                steps = obs[self.step_weights]
+            offset, nsamp = obs["tod"].local_samples
             for det, detweight in detweights.items():
                 new_signal[iobs, det, :] *= detweight
+                if steps is None or det not in steps:
+                    continue
+                starts, weights = local_step_weights(steps[det], offset, nsamp)
+                stops = np.append(starts[1:], nsamp)
+                detsignal = new_signal[iobs, det, :]
+                detsignal[: starts[0]] = 0
+                for start, stop, weight in zip(starts, stops, weights):
+                    detsignal[start:stop] *= weight
+                del detsignal
         # Set flagged samples to zero
         new_signal.apply_flags(self.common_flag_mask, self.flag_mask)
         # Scale the signal with the weight map
@@ -1443,6 +2064,7 @@ class PCGSolver:
         niter_min=3,
         niter_max=100,
         convergence_limit=1e-12,
+        coarse=None,
     ):
         self.comm = comm
         if comm is None:
@@ -1456,11 +2078,16 @@ class PCGSolver:
         self.niter_min = niter_min
         self.niter_max = niter_max
         self.convergence_limit = convergence_limit
+        self.coarse = coarse
+        # Number of iterations used by the last solve
+        self.niter = 0
 
         self.rhs = self.templates.apply_transpose(
-            self.noise.apply(self.projection.apply(self.signal))
+            self.noise.apply(self.projection.apply(self.signal, prior=True))
         )
         # print("RHS {}: {}".format(self.signal.name, self.rhs))  # DEBUG
+        if self.coarse is not None:
+            self.coarse.build()
         return
 
     @function_timer
@@ -1473,9 +2100,21 @@ class PCGSolver:
         return new_amplitudes
 
     @function_timer
-    def solve(self):
+    def apply_precond(self, amplitudes):
+        """Return M^{-1}.x, including the optional coarse correction"""
+        new_amplitudes = self.templates.apply_precond(amplitudes)
+        if self.coarse is not None:
+            self.coarse.apply(amplitudes, new_amplitudes)
+        return new_amplitudes
+
+    @function_timer
+    def solve(self, guess=None):
         """Standard issue PCG solution of A.x = b
 
+        Args:
+            guess (TemplateAmplitudes):  Optional starting point of the
+                iterations.  If None, start from zero amplitudes.
+
         Returns:
             x : the least squares solution
         """
@@ -1484,21 +2123,30 @@ class PCGSolver:
         timer0.start()
         timer = Timer()
         timer.start()
-        # Initial guess is zero amplitudes
-        guess = self.templates.zero_amplitudes()
+        # Default initial guess is zero amplitudes
+        cold_start = guess is None
+        if cold_start:
+            guess = self.templates.zero_amplitudes()
+        else:
+            guess = guess.copy()
         # print("guess:", guess)  # DEBUG
         # print("RHS:", self.rhs)  # DEBUG
         residual = self.rhs.copy()
         # print("residual(1):", residual)  # DEBUG
         residual -= self.apply_lhs(guess)
         # print("residual(2):", residual)  # DEBUG
-        precond_residual = self.templates.apply_precond(residual)
+        precond_residual = self.apply_precond(residual)
         proposal = precond_residual.copy()
         sqsum = precond_residual.dot(residual)
         init_sqsum, best_sqsum, last_best = sqsum, sqsum, sqsum
+        if not cold_start:
+            # Measure convergence against the residual of zero amplitudes, so
+            # that a good starting point saves iterations
+            init_sqsum = self.apply_precond(self.rhs).dot(self.rhs)
         if self.rank == 0:
             log.info("Initial residual: {}".format(init_sqsum))
         # Iterate to convergence
+        self.niter = 0
         for iiter in range(self.niter_max):
             if not np.isfinite(sqsum):
                 raise RuntimeError("Residual is not finite")
@@ -1509,8 +2157,9 @@ class PCGSolver:
             guess += alpha_proposal
             residual -= self.apply_lhs(alpha_proposal)
             del alpha_proposal
+            self.niter = iiter + 1
             # Prepare for next iteration
-            precond_residual = self.templates.apply_precond(residual)
+            precond_residual = self.apply_precond(residual)
             beta = 1 / sqsum
             # Check for convergence
             sqsum = precond_residual.dot(residual)
@@ -1544,6 +2193,81 @@ class PCGSolver:
 
 
 class OpMapMaker(Operator):
+    """Operator which destripes and bins the TOD into maps.
+
+    The template amplitudes (baseline offsets and the optional subharmonic,
+    2D Fourier, gain and ground templates) are solved with a preconditioned
+    conjugate gradient, removed from the signal, and the cleaned signal is
+    binned into a map.
+
+    With `state_dir`, the hits, inverse white noise covariance and noise
+    weighted map are saved after each run and the observations of the next
+    run are folded into them:  the products of the earlier observations
+    enter the binning and the earlier observations are treated as fixed
+    when destriping.  Each process saves the submaps it owns.  The next run
+    may use any number of processes, which read the submaps they own from
+    all of the state files.
+
+    Args:
+        nside (int):  The NSIDE of the output maps.
+        nnz (int):  The number of Stokes parameters.
+        name (str):  Name of the signal cache objects <name>_<detector>.
+            If None, the TOD signal is used.
+        outdir (str):  Output directory.
+        outprefix (str):  Prefix of the output file names.
+        write_hits (bool):  Write the hit map.
+        zip_maps (bool):  Compress the output maps.
+        write_wcov_inv (bool):  Write the inverse white noise covariance.
+        write_wcov (bool):  Write the white noise covariance.
+        write_binned (bool):  Write the binned map.
+        write_destriped (bool):  Write the destriped map.
+        write_rcond (bool):  Write the reciprocal condition numbers of the
+            pixel covariance.
+        rcond_limit (float):  Pixels with a smaller reciprocal condition
+            number are left out of the maps.
+        baseline_length (float):  Length of the baselines in seconds, or
+            None to not solve for baselines.
+        baseline_knee_periods (float):  If set, the baseline length of each
+            detector is this many periods of its knee frequency, but at least
+            `baseline_length`.
+        maskfile (str):  Optional processing mask.  Masked pixels are not
+            used for solving the template amplitudes.
+        weightmapfile (str):  Optional map of relative sample weights.
+        common_flag_mask (int):  Bitmask applied to the common flags.
+        flag_mask (int):  Bitmask applied to the detector flags.
+        intervals (str):  Name of the observation intervals.
+        subharmonic_order (int):  Order of the subharmonic template, or None.
+        fourier2D_order (int):  Order of the 2D Fourier template, or None.
+        fourier2D_subharmonics (bool):  Include subharmonics in the 2D
+            Fourier template.
+        gain_templatename (str):  Name of the signal template cache objects
+            for fitting gain fluctuations, or None.
+        gain_poly_order (int):  Order of the Legendre polynomials of the gain
+            template.
+        ground_resolution (float):  Azimuthal resolution of the ground
+            template, or None.
+        ground_el_resolution (float):  Elevation resolution of the ground
+            template.
+        ground_shared (bool):  Share the ground template between detectors.
+        iter_min (int):  Minimum number of PCG iterations.
+        iter_max (int):  Maximum number of PCG iterations.
+        use_noise_prior (bool):  Constrain the baselines with the noise prior.
+        precond_width (int):  Width of the banded baseline preconditioner.
+        pixels (str):  Name of the pixel cache objects.
+        weights (str):  Name of the pointing weight cache objects.
+        nest (bool):  The pixels are in the NESTED ordering.
+        coarse_nside (int):  NSIDE of the coarse correction added to the
+            baseline preconditioner, or None.
+        step_weights (str):  Name of the observation key with the relative
+            weights of the sample ranges.
+        state_dir (str):  Directory of the incremental mapmaking state, or
+            None.
+        warm_start (bool):  Start the solver from the map of the earlier
+            runs in `state_dir`.
+        node_shared (bool):  Store the pixel domain products once per node.
+            Not supported with `state_dir`.
+
+    """
 
     # Choose one bit in the common flags for storing gap information
     gap_bit = 2 ** 7
@@ -1566,6 +2290,7 @@ class OpMapMaker(Operator):
         write_rcond=True,
         rcond_limit=1e-3,
         baseline_length=100000,
+        baseline_knee_periods=None,
         maskfile=None,
         weightmapfile=None,
         common_flag_mask=1,
@@ -1576,12 +2301,26 @@ class OpMapMaker(Operator):
         fourier2D_subharmonics=False,
         gain_templatename=None,
         gain_poly_order=None,
+        ground_resolution=None,
+        ground_el_resolution=None,
+        ground_shared=False,
         iter_min=3,
         iter_max=100,
         use_noise_prior=True,
         precond_width=20,
         pixels="pixels",
+        weights="weights",
+        nest=True,
+        coarse_nside=None,
+        step_weights=None,
+        state_dir=None,
+        warm_start=True,
+        node_shared=False,
     ):
+        if node_shared and state_dir is not None:
+            raise RuntimeError(
+                "Node-shared pixel domain products do not support state_dir"
+            )
         self.nside = nside
         self.npix = 12 * self.nside ** 2
         self.name = name
@@ -1598,6 +2337,7 @@ class OpMapMaker(Operator):
         self.write_rcond = write_rcond
         self.rcond_limit = rcond_limit
         self.baseline_length = baseline_length
+        self.baseline_knee_periods = baseline_knee_periods
         self.maskfile = maskfile
         self.weightmap = None
         self.weightmapfile = weightmapfile
@@ -1609,11 +2349,27 @@ class OpMapMaker(Operator):
         self.fourier2D_subharmonics = fourier2D_subharmonics
         self.gain_poly_order = gain_poly_order
         self.gain_templatename = gain_templatename
+        self.ground_resolution = ground_resolution
+        self.ground_el_resolution = ground_el_resolution
+        self.ground_shared = ground_shared
         self.iter_min = iter_min
         self.iter_max = iter_max
         self.use_noise_prior = use_noise_prior
         self.precond_width = precond_width
         self.pixels = pixels
+        self.weights = weights
+        # Ordering of the pixel numbers, only used by the coarse correction
+        self.nest = nest
+        self.coarse_nside = coarse_nside
+        self.step_weights = step_weights
+        # Optional persistent state for incremental mapmaking
+        self.state_dir = state_dir
+        self.warm_start = warm_start
+        self.state = None
+        # Store the pixel domain products once per node
+        self.node_shared = node_shared
+        # Number of PCG iterations in the last solve
+        self.niter = None
 
     def report_timing(self):
         # gt.stop_all()
@@ -1656,6 +2412,7 @@ class OpMapMaker(Operator):
                             ("SubharmonicTemplate.project_signal", None),
                             ("fourier2DTemplate.project_signal", None),
                             ("GainTemplate.project_signal", None),
+                            ("GroundTemplate.project_signal", None),
                         ]
                     ),
                 ),
@@ -1718,6 +2475,7 @@ class OpMapMaker(Operator):
                             ("SubharmonicTemplate.add_to_signal", None),
                             ("fourier2DTemplate.add_to_signal", None),
                             ("GainTemplate.add_to_signal", None),
+                            ("GroundTemplate.add_to_signal", None),
                         ]
                     ),
                 ),
@@ -1761,6 +2519,7 @@ class OpMapMaker(Operator):
             self.weightmap,
             common_flag_mask=(self.common_flag_mask | self.gap_bit),
             flag_mask=(self.flag_mask | self.mask_bit),
+            step_weights=self.step_weights,
         )
         if self.rank == 0:
             timer.report_clear("Initialize projection matrix")
@@ -1780,6 +2539,9 @@ class OpMapMaker(Operator):
             # Do not add mask_bit here since it is not
             # included in the white noise matrices
             flag_mask=self.flag_mask,
+            step_weights=self.step_weights,
+            prior_zmap=self.state_zmap,
+            node_shared=self.node_shared,
         )
         if self.rank == 0:
             timer.report_clear("Initialize projection matrix")
@@ -1808,6 +2570,7 @@ class OpMapMaker(Operator):
                     flag_mask=(self.flag_mask | self.mask_bit),
                     use_noise_prior=self.use_noise_prior,
                     precond_width=self.precond_width,
+                    knee_periods=self.baseline_knee_periods,
                 )
             )
         if self.subharmonic_order is not None:
@@ -1860,6 +2623,24 @@ class OpMapMaker(Operator):
                     templatename=self.gain_templatename,
                 )
             )
+        if self.ground_resolution is not None:
+            if self.rank == 0:
+                log.info(
+                    "Initializing ground template, resolution = {} deg".format(
+                        self.ground_resolution
+                    )
+                )
+            templatelist.append(
+                GroundTemplate(
+                    data,
+                    self.detweights,
+                    az_resolution=self.ground_resolution,
+                    el_resolution=self.ground_el_resolution,
+                    shared=self.ground_shared,
+                    common_flag_mask=(self.common_flag_mask | self.gap_bit),
+                    flag_mask=(self.flag_mask | self.mask_bit),
+                )
+            )
         if len(templatelist) == 0:
             if self.rank == 0:
                 log.info("No templates to fit, no destriping done.")
@@ -1874,6 +2655,19 @@ class OpMapMaker(Operator):
     def get_solver(self, data, templates, noise, projection, signal):
         timer = Timer()
         timer.start()
+        coarse = None
+        if self.coarse_nside is not None and OffsetTemplate.name in templates.templates:
+            coarse = CoarseCorrection(
+                data,
+                self.comm,
+                templates,
+                self.nside,
+                self.coarse_nside,
+                pixels=self.pixels,
+                weights=self.weights,
+                nnz=self.nnz,
+                nest=self.nest,
+            )
         solver = PCGSolver(
             self.comm,
             templates,
@@ -1882,6 +2676,7 @@ class OpMapMaker(Operator):
             signal,
             niter_min=self.iter_min,
             niter_max=self.iter_max,
+            coarse=coarse,
         )
         if self.rank == 0:
             timer.report_clear("Initialize PCG solver")
@@ -1946,9 +2741,10 @@ class OpMapMaker(Operator):
             self.rank = self.comm.rank
         self.flag_gaps(data)
         self.get_detweights(data)
+        self.load_state(data)
         self.initialize_binning(data)
-        if self.write_binned:
-            self.bin_map(data, "binned")
+        if self.write_binned or self.state_dir is not None:
+            self.bin_map(data, "binned", write=self.write_binned)
         self.load_mask(data)
         self.load_weightmap(data)
 
@@ -1956,13 +2752,19 @@ class OpMapMaker(Operator):
 
         templates = self.get_templatematrix(data)
         if templates is None:
+            self.save_state(data)
+            self.restore_local_submaps(data)
             return
         noise = self.get_noisematrix(data)
         projection = self.get_projectionmatrix(data)
         signal = Signal(data, name=self.name)
         solver = self.get_solver(data, templates, noise, projection, signal)
+        guess = None
+        if self.warm_start and self.state is not None:
+            guess = self.get_warm_start(data, templates, noise, projection, signal)
         timer.start()
-        amplitudes = solver.solve()
+        amplitudes = solver.solve(guess)
+        self.niter = solver.niter
         if self.rank == 0:
             timer.report_clear("Solve amplitudes")
 
@@ -1980,11 +2782,255 @@ class OpMapMaker(Operator):
             if self.rank == 0:
                 timer.report_clear("Clean TOD")
 
-        if self.write_destriped:
-            self.bin_map(data, "destriped")
+        if self.write_destriped or self.state_dir is not None:
+            self.bin_map(data, "destriped", write=self.write_destriped)
+
+        self.save_state(data)
+        self.restore_local_submaps(data)
 
         return
 
+    def _state_file(self, rank):
+        return os.path.join(self.state_dir, "mapmaker_state_{:05d}.npz".format(rank))
+
+    def _submap_owners(self, nsubmap, local_submaps):
+        """Return the owner of each submap.
+
+        The lowest process with a submap in its local submaps owns it.
+        Submaps that no process has are assigned the number of processes.
+        """
+        nproc = 1
+        if self.comm is not None:
+            nproc = self.comm.size
+        owners = np.zeros(nsubmap, dtype=np.int32)
+        owners.fill(nproc)
+        owners[local_submaps] = self.rank
+        if self.comm is not None:
+            allowners = np.zeros_like(owners)
+            self.comm.Allreduce(owners, allowners, op=MPI.MIN)
+            owners = allowners
+        return owners
+
+    @function_timer
+    def load_state(self, data):
+        """Load the accumulated products of earlier runs.
+
+        The state holds the inverse white noise covariance, hits and noise
+        weighted destriped map of all observations folded in by earlier runs,
+        saved by the owner of each submap in one file per process of the run
+        that saved it.  Each process of this run reads the submaps it owns
+        from all of the files, so the number of processes may change between
+        runs.  The observations of this run are added to these products, and
+        the destriping treats the earlier observations as fixed.  The local
+        submaps are extended with the submaps of the state so that the
+        products of earlier observations are carried forward, until exec()
+        restores the original local submaps.
+        """
+        self.state = None
+        self.state_invnpp = None
+        self.state_hits = None
+        self.state_zmap = None
+        self.state_observations = set()
+        if self.state_dir is None:
+            return
+        timer = Timer()
+        timer.start()
+        nproc = 1
+        if self.comm is not None:
+            nproc = self.comm.size
+
+        # Every process reads the same header, so they all agree on the
+        # errors below.
+        fname = self._state_file(0)
+        if not os.path.isfile(fname):
+            return
+        with np.load(fname) as state:
+            nfile = int(state["nproc"])
+            mismatch = (
+                int(state["nside"]) != self.nside
+                or int(state["nnz"]) != self.nnz
+                or int(state["npix_submap"]) != data["pixels_npix_submap"]
+            )
+            self.state_observations = set(str(x) for x in state["observations"])
+        if mismatch:
+            raise RuntimeError(
+                "Mapmaker state in {} does not match this run".format(self.state_dir)
+            )
+        fnames = [self._state_file(x) for x in range(nfile)]
+        if not all(os.path.isfile(x) for x in fnames):
+            raise RuntimeError(
+                "Missing mapmaker state files in {}".format(self.state_dir)
+            )
+
+        duplicates = [
+            obs["name"]
+            for obs in data.obs
+            if "name" in obs and obs["name"] in self.state_observations
+        ]
+        if self.comm is not None:
+            duplicates = [x for names in self.comm.allgather(duplicates) for x in names]
+        if len(duplicates) > 0:
+            raise RuntimeError(
+                "Observations {} are already in the mapmaker state".format(
+                    sorted(set(duplicates))
+                )
+            )
+
+        # Assign the submaps of this run as in save_state(), and the others
+        # round robin.
+        nsubmap = data["pixels_nsubmap"]
+        local_submaps = data["pixels_local_submaps"]
+        self.local_submaps = local_submaps
+        if local_submaps is None:
+            local_submaps = np.zeros(0, dtype=np.int64)
+        owners = self._submap_owners(nsubmap, local_submaps)
+        unowned = owners == nproc
+        owners[unowned] = np.arange(nsubmap)[unowned] % nproc
+
+        keys = ["invnpp", "hits", "zmap"]
+        submaps = [np.zeros(0, dtype=np.int64)]
+        products = {key: list() for key in keys}
+        for fname in fnames:
+            with np.load(fname) as state:
+                file_submaps = state["submaps"]
+                mine = owners[file_submaps] == self.rank
+                if not np.any(mine):
+                    continue
+                submaps.append(file_submaps[mine])
+                for key in keys:
+                    products[key].append(state[key][mine])
+        submaps = np.concatenate(submaps).astype(np.int64)
+        self.state = dict(submaps=submaps)
+        data["pixels_local_submaps"] = np.union1d(local_submaps, submaps).astype(
+            np.int64
+        )
+
+        # The state is only stored by the owner of each submap, so it can be
+        # added to the local products before their reduction.
+        self.state_invnpp = DistPixels(
+            data, comm=self.comm, nnz=self.ncov, dtype=np.float64
+        )
+        self.state_hits = DistPixels(data, comm=self.comm, nnz=1, dtype=np.int64)
+        self.state_zmap = DistPixels(
+            data, comm=self.comm, nnz=self.nnz, dtype=np.float64
+        )
+        for obj, key in [
+            (self.state_invnpp, "invnpp"),
+            (self.state_hits, "hits"),
+            (self.state_zmap, "zmap"),
+        ]:
+            if obj.data is None:
+                continue
+            obj.data.fill(0)
+            if submaps.size > 0:
+                obj.data[obj.global2local[submaps]] = np.concatenate(products[key])
+        if self.rank == 0:
+            timer.report_clear("Load mapmaker state")
+        return
+
+    def restore_local_submaps(self, data):
+        """Restore the local submaps that load_state() extended."""
+        if self.state is not None:
+            data["pixels_local_submaps"] = self.local_submaps
+        return
+
+    @function_timer
+    def save_state(self, data):
+        """Save the accumulated products for the next incremental run."""
+        if self.state_dir is None:
+            return
+        timer = Timer()
+        timer.start()
+        if self.rank == 0:
+            os.makedirs(self.state_dir, exist_ok=True)
+        nproc = 1
+        if self.comm is not None:
+            nproc = self.comm.size
+            self.comm.Barrier()
+
+        # The lowest process with a submap owns it
+        nsubmap = data["pixels_nsubmap"]
+        local_submaps = self.state_hits_total.local_submaps
+        if local_submaps is None:
+            local_submaps = np.zeros(0, dtype=np.int64)
+        owners = self._submap_owners(nsubmap, local_submaps)
+        submaps = np.array(
+            [x for x in local_submaps if owners[x] == self.rank], dtype=np.int64
+        )
+
+        observations = set(self.state_observations)
+        for obs in data.obs:
+            if "name" in obs:
+                observations.add(obs["name"])
+        if self.comm is not None:
+            for obsnames in self.comm.allgather(observations):
+                observations.update(obsnames)
+
+        products = dict()
+        for obj, key in [
+            (self.state_invnpp_total, "invnpp"),
+            (self.state_hits_total, "hits"),
+            (self.state_zmap_total, "zmap"),
+        ]:
+            if obj.data is None:
+                products[key] = np.zeros((0, obj.npix_submap, obj.nnz), dtype=obj.dtype)
+            else:
+                products[key] = obj.data[obj.global2local[submaps]]
+        np.savez(
+            self._state_file(self.rank),
+            nside=self.nside,
+            nnz=self.nnz,
+            nproc=nproc,
+            npix_submap=data["pixels_npix_submap"],
+            submaps=submaps,
+            observations=np.array(sorted(observations), dtype=np.str_),
+            **products,
+        )
+        if self.comm is not None:
+            self.comm.Barrier()
+        if self.rank == 0:
+            timer.report_clear("Save mapmaker state to {}".format(self.state_dir))
+        return
+
+    @function_timer
+    def get_warm_start(self, data, templates, noise, projection, signal):
+        """Estimate the amplitudes from the map of earlier runs.
+
+        The map of the earlier observations is scanned and subtracted from
+        the signal, and the preconditioner is applied to the noise weighted
+        and projected residual, F^T N^-1 Z (d - P m).  This gives a starting point that is close to the solution
+        wherever the earlier observations constrain the sky.
+        """
+        timer = Timer()
+        timer.start()
+        prev_map = self.state_zmap.duplicate()
+        prev_map.allreduce()
+        prev_cov = self.state_invnpp.duplicate()
+        prev_cov.allreduce()
+        covariance_invert(prev_cov, self.rcond_limit)
+        covariance_apply(prev_cov, prev_map)
+        del prev_cov
+        residual = signal.copy()
+        scanned = Signal(data, temporary=True, init_val=0)
+        scansim = OpSimScan(
+            input_map=prev_map,
+            pixels=self.pixels,
+            weights=self.weights,
+            out=scanned.name,
+        )
+        scansim.exec(data)
+        residual -= scanned
+        del scanned
+        projected = projection.apply(residual)
+        del residual
+        guess = templates.apply_precond(
+            templates.apply_transpose(noise.apply(projected, in_place=True))
+        )
+        del projected
+        if self.rank == 0:
+            timer.report_clear("Warm start amplitudes")
+        return guess
+
     @function_timer
     def flag_gaps(self, data):
         """Add flag bits between the intervals"""
@@ -1997,11 +3043,17 @@ class OpMapMaker(Operator):
         return
 
     @function_timer
-    def bin_map(self, data, suffix):
+    def bin_map(self, data, suffix, write=True):
         log = Logger.get()
         timer = Timer()
 
-        dist_map = DistPixels(data, comm=self.comm, nnz=self.nnz, dtype=np.float64)
+        dist_map = DistPixels(
+            data,
+            comm=self.comm,
+            nnz=self.nnz,
+            dtype=np.float64,
+            node_shared=self.node_shared,
+        )
         if dist_map.data is not None:
             dist_map.data.fill(0.0)
         # FIXME: OpAccumDiag should support separate detweights for each observation
@@ -2011,11 +3063,19 @@ class OpMapMaker(Operator):
             detweights=self.detweights[0],
             common_flag_mask=(self.common_flag_mask | self.gap_bit),
             flag_mask=self.flag_mask,
+            step_weights=self.step_weights,
         )
         build_dist_map.exec(data)
+        if self.state_zmap is not None and dist_map.data is not None:
+            dist_map.data += self.state_zmap.data
         dist_map.allreduce()
         if self.rank == 0:
             timer.report_clear("  Build noise-weighted map")
+        if self.state_dir is not None:
+            self.state_zmap_total = dist_map.duplicate()
+
+        if not write:
+            return
 
         covariance_apply(self.white_noise_cov_matrix, dist_map)
         if self.rank == 0:
@@ -2071,12 +3131,18 @@ class OpMapMaker(Operator):
             os.makedirs(self.outdir, exist_ok=True)
 
         self.white_noise_cov_matrix = DistPixels(
-            data, comm=self.comm, nnz=self.ncov, dtype=np.float64
+            data,
+            comm=self.comm,
+            nnz=self.ncov,
+            dtype=np.float64,
+            node_shared=self.node_shared,
         )
         if self.white_noise_cov_matrix.data is not None:
             self.white_noise_cov_matrix.data.fill(0.0)
 
-        hits = DistPixels(data, comm=self.comm, nnz=1, dtype=np.int64)
+        hits = DistPixels(
+            data, comm=self.comm, nnz=1, dtype=np.int64, node_shared=self.node_shared
+        )
         if hits.data is not None:
             hits.data.fill(0)
 
@@ -2090,8 +3156,12 @@ class OpMapMaker(Operator):
             hits=hits,
             common_flag_mask=(self.common_flag_mask | self.gap_bit),
             flag_mask=self.flag_mask,
+            step_weights=self.step_weights,
         )
         build_wcov.exec(data)
+        if self.state_invnpp is not None and hits.data is not None:
+            self.white_noise_cov_matrix.data += self.state_invnpp.data
+            hits.data += self.state_hits.data
 
         if self.comm is not None:
             self.comm.Barrier()
@@ -2105,8 +3175,14 @@ class OpMapMaker(Operator):
         if self.rank == 0:
             timer.report_clear("All reduce N_pp'^1")
 
-        if self.write_hits:
+        if self.state_dir is not None:
             hits.allreduce()
+            self.state_hits_total = hits
+            self.state_invnpp_total = self.white_noise_cov_matrix.duplicate()
+
+        if self.write_hits:
+            if self.state_dir is None:
+                hits.allreduce()
             fname = os.path.join(self.outdir, self.outprefix + "hits.fits")
             if self.zip_maps:
                 fname += ".gz"
@@ -0,0 +1,180 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import numpy as np
+
+from .. import qarray as qa
+
+from ..op import Operator
+
+from ..timing import function_timer
+
+
+def find_detector_pairs(detquats, dets, suffixes=("A", "B"), tol=1.0e-6):
+    """Find the co-located detector pairs of a focalplane.
+
+    Two detectors form a pair if their names only differ by the suffixes
+    (for example "fake_12A" and "fake_12B") and if their quaternion offsets
+    only differ by a rotation about the line of sight.
+
+    Args:
+        detquats (dict):  The quaternion offset of every detector.
+        dets (list):  The detectors to pair.  Both detectors of a pair must
+            be in this list.
+        suffixes (tuple):  The name suffixes of the two detectors.
+        tol (float):  Tolerance of the line of sight comparison.
+
+    Returns:
+        (tuple):  The list of (det_a, det_b, dpsi) pairs, where dpsi is the
+            polarization angle of det_b relative to det_a in radians, and
+            the list of the remaining detectors.
+
+    """
+    suffix_a, suffix_b = suffixes
+    detset = set(dets)
+    pairs = list()
+    paired = set()
+    for det in dets:
+        if not det.endswith(suffix_a):
+            continue
+        partner = det[: len(det) - len(suffix_a)] + suffix_b
+        if partner not in detset or partner in paired:
+            continue
+        # The rotation from the frame of det to the frame of its partner
+        # must be about the Z axis.
+        qrel = qa.mult(qa.inv(np.asarray(detquats[det])), detquats[partner])
+        if np.abs(qrel[0]) > tol or np.abs(qrel[1]) > tol:
+            continue
+        dpsi = 2.0 * np.arctan2(qrel[2], qrel[3])
+        pairs.append((det, partner, dpsi))
+        paired.add(det)
+        paired.add(partner)
+    singles = [x for x in dets if x not in paired]
+    return pairs, singles
+
+
+class OpPairSumDiff(Operator):
+    """Operator which forms the sum and difference of detector pairs.
+
+    For every pair of co-located detectors A and B (see find_detector_pairs),
+    this computes the half sum (A + B) / 2 and the half difference
+    (A - B) / 2 of their signals.  For a pair of orthogonal detectors with
+    matched gains, the sum only sees the intensity and the difference only
+    sees the polarization.  The corresponding pointing weights are the half
+    sum of the intensity weights and the half difference of the Q and U
+    weights, so the sum streams can be mapped in "I" mode and the
+    difference streams in "QU" mode (nnz = 2) with half the samples of the
+    full data.  Any intensity leakage of mismatched detectors into the
+    difference is not part of these weights.
+
+    The outputs are stored in the cache under the name of the first
+    detector of each pair, and the pixel numbers of the first detector
+    apply to both.  Pass the list returned by `detectors` to the mapmaking
+    operators.
+
+    Args:
+        name (str):  Name of the input signal cache objects
+            <name>_<detector>.  If None, the TOD signal is used.
+        sum_name (str):  Name of the output sum cache objects, or None.
+        diff_name (str):  Name of the output difference cache objects, or
+            None.
+        weights (str):  Name of the IQU pointing weights.  If None, no
+            weights are produced.
+        sum_weights (str):  Name of the output intensity weights of the
+            sums.
+        diff_weights (str):  Name of the output QU weights of the
+            differences.
+        suffixes (tuple):  The name suffixes of the two detectors of a pair.
+
+    """
+
+    def __init__(
+        self,
+        name=None,
+        sum_name="sum",
+        diff_name="diff",
+        weights=None,
+        sum_weights="weights_sum",
+        diff_weights="weights_diff",
+        suffixes=("A", "B"),
+    ):
+        self._name = name
+        self._sum_name = sum_name
+        self._diff_name = diff_name
+        self._weights = weights
+        self._sum_weights = sum_weights
+        self._diff_weights = diff_weights
+        self._suffixes = suffixes
+        self._detectors = set()
+
+        # We call the parent class constructor, which currently does nothing
+        super().__init__()
+
+    @property
+    def detectors(self):
+        """(list): The names of the sum and difference streams."""
+        return sorted(self._detectors)
+
+    def _put(self, tod, name, det, value):
+        cachename = "{}_{}".format(name, det)
+        if tod.cache.exists(cachename):
+            ref = tod.cache.reference(cachename)
+            ref[:] = value
+            del ref
+        else:
+            tod.cache.put(cachename, value)
+        return
+
+    @function_timer
+    def exec(self, data):
+        """Form the pair sums and differences.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            None
+
+        """
+        for obs in data.obs:
+            tod = obs["tod"]
+            pairs, _ = find_detector_pairs(
+                tod.detoffset(), tod.local_dets, suffixes=self._suffixes
+            )
+            for det_a, det_b, _ in pairs:
+                self._detectors.add(det_a)
+                sig_a = tod.local_signal(det_a, self._name)
+                sig_b = tod.local_signal(det_b, self._name)
+                if self._sum_name is not None:
+                    self._put(tod, self._sum_name, det_a, 0.5 * (sig_a + sig_b))
+                if self._diff_name is not None:
+                    self._put(tod, self._diff_name, det_a, 0.5 * (sig_a - sig_b))
+                del sig_a
+                del sig_b
+
+                if self._weights is None:
+                    continue
+                weights_a = tod.cache.reference("{}_{}".format(self._weights, det_a))
+                weights_b = tod.cache.reference("{}_{}".format(self._weights, det_b))
+                if weights_a.shape[1] != 3:
+                    raise RuntimeError("Pair differences require IQU weights")
+                dtype = weights_a.dtype
+                if self._sum_name is not None:
+                    self._put(
+                        tod,
+                        self._sum_weights,
+                        det_a,
+                        (0.5 * (weights_a[:, 0:1] + weights_b[:, 0:1])).astype(dtype),
+                    )
+                if self._diff_name is not None:
+                    self._put(
+                        tod,
+                        self._diff_weights,
+                        det_a,
+                        (0.5 * (weights_a[:, 1:] - weights_b[:, 1:])).astype(dtype),
+                    )
+                del weights_a
+                del weights_b
+
+        return
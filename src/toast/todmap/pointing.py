@@ -16,7 +16,9 @@ from ..op import Operator
 
 from ..timing import function_timer
 
-from .._libtoast import pointing_matrix_healpix
+from .._libtoast import pointing_matrix_healpix, pointing_matrix_healpix_pair
+
+from .pairs import find_detector_pairs
 
 
 class OpPointingHpix(Operator):
@@ -61,6 +63,12 @@ class OpPointingHpix(Operator):
         single_precision (bool):  Return the pixel numbers and pointing
              weights in single precision.  Default=False.
         nside_submap (int):  Size of a submap is 12 * nside_submap ** 2
+        pairs (bool):  If True, the pointing of co-located detector pairs
+            (see find_detector_pairs) is expanded once per pair.  The pixel
+            numbers and orientation of the second detector are derived from
+            the first one and its polarization angle offset.  With
+            keep_quats, only the quaternions of the first detector are
+            cached.
     """
 
     def __init__(
@@ -78,6 +86,7 @@ class OpPointingHpix(Operator):
         keep_quats=False,
         single_precision=False,
         nside_submap=16,
+        pairs=False,
     ):
         self._pixels = pixels
         self._weights = weights
@@ -95,6 +104,7 @@ class OpPointingHpix(Operator):
         self._npix_submap = 12 * self._nside_submap ** 2
         self._nsubmap = (self._nside // self._nside_submap) ** 2
         self._hit_submaps = np.zeros(self._nsubmap, dtype=bool)
+        self._pairs = pairs
 
         # initialize the healpix pixels object
         self.hpix = HealpixPixels(self._nside)
@@ -133,6 +143,55 @@ class OpPointingHpix(Operator):
             dtype = np.int64
         return np.arange(self._nsubmap, dtype=dtype)[self._hit_submaps]
 
+    def config_hash(self):
+        """Hash of the pointing configuration (see Operator.config_hash)."""
+        # The pixelization object follows from nside and the hit submaps are
+        # accumulated by exec(), so neither is part of the configuration.
+        return super().config_hash(exclude=["hpix", "_hit_submaps"])
+
+    def _det_eps(self, det):
+        if self._epsilon is None:
+            return 0.0
+        return self._epsilon[det]
+
+    def _det_cal(self, det):
+        if self._cal is None:
+            return 1.0
+        return self._cal[det]
+
+    def _get_buffers(self, tod, det, nsamp):
+        """Create cache objects for the pointing matrix of one detector."""
+        pixelsname = "{}_{}".format(self._pixels, det)
+        weightsname = "{}_{}".format(self._weights, det)
+
+        if tod.cache.exists(pixelsname):
+            pixelsref = tod.cache.reference(pixelsname)
+        else:
+            pixelsref = tod.cache.create(pixelsname, np.int64, (nsamp,))
+
+        if tod.cache.exists(weightsname):
+            weightsref = tod.cache.reference(weightsname)
+        else:
+            weightsref = tod.cache.create(weightsname, np.float64, (nsamp, self._nnz))
+        return pixelsref, weightsref
+
+    def _finalize_buffers(self, tod, det, pixelsref, weightsref):
+        """Convert the pointing matrix precision and record the hit submaps."""
+        if self._single_precision:
+            pixelsname = "{}_{}".format(self._pixels, det)
+            weightsname = "{}_{}".format(self._weights, det)
+            pixels = pixelsref.astype(np.int32)
+            del pixelsref
+            pixelsref = tod.cache.put(pixelsname, pixels, replace=True)
+            del pixels
+            weights = weightsref.astype(np.float32)
+            del weightsref
+            weightsref = tod.cache.put(weightsname, weights, replace=True)
+            del weights
+
+        self._hit_submaps[pixelsref // self._npix_submap] = True
+        return
+
     @function_timer
     def exec(self, data):
         """Create pixels and weights.
@@ -175,34 +234,13 @@ class OpPointingHpix(Operator):
             else:
                 common = np.zeros(nsamp, dtype=np.uint8)
 
-            for det in tod.local_dets:
-                eps = 0.0
-                if self._epsilon is not None:
-                    eps = self._epsilon[det]
-
-                cal = 1.0
-                if self._cal is not None:
-                    cal = self._cal[det]
-
-                # Create cache objects and use that memory directly
-
-                pixelsname = "{}_{}".format(self._pixels, det)
-                weightsname = "{}_{}".format(self._weights, det)
-
-                pixelsref = None
-                weightsref = None
-
-                if tod.cache.exists(pixelsname):
-                    pixelsref = tod.cache.reference(pixelsname)
-                else:
-                    pixelsref = tod.cache.create(pixelsname, np.int64, (nsamp,))
+            pairs = list()
+            singles = tod.local_dets
+            if self._pairs:
+                pairs, singles = find_detector_pairs(tod.detoffset(), tod.local_dets)
 
-                if tod.cache.exists(weightsname):
-                    weightsref = tod.cache.reference(weightsname)
-                else:
-                    weightsref = tod.cache.create(
-                        weightsname, np.float64, (nsamp, self._nnz)
-                    )
+            for det in singles:
+                pixelsref, weightsref = self._get_buffers(tod, det, nsamp)
 
                 pdata = None
                 if self._keep_quats:
@@ -233,8 +271,8 @@ class OpPointingHpix(Operator):
                     pointing_matrix_healpix(
                         self.hpix,
                         self._nest,
-                        eps,
-                        cal,
+                        self._det_eps(det),
+                        self._det_cal(det),
                         self._mode,
                         detp.reshape(-1),
                         hslice,
@@ -244,22 +282,68 @@ class OpPointingHpix(Operator):
                     )
                     buf_off += buf_n
 
-                if self._single_precision:
-                    pixels = pixelsref.astype(np.int32)
-                    del pixelsref
-                    pixelsref = tod.cache.put(pixelsname, pixels, replace=True)
-                    del pixels
-                    weights = weightsref.astype(np.float32)
-                    del weightsref
-                    weightsref = tod.cache.put(weightsname, weights, replace=True)
-                    del weights
-
-                self._hit_submaps[pixelsref // self._npix_submap] = True
+                self._finalize_buffers(tod, det, pixelsref, weightsref)
 
                 del pixelsref
                 del weightsref
                 del pdata
 
+            for det_a, det_b, dpsi in pairs:
+                pixels_a, weights_a = self._get_buffers(tod, det_a, nsamp)
+                pixels_b, weights_b = self._get_buffers(tod, det_b, nsamp)
+
+                pdata = None
+                if self._keep_quats:
+                    pdata = tod.local_pointing(det_a)
+
+                buf_off = 0
+                buf_n = tod_buffer_length
+                while buf_off < nsamp:
+                    if buf_off + buf_n > nsamp:
+                        buf_n = nsamp - buf_off
+                    bslice = slice(buf_off, buf_off + buf_n)
+
+                    detp = None
+                    if pdata is None:
+                        detp = tod.read_pntg(
+                            detector=det_a, local_start=buf_off, n=buf_n
+                        )
+                    else:
+                        detp = pdata[bslice, :]
+
+                    hslice = None
+                    if hwpang is not None:
+                        hslice = hwpang[bslice].reshape(-1)
+                    fslice = common[bslice].reshape(-1)
+
+                    pointing_matrix_healpix_pair(
+                        self.hpix,
+                        self._nest,
+                        self._det_eps(det_a),
+                        self._det_cal(det_a),
+                        self._det_eps(det_b),
+                        self._det_cal(det_b),
+                        dpsi,
+                        self._mode,
+                        detp.reshape(-1),
+                        hslice,
+                        fslice,
+                        pixels_a[bslice].reshape(-1),
+                        pixels_b[bslice].reshape(-1),
+                        weights_a[bslice, :].reshape(-1),
+                        weights_b[bslice, :].reshape(-1),
+                    )
+                    buf_off += buf_n
+
+                self._finalize_buffers(tod, det_a, pixels_a, weights_a)
+                self._finalize_buffers(tod, det_b, pixels_b, weights_b)
+
+                del pixels_a
+                del weights_a
+                del pixels_b
+                del weights_b
+                del pdata
+
             del common
 
         # Store the local submaps in the data object under the same name
@@ -411,6 +495,12 @@ class OpMuellerPointingHpix(Operator):
             dtype = np.int64
         return np.arange(self._nsubmap, dtype=dtype)[self._hit_submaps]
 
+    def config_hash(self):
+        """Hash of the pointing configuration (see Operator.config_hash)."""
+        # The pixelization object follows from nside and the hit submaps are
+        # accumulated by exec(), so neither is part of the configuration.
+        return super().config_hash(exclude=["hpix", "_hit_submaps"])
+
     @function_timer
     def exec(self, data):
         """Create pixels and weights.
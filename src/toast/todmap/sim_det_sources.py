@@ -0,0 +1,202 @@
+# Copyright (c) 2015-2020 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+
+import numpy as np
+
+from ..timing import function_timer
+
+from .._libtoast import SourceIndex
+
+from ..op import Operator
+
+from ..utils import Environment
+
+
+class OpSimSources(Operator):
+    """Operator which scans a catalog of compact sources into the TOD.
+
+    The sources are evaluated directly from the detector quaternions with
+    an elliptical Gaussian beam, instead of painting them onto a map and
+    scanning it.  The catalog is held in a spatial index (HEALPix buckets
+    organized in a k-d tree) and only the sources near each block of
+    samples are evaluated.  Solar system bodies may be given a constant
+    angular velocity, which is accurate as long as their motion is close to
+    linear over the observation.  Only the intensity response is simulated.
+
+    The catalog coordinates must be in the same frame as the detector
+    pointing.  The beam has unit integral, so the flux of a source is its
+    integrated amplitude (for example in K sr) and the peak response is
+    flux / (2 pi sigma_major sigma_minor).
+
+    The beam parameters and the fluxes may be given either once for all
+    detectors, or as dictionaries with a value per detector.
+
+    Args:
+        lon (array):  The source longitudes in degrees.
+        lat (array):  The source latitudes in degrees.
+        flux (array or dict):  The integrated amplitude of every source.
+        fwhm (float or dict):  The beam FWHM along the major axis in
+            arcminutes.
+        fwhm_minor (float or dict):  The beam FWHM along the minor axis in
+            arcminutes.  If None, the beam is circular.
+        beam_angle (float or dict):  The angle of the beam major axis from
+            the detector polarization direction, in degrees.
+        lon_rate (array):  Optional rate of change of the longitudes in
+            degrees per second.
+        lat_rate (array):  Optional rate of change of the latitudes in
+            degrees per second.
+        tref (float):  The time at which the sources are at (lon, lat).
+        nsigma (float):  The beam is truncated at this many sigmas along
+            the major axis.
+        out (str):  Accumulate data to the cache with name <out>_<detector>.
+            If the named cache objects do not exist, then they are created.
+        nside (int):  The NSIDE of the HEALPix buckets of the index.
+        keep_quats (bool):  If True, cache the detector quaternions.
+
+    """
+
+    def __init__(
+        self,
+        lon,
+        lat,
+        flux,
+        fwhm,
+        fwhm_minor=None,
+        beam_angle=0.0,
+        lon_rate=None,
+        lat_rate=None,
+        tref=0.0,
+        nsigma=5.0,
+        out="signal",
+        nside=64,
+        keep_quats=False,
+    ):
+        self._flux = flux
+        self._fwhm = fwhm
+        self._fwhm_minor = fwhm_minor
+        self._beam_angle = beam_angle
+        self._tref = tref
+        self._nsigma = nsigma
+        self._out = out
+        self._keep_quats = keep_quats
+
+        lon = np.radians(np.atleast_1d(lon).astype(np.float64))
+        lat = np.radians(np.atleast_1d(lat).astype(np.float64))
+        if lon.shape != lat.shape:
+            raise RuntimeError("Source longitudes and latitudes do not match")
+        self._nsource = lon.size
+
+        dirs = np.zeros((self._nsource, 3), dtype=np.float64)
+        dirs[:, 0] = np.cos(lat) * np.cos(lon)
+        dirs[:, 1] = np.cos(lat) * np.sin(lon)
+        dirs[:, 2] = np.sin(lat)
+
+        # The angular velocity of every source as a vector tangent to the
+        # sphere, in radians per second.
+        vels = np.zeros(0, dtype=np.float64)
+        if lon_rate is not None or lat_rate is not None:
+            dlon = np.zeros(self._nsource)
+            dlat = np.zeros(self._nsource)
+            if lon_rate is not None:
+                dlon[:] = np.radians(lon_rate)
+            if lat_rate is not None:
+                dlat[:] = np.radians(lat_rate)
+            vels = np.zeros((self._nsource, 3), dtype=np.float64)
+            coslat = np.cos(lat)
+            sinlat = np.sin(lat)
+            vels[:, 0] = -dlon * coslat * np.sin(lon) - dlat * sinlat * np.cos(lon)
+            vels[:, 1] = dlon * coslat * np.cos(lon) - dlat * sinlat * np.sin(lon)
+            vels[:, 2] = dlat * coslat
+
+        self._index = SourceIndex(dirs.ravel(), vels.ravel(), tref, nside)
+
+        # We call the parent class constructor, which currently does nothing
+        super().__init__()
+
+    def _det_value(self, value, det):
+        if isinstance(value, dict):
+            return value[det]
+        return value
+
+    @function_timer
+    def exec(self, data):
+        """Scan the sources into the timestreams.
+
+        Args:
+            data (toast.Data): The distributed data.
+
+        Returns:
+            None
+
+        """
+        env = Environment.get()
+
+        for obs in data.obs:
+            tod = obs["tod"]
+            offset, nsamp = tod.local_samples
+            times = tod.local_times()
+
+            for det in tod.local_dets:
+                flux = np.ascontiguousarray(
+                    self._det_value(self._flux, det), dtype=np.float64
+                )
+                if flux.size != self._nsource:
+                    raise RuntimeError(
+                        "Detector {} has {} source fluxes for {} sources".format(
+                            det, flux.size, self._nsource
+                        )
+                    )
+                fwhm = np.radians(self._det_value(self._fwhm, det) / 60.0)
+                fwhm_minor = self._det_value(self._fwhm_minor, det)
+                if fwhm_minor is None:
+                    fwhm_minor = fwhm
+                else:
+                    fwhm_minor = np.radians(fwhm_minor / 60.0)
+                psi_beam = np.radians(self._det_value(self._beam_angle, det))
+
+                pdata = None
+                if self._keep_quats:
+                    # We are keeping the detector quaternions, so cache
+                    # them now for the full sample range.
+                    pdata = tod.local_pointing(det)
+
+                # Set up output cache
+                cachename = "{}_{}".format(self._out, det)
+                if not tod.cache.exists(cachename):
+                    tod.cache.create(cachename, np.float64, (nsamp,))
+                ref = tod.cache.reference(cachename)
+
+                buf_off = 0
+                buf_n = env.tod_buffer_length()
+                while buf_off < nsamp:
+                    if buf_off + buf_n > nsamp:
+                        buf_n = nsamp - buf_off
+                    bslice = slice(buf_off, buf_off + buf_n)
+
+                    detp = None
+                    if pdata is None:
+                        # Read and discard
+                        detp = tod.read_pntg(detector=det, local_start=buf_off, n=buf_n)
+                    else:
+                        # Use cached version
+                        detp = pdata[bslice, :]
+
+                    self._index.scan(
+                        np.ascontiguousarray(times[bslice]),
+                        np.ascontiguousarray(detp).reshape(-1),
+                        fwhm,
+                        fwhm_minor,
+                        psi_beam,
+                        flux,
+                        self._nsigma,
+                        ref[bslice],
+                    )
+                    buf_off += buf_n
+
+                del pdata
+                del ref
+
+            del times
+
+        return
@@ -595,6 +595,23 @@ class TODSatellite(TOD):
                 raise RuntimeError("Unknown coordinate system: {}".format(self._coord))
         return
 
+    def redistribute(self, detranks, buffer_bytes=100000000):
+        """Change the shape of the process grid.
+
+        See TOD.redistribute().  The simulated boresight pointing is moved
+        along with the cached data.
+
+        """
+        cachename = "toast_satellite_boresight"
+        if self._boresight is not None:
+            self.cache.put(cachename, self._boresight)
+            self._boresight = None
+        super().redistribute(detranks, buffer_bytes=buffer_bytes)
+        if self.cache.exists(cachename):
+            self._boresight = np.array(self.cache.reference(cachename))
+            self.cache.destroy(cachename)
+        return
+
     def detoffset(self):
         return {d: np.asarray(self._fp[d]) for d in self._detlist}
 
@@ -1785,6 +1802,30 @@ class TODGround(TOD):
         self._boresight = None
         self.cache.destroy("boresight_radec")
 
+    def redistribute(self, detranks, buffer_bytes=100000000):
+        """Change the shape of the process grid.
+
+        See TOD.redistribute().  The scan vectors are references to cached
+        objects, which are replaced by the redistribution.
+
+        """
+        self._times = None
+        self._az = None
+        self._el = None
+        self._commonflags = None
+        self._boresight_azel = None
+        self._boresight = None
+        super().redistribute(detranks, buffer_bytes=buffer_bytes)
+        self._times = self.cache.reference("times")
+        self._az = self.cache.reference("az")
+        self._el = self.cache.reference("el")
+        self._commonflags = self.cache.reference("common_flags")
+        if self.cache.exists("boresight_azel"):
+            self._boresight_azel = self.cache.reference("boresight_azel")
+        if self.cache.exists("boresight_radec"):
+            self._boresight = self.cache.reference("boresight_radec")
+        return
+
     @function_timer
     def radec2quat(self, ra, dec, pa):
         qR = qa.rotation(ZAXIS, ra + np.pi / 2)
@@ -11,19 +11,45 @@ from ..op import Operator
 
 from .. import qarray as qa
 
-from .._libtoast import (
-    cov_accum_diag,
-    cov_accum_zmap,
-    cov_accum_diag_hits,
-    cov_accum_diag_invnpp,
-    scan_map_float64,
-    scan_map_float32,
-    apply_flags_to_pixels,
-)
+from .._libtoast import cov_accum_split, scan_map_float64, scan_map_float32
 
 from ..map import DistPixels
 
 
+def local_step_weights(steps, offset, nsamp):
+    """Restrict piecewise constant weights to the local samples.
+
+    Each piece of the weights extends from its first sample to the first
+    sample of the next piece, and the last piece extends to the end of the
+    observation.  Samples before the first piece have zero weight.
+
+    Args:
+        steps (tuple):  The (starts, weights) arrays of one detector, where
+            starts are the increasing observation sample indices of the
+            first sample of each piece.
+        offset (int):  The first local sample of the observation.
+        nsamp (int):  The number of local samples.
+
+    Returns:
+        (tuple):  The int64 starts relative to the first local sample and the
+            float64 weights of the pieces that cover the local samples.
+
+    """
+    starts = np.asarray(steps[0], dtype=np.int64)
+    weights = np.asarray(steps[1], dtype=np.float64)
+    if starts.size != weights.size:
+        raise RuntimeError("Step starts and weights must have the same length")
+    if np.any(np.diff(starts) <= 0):
+        raise RuntimeError("Step starts must be increasing")
+    first = max(np.searchsorted(starts, offset, side="right") - 1, 0)
+    last = np.searchsorted(starts, offset + nsamp, side="left")
+    if last <= first:
+        # No piece covers the local samples
+        return np.zeros(1, dtype=np.int64), np.zeros(1, dtype=np.float64)
+    local_starts = np.maximum(starts[first:last] - offset, 0)
+    return local_starts, weights[first:last].copy()
+
+
 class OpAccumDiag(Operator):
     """Operator which accumulates the diagonal covariance and noise weighted map.
 
@@ -39,10 +65,26 @@ class OpAccumDiag(Operator):
     memory.  You should manually clear the pixel domain objects before
     accumulation if desired.
 
+    Several data splits (for example for null tests) can be accumulated in a
+    single pass over the pointing by passing lists of DistPixels objects, one
+    per split (at most 64).  Each sample is then accumulated into split s if
+    bit s of its split mask is set.  The split mask of a sample is the
+    bitwise OR of the per-sample mask in the cache (if split_name is given)
+    and the detector mask in detector_splits (if given).  With neither, all
+    samples go into every split.
+
+    Node-shared products (see DistPixels) are accumulated in one pass into
+    temporary buffers of the submaps of each process, which are then
+    summed into the shared buffers of the node.  Either all or none of the
+    products must be node-shared.
+
     Args:
-        zmap (DistPixels):  (optional) the noise weighted map to accumulate.
-        hits (DistPixels):  (optional) the hits to accumulate.
-        invnpp (DistPixels):  (optional) the diagonal covariance matrix.
+        zmap (DistPixels):  (optional) the noise weighted map to accumulate,
+            or a list of maps, one per split.
+        hits (DistPixels):  (optional) the hits to accumulate, or a list of
+            hit maps, one per split.
+        invnpp (DistPixels):  (optional) the diagonal covariance matrix, or
+            a list of matrices, one per split.
         detweights (dictionary): individual noise weights to use for each
             detector.
         name (str): the name of the cache object (<name>_<detector>) to
@@ -63,6 +105,18 @@ class OpAccumDiag(Operator):
             containing the pointing weights to use.
         detectors (iterable):  List of detectors to process.  If None, use
             all detectors.
+        split_name (str):  The name of the cache object
+            (<split_name>_<detector>, or <split_name> if that does not exist)
+            containing the uint64 split mask of each sample.
+        detector_splits (dictionary):  The split mask of each detector.
+            Detectors not in the dictionary are only accumulated according
+            to split_name.
+        step_weights (str):  The name of the observation dictionary entry
+            with piecewise constant weights that multiply the detector
+            weights.  The entry maps each detector to a tuple of (starts,
+            weights) arrays (see local_step_weights).  Detectors without an
+            entry are not reweighted.  The weights are expanded inside the
+            accumulation, so no weighted copy of the signal is made.
     """
 
     def __init__(
@@ -80,6 +134,9 @@ class OpAccumDiag(Operator):
         weights="weights",
         apply_flags=True,
         detectors=None,
+        split_name=None,
+        detector_splits=None,
+        step_weights=None,
     ):
 
         self._flag_name = flag_name
@@ -93,6 +150,56 @@ class OpAccumDiag(Operator):
         self._weights = weights
         self._detweights = detweights
         self._detectors = detectors
+        self._split_name = split_name
+        self._detector_splits = detector_splits
+        self._step_weights = step_weights
+
+        # Single objects are accumulated as one split containing all samples
+
+        self._nsplit = None
+        self._split_list = None
+        products = list()
+        for obj in [zmap, hits, invnpp]:
+            if obj is None:
+                products.append(None)
+                continue
+            if isinstance(obj, (list, tuple)):
+                self._split_list = True
+                obj = list(obj)
+            else:
+                obj = [obj]
+            if self._nsplit is None:
+                self._nsplit = len(obj)
+            elif self._nsplit != len(obj):
+                raise RuntimeError(
+                    "All pixel domain products must have the same number of splits"
+                )
+            products.append(obj)
+        zmaps, hitmaps, invnpps = products
+        if self._nsplit is None:
+            self._nsplit = 1
+        if self._nsplit < 1 or self._nsplit > 64:
+            raise RuntimeError("The number of splits must be between 1 and 64")
+        if not self._split_list and (
+            self._split_name is not None or self._detector_splits is not None
+        ):
+            raise RuntimeError("Split masks require lists of pixel domain products")
+        for objs in [zmaps, hitmaps, invnpps]:
+            if objs is None:
+                continue
+            for obj in objs[1:]:
+                if (
+                    obj.nsubmap != objs[0].nsubmap
+                    or obj.npix_submap != objs[0].npix_submap
+                    or obj.nnz != objs[0].nnz
+                ):
+                    raise RuntimeError("All splits must have the same distribution")
+        if zmaps is not None:
+            zmap = zmaps[0]
+        if hitmaps is not None:
+            hits = hitmaps[0]
+        if invnpps is not None:
+            invnpp = invnpps[0]
 
         # Ensure that the 3 different DistPixel objects have the same number
         # of pixels.
@@ -105,9 +212,9 @@ class OpAccumDiag(Operator):
         self._do_hits = False
         self._do_invn = False
 
-        self._zmap = zmap
-        self._hits = hits
-        self._invnpp = invnpp
+        self._zmap = zmaps
+        self._hits = hitmaps
+        self._invnpp = invnpps
 
         self._globloc = None
 
@@ -117,7 +224,7 @@ class OpAccumDiag(Operator):
             self._subsize = zmap.npix_submap
             self._nnz = zmap.nnz
             if self._globloc is None:
-                self._globloc = self._zmap
+                self._globloc = zmap
 
         if hits is not None:
             self._do_hits = True
@@ -137,7 +244,7 @@ class OpAccumDiag(Operator):
                         "All pixel domain objects must have the same submap size."
                     )
             if self._globloc is None:
-                self._globloc = self._hits
+                self._globloc = hits
 
         if invnpp is not None:
             self._do_invn = True
@@ -163,12 +270,22 @@ class OpAccumDiag(Operator):
                         "All pixel domain objects must have the same submap size."
                     )
             if self._globloc is None:
-                self._globloc = self._invnpp
+                self._globloc = invnpp
 
         if self._nnz is None:
             # this means we only have a hit map
             self._nnz = 1
 
+        for objs in [zmaps, hitmaps, invnpps]:
+            if objs is None:
+                continue
+            for obj in objs:
+                if obj.shared != self._globloc.shared:
+                    raise RuntimeError(
+                        "Either all or none of the pixel domain objects must be "
+                        "node-shared."
+                    )
+
         if self._do_invn and (not self._do_hits):
             raise RuntimeError(
                 "When accumulating the diagonal pixel covariance, you must "
@@ -191,65 +308,72 @@ class OpAccumDiag(Operator):
         Args:
             data (toast.Data): The distributed data.
         """
-        # the two-level pytoast communicator
-        comm = data.comm
-        # the global communicator
-        cworld = comm.comm_world
-        # the communicator within the group
-        cgroup = comm.comm_group
-        # the communicator with all processes with
-        # the same rank within their group
-        crank = comm.comm_rank
-        gt = GlobalTimers.get()
+        # Empty lists of output buffers disable that accumulation
+        products = [self._invnpp, self._hits, self._zmap]
+        if not self._globloc.shared:
+            buffers = [
+                list() if x is None else [y.flatdata for y in x] for x in products
+            ]
+            self._accumulate(data, self._nsub, self._globloc.global2local, *buffers)
+            return
+
+        # Accumulate the submaps of this process and add them to the shared
+        # products of the node afterwards.
+        submaps = self._globloc.process_submaps
+        nsub = len(submaps)
+        global2local = None
+        if nsub > 0:
+            global2local = np.zeros_like(self._globloc.global2local) - 1
+            global2local[submaps] = np.arange(nsub)
+        local = list()
+        for objs in products:
+            if objs is None:
+                local.append(list())
+                continue
+            local.append(
+                [np.zeros((nsub, self._subsize, x.nnz), dtype=x.dtype) for x in objs]
+            )
+        buffers = [[y.reshape(-1) for y in x] for x in local]
+        self._accumulate(data, nsub, global2local, *buffers)
+        del buffers
+        for objs, bufs in zip(products, local):
+            if objs is None:
+                continue
+            for obj, buf in zip(objs, bufs):
+                obj.reduce_node(buf)
+        return
 
+    def _accumulate(self, data, nsub, global2local, invnpp, hits, zmap):
+        """Accumulate all observations into the given local buffers."""
         for obs in data.obs:
             tod = obs["tod"]
 
-            nsamp = tod.local_samples[1]
+            offset, nsamp = tod.local_samples
 
-            commonflags = None
+            if global2local is None:
+                # No local submaps, nothing to accumulate
+                continue
+
+            empty_flags = np.empty(shape=0, dtype=np.uint8)
+            commonflags = empty_flags
             if self._apply_flags:
-                commonflags = tod.local_common_flags(self._common_flag_name).copy()
+                commonflags = tod.local_common_flags(self._common_flag_name)
+
+            empty_splits = np.empty(shape=0, dtype=np.uint64)
+            common_splits = empty_splits
+            if self._split_name is not None and tod.cache.exists(self._split_name):
+                common_splits = tod.cache.reference(self._split_name)
+
+            empty_starts = np.empty(shape=0, dtype=np.int64)
+            empty_weights = np.empty(shape=0, dtype=np.float64)
+            steps = None
+            if self._step_weights is not None and self._step_weights in obs:
+                steps = obs[self._step_weights]
 
             for det in tod.local_dets:
                 if self._detectors is not None and det not in self._detectors:
                     continue
 
-                # get the pixels and weights from the cache
-
-                pixelsname = "{}_{}".format(self._pixels, det)
-                weightsname = "{}_{}".format(self._weights, det)
-                pixels = tod.cache.reference(pixelsname)
-                weights = tod.cache.reference(weightsname)
-
-                cachename = None
-                signal = None
-
-                if self._do_z:
-                    signal = tod.local_signal(det, self._name)
-
-                # get flags
-
-                if self._apply_flags:
-                    gt.start("OpAccumDiag.exec.apply_flags")
-                    # Don't change the cached pixel numbers
-                    pixels = pixels.astype(np.int64).copy()
-                    detflags = tod.local_flags(det, self._flag_name)
-                    apply_flags_to_pixels(
-                        commonflags.astype(np.uint8),
-                        np.uint8(self._common_flag_mask),
-                        detflags.astype(np.uint8),
-                        np.uint8(self._flag_mask),
-                        pixels,
-                    )
-                    gt.stop("OpAccumDiag.exec.apply_flags")
-
-                # local pointing
-
-                gt.start("OpAccumDiag.exec.global_to_local")
-                sm, lpix = self._globloc.global_to_local(pixels)
-                gt.stop("OpAccumDiag.exec.global_to_local")
-
                 detweight = 1.0
 
                 if self._detweights is not None:
@@ -261,88 +385,67 @@ class OpAccumDiag(Operator):
                     if detweight == 0:
                         continue
 
-                # Now call the correct accumulation operator depending
-                # on which input pixel objects were given.
-
-                if self._do_invn and self._do_z:
-                    invnpp = self._invnpp.flatdata
-                    if invnpp is None:
-                        invnpp = np.empty(shape=0, dtype=np.float64)
-                    zmap = self._zmap.flatdata
-                    if zmap is None:
-                        zmap = np.empty(shape=0, dtype=np.float64)
-                    hits = self._hits.flatdata
-                    if hits is None:
-                        hits = np.empty(shape=0, dtype=np.int64)
-                    cov_accum_diag(
-                        self._nsub,
-                        self._subsize,
-                        self._nnz,
-                        sm.astype(np.int64),
-                        lpix.astype(np.int64),
-                        weights.reshape(-1).astype(np.float64),
-                        detweight,
-                        signal,
-                        invnpp,
-                        hits,
-                        zmap,
-                    )
+                # get the pixels and weights from the cache.  Flagging and the
+                # conversion to local pixels happen inside the accumulation, so
+                # the cached pointing is used as-is with no temporary copies.
 
-                elif self._do_invn:
-                    invnpp = self._invnpp.flatdata
-                    if invnpp is None:
-                        invnpp = np.empty(shape=0, dtype=np.float64)
-                    hits = self._hits.flatdata
-                    if hits is None:
-                        hits = np.empty(shape=0, dtype=np.int64)
-                    cov_accum_diag_invnpp(
-                        self._nsub,
-                        self._subsize,
-                        self._nnz,
-                        sm.astype(np.int64),
-                        lpix.astype(np.int64),
-                        weights.reshape(-1).astype(np.float64),
-                        detweight,
-                        invnpp,
-                        hits,
-                    )
+                pixelsname = "{}_{}".format(self._pixels, det)
+                weightsname = "{}_{}".format(self._weights, det)
+                pixels = tod.cache.reference(pixelsname)
+                weights = tod.cache.reference(weightsname)
 
-                elif self._do_z:
-                    zmap = self._zmap.flatdata
-                    if zmap is None:
-                        zmap = np.empty(shape=0, dtype=np.float64)
-                    cov_accum_zmap(
-                        self._nsub,
-                        self._subsize,
-                        self._nnz,
-                        sm.astype(np.int64),
-                        lpix.astype(np.int64),
-                        weights.reshape(-1).astype(np.float64),
-                        detweight,
-                        signal,
-                        zmap,
-                    )
+                signal = np.empty(shape=0, dtype=np.float64)
+                if self._do_z:
+                    signal = tod.local_signal(det, self._name)
+
+                detflags = empty_flags
+                if self._apply_flags:
+                    detflags = tod.local_flags(det, self._flag_name)
 
-                elif self._do_hits:
-                    hits = self._hits.flatdata
-                    if hits is None:
-                        hits = np.empty(shape=0, dtype=np.int64)
-                    cov_accum_diag_hits(
-                        self._nsub,
-                        self._subsize,
-                        self._nnz,
-                        sm.astype(np.int64),
-                        lpix.astype(np.int64),
-                        hits,
+                # Without any split masks all samples go into every split
+
+                splits = empty_splits
+                detsplits = 0
+                if self._split_name is not None:
+                    splitname = "{}_{}".format(self._split_name, det)
+                    if tod.cache.exists(splitname):
+                        splits = tod.cache.reference(splitname)
+                    else:
+                        splits = common_splits
+                if self._detector_splits is not None:
+                    detsplits = int(self._detector_splits.get(det, 0))
+                if self._split_name is None and self._detector_splits is None:
+                    detsplits = 2 ** self._nsplit - 1
+
+                step_starts = empty_starts
+                step_weights = empty_weights
+                if steps is not None and det in steps:
+                    step_starts, step_weights = local_step_weights(
+                        steps[det], offset, nsamp
                     )
 
-                # print("det {}:".format(det))
-                # if self._zmap is not None:
-                #     print(self._zmap.data)
-                # if self._hits is not None:
-                #     print(self._hits.data)
-                # if self._invnpp is not None:
-                #     print(self._invnpp.data)
+                cov_accum_split(
+                    nsub,
+                    self._subsize,
+                    self._nnz,
+                    pixels,
+                    global2local,
+                    weights,
+                    detweight,
+                    signal,
+                    detflags,
+                    self._flag_mask,
+                    commonflags,
+                    self._common_flag_mask,
+                    splits,
+                    detsplits,
+                    invnpp,
+                    hits,
+                    zmap,
+                    step_starts,
+                    step_weights,
+                )
+                del splits
 
         return
 
@@ -10,6 +10,8 @@ from . import rng as rng
 
 from .timing import function_timer
 
+from ._libtoast import weather_sample
+
 
 class Weather(object):
     """TOAST Weather objects allow sampling weather parameters.
@@ -50,59 +52,33 @@ class Weather(object):
             nstep = 101
             self._prob = np.linspace(prob_start, prob_stop, nstep)
 
-            self._monthly_cdf = []
-            ivar = 0
-            for month in range(12):
-                self._monthly_cdf.append([])
-                # One entry for every hour
-                for hour in range(24):
-                    self._monthly_cdf[month].append({})
-                # and one entry for every weather variable:
-                #  TQI   : ice water
-                #  TQL   : liquid water
-                #  TQV   : water vapor
-                #  QV10M : specific humidity
-                #  PS    : surface pressure
-                #  TS    : surface temperature
-                #  T10M  : air temperature at 10m
-                #  U10M  : eastward wind at 10m
-                #  V10M  : northward wind at 10m
-                name = "TQI"
-                self._varindex[name] = 0
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 0.0
-                name = "TQL"
-                self._varindex[name] = 1
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 0.0
-                name = "TQV"
-                self._varindex[name] = 2
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 0.2
-                name = "QV10M"
-                self._varindex[name] = 3
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 0.00015
-                name = "PS"
-                self._varindex[name] = 4
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 58200.0
-                name = "TS"
-                self._varindex[name] = 5
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 263.0
-                name = "T10M"
-                self._varindex[name] = 6
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = 263.0
-                name = "U10M"
-                self._varindex[name] = 7
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = -3.0
-                name = "V10M"
-                self._varindex[name] = 8
-                for hour in range(24):
-                    self._monthly_cdf[month][hour][name] = -7.0
+            # One constant entry for every weather variable:
+            #  TQI   : ice water
+            #  TQL   : liquid water
+            #  TQV   : water vapor
+            #  QV10M : specific humidity
+            #  PS    : surface pressure
+            #  TS    : surface temperature
+            #  T10M  : air temperature at 10m
+            #  U10M  : eastward wind at 10m
+            #  V10M  : northward wind at 10m
+            fake = [
+                ("TQI", 0.0),
+                ("TQL", 0.0),
+                ("TQV", 0.2),
+                ("QV10M", 0.00015),
+                ("PS", 58200.0),
+                ("TS", 263.0),
+                ("T10M", 263.0),
+                ("U10M", -3.0),
+                ("V10M", -7.0),
+            ]
+            # The CDF:s for every month, hour and variable are stored in one
+            # contiguous (month, hour, variable, probability) table.
+            self._cdf = np.zeros([12, 24, len(fake), nstep], dtype=np.float64)
+            for ivar, (name, value) in enumerate(fake):
+                self._varindex[name] = ivar
+                self._cdf[:, :, ivar, :] = value
         else:
             hdulist = pf.open(self._fname, "readonly")
 
@@ -114,34 +90,27 @@ class Weather(object):
             nstep = hdulist[1].header["nstep"]
             self._prob = np.linspace(prob_start, prob_stop, nstep)
 
-            # Load the CDF:s.  One entry per month.
-            self._monthly_cdf = []
-            ivar = 0
+            # Every month has one column for every weather variable:
+            #  TQI   : ice water
+            #  TQL   : liquid water
+            #  TQV   : water vapor
+            #  QV10M : specific humidity
+            #  PS    : surface pressure
+            #  TS    : surface temperature
+            #  T10M  : air temperature at 10m
+            #  U10M  : eastward wind at 10m
+            #  V10M  : northward wind at 10m
+            # and one row for every hour.
+            for col in hdulist[1].columns:
+                self._varindex[col.name] = len(self._varindex)
+
+            # Load the CDF:s into one contiguous
+            # (month, hour, variable, probability) table.
+            self._cdf = np.zeros([12, 24, len(self._varindex), nstep], dtype=np.float64)
             for month in range(12):
-                self._monthly_cdf.append([])
                 hdu = hdulist[1 + month]
-                # One entry for every hour
-                for hour in range(24):
-                    self._monthly_cdf[month].append({})
-                # and one entry for every weather variable:
-                #  TQI   : ice water
-                #  TQL   : liquid water
-                #  TQV   : water vapor
-                #  QV10M : specific humidity
-                #  PS    : surface pressure
-                #  TS    : surface temperature
-                #  T10M  : air temperature at 10m
-                #  U10M  : eastward wind at 10m
-                #  V10M  : northward wind at 10m
-                for col in hdu.columns:
-                    name = col.name
-                    if name not in self._varindex:
-                        self._varindex[name] = ivar
-                        ivar += 1
-                    for hour in range(24):
-                        self._monthly_cdf[month][hour][name] = hdu.data.field(name)[
-                            hour
-                        ]
+                for name, ivar in self._varindex.items():
+                    self._cdf[month, :, ivar, :] = hdu.data.field(name)[:24]
 
             hdulist.close()
 
@@ -226,10 +195,49 @@ class Weather(object):
             counter=(counter1, counter2),
         )[0]
         # Sample the variable from the inverse cumulative distribution function
-        cdf = self._monthly_cdf[self._month][self._hour][name]
+        cdf = self._cdf[self._month, self._hour, counter1]
 
         return np.interp(x, self._prob, cdf)
 
+    @function_timer
+    def sample(self, times, sites=None, realizations=None, names=None):
+        """Sample weather parameters for many times, sites and realizations.
+
+        All values are generated in a single compiled call and are identical
+        to the values returned by the single-time properties for the same
+        time, site and realization.
+
+        Args:
+            times (array):  POSIX timestamps.
+            sites (array):  Site index of each sample.  Defaults to the
+                current site.
+            realizations (array):  Realization index of each sample.  Defaults
+                to the current realization.
+            names (list):  MERRA-2 names of the variables to sample.  Defaults
+                to all variables in the weather file.
+
+        Returns:
+            (dict):  Array of sampled values for each variable name.
+
+        """
+        times = np.atleast_1d(np.asarray(times, dtype=np.float64))
+        nsamp = times.size
+        if sites is None:
+            sites = self.site
+        if realizations is None:
+            realizations = self.realization
+        sites = np.ascontiguousarray(np.broadcast_to(sites, nsamp), dtype=np.uint64)
+        realizations = np.ascontiguousarray(
+            np.broadcast_to(realizations, nsamp), dtype=np.uint64
+        )
+        if names is None:
+            names = list(self._varindex.keys())
+        varindex = np.array([self._varindex[x] for x in names], dtype=np.uint64)
+        values = weather_sample(
+            times, sites, realizations, varindex, self._prob, self._cdf
+        )
+        return {name: values[:, ivar] for ivar, name in enumerate(names)}
+
     @property
     def ice_water(self):
         """Total precipitable ice water [kg/m^2] (also [mm]).